@@ -0,0 +1,155 @@
+#version 400
+
+// Every render mode of the viewers, in one source.
+// The shader manager compiles it once per stage and mode, defining
+// VERTEX_SHADER or FRAGMENT_SHADER and one of PHONG, TOON, SPOTLIGHT,
+// VERTEX_COLOR or UNLIT. Each mode declares only the vertex attributes it
+// reads: VERTEX_COLOR needs no normals.
+//
+// With INSTANCED, every instance brings its own model matrix, and the
+// matrices in Frame hold the camera only.
+
+layout(std140) uniform Frame
+{
+   mat4 MVP;
+   mat4 ModelViewMatrix;
+   mat4 NormalMatrix; // only the upper 3x3 is used
+   vec4 LightPosition; // eye coordinates
+   vec4 LightColor;
+   vec4 SpotDirection; // xyz: eye coordinates, w: angular exponent
+   float SpotCutoff; // degrees
+};
+
+layout(std140) uniform MaterialBlock
+{
+   vec4 Ka;
+   vec4 Kd;
+   vec4 Ks;
+   float shininess;
+} Material;
+
+#ifdef VERTEX_SHADER
+
+layout (location = 0) in vec3 VertexPosition;
+#ifdef VERTEX_COLOR
+layout (location = 2) in vec3 VertexColor;
+#else
+layout (location = 1) in vec3 VertexNormal;
+#endif
+#ifdef INSTANCED
+layout (location = 3) in mat4 InstanceMatrix; // locations 3-6, model to world
+#endif
+
+#if defined(PHONG)
+out vec3 LightIntensity;
+#elif defined(TOON) || defined(SPOTLIGHT)
+out vec3 Position;
+out vec3 Normal;
+#endif
+#if defined(VERTEX_COLOR) || defined(UNLIT)
+out vec3 Color;
+#endif
+
+void main()
+{
+#ifdef INSTANCED
+   mat4 mvp = MVP * InstanceMatrix;
+   mat4 modelView = ModelViewMatrix * InstanceMatrix;
+   mat3 normalMatrix = mat3(NormalMatrix) * mat3(InstanceMatrix); // instances are scaled uniformly
+#else
+   mat4 mvp = MVP;
+   mat4 modelView = ModelViewMatrix;
+   mat3 normalMatrix = mat3(NormalMatrix);
+#endif
+
+#ifdef PHONG
+   // lit per vertex
+   vec3 tnorm = normalize( normalMatrix * VertexNormal);
+   vec4 eyeCoords = modelView * vec4 (VertexPosition, 1.0);
+   vec3 s = normalize(vec3(LightPosition - eyeCoords));
+   vec3 v = normalize(-eyeCoords.xyz);
+
+   vec3 r = -reflect (s, tnorm);
+   vec3 ambient = LightColor.rgb * Material.Ka.rgb;
+   float sDotN = max( dot(s, tnorm), 0.0);
+   vec3 diffuse = LightColor.rgb * Material.Kd.rgb * sDotN;
+   vec3 spec = vec3(0.0);
+   if(sDotN > 0.0){
+      spec = LightColor.rgb * Material.Ks.rgb * pow(max(dot(r,v), 0.0), Material.shininess);
+   }
+   LightIntensity = ambient + diffuse + spec;
+#elif defined(TOON) || defined(SPOTLIGHT)
+   Normal = normalize( normalMatrix * VertexNormal);
+   Position = vec3(modelView * vec4(VertexPosition,1.0));
+#endif
+
+#if defined(VERTEX_COLOR)
+   Color = VertexColor;
+#elif defined(UNLIT)
+   Color = 0.5 * (VertexNormal + vec3(1.0));
+#endif
+   gl_Position = mvp * vec4(VertexPosition, 1.0);
+}
+
+#endif
+
+#ifdef FRAGMENT_SHADER
+
+#if defined(PHONG)
+in vec3 LightIntensity;
+#elif defined(TOON) || defined(SPOTLIGHT)
+in vec3 Position;
+in vec3 Normal;
+#endif
+#if defined(VERTEX_COLOR) || defined(UNLIT)
+in vec3 Color;
+#endif
+
+layout( location = 0 ) out vec4 FragColor;
+
+#ifdef TOON
+const int levels = 3;
+const float scaleFactor = 1.0 / levels;
+
+vec3 toonShade( )
+{
+   vec3 s = normalize( LightPosition.xyz - Position.xyz );
+   float cosine = max( 0.0, dot( s, Normal ) );
+   vec3 diffuse = Material.Kd.rgb * floor( cosine * levels ) * scaleFactor;
+   return LightColor.rgb * (Material.Ka.rgb + diffuse);
+}
+#endif
+
+#ifdef SPOTLIGHT
+vec3 adsWithSpotlight( )
+{
+  vec3 s = normalize( vec3( LightPosition) - Position );
+  float angle = acos( dot(-s, SpotDirection.xyz) );
+  float cutoff = radians( clamp( SpotCutoff, 0.0, 90.0 ) );
+  vec3 ambient = LightColor.rgb * Material.Ka.rgb;
+  if( angle < cutoff ) {
+    float spotFactor = pow( dot(-s, SpotDirection.xyz), SpotDirection.w );
+    vec3 v = normalize(vec3(-Position));
+    vec3 h = normalize( v + s );
+    return ambient + spotFactor * LightColor.rgb * ( Material.Kd.rgb * max( dot(s, Normal), 0.0 ) + Material.Ks.rgb * pow(max(dot(h,Normal), 0.0),Material.shininess));
+  }
+  else {
+    return ambient;
+  }
+}
+#endif
+
+void main()
+{
+#if defined(PHONG)
+   FragColor = vec4(LightIntensity, 1.0);
+#elif defined(TOON)
+   FragColor = vec4(toonShade(), 1.0);
+#elif defined(SPOTLIGHT)
+   FragColor = vec4(adsWithSpotlight(), 1.0);
+#else
+   FragColor = vec4(Color, 1.0);
+#endif
+}
+
+#endif
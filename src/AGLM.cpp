@@ -1,7 +1,13 @@
+#include "AGLM.h"
 #include <iostream>
 #include <stdio.h>
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_RANDOM_SSE
+#include <emmintrin.h>
+#endif
+
 std::ostream& operator<<(std::ostream& o, const glm::mat4& m)
 {
    char line[1024];
@@ -52,3 +58,194 @@ std::ostream& operator<<(std::ostream& o, const glm::vec2& v)
    return o;
 }
 
+namespace
+{
+   enum SampleKind
+   {
+      UnitVectors,
+      HemisphereVectors,
+      CosineVectors,
+      DiskPoints
+   };
+
+   // An orthonormal basis around a unit normal, without branches
+   // (Duff et al., Building an Orthonormal Basis, Revisited)
+   void basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+   {
+      float sign = std::copysign(1.0f, n.z);
+      float a = -1.0f / (sign + n.z);
+      float b = n.x * n.y * a;
+      tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+      bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+   }
+
+#ifdef AGL_RANDOM_SSE
+   // Four xoshiro128+ generators side by side, seeded from one
+   struct random_lanes
+   {
+      __m128i s[4];
+
+      explicit random_lanes(random_generator& generator)
+      {
+         uint64_t seed = ((uint64_t) generator.next() << 32) | generator.next();
+         uint32_t words[4][4];
+         for (int lane = 0; lane < 4; lane++)
+         {
+            random_generator g(seed, lane);
+            for (int k = 0; k < 4; k++) words[k][lane] = g.next();
+         }
+         for (int k = 0; k < 4; k++) s[k] = _mm_loadu_si128((const __m128i*) words[k]);
+      }
+
+      __m128i next()
+      {
+         __m128i result = _mm_add_epi32(s[0], s[3]);
+         __m128i t = _mm_slli_epi32(s[1], 9);
+         s[2] = _mm_xor_si128(s[2], s[0]);
+         s[3] = _mm_xor_si128(s[3], s[1]);
+         s[1] = _mm_xor_si128(s[1], s[2]);
+         s[0] = _mm_xor_si128(s[0], s[3]);
+         s[2] = _mm_xor_si128(s[2], t);
+         s[3] = _mm_or_si128(_mm_slli_epi32(s[3], 11), _mm_srli_epi32(s[3], 21));
+         return result;
+      }
+   };
+
+   // In [0, 1), from the high 24 bits
+   inline __m128 to_float(__m128i bits)
+   {
+      return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(bits, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+   }
+
+   // A point on the unit circle: an angle in [-pi/2, pi/2) from the high
+   // bits, whose sine and cosine are short polynomials, and a bit choosing
+   // its half of the circle
+   inline void circle(__m128i bits, __m128& c, __m128& s)
+   {
+      __m128 x = _mm_mul_ps(_mm_sub_ps(to_float(bits), _mm_set1_ps(0.5f)), _mm_set1_ps(pi));
+      __m128 x2 = _mm_mul_ps(x, x);
+      __m128 sp = _mm_set1_ps(-1.0f / 39916800.0f);
+      sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(1.0f / 362880.0f));
+      sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(-1.0f / 5040.0f));
+      sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(1.0f / 120.0f));
+      sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(-1.0f / 6.0f));
+      sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(1.0f));
+      __m128 cp = _mm_set1_ps(1.0f / 479001600.0f);
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-1.0f / 3628800.0f));
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(1.0f / 40320.0f));
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-1.0f / 720.0f));
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(1.0f / 24.0f));
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-0.5f));
+      cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(1.0f));
+      // bit 7, clear of the weak lowest bits
+      __m128 flip = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(bits, 7), 31));
+      s = _mm_xor_ps(_mm_mul_ps(sp, x), flip);
+      c = _mm_xor_ps(cp, flip);
+   }
+
+   inline __m128 sqrt_positive(__m128 x)
+   {
+      return _mm_sqrt_ps(_mm_max_ps(x, _mm_setzero_ps()));
+   }
+#endif
+
+   void sample(random_generator& generator, SampleKind kind, const glm::vec3& normal,
+      glm::vec3* out, size_t count)
+   {
+      glm::vec3 tangent, bitangent;
+      basis(normal, tangent, bitangent);
+      size_t i = 0;
+#ifdef AGL_RANDOM_SSE
+      random_lanes lanes(generator);
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 nx = _mm_set1_ps(normal.x);
+      const __m128 ny = _mm_set1_ps(normal.y);
+      const __m128 nz = _mm_set1_ps(normal.z);
+      for (; i < count; i += 4)
+      {
+         __m128 c, s;
+         circle(lanes.next(), c, s);
+         __m128 u = to_float(lanes.next());
+         __m128 x, y, z;
+         if (kind == UnitVectors || kind == HemisphereVectors)
+         {
+            z = _mm_sub_ps(one, _mm_add_ps(u, u));
+            __m128 r = sqrt_positive(_mm_sub_ps(one, _mm_mul_ps(z, z)));
+            x = _mm_mul_ps(r, c);
+            y = _mm_mul_ps(r, s);
+            if (kind == HemisphereVectors)
+            {
+               // mirror the ones behind the normal
+               __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(y, ny)), _mm_mul_ps(z, nz));
+               __m128 flip = _mm_and_ps(_mm_cmplt_ps(d, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+               x = _mm_xor_ps(x, flip);
+               y = _mm_xor_ps(y, flip);
+               z = _mm_xor_ps(z, flip);
+            }
+         }
+         else
+         {
+            // uniform on the disk; for cosine vectors, lifted onto the hemisphere
+            __m128 r = _mm_sqrt_ps(u);
+            x = _mm_mul_ps(r, c);
+            y = _mm_mul_ps(r, s);
+            z = kind == CosineVectors ? sqrt_positive(_mm_sub_ps(one, u)) : _mm_setzero_ps();
+         }
+
+         float px[4], py[4], pz[4];
+         _mm_storeu_ps(px, x);
+         _mm_storeu_ps(py, y);
+         _mm_storeu_ps(pz, z);
+         size_t n = std::min<size_t>(4, count - i);
+         for (size_t k = 0; k < n; k++)
+         {
+            glm::vec3 p(px[k], py[k], pz[k]);
+            out[i + k] = kind == CosineVectors ? p.x * tangent + p.y * bitangent + p.z * normal : p;
+         }
+      }
+#endif
+      for (; i < count; i++)
+      {
+         float phi = 2.0f * pi * generator.next_float();
+         float u = generator.next_float();
+         glm::vec3 p;
+         if (kind == UnitVectors || kind == HemisphereVectors)
+         {
+            float z = 1.0f - 2.0f * u;
+            float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            p = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+            if (kind == HemisphereVectors && glm::dot(p, normal) < 0.0f) p = -p;
+         }
+         else
+         {
+            float r = std::sqrt(u);
+            p = glm::vec3(r * std::cos(phi), r * std::sin(phi),
+               kind == CosineVectors ? std::sqrt(std::max(0.0f, 1.0f - u)) : 0.0f);
+            if (kind == CosineVectors) p = p.x * tangent + p.y * bitangent + p.z * normal;
+         }
+         out[i] = p;
+      }
+   }
+}
+
+void random_unit_vectors(random_generator& generator, glm::vec3* out, size_t count)
+{
+   sample(generator, UnitVectors, glm::vec3(0, 0, 1), out, count);
+}
+
+void random_hemisphere_vectors(random_generator& generator, const glm::vec3& normal,
+   glm::vec3* out, size_t count)
+{
+   sample(generator, HemisphereVectors, normal, out, count);
+}
+
+void random_cosine_vectors(random_generator& generator, const glm::vec3& normal,
+   glm::vec3* out, size_t count)
+{
+   sample(generator, CosineVectors, normal, out, count);
+}
+
+void random_disk_points(random_generator& generator, glm::vec3* out, size_t count)
+{
+   sample(generator, DiskPoints, glm::vec3(0, 0, 1), out, count);
+}
@@ -7,6 +7,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtc/epsilon.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -26,18 +29,77 @@ namespace glm
 const float pi = glm::pi<float>();
 const float infinity = std::numeric_limits<float>::infinity();
 
+// Fast generator with 128 bits of state: xoshiro128+ by Blackman and Vigna.
+// The same seed and stream always give the same numbers, and the streams
+// of a seed are unrelated, so parallel tasks can each take their own.
+// Not for cryptography.
+class random_generator
+{
+public:
+   explicit random_generator(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+
+   void seed(uint64_t seed, uint64_t stream = 0)
+   {
+      // splitmix64 spreads the seed over the state, which must not be all zero
+      uint64_t x = mix(seed ^ mix(stream + 0x632BE59BD9B4E019ull));
+      for (int i = 0; i < 4; i++)
+      {
+         x += 0x9E3779B97F4A7C15ull;
+         s[i] = (uint32_t) (mix(x) >> 32);
+      }
+      if (!(s[0] | s[1] | s[2] | s[3])) s[0] = 1;
+   }
+
+   uint32_t next()
+   {
+      uint32_t result = s[0] + s[3];
+      uint32_t t = s[1] << 9;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = (s[3] << 11) | (s[3] >> 21);
+      return result;
+   }
+
+   // In [0, 1), from the high bits, which are the best
+   float next_float() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+   static uint64_t mix(uint64_t z)
+   {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+   }
+
+   uint32_t s[4];
+};
+
+// The calling thread's generator. Threads start on streams of seed 0,
+// numbered in the order they first use it.
+inline random_generator& thread_random()
+{
+   static std::atomic<uint64_t> threads(0);
+   thread_local random_generator generator(0, threads++);
+   return generator;
+}
+
+// Reseed the calling thread's generator
+inline void seed_random(uint64_t seed, uint64_t stream = 0)
+{
+   thread_random().seed(seed, stream);
+}
+
 inline float random_float() 
 {
-   static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-   static std::mt19937 generator;
-   return distribution(generator); 
+   return thread_random().next_float();
 }
 
 inline float random_float(float min, float max) 
 {
-   static std::uniform_real_distribution<float> distribution(min, max);
-   static std::mt19937 generator;
-   return distribution(generator);
+   return min + (max - min) * random_float();
 }
 
 inline glm::vec3 random_unit_cube() 
@@ -55,25 +117,27 @@ inline glm::vec3 random_unit_square()
    return glm::vec3(x, y, 0);
 }
 
+// Generate random unit vector, uniform over the sphere
+inline glm::vec3 random_unit_vector() 
+{
+   float z = 1.0f - 2.0f * random_float();
+   float phi = 2.0f * pi * random_float();
+   float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+   return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
 
+// Generate random point inside the unit sphere
 inline glm::vec3 random_unit_sphere() 
 {
-   glm::vec3 p = random_unit_cube();
-   while (glm::length(p) >= 1.0f) 
-   {
-      p = random_unit_cube();
-   } 
-   return p;
+   return random_unit_vector() * std::cbrt(random_float());
 }
 
+// Generate random point inside the unit disk, at z = 0
 inline glm::vec3 random_unit_disk()
 {
-    glm::vec3 p = random_unit_square();
-    while (glm::length(p) >= 1.0f)
-    {
-        p = random_unit_square();
-    }
-    return p;
+   float r = std::sqrt(random_float());
+   float phi = 2.0f * pi * random_float();
+   return glm::vec3(r * std::cos(phi), r * std::sin(phi), 0);
 }
 
 // Generate random direction in hemisphere around normal
@@ -91,12 +155,24 @@ inline glm::vec3 random_hemisphere(const glm::vec3& normal)
    }
 }
 
-// Generate random unit vector
-// from https://raytracing.github.io/books/RayTracingInOneWeekend.html (Peter Shirley)
-inline glm::vec3 random_unit_vector() 
-{
-   return glm::normalize(random_unit_sphere());
-}
+// Fill out with count samples from generator, four at a time with SSE and
+// without rejection loops. Give each thread or task its own generator, such
+// as random_generator(seed, task), for results that don't depend on threads.
+
+// Unit vectors, uniform over the sphere
+void random_unit_vectors(random_generator& generator, glm::vec3* out, size_t count);
+
+// Unit vectors, uniform over the hemisphere around normal
+void random_hemisphere_vectors(random_generator& generator, const glm::vec3& normal,
+   glm::vec3* out, size_t count);
+
+// Unit vectors around normal, more of them nearer it: the density is
+// cos(angle) / pi, as diffuse light and ambient occlusion need
+void random_cosine_vectors(random_generator& generator, const glm::vec3& normal,
+   glm::vec3* out, size_t count);
+
+// Points uniform inside the unit disk, at z = 0
+void random_disk_points(random_generator& generator, glm::vec3* out, size_t count);
 
 // test for vec3 close to zero (avoid numerical instability)
 // from https://raytracing.github.io/books/RayTracingInOneWeekend.html (Peter Shirley)
@@ -0,0 +1,360 @@
+// Haverford College, Jiajie Ma, 2021
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "colorconvert.h"
+#include "imagepool.h"
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+using namespace agl;
+
+// How long release waits for a readback, in nanoseconds
+static const GLuint64 DrainTimeout = 1000000000;
+
+namespace {
+
+   double MsSince(std::chrono::steady_clock::time_point start)
+   {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   }
+}
+
+FrameCapture::FrameCapture() : myNumBuffers(0), myWidth(0), myHeight(0), myPersistent(false),
+   myLevel(PngFastest), myFps(0), myStart(-1), myNextFrame(0), myEncoding(0), myStop(false)
+{
+   memset(&myStats, 0, sizeof(myStats));
+}
+
+FrameCapture::~FrameCapture()
+{
+}
+
+void FrameCapture::create(int numBuffers, int numWorkers, PngLevel level)
+{
+   release();
+#ifdef APPLE
+   myPersistent = false; // macOS stops at GL 4.1
+#else
+   myPersistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+   myNumBuffers = std::max(numBuffers, 1);
+   myLevel = level;
+   if (numWorkers <= 0)
+   {
+      numWorkers = std::min(std::max(NumWorkerThreads() - 1, 1), 4);
+   }
+   myStop = false;
+   for (int i = 0; i < numWorkers; i++)
+   {
+      myWorkers.push_back(std::thread(&FrameCapture::work, this));
+   }
+}
+
+void FrameCapture::release()
+{
+   if (myWorkers.empty()) return;
+
+   // the buffers must outlive the workers reading them
+   collect(true);
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myStop = true;
+   }
+   myWake.notify_all();
+   for (size_t i = 0; i < myWorkers.size(); i++)
+   {
+      myWorkers[i].join();
+   }
+   myWorkers.clear();
+   freeBuffers();
+   myFps = 0;
+   myScreenshot.clear();
+}
+
+void FrameCapture::screenshot(const std::string& filename)
+{
+   myScreenshot = filename;
+}
+
+void FrameCapture::start(const std::string& prefix, double fps)
+{
+   myPrefix = prefix;
+   myFps = fps;
+   myStart = -1;
+   myNextFrame = 0;
+}
+
+void FrameCapture::stop()
+{
+   myFps = 0;
+}
+
+void FrameCapture::frame(int width, int height, double time)
+{
+   if (myWorkers.empty() || width <= 0 || height <= 0) return;
+   if (myScreenshot.empty() && myFps <= 0 && myReading.empty()) return;
+
+   AGL_PROFILE_SCOPE("FrameCapture::frame");
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   if (width != myWidth || height != myHeight)
+   {
+      // the buffers have the old size; let the frames in them finish first
+      collect(true);
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         myIdle.wait(lock, [this] { return myJobs.empty() && myEncoding == 0; });
+      }
+      freeBuffers();
+      allocate(width, height);
+   }
+
+   // hand the readbacks that have finished to the workers
+   collect(false);
+
+   if (!myScreenshot.empty())
+   {
+      myStats.due++;
+      if (!read(myScreenshot))
+      {
+         myStats.dropped++;
+      }
+      myScreenshot.clear();
+   }
+   else if (myFps > 0)
+   {
+      if (myStart < 0)
+      {
+         myStart = time;
+      }
+      long long due = (long long) floor((time - myStart) * myFps);
+      if (due >= myNextFrame)
+      {
+         // frames due while nothing was drawn are lost
+         myStats.due += due - myNextFrame + 1;
+         myStats.dropped += due - myNextFrame;
+         myNextFrame = due + 1;
+
+         char number[16];
+         snprintf(number, sizeof(number), "%05lld", due);
+         if (!read(myPrefix + number + ".png"))
+         {
+            myStats.dropped++;
+         }
+         else if (time - myStart - due / myFps > 0.5 / myFps)
+         {
+            myStats.late++;
+         }
+      }
+   }
+   myStats.glMs += MsSince(start);
+}
+
+bool FrameCapture::read(const std::string& filename)
+{
+   int index = -1;
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      for (size_t i = 0; i < mySlots.size() && index < 0; i++)
+      {
+         if (!mySlots[i].busy) index = (int) i;
+      }
+      if (index < 0) return false;
+      mySlots[index].busy = true;
+   }
+
+   // only queues a copy; the pixels are collected once the fence signals
+   Slot& slot = mySlots[index];
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glReadPixels(0, 0, myWidth, myHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   slot.filename = filename;
+   myReading.push_back(index);
+   myStats.read++;
+   return true;
+}
+
+void FrameCapture::collect(bool wait)
+{
+   while (!myReading.empty())
+   {
+      int index = myReading.front();
+      Slot& slot = mySlots[index];
+      GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+         wait ? DrainTimeout : 0);
+      if (status == GL_TIMEOUT_EXPIRED && !wait) break;
+      glDeleteSync(slot.fence);
+      slot.fence = 0;
+      myReading.pop_front();
+
+      // a copy that never finished must not reach the encoder
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         slot.busy = false;
+         myStats.failed++;
+         continue;
+      }
+
+      Job job;
+      job.slot = -1;
+      job.copy = 0;
+      job.width = myWidth;
+      job.height = myHeight;
+      job.filename = slot.filename;
+      if (slot.mapping)
+      {
+         job.slot = index; // the worker frees the slot once it has the rows
+      }
+      else
+      {
+         // the copy is done, so mapping doesn't wait
+         size_t bytes = (size_t) myWidth * myHeight * 4;
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+         void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) bytes, GL_MAP_READ_BIT);
+         job.copy = data ? ImagePool::shared().acquire(bytes) : 0;
+         if (job.copy)
+         {
+            memcpy(job.copy, data, bytes);
+         }
+         if (data)
+         {
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+         }
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+         std::lock_guard<std::mutex> lock(myMutex);
+         slot.busy = false;
+         if (!job.copy)
+         {
+            myStats.failed++;
+            continue;
+         }
+      }
+
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         myJobs.push_back(std::move(job));
+      }
+      myWake.notify_one();
+   }
+}
+
+void FrameCapture::allocate(int width, int height)
+{
+   myWidth = width;
+   myHeight = height;
+   GLsizeiptr bytes = (GLsizeiptr) width * height * 4;
+   mySlots.resize(myNumBuffers);
+   for (int i = 0; i < myNumBuffers; i++)
+   {
+      Slot& slot = mySlots[i];
+      slot.mapping = 0;
+      slot.fence = 0;
+      slot.busy = false;
+      glGenBuffers(1, &slot.buffer);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      if (myPersistent)
+      {
+         // coherent, so the workers see the pixels once the fence signals
+         GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+         glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, NULL, flags);
+         slot.mapping = (unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags);
+      }
+      else
+      {
+         glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+      }
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::freeBuffers()
+{
+   for (size_t i = 0; i < mySlots.size(); i++)
+   {
+      Slot& slot = mySlots[i];
+      if (slot.fence)
+      {
+         glDeleteSync(slot.fence);
+      }
+      if (slot.mapping)
+      {
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      glDeleteBuffers(1, &slot.buffer);
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   mySlots.clear();
+   myReading.clear();
+   myWidth = myHeight = 0;
+}
+
+void FrameCapture::work()
+{
+   SetProfileThreadName("capture");
+   for (;;)
+   {
+      Job job;
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         myWake.wait(lock, [this] { return myStop || !myJobs.empty(); });
+         if (myJobs.empty()) return; // stopping, with every frame saved
+         job = std::move(myJobs.front());
+         myJobs.pop_front();
+         myEncoding++;
+      }
+
+      AGL_PROFILE_SCOPE("FrameCapture::encode");
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      // GL rows start at the bottom
+      const unsigned char* rgba = job.slot >= 0 ? mySlots[job.slot].mapping : job.copy;
+      Image pixels;
+      pixels.allocate(job.width, job.height);
+      for (int y = 0; y < job.height; y++)
+      {
+         ConvertPixels(rgba + (size_t) (job.height - 1 - y) * job.width * 4, 4,
+            pixels.data() + (size_t) y * job.width * 3, 3, job.width);
+      }
+      if (job.slot >= 0)
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         mySlots[job.slot].busy = false;
+      }
+      ImagePool::release(job.copy);
+
+      // the workers already run side by side, so each encodes on one thread
+      bool saved = WritePng(job.filename, job.width, job.height, 3, pixels.data(), job.width * 3, myLevel, 1);
+      double ms = MsSince(start);
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         myStats.encodeMs += ms;
+         if (saved) myStats.written++;
+         else myStats.failed++;
+         myEncoding--;
+      }
+      myIdle.notify_all();
+   }
+}
+
+CaptureStats FrameCapture::stats() const
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   return myStats;
+}
+
+void FrameCapture::printStats(std::ostream& out) const
+{
+   CaptureStats s = stats();
+   out << "Capture: " << s.written << " of " << s.due << " frames saved, " << s.dropped << " dropped, "
+      << s.late << " late, " << s.failed << " failed; " << (s.read > 0 ? s.glMs / s.read : 0.0)
+      << " ms of the render thread and " << (s.written > 0 ? s.encodeMs / s.written : 0.0)
+      << " ms of a worker per frame" << std::endl;
+}
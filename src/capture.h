@@ -0,0 +1,124 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef capture_H_
+#define capture_H_
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AGL.h"
+#include "image.h"
+
+namespace agl {
+
+   struct CaptureStats
+   {
+      long long due;      // frames asked for, by the capture rate or as screenshots
+      long long read;     // read back from the GPU
+      long long written;  // saved
+      long long dropped;  // due but not read: no frame was drawn in time, or no buffer was free
+      long long late;     // read more than half a period after they were due
+      long long failed;   // read but not saved
+      double glMs;        // render thread time spent capturing
+      double encodeMs;    // worker time spent flipping and encoding
+   };
+
+   // Saves frames as PNGs without stalling the render thread.
+   //
+   // A frame is read into one of a ring of pixel buffer objects, so
+   // glReadPixels only queues a copy on the GPU. A fence tells when it is
+   // done, a frame or two later; the pixels then go to worker threads that
+   // flip the rows into a pooled Image, dropping alpha, and encode it. The
+   // readback is RGBA, which drivers copy without converting. With GL 4.4 the
+   // buffers stay mapped and the workers read them directly; otherwise the
+   // render thread copies each one out. A frame due while every buffer is
+   // busy is dropped rather than waited for.
+   class FrameCapture
+   {
+   public:
+      FrameCapture();
+      virtual ~FrameCapture();
+
+      FrameCapture(const FrameCapture&) = delete;
+      FrameCapture& operator=(const FrameCapture&) = delete;
+
+      // Use numBuffers pixel buffers and numWorkers encoding threads
+      // (<= 0 for one per spare core, at most 4)
+      void create(int numBuffers = 3, int numWorkers = 0, PngLevel level = PngFastest);
+
+      // Save every frame in flight, then free the buffers and join the workers
+      void release();
+
+      // Save the next frame to filename
+      void screenshot(const std::string& filename);
+
+      // Save fps frames per second as prefix00000.png, prefix00001.png, ...
+      // Frames are numbered by when they were due, so drops leave gaps.
+      void start(const std::string& prefix, double fps);
+      void stop();
+      bool capturing() const { return myFps > 0; }
+
+      // Whether frames are still needed: capturing, or reads to collect
+      bool busy() const { return myFps > 0 || !myScreenshot.empty() || !myReading.empty(); }
+
+      // Call once a frame, after drawing and before swapping, with the size
+      // of the framebuffer and the time in seconds
+      void frame(int width, int height, double time);
+
+      CaptureStats stats() const;
+      void printStats(std::ostream& out) const;
+
+   private:
+      struct Slot
+      {
+         GLuint buffer;
+         unsigned char* mapping; // persistent, or 0
+         GLsync fence;
+         std::string filename;
+         bool busy;              // reading, or being flipped by a worker
+      };
+
+      struct Job
+      {
+         int slot;                 // flip from this slot's mapping, or -1
+         unsigned char* copy;      // else from this pooled copy of the buffer
+         int width;
+         int height;
+         std::string filename;
+      };
+
+      bool read(const std::string& filename);
+      void collect(bool wait);
+      void allocate(int width, int height);
+      void freeBuffers();
+      void work();
+
+   private:
+      std::vector<Slot> mySlots;
+      std::deque<int> myReading; // slots with a readback in flight, oldest first
+      int myNumBuffers;
+      int myWidth;
+      int myHeight;
+      bool myPersistent;
+      PngLevel myLevel;
+      std::string myScreenshot;
+      std::string myPrefix;
+      double myFps;
+      double myStart;            // time of frame 0, < 0 until the first frame
+      long long myNextFrame;
+
+      std::vector<std::thread> myWorkers;
+      mutable std::mutex myMutex;
+      std::condition_variable myWake;
+      std::condition_variable myIdle;
+      std::deque<Job> myJobs;
+      int myEncoding;
+      bool myStop;
+      CaptureStats myStats;
+   };
+}
+
+#endif
@@ -0,0 +1,328 @@
+// Haverford College, Jiajie Ma, 2021
+#include "catalog.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "parallel.h"
+#include "plyheader.h"
+#include "stream.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+static const char* catalog_version = "# mesh-viewer catalog 1";
+
+//--------------------------------------------------------------------
+// directory walking
+
+struct FileEntry
+{
+   std::string path; // relative to the scanned directory
+   long long size;
+   long long modified;
+};
+
+static bool IsModelFile(const std::string& name)
+{
+   size_t n = name.size();
+   return (n > 4 && name.compare(n - 4, 4, ".ply") == 0) ||
+      (n > 7 && name.compare(n - 7, 7, ".ply.gz") == 0);
+}
+
+static void AddIfModel(const std::string& root, const std::string& relative, std::vector<FileEntry>& files)
+{
+   if (!IsModelFile(relative)) return;
+
+   struct stat info;
+   if (stat((root + relative).c_str(), &info) != 0) return;
+
+   FileEntry entry;
+   entry.path = relative;
+   entry.size = (long long) info.st_size;
+   entry.modified = (long long) info.st_mtime;
+   files.push_back(entry);
+}
+
+#ifdef _WIN32
+static void ListModelFiles(const std::string& root, const std::string& relative, std::vector<FileEntry>& files)
+{
+   WIN32_FIND_DATAA ffd;
+   HANDLE hFind = FindFirstFileA((root + relative + "*").c_str(), &ffd);
+   if (hFind == INVALID_HANDLE_VALUE) return;
+   do
+   {
+      std::string name = ffd.cFileName;
+      if (name == "." || name == "..") continue;
+      if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      {
+         ListModelFiles(root, relative + name + "/", files);
+      }
+      else
+      {
+         AddIfModel(root, relative + name, files);
+      }
+   }
+   while (FindNextFileA(hFind, &ffd) != 0);
+   FindClose(hFind);
+}
+#else
+static void ListModelFiles(const std::string& root, const std::string& relative, std::vector<FileEntry>& files)
+{
+   DIR* dir = opendir((root + relative).c_str());
+   if (!dir) return;
+
+   struct dirent* ent;
+   while ((ent = readdir(dir)) != NULL)
+   {
+      std::string name = ent->d_name;
+      if (name == "." || name == "..") continue;
+
+      struct stat info;
+      std::string path = root + relative + name;
+      if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+      {
+         ListModelFiles(root, relative + name + "/", files);
+      }
+      else
+      {
+         AddIfModel(root, relative + name, files);
+      }
+   }
+   closedir(dir);
+}
+#endif
+
+static bool ReadModelHeader(const std::string& filename, ModelInfo& info)
+{
+   // headers are small, so read ahead only a few KB
+   InputStream file;
+   PlyHeader header;
+   if (!file.open(filename, 4096) || !header.read(file))
+   {
+      return false;
+   }
+
+   info.format = header.format;
+   info.numVertices = header.numVertices();
+   info.numFaces = header.numFaces();
+   info.vertexLayout = header.layout("vertex");
+   info.faceLayout = header.layout("face");
+   return true;
+}
+
+static bool HasProperty(const std::string& layout, const std::string& name)
+{
+   std::string key = name + ":";
+   return layout.compare(0, key.size(), key) == 0 ||
+      layout.find("," + key) != std::string::npos;
+}
+
+//--------------------------------------------------------------------
+// ModelInfo
+
+ModelInfo::ModelInfo() :
+   fileSize(0),
+   modified(0),
+   valid(false),
+   compressed(false),
+   numVertices(0),
+   numFaces(0),
+   hasBounds(false),
+   minBounds(0),
+   maxBounds(0)
+{
+}
+
+bool ModelInfo::hasNormals() const
+{
+   return HasProperty(vertexLayout, "nx");
+}
+
+bool ModelInfo::hasColors() const
+{
+   return HasProperty(vertexLayout, "red");
+}
+
+//--------------------------------------------------------------------
+// ModelCatalog
+
+ModelCatalog::ModelCatalog() : myModified(false)
+{
+}
+
+int ModelCatalog::scan(const std::string& dirname, int numThreads)
+{
+   myDirectory = dirname;
+   if (!myDirectory.empty() && myDirectory[myDirectory.size() - 1] != '/' &&
+      myDirectory[myDirectory.size() - 1] != '\\')
+   {
+      myDirectory += "/";
+   }
+
+   std::vector<FileEntry> files;
+   ListModelFiles(myDirectory, "", files);
+
+   std::map<std::string, ModelInfo> previous;
+   for (size_t i = 0; i < myModels.size(); i++)
+   {
+      previous[myModels[i].path] = myModels[i];
+   }
+
+   // keep entries whose file is unchanged; re-read the rest
+   std::vector<ModelInfo> models(files.size());
+   std::vector<int> stale;
+   for (size_t i = 0; i < files.size(); i++)
+   {
+      std::map<std::string, ModelInfo>::iterator it = previous.find(files[i].path);
+      if (it != previous.end() && it->second.fileSize == files[i].size &&
+         it->second.modified == files[i].modified)
+      {
+         models[i] = it->second;
+         continue;
+      }
+
+      models[i].path = files[i].path;
+      models[i].fileSize = files[i].size;
+      models[i].modified = files[i].modified;
+      models[i].compressed = files[i].path.size() > 3 &&
+         files[i].path.compare(files[i].path.size() - 3, 3, ".gz") == 0;
+      stale.push_back((int) i);
+   }
+
+   ParallelFor(0, (int) stale.size(), [&](int i)
+   {
+      ModelInfo& info = models[stale[i]];
+      info.valid = ReadModelHeader(myDirectory + info.path, info);
+   }, numThreads);
+
+   std::sort(models.begin(), models.end(), [](const ModelInfo& a, const ModelInfo& b)
+   {
+      return a.path < b.path;
+   });
+
+   if (!stale.empty() || models.size() != myModels.size())
+   {
+      myModified = true;
+   }
+   myModels.swap(models);
+   return (int) stale.size();
+}
+
+bool ModelCatalog::load(const std::string& filename)
+{
+   ifstream file(filename);
+   if (!file)
+   {
+      return false;
+   }
+
+   string line;
+   if (!getline(file, line) || line != catalog_version)
+   {
+      cout << "Ignoring out of date catalog: " << filename << endl;
+      return false;
+   }
+
+   std::vector<ModelInfo> models;
+   while (getline(file, line))
+   {
+      // fields are tab separated; layouts never contain tabs
+      std::vector<std::string> fields;
+      istringstream row(line);
+      string field;
+      while (getline(row, field, '\t'))
+      {
+         fields.push_back(field);
+      }
+      if (fields.size() != 10) continue;
+
+      ModelInfo info;
+      info.path = fields[0];
+      info.fileSize = atoll(fields[1].c_str());
+      info.modified = atoll(fields[2].c_str());
+      info.format = fields[3];
+      info.valid = !info.format.empty() && info.format != "-";
+      info.compressed = info.path.size() > 3 && info.path.compare(info.path.size() - 3, 3, ".gz") == 0;
+      info.numVertices = atoi(fields[4].c_str());
+      info.numFaces = atoi(fields[5].c_str());
+      info.vertexLayout = fields[6] == "-" ? "" : fields[6];
+      info.faceLayout = fields[7] == "-" ? "" : fields[7];
+      info.hasBounds = (fields[8] == "1");
+      istringstream bounds(fields[9]);
+      bounds >> info.minBounds[0] >> info.minBounds[1] >> info.minBounds[2]
+         >> info.maxBounds[0] >> info.maxBounds[1] >> info.maxBounds[2];
+      models.push_back(info);
+   }
+
+   myModels.swap(models);
+   myModified = false;
+   return true;
+}
+
+bool ModelCatalog::save(const std::string& filename) const
+{
+   ofstream file(filename);
+   if (!file)
+   {
+      cout << "ERROR: Cannot write catalog: " << filename << endl;
+      return false;
+   }
+
+   file << catalog_version << "\n";
+   file.precision(9);
+   for (size_t i = 0; i < myModels.size(); i++)
+   {
+      const ModelInfo& m = myModels[i];
+      file << m.path << "\t" << m.fileSize << "\t" << m.modified << "\t"
+         << (m.valid ? m.format : "-") << "\t"
+         << m.numVertices << "\t" << m.numFaces << "\t"
+         << (m.vertexLayout.empty() ? "-" : m.vertexLayout) << "\t"
+         << (m.faceLayout.empty() ? "-" : m.faceLayout) << "\t"
+         << (m.hasBounds ? 1 : 0) << "\t"
+         << m.minBounds[0] << " " << m.minBounds[1] << " " << m.minBounds[2] << " "
+         << m.maxBounds[0] << " " << m.maxBounds[1] << " " << m.maxBounds[2] << "\n";
+   }
+   if (!file)
+   {
+      return false;
+   }
+   myModified = false;
+   return true;
+}
+
+std::string ModelCatalog::fullPath(int i) const
+{
+   return myDirectory + myModels[i].path;
+}
+
+int ModelCatalog::find(const std::string& path) const
+{
+   for (int i = 0; i < (int) myModels.size(); i++)
+   {
+      if (myModels[i].path == path || fullPath(i) == path) return i;
+   }
+   return -1;
+}
+
+void ModelCatalog::setBounds(int i, const glm::vec3& minBounds, const glm::vec3& maxBounds)
+{
+   ModelInfo& m = myModels[i];
+   if (m.hasBounds && m.minBounds == minBounds && m.maxBounds == maxBounds)
+   {
+      return;
+   }
+   m.hasBounds = true;
+   m.minBounds = minBounds;
+   m.maxBounds = maxBounds;
+   myModified = true;
+}
@@ -0,0 +1,83 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef catalog_H_
+#define catalog_H_
+
+#include <string>
+#include <vector>
+#include "AGLM.h"
+
+namespace agl {
+
+   // What the catalog knows about a model without parsing its body
+   struct ModelInfo
+   {
+      ModelInfo();
+
+      // Return true if the vertices have normals (nx, ny, nz)
+      bool hasNormals() const;
+
+      // Return true if the vertices have colors (red, green, blue)
+      bool hasColors() const;
+
+      std::string path;       // relative to the catalog directory
+      long long fileSize;     // in bytes, as stored on disk
+      long long modified;     // modification time, seconds since the epoch
+      bool valid;             // false if the header could not be read
+      bool compressed;        // true for .ply.gz
+      std::string format;     // ascii, binary_little_endian or binary_big_endian
+      int numVertices;
+      int numFaces;
+      std::string vertexLayout; // see PlyHeader::layout
+      std::string faceLayout;
+      bool hasBounds;         // bounds are only known after the first full load
+      glm::vec3 minBounds;
+      glm::vec3 maxBounds;
+   };
+
+   // An index of the .ply and .ply.gz files under a directory, built from
+   // their headers only. The catalog can be saved and loaded again so that
+   // unchanged files are not even opened on the next start.
+   class ModelCatalog
+   {
+   public:
+      ModelCatalog();
+
+      // Scan dirname and its subdirectories, reading the headers of new or
+      // changed files on numThreads threads (<= 0 uses all cores).
+      // Entries for files that no longer exist are removed.
+      // Returns the number of headers that were read.
+      int scan(const std::string& dirname, int numThreads = 0);
+
+      // Load a catalog written by save; returns false if there is none
+      bool load(const std::string& filename);
+
+      // Write the catalog to the given file
+      // Returns true if successfull. false otherwise.
+      bool save(const std::string& filename) const;
+
+      // Return true if the catalog changed since it was loaded or saved
+      bool modified() const { return myModified; }
+
+      // Return number of models in the catalog
+      int size() const { return (int) myModels.size(); }
+
+      // Return the model at index i, sorted by path
+      const ModelInfo& model(int i) const { return myModels[i]; }
+
+      // Return the path of model i that can be passed to Mesh::loadPLY
+      std::string fullPath(int i) const;
+
+      // Return the index of the model with the given full or relative path, -1 if none
+      int find(const std::string& path) const;
+
+      // Record the bounds of model i once it has been fully loaded
+      void setBounds(int i, const glm::vec3& minBounds, const glm::vec3& maxBounds);
+
+   private:
+      std::string myDirectory;
+      std::vector<ModelInfo> myModels;
+      mutable bool myModified;
+   };
+}
+
+#endif
@@ -0,0 +1,303 @@
+// Haverford College, Jiajie Ma, 2021
+#include "colorconvert.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_COLOR_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Pixels converted by each parallel task
+static const size_t ParallelPixels = 1 << 16;
+
+// Entries in the table of the encoding curves
+static const int EncodeSteps = 1 << 16;
+
+namespace {
+
+   // Clamp to [0, 1], NaN to 0
+   inline float Saturate(float value)
+   {
+      return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+   }
+
+   // Round to the nearest 8-bit value, halves to even like the SSE path
+   inline unsigned char Quantize(float value)
+   {
+      return (unsigned char) std::lrint(Saturate(value) * 255.0f);
+   }
+}
+
+ColorConverter::ColorConverter(ColorSpace space, float gamma) : mySpace(space), myGamma(gamma)
+{
+   for (int i = 0; i < 256; i++)
+   {
+      double c = i / 255.0;
+      if (space == SrgbColor)
+      {
+         c = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+      }
+      else if (space == GammaColor)
+      {
+         c = pow(c, (double) gamma);
+      }
+      myDecode[i] = (float) c;
+   }
+
+   if (space == LinearColor) return;
+   myEncode.resize(EncodeSteps);
+   for (int i = 0; i < EncodeSteps; i++)
+   {
+      double x = (double) i / (EncodeSteps - 1);
+      if (space == SrgbColor)
+      {
+         x = x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+      }
+      else
+      {
+         x = pow(x, 1.0 / gamma);
+      }
+      myEncode[i] = (unsigned char) std::min(x * 255.0 + 0.5, 255.0);
+   }
+}
+
+ColorConverter::~ColorConverter()
+{
+}
+
+const ColorConverter& ColorConverter::get(ColorSpace space)
+{
+   static const ColorConverter linear(LinearColor);
+   if (space == SrgbColor)
+   {
+      static const ColorConverter srgb(SrgbColor);
+      return srgb;
+   }
+   if (space == GammaColor)
+   {
+      static const ColorConverter gamma(GammaColor, 2.2f);
+      return gamma;
+   }
+   return linear;
+}
+
+unsigned char ColorConverter::encode(float value) const
+{
+   if (myEncode.empty()) return Quantize(value);
+   return myEncode[(int) (Saturate(value) * (EncodeSteps - 1) + 0.5f)];
+}
+
+void ColorConverter::encode(const float* in, int inChannels, unsigned char* out, int outChannels,
+   size_t count, int numThreads) const
+{
+   assert((inChannels == 3 || inChannels == 4) && (outChannels == 3 || outChannels == 4));
+   if (count < 2 * ParallelPixels || numThreads == 1)
+   {
+      encodeSpan(in, inChannels, out, outChannels, count);
+      return;
+   }
+   int numChunks = (int) ((count + ParallelPixels - 1) / ParallelPixels);
+   ParallelFor(0, numChunks, [&](int chunk)
+   {
+      size_t first = chunk * ParallelPixels;
+      encodeSpan(in + first * inChannels, inChannels, out + first * outChannels, outChannels,
+         std::min(ParallelPixels, count - first));
+   }, numThreads);
+}
+
+void ColorConverter::decode(const unsigned char* in, int inChannels, float* out, int outChannels,
+   size_t count, int numThreads) const
+{
+   assert((inChannels == 3 || inChannels == 4) && (outChannels == 3 || outChannels == 4));
+   if (count < 2 * ParallelPixels || numThreads == 1)
+   {
+      decodeSpan(in, inChannels, out, outChannels, count);
+      return;
+   }
+   int numChunks = (int) ((count + ParallelPixels - 1) / ParallelPixels);
+   ParallelFor(0, numChunks, [&](int chunk)
+   {
+      size_t first = chunk * ParallelPixels;
+      decodeSpan(in + first * inChannels, inChannels, out + first * outChannels, outChannels,
+         std::min(ParallelPixels, count - first));
+   }, numThreads);
+}
+
+void ColorConverter::encodeSpan(const float* in, int inChannels, unsigned char* out, int outChannels,
+   size_t count) const
+{
+   if (inChannels == outChannels)
+   {
+      // the pixels are one run of values; alpha is fixed afterwards
+      size_t n = count * inChannels;
+      size_t i = 0;
+#ifdef AGL_COLOR_SSE
+      // max before min turns NaN into 0; the conversions round to nearest
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps(1.0f);
+      if (myEncode.empty())
+      {
+         const __m128 scale = _mm_set1_ps(255.0f);
+         for (; i + 16 <= n; i += 16)
+         {
+            __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one), scale));
+            __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), zero), one), scale));
+            __m128i c = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 8), zero), one), scale));
+            __m128i d = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 12), zero), one), scale));
+            _mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+         }
+      }
+      else
+      {
+         // indices four at a time, then one lookup each
+         const __m128 scale = _mm_set1_ps((float) (EncodeSteps - 1));
+         const unsigned char* table = &myEncode[0];
+         for (; i + 4 <= n; i += 4)
+         {
+            __m128i index = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one), scale));
+            out[i] = table[_mm_cvtsi128_si32(index)];
+            out[i + 1] = table[_mm_cvtsi128_si32(_mm_srli_si128(index, 4))];
+            out[i + 2] = table[_mm_cvtsi128_si32(_mm_srli_si128(index, 8))];
+            out[i + 3] = table[_mm_cvtsi128_si32(_mm_srli_si128(index, 12))];
+         }
+      }
+#endif
+      for (; i < n; i++)
+      {
+         out[i] = encode(in[i]);
+      }
+      if (inChannels == 4 && !myEncode.empty())
+      {
+         for (size_t p = 0; p < count; p++)
+         {
+            out[p * 4 + 3] = Quantize(in[p * 4 + 3]);
+         }
+      }
+      return;
+   }
+
+   size_t p = 0;
+#ifdef AGL_COLOR_SSE
+   if (inChannels == 4)
+   {
+      // a pixel at a time; alpha is dropped
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 scale = _mm_set1_ps(myEncode.empty() ? 255.0f : (float) (EncodeSteps - 1));
+      for (; p < count; p++)
+      {
+         __m128i index = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + p * 4), zero), one), scale));
+         int r = _mm_cvtsi128_si32(index);
+         int g = _mm_cvtsi128_si32(_mm_srli_si128(index, 4));
+         int b = _mm_cvtsi128_si32(_mm_srli_si128(index, 8));
+         unsigned char* dst = out + p * 3;
+         if (myEncode.empty())
+         {
+            dst[0] = (unsigned char) r;
+            dst[1] = (unsigned char) g;
+            dst[2] = (unsigned char) b;
+         }
+         else
+         {
+            dst[0] = myEncode[r];
+            dst[1] = myEncode[g];
+            dst[2] = myEncode[b];
+         }
+      }
+   }
+#endif
+   for (; p < count; p++)
+   {
+      const float* src = in + p * inChannels;
+      unsigned char* dst = out + p * outChannels;
+      dst[0] = encode(src[0]);
+      dst[1] = encode(src[1]);
+      dst[2] = encode(src[2]);
+      if (outChannels == 4)
+      {
+         dst[3] = inChannels == 4 ? Quantize(src[3]) : 255;
+      }
+   }
+}
+
+void ColorConverter::decodeSpan(const unsigned char* in, int inChannels, float* out, int outChannels,
+   size_t count) const
+{
+   if (inChannels == outChannels)
+   {
+      size_t n = count * inChannels;
+      size_t i = 0;
+#ifdef AGL_COLOR_SSE
+      if (mySpace == LinearColor)
+      {
+         // widen 16 bytes to 16 floats
+         const __m128i zero = _mm_setzero_si128();
+         const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+         for (; i + 16 <= n; i += 16)
+         {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (in + i));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale));
+            _mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+            _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale));
+         }
+      }
+#endif
+      for (; i < n; i++)
+      {
+         out[i] = myDecode[in[i]];
+      }
+      if (inChannels == 4 && mySpace != LinearColor)
+      {
+         for (size_t p = 0; p < count; p++)
+         {
+            out[p * 4 + 3] = in[p * 4 + 3] * (1.0f / 255.0f);
+         }
+      }
+      return;
+   }
+
+   for (size_t p = 0; p < count; p++)
+   {
+      const unsigned char* src = in + p * inChannels;
+      float* dst = out + p * outChannels;
+      dst[0] = myDecode[src[0]];
+      dst[1] = myDecode[src[1]];
+      dst[2] = myDecode[src[2]];
+      if (outChannels == 4)
+      {
+         dst[3] = inChannels == 4 ? src[3] * (1.0f / 255.0f) : 1.0f;
+      }
+   }
+}
+
+void agl::ConvertPixels(const unsigned char* in, int inChannels, unsigned char* out, int outChannels,
+   size_t count)
+{
+   assert((inChannels == 3 || inChannels == 4) && (outChannels == 3 || outChannels == 4));
+   if (inChannels == outChannels)
+   {
+      std::copy(in, in + count * inChannels, out);
+      return;
+   }
+   for (size_t p = 0; p < count; p++)
+   {
+      const unsigned char* src = in + p * inChannels;
+      unsigned char* dst = out + p * outChannels;
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+      if (outChannels == 4)
+      {
+         dst[3] = 255;
+      }
+   }
+}
@@ -0,0 +1,69 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef colorconvert_H_
+#define colorconvert_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace agl {
+
+   // How 8-bit values encode linear intensities
+   enum ColorSpace
+   {
+      LinearColor, // value / 255
+      SrgbColor,   // the sRGB curve
+      GammaColor   // (value / 255)^gamma
+   };
+
+   // Converts spans of pixels between floats and 8-bit values.
+   //
+   // Floats are linear, nominally in [0, 1]; they are clamped, and NaNs
+   // become 0. Pixels have 3 (RGB) or 4 (RGBA) channels, and the two sides
+   // may differ: alpha is dropped, or added as opaque. Alpha is always
+   // linear. Linear encoding rounds 16 values at a time with SSE; the curves
+   // go through a table of 64K entries, accurate to the nearest step
+   // except in the very darkest values of a power curve. Decoding is a 256
+   // entry table. Spans of more than 64K pixels are split across threads.
+   class ColorConverter
+   {
+   public:
+      explicit ColorConverter(ColorSpace space = LinearColor, float gamma = 2.2f);
+      virtual ~ColorConverter();
+
+      // A shared converter for space; GammaColor uses gamma 2.2
+      static const ColorConverter& get(ColorSpace space);
+
+      // Floats to 8-bit values, count pixels. numThreads <= 0 uses all cores.
+      void encode(const float* in, int inChannels, unsigned char* out, int outChannels,
+         size_t count, int numThreads = 0) const;
+
+      // 8-bit values to floats, count pixels
+      void decode(const unsigned char* in, int inChannels, float* out, int outChannels,
+         size_t count, int numThreads = 0) const;
+
+      // One value of a color channel
+      unsigned char encode(float value) const;
+      float decode(unsigned char value) const { return myDecode[value]; }
+
+      ColorSpace space() const { return mySpace; }
+      float gamma() const { return myGamma; }
+
+   private:
+      void encodeSpan(const float* in, int inChannels, unsigned char* out, int outChannels,
+         size_t count) const;
+      void decodeSpan(const unsigned char* in, int inChannels, float* out, int outChannels,
+         size_t count) const;
+
+   private:
+      ColorSpace mySpace;
+      float myGamma;
+      std::vector<unsigned char> myEncode; // by linear value * 65535, for the curves
+      float myDecode[256];
+   };
+
+   // Copy count 8-bit pixels with 3 or 4 channels; added alpha is 255
+   void ConvertPixels(const unsigned char* in, int inChannels, unsigned char* out, int outChannels,
+      size_t count);
+}
+
+#endif
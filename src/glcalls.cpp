@@ -0,0 +1,118 @@
+// Haverford College, Jiajie Ma, 2021
+#include "glcalls.h"
+#include <atomic>
+#include <iomanip>
+#include "AGL.h"
+
+using namespace agl;
+
+static const int max_counters = 64;
+static const char* theNames[max_counters];
+static std::atomic<long long> theCounts[max_counters]; // the upload thread calls GL too
+static int theNumCounters = 0;
+
+#ifndef APPLE
+
+// One wrapper per hooked function; Id keeps functions with the same
+// signature apart
+template <int Id, typename Ret, typename... Args>
+struct CountedCall
+{
+   static Ret (GLAPIENTRY* original)(Args...);
+   static int counter;
+
+   static Ret GLAPIENTRY call(Args... args)
+   {
+      theCounts[counter].fetch_add(1, std::memory_order_relaxed);
+      return original(args...);
+   }
+};
+
+template <int Id, typename Ret, typename... Args>
+Ret (GLAPIENTRY* CountedCall<Id, Ret, Args...>::original)(Args...) = 0;
+
+template <int Id, typename Ret, typename... Args>
+int CountedCall<Id, Ret, Args...>::counter = 0;
+
+template <int Id, typename Ret, typename... Args>
+static void Hook(Ret (GLAPIENTRY*& fn)(Args...), const char* name)
+{
+   typedef CountedCall<Id, Ret, Args...> Counted;
+   if (!fn || fn == &Counted::call || theNumCounters == max_counters) return;
+
+   Counted::original = fn;
+   Counted::counter = theNumCounters;
+   theNames[theNumCounters++] = name;
+   fn = &Counted::call;
+}
+
+// fn is the GLEW macro, which names the function pointer GLEW loaded
+#define AGL_COUNT_CALLS(fn) Hook<__LINE__>(fn, #fn)
+
+bool agl::EnableGLCallCounting()
+{
+   AGL_COUNT_CALLS(glUseProgram);
+   AGL_COUNT_CALLS(glGetUniformLocation);
+   AGL_COUNT_CALLS(glUniform1i);
+   AGL_COUNT_CALLS(glUniform1f);
+   AGL_COUNT_CALLS(glUniform2fv);
+   AGL_COUNT_CALLS(glUniform3f);
+   AGL_COUNT_CALLS(glUniform3fv);
+   AGL_COUNT_CALLS(glUniform4f);
+   AGL_COUNT_CALLS(glUniform4fv);
+   AGL_COUNT_CALLS(glUniformMatrix3fv);
+   AGL_COUNT_CALLS(glUniformMatrix4fv);
+   AGL_COUNT_CALLS(glUniformBlockBinding);
+   AGL_COUNT_CALLS(glBindBuffer);
+   AGL_COUNT_CALLS(glBindBufferBase);
+   AGL_COUNT_CALLS(glBufferData);
+   AGL_COUNT_CALLS(glBufferSubData);
+   AGL_COUNT_CALLS(glBindVertexArray);
+   AGL_COUNT_CALLS(glEnableVertexAttribArray);
+   AGL_COUNT_CALLS(glDisableVertexAttribArray);
+   AGL_COUNT_CALLS(glVertexAttribPointer);
+   AGL_COUNT_CALLS(glActiveTexture);
+   return true;
+}
+
+#else
+
+bool agl::EnableGLCallCounting()
+{
+   std::cout << "GL call counting needs GLEW" << std::endl;
+   return false;
+}
+
+#endif
+
+long long agl::GLCallCount()
+{
+   long long total = 0;
+   for (int i = 0; i < theNumCounters; i++)
+   {
+      total += theCounts[i].load(std::memory_order_relaxed);
+   }
+   return total;
+}
+
+void agl::ResetGLCallCounts()
+{
+   for (int i = 0; i < theNumCounters; i++)
+   {
+      theCounts[i].store(0, std::memory_order_relaxed);
+   }
+}
+
+void agl::PrintGLCallCounts(std::ostream& out, int frames)
+{
+   if (frames < 1) frames = 1;
+   for (int i = 0; i < theNumCounters; i++)
+   {
+      long long count = theCounts[i].load(std::memory_order_relaxed);
+      if (count == 0) continue;
+      out << "   " << std::left << std::setw(28) << theNames[i]
+         << std::fixed << std::setprecision(2) << (double) count / frames << "\n";
+   }
+   out << "   " << std::left << std::setw(28) << "total"
+      << std::fixed << std::setprecision(2) << (double) GLCallCount() / frames << std::endl;
+}
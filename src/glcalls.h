@@ -0,0 +1,28 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef glcalls_H_
+#define glcalls_H_
+
+#include <iostream>
+
+namespace agl {
+
+   // Count calls to the GL entry points used for state changes and uploads
+   // (programs, uniforms, buffers, vertex arrays, textures).
+   //
+   // Counting works by swapping the GLEW function pointers for counting
+   // wrappers, so call it after glewInit(). Functions from GL 1.1, such as
+   // glClear and glDrawElements, are linked directly and aren't counted.
+   // Returns false where GLEW isn't used (macOS).
+   bool EnableGLCallCounting();
+
+   // Total calls counted since the last reset, from every thread
+   long long GLCallCount();
+
+   // Zero every counter
+   void ResetGLCallCounts();
+
+   // Print the counters that are not zero, divided by frames
+   void PrintGLCallCounts(std::ostream& out, int frames);
+}
+
+#endif
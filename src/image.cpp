@@ -1,8 +1,14 @@
 // alinen, 2021
 #include "image.h"
 #include <cassert>
+#include <cstring>
+#include "imagepool.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
+// decoded images and stb's scratch buffers are recycled
+#define STBI_MALLOC(size) agl::ImagePool::shared().acquire(size)
+#define STBI_REALLOC(p, size) agl::ImagePool::resize((unsigned char*) (p), size)
+#define STBI_FREE(p) agl::ImagePool::release((unsigned char*) (p))
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
@@ -10,18 +16,26 @@ using namespace agl;
 using namespace std;
 using namespace glm;
       
-Image::Image() : myData(0), myWidth(0), myHeight(0), myLoaded(false)
+Image::Image() : myData(0), myWidth(0), myHeight(0), myStorage(NoStorage)
 {
 }
 
-Image::Image(int width, int height) : myWidth(width), myHeight(height), myLoaded(false)
+Image::Image(int width, int height) : myData(0), myWidth(0), myHeight(0), myStorage(NoStorage)
 {
-    myData = new Pixel[width*height];
+    allocate(width, height);
 }
 
-Image::Image(const Image& orig)
+Image::Image(const Image& orig) : myData(0), myWidth(0), myHeight(0), myStorage(NoStorage)
 {
-    cout << "not implemented\n";
+    *this = orig;
+}
+
+Image::Image(Image&& orig) noexcept : myData(orig.myData), myWidth(orig.myWidth),
+    myHeight(orig.myHeight), myStorage(orig.myStorage)
+{
+    orig.myData = 0;
+    orig.myWidth = orig.myHeight = 0;
+    orig.myStorage = NoStorage;
 }
 
 Image& Image::operator=(const Image& orig)
@@ -31,7 +45,30 @@ Image& Image::operator=(const Image& orig)
         return *this;
     }
 
-    cout << "not implemented\n";
+    // a wrapped buffer of the same size is filled in place
+    allocate(orig.myWidth, orig.myHeight);
+    if (myData)
+    {
+        memcpy(myData, orig.myData, (size_t) myWidth * myHeight * sizeof(Pixel));
+    }
+    return *this;
+}
+
+Image& Image::operator=(Image&& orig) noexcept
+{
+    if (&orig == this)
+    {
+        return *this;
+    }
+
+    clear();
+    myData = orig.myData;
+    myWidth = orig.myWidth;
+    myHeight = orig.myHeight;
+    myStorage = orig.myStorage;
+    orig.myData = 0;
+    orig.myWidth = orig.myHeight = 0;
+    orig.myStorage = NoStorage;
     return *this;
 }
 
@@ -42,38 +79,82 @@ Image::~Image()
 
 void Image::clear()
 {
-   if (myLoaded)
+   if (myStorage == PooledStorage)
    {
-      stbi_image_free(myData);
-      myData = 0;
-      myLoaded = false;
+      ImagePool::release((unsigned char*) myData);
    }
-   else
+   myData = 0;
+   myWidth = myHeight = 0;
+   myStorage = NoStorage;
+}
+
+void Image::allocate(int width, int height)
+{
+   if (myData && (int) myWidth == width && (int) myHeight == height) return;
+
+   clear();
+   size_t bytes = (size_t) width * height * sizeof(Pixel);
+   if (bytes == 0) return;
+   myData = (Pixel*) ImagePool::shared().acquire(bytes);
+   if (myData)
    {
-      delete[] myData;
+      myWidth = width;
+      myHeight = height;
+      myStorage = PooledStorage;
    }
 }
 
+void Image::wrap(int width, int height, unsigned char* pixels)
+{
+   clear();
+   myData = (Pixel*) pixels;
+   myWidth = width;
+   myHeight = height;
+   myStorage = pixels ? CallerStorage : NoStorage;
+}
+
 bool Image::load(const std::string& filename) 
 {
    clear();
 
+   // pixels are always RGB; stb allocates them from the pool
    int x, y, n;
-   myData = (Pixel*) stbi_load(filename.c_str(), &x, &y, &n, 0);
+   myData = (Pixel*) stbi_load(filename.c_str(), &x, &y, &n, 3);
+   if (!myData)
+   {
+      return false;
+   }
    myWidth = x;
    myHeight = y;
-   std::cout << myWidth << std::endl;
-   std::cout << myHeight << std::endl;
-   myLoaded = true;
-   return (myData != NULL);
+   myStorage = PooledStorage;
+   return true;
+}
+
+bool Image::load(const std::string& filename, unsigned char* pixels, size_t bytes)
+{
+   Image decoded;
+   if (!decoded.load(filename))
+   {
+      return false;
+   }
+   size_t needed = (size_t) decoded.width() * decoded.height() * sizeof(Pixel);
+   if (needed > bytes)
+   {
+      std::cout << filename << " needs " << needed << " bytes, not " << bytes << std::endl;
+      return false;
+   }
+
+   // stb decodes into its own buffer, which goes back to the pool
+   memcpy(pixels, decoded.data(), needed);
+   wrap(decoded.width(), decoded.height(), pixels);
+   return true;
 }
 
 
-bool Image::save(const std::string& filename) const
+bool Image::save(const std::string& filename, PngLevel level) const
 {
-    int result = stbi_write_png(filename.c_str(), myWidth, myHeight, 
-        3, (unsigned char*) myData, myWidth*3);
-    return (result == 1);
+    return WritePng(filename, myWidth, myHeight, 3,
+        (unsigned char*) myData, myWidth*3, level);
 }
 
 Pixel Image::get(int row, int col) const
@@ -110,3 +191,51 @@ void Image::set_vec3(int i, int j, const vec3 & c)
    myData[idx].g = (unsigned char) (c[1] * 255.999);
    myData[idx].b = (unsigned char) (c[2] * 255.999);
 }
+
+void Image::set_span(int row, int col, int count, const float* colors,
+   int channels, ColorSpace space)
+{
+   assert(row >= 0 && row < (int) myHeight);
+   assert(col >= 0 && count >= 0 && col + count <= (int) myWidth);
+   ColorConverter::get(space).encode(colors, channels,
+      (unsigned char*) (myData + (size_t) row * myWidth + col), 3, count);
+}
+
+void Image::get_span(int row, int col, int count, float* colors,
+   int channels, ColorSpace space) const
+{
+   assert(row >= 0 && row < (int) myHeight);
+   assert(col >= 0 && count >= 0 && col + count <= (int) myWidth);
+   ColorConverter::get(space).decode((const unsigned char*) (myData + (size_t) row * myWidth + col), 3,
+      colors, channels, count);
+}
+
+void Image::set_rows(int row, int numRows, const float* colors,
+   int channels, ColorSpace space)
+{
+   assert(row >= 0 && numRows >= 0 && row + numRows <= (int) myHeight);
+   ColorConverter::get(space).encode(colors, channels,
+      (unsigned char*) (myData + (size_t) row * myWidth), 3, (size_t) numRows * myWidth);
+}
+
+void Image::get_rows(int row, int numRows, float* colors,
+   int channels, ColorSpace space) const
+{
+   assert(row >= 0 && numRows >= 0 && row + numRows <= (int) myHeight);
+   ColorConverter::get(space).decode((const unsigned char*) (myData + (size_t) row * myWidth), 3,
+      colors, channels, (size_t) numRows * myWidth);
+}
+
+void Image::set_rows(int row, int numRows, const unsigned char* pixels, int channels)
+{
+   assert(row >= 0 && numRows >= 0 && row + numRows <= (int) myHeight);
+   ConvertPixels(pixels, channels, (unsigned char*) (myData + (size_t) row * myWidth), 3,
+      (size_t) numRows * myWidth);
+}
+
+void Image::get_rows(int row, int numRows, unsigned char* pixels, int channels) const
+{
+   assert(row >= 0 && numRows >= 0 && row + numRows <= (int) myHeight);
+   ConvertPixels((const unsigned char*) (myData + (size_t) row * myWidth), 3, pixels, channels,
+      (size_t) numRows * myWidth);
+}
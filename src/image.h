@@ -4,6 +4,8 @@
 
 #include <iostream>
 #include "AGLM.h"
+#include "colorconvert.h"
+#include "pngwriter.h"
 
 // This is a placeholder class
 // Feel free to replace this class with your own image class
@@ -23,15 +25,28 @@ namespace agl
         Image();
         Image(int width, int height);
         Image(const Image& orig);
+        Image(Image&& orig) noexcept;
         Image& operator=(const Image& orig);
+        Image& operator=(Image&& orig) noexcept;
 
         virtual ~Image();
 
+        // Make the image width x height, keeping its storage if the size
+        // is unchanged. New storage comes from ImagePool::shared().
+        void allocate(int width, int height);
+
+        // Use the caller's width * height * 3 bytes; they are not freed
+        void wrap(int width, int height, unsigned char* pixels);
+
         // load the given filename
         bool load(const std::string& filename);
 
-        // save the given filename
-        bool save(const std::string& filename) const;
+        // load the given filename into the caller's pixels, which the image
+        // then wraps. Fails if the image needs more than bytes.
+        bool load(const std::string& filename, unsigned char* pixels, size_t bytes);
+
+        // save the given filename as a PNG, encoded on every core
+        bool save(const std::string& filename, PngLevel level = PngDefault) const;
 
         // return the current width
         inline int width() const { return myWidth; }
@@ -54,14 +69,36 @@ namespace agl
         // Get a vec3 color 
         glm::vec3 get_vec3(int row, int col) const;
 
+        // Set count pixels of row, starting at col, from colors with channels
+        // (3 or 4) floats per pixel in range [0, 1]; alpha is ignored
+        void set_span(int row, int col, int count, const float* colors,
+            int channels = 3, ColorSpace space = LinearColor);
+
+        // Get count pixels of row, starting at col, as floats; alpha is 1
+        void get_span(int row, int col, int count, float* colors,
+            int channels = 3, ColorSpace space = LinearColor) const;
+
+        // Set or get numRows whole rows, starting at row, as floats.
+        // Large images are converted on every core.
+        void set_rows(int row, int numRows, const float* colors,
+            int channels = 3, ColorSpace space = LinearColor);
+        void get_rows(int row, int numRows, float* colors,
+            int channels = 3, ColorSpace space = LinearColor) const;
+
+        // Set or get numRows whole rows as 8-bit RGB (3) or RGBA (4) pixels
+        void set_rows(int row, int numRows, const unsigned char* pixels, int channels = 3);
+        void get_rows(int row, int numRows, unsigned char* pixels, int channels = 3) const;
+
     private:
        void clear();
 
     private:
+        enum Storage { NoStorage, PooledStorage, CallerStorage };
+
         Pixel* myData;
         unsigned int myWidth;
         unsigned int myHeight;
-        bool myLoaded;
+        Storage myStorage;
     };
 }
 
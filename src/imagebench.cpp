@@ -0,0 +1,284 @@
+// Haverford College, Jiajie Ma, 2021
+//
+// image-bench: time the image kernels on a large image
+//
+//    image-bench [image] [tiles] [threads]
+//
+// The image (by default ../results/cowphong.png) is repeated tiles times
+// across and down (by default 4) to make a large render-like frame. PNG
+// encoding is timed on one thread and on threads threads (by default all
+// cores).
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "image.h"
+#include "imagecompare.h"
+#include "imagepool.h"
+#include "parallel.h"
+#include "pngwriter.h"
+#include "resample.h"
+#include "stb/stb_image.h"
+#include "stb/stb_image_write.h"
+
+using namespace std;
+using namespace agl;
+
+// Run fn repeats times; return the fastest run in milliseconds
+static double TimeMs(const std::function<void()>& fn, int repeats = 3)
+{
+   double best = 0;
+   for (int i = 0; i < repeats; i++)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn();
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      best = i == 0 ? ms : std::min(best, ms);
+   }
+   return best;
+}
+
+static long FileSize(const std::string& filename)
+{
+   FILE* file = fopen(filename.c_str(), "rb");
+   if (!file) return -1;
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   fclose(file);
+   return size;
+}
+
+// Return true if filename decodes to exactly pixels
+static bool SameAsFile(const std::string& filename, const std::vector<unsigned char>& pixels,
+   int width, int height)
+{
+   int x, y, n;
+   unsigned char* data = stbi_load(filename.c_str(), &x, &y, &n, 3);
+   bool same = data && x == width && y == height &&
+      memcmp(data, &pixels[0], pixels.size()) == 0;
+   stbi_image_free(data);
+   return same;
+}
+
+static void BenchPng(const std::vector<unsigned char>& pixels, int width, int height, int threads)
+{
+   cout << "PNG encoding, 1 and " << threads << " threads (" << NumWorkerThreads() << " cores)" << endl;
+   const unsigned char* data = &pixels[0];
+   int stride = width * 3;
+
+   double stbMs = TimeMs([&]() { stbi_write_png("bench-stb.png", width, height, 3, data, stride); }, 1);
+   printf("   %-10s %9.1f ms %10ld bytes\n", "stb", stbMs, FileSize("bench-stb.png"));
+
+   const char* names[3] = {"fastest", "default", "smallest"};
+   for (int level = PngFastest; level <= PngSmallest; level++)
+   {
+      double serialMs = TimeMs([&]() { WritePng("bench-agl.png", width, height, 3, data, stride, (PngLevel) level, 1); });
+      double ms = TimeMs([&]() { WritePng("bench-agl.png", width, height, 3, data, stride, (PngLevel) level, threads); });
+      bool same = SameAsFile("bench-agl.png", pixels, width, height);
+      printf("   %-10s %9.1f ms %9.1f ms %10ld bytes  %5.2fx stb  %5.2fx 1 thread%s\n", names[level], serialMs, ms,
+         FileSize("bench-agl.png"), stbMs / ms, serialMs / ms, same ? "" : "  MISMATCH");
+   }
+   remove("bench-stb.png");
+   remove("bench-agl.png");
+}
+
+static void BenchPixels(const std::vector<unsigned char>& pixels, int width, int height)
+{
+   cout << "Float pixels" << endl;
+   size_t count = (size_t) width * height;
+   std::vector<float> colors(count * 3);
+   ColorConverter::get(LinearColor).decode(&pixels[0], 3, &colors[0], 3, count);
+   Image image(width, height);
+
+   double perPixel = TimeMs([&]()
+   {
+      for (int i = 0; i < height; i++)
+      {
+         for (int j = 0; j < width; j++)
+         {
+            const float* c = &colors[((size_t) i * width + j) * 3];
+            image.set_vec3(i, j, glm::vec3(c[0], c[1], c[2]));
+         }
+      }
+   });
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s\n", "set_vec3", perPixel, count / perPixel / 1000.0);
+
+   const char* names[3] = {"set_rows linear", "set_rows sRGB", "set_rows gamma"};
+   for (int space = LinearColor; space <= GammaColor; space++)
+   {
+      double ms = TimeMs([&]() { image.set_rows(0, height, &colors[0], 3, (ColorSpace) space); });
+      printf("   %-16s %8.1f ms %8.1f Mpixels/s  %5.1fx set_vec3\n", names[space], ms,
+         count / ms / 1000.0, perPixel / ms);
+   }
+
+   std::vector<glm::vec3> vectors(count);
+   double getPerPixel = TimeMs([&]()
+   {
+      for (int i = 0; i < height; i++)
+      {
+         for (int j = 0; j < width; j++)
+         {
+            vectors[(size_t) i * width + j] = image.get_vec3(i, j);
+         }
+      }
+   });
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s\n", "get_vec3", getPerPixel, count / getPerPixel / 1000.0);
+   double ms = TimeMs([&]() { image.get_rows(0, height, &colors[0]); });
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s  %5.1fx get_vec3\n", "get_rows linear", ms,
+      count / ms / 1000.0, getPerPixel / ms);
+}
+
+static void BenchPool(int width, int height)
+{
+   // a frame is created, filled and dropped, as a capture loop would
+   cout << "Frame storage, 20 frames" << endl;
+   size_t bytes = (size_t) width * height * 3;
+   double fresh = TimeMs([&]()
+   {
+      for (int i = 0; i < 20; i++)
+      {
+         Pixel* frame = new Pixel[(size_t) width * height];
+         memset(frame, i, bytes);
+         delete[] frame;
+      }
+   });
+   printf("   %-16s %8.2f ms/frame\n", "new[]", fresh / 20);
+
+   double pooled = TimeMs([&]()
+   {
+      for (int i = 0; i < 20; i++)
+      {
+         Image frame(width, height);
+         memset(frame.data(), i, bytes);
+      }
+   });
+   printf("   %-16s %8.2f ms/frame  %5.1fx new[]\n", "ImagePool", pooled / 20, fresh / pooled);
+   cout << "   ";
+   ImagePool::shared().printStats(cout);
+}
+
+static void BenchResample(const std::vector<unsigned char>& pixels, int width, int height)
+{
+   cout << "Resampling" << endl;
+   Image image(width, height);
+   memcpy(image.data(), &pixels[0], pixels.size());
+
+   // a 2x2 box in linear light, a pixel at a time, as a simple loop would do it
+   const ColorConverter& srgb = ColorConverter::get(SrgbColor);
+   Image half;
+   double naive = TimeMs([&]()
+   {
+      half.allocate(width / 2, height / 2);
+      for (int i = 0; i < height / 2; i++)
+      {
+         for (int j = 0; j < width / 2; j++)
+         {
+            Pixel p[4] = {image.get(2 * i, 2 * j), image.get(2 * i, 2 * j + 1),
+               image.get(2 * i + 1, 2 * j), image.get(2 * i + 1, 2 * j + 1)};
+            glm::vec3 sum(0);
+            for (int k = 0; k < 4; k++)
+            {
+               sum += glm::vec3(srgb.decode(p[k].r), srgb.decode(p[k].g), srgb.decode(p[k].b));
+            }
+            Pixel out = {srgb.encode(sum.x * 0.25f), srgb.encode(sum.y * 0.25f), srgb.encode(sum.z * 0.25f)};
+            half.set(i, j, out);
+         }
+      }
+   });
+   printf("   %-16s %8.1f ms\n", "per-pixel halve", naive);
+
+   std::vector<Image> levels;
+   double chain = TimeMs([&]() { MakeMipChain(image, levels); });
+   printf("   %-16s %8.1f ms  %d levels  %5.1fx per-pixel halve\n", "mip chain", chain,
+      (int) levels.size(), naive / chain);
+
+   const char* names[3] = {"thumbnail box", "thumbnail mitch", "thumbnail lanczos"};
+   Image thumbnail;
+   for (int filter = BoxFilter; filter <= LanczosFilter; filter++)
+   {
+      double ms = TimeMs([&]() { MakeThumbnail(image, thumbnail, 256, (ResampleFilter) filter); });
+      printf("   %-16s %8.1f ms %8.1f Mpixels/s  %dx%d\n", names[filter], ms,
+         (double) width * height / ms / 1000.0, thumbnail.width(), thumbnail.height());
+   }
+
+   Image twice;
+   double up = TimeMs([&]() { ResampleImage(image, twice, width * 2, height * 2); }, 1);
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s out\n", "mitchell 2x", up, 4.0 * width * height / up / 1000.0);
+}
+
+static void BenchCompare(const std::vector<unsigned char>& pixels, int width, int height)
+{
+   cout << "Comparing" << endl;
+   Image golden(width, height);
+   memcpy(golden.data(), &pixels[0], pixels.size());
+   Image render = golden;
+   for (size_t i = 0; i < pixels.size(); i += 997)
+   {
+      render.data()[i] ^= 1;
+   }
+
+   // every channel, a pixel at a time
+   size_t naiveMismatched = 0;
+   double naive = TimeMs([&]()
+   {
+      naiveMismatched = 0;
+      for (int i = 0; i < height; i++)
+      {
+         for (int j = 0; j < width; j++)
+         {
+            Pixel p = golden.get(i, j);
+            Pixel q = render.get(i, j);
+            if (p.r != q.r || p.g != q.g || p.b != q.b) naiveMismatched++;
+         }
+      }
+   });
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s\n", "get per pixel", naive, (double) width * height / naive / 1000.0);
+
+   ImageDiff diff;
+   std::vector<unsigned char> mask;
+   double ms = TimeMs([&]() { CompareImages(golden, render, diff, 0, (size_t) -1, &mask); });
+   printf("   %-16s %8.1f ms %8.1f Mpixels/s  %5.1fx get  %s\n", "CompareImages", ms,
+      (double) width * height / ms / 1000.0, naive / ms, diff.mismatched == naiveMismatched ? "same" : "DIFFERENT");
+   ms = TimeMs([&]() { CompareImages(golden, render, diff); });
+   printf("   %-16s %8.3f ms  stopped after %d rows\n", "first mismatch", ms, (int) (diff.pixels / width));
+   cout << "   ";
+   PrintImageDiff(cout, diff);
+}
+
+int main(int argc, char** argv)
+{
+   std::string filename = argc > 1 ? argv[1] : "../results/cowphong.png";
+   int tiles = argc > 2 ? std::max(atoi(argv[2]), 1) : 4;
+   int threads = argc > 3 ? std::max(atoi(argv[3]), 1) : NumWorkerThreads();
+
+   int w, h, n;
+   unsigned char* tile = stbi_load(filename.c_str(), &w, &h, &n, 3);
+   if (!tile)
+   {
+      cout << "Cannot load " << filename << endl;
+      return 1;
+   }
+
+   int width = w * tiles;
+   int height = h * tiles;
+   std::vector<unsigned char> pixels((size_t) width * height * 3);
+   for (int y = 0; y < height; y++)
+   {
+      for (int t = 0; t < tiles; t++)
+      {
+         memcpy(&pixels[((size_t) y * width + (size_t) t * w) * 3], tile + (size_t) (y % h) * w * 3, (size_t) w * 3);
+      }
+   }
+   stbi_image_free(tile);
+   cout << "Image: " << width << "x" << height << " from " << filename << endl;
+
+   BenchPng(pixels, width, height, threads);
+   BenchPixels(pixels, width, height);
+   BenchPool(width, height);
+   BenchResample(pixels, width, height);
+   BenchCompare(pixels, width, height);
+   return 0;
+}
@@ -0,0 +1,219 @@
+// Haverford College, Jiajie Ma, 2021
+#include "imagecompare.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_COMPARE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Rows compared by each parallel task
+static const int BandRows = 16;
+
+namespace {
+
+   // Sums over the pixels of a band
+   struct Totals
+   {
+      size_t pixels;
+      size_t mismatched;
+      unsigned long long errors;  // of the absolute differences
+      unsigned long long squares; // of the squared differences
+      int maxError;
+   };
+
+   // Add count pixels of a and b to totals, marking the mismatched ones in mask
+   void CompareRow(const unsigned char* a, const unsigned char* b, int count, int threshold,
+      Totals& totals, unsigned char* mask)
+   {
+      int p = 0;
+#ifdef AGL_COMPARE_SSE
+      // 16 pixels are three vectors; the sums of squares hold 32 bits, so
+      // they are emptied every 1024 steps
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i limit = _mm_set1_epi8((char) threshold);
+      __m128i errors = zero;
+      __m128i squares = zero;
+      __m128i maxError = zero;
+      unsigned long long lanes[2];
+      unsigned int squareLanes[4];
+      int steps = 0;
+      for (; p + 16 <= count; p += 16)
+      {
+         unsigned long long over = 0;
+         for (int k = 0; k < 3; k++)
+         {
+            __m128i x = _mm_loadu_si128((const __m128i*) (a + p * 3 + 16 * k));
+            __m128i y = _mm_loadu_si128((const __m128i*) (b + p * 3 + 16 * k));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+            maxError = _mm_max_epu8(maxError, d);
+            errors = _mm_add_epi64(errors, _mm_sad_epu8(d, zero));
+            __m128i low = _mm_unpacklo_epi8(d, zero);
+            __m128i high = _mm_unpackhi_epi8(d, zero);
+            squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+            int within = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, limit), zero));
+            over |= (unsigned long long) (~within & 0xFFFF) << (16 * k);
+         }
+         if (over)
+         {
+            // a bit per channel, three per pixel
+            for (int i = 0; i < 16; i++)
+            {
+               if ((over >> (3 * i)) & 7)
+               {
+                  totals.mismatched++;
+                  if (mask) mask[p + i] = 255;
+               }
+            }
+         }
+         if (++steps == 1024)
+         {
+            _mm_storeu_si128((__m128i*) squareLanes, squares);
+            totals.squares += (unsigned long long) squareLanes[0] + squareLanes[1] + squareLanes[2] + squareLanes[3];
+            squares = zero;
+            steps = 0;
+         }
+      }
+      _mm_storeu_si128((__m128i*) squareLanes, squares);
+      totals.squares += (unsigned long long) squareLanes[0] + squareLanes[1] + squareLanes[2] + squareLanes[3];
+      _mm_storeu_si128((__m128i*) lanes, errors);
+      totals.errors += lanes[0] + lanes[1];
+      unsigned char maxLanes[16];
+      _mm_storeu_si128((__m128i*) maxLanes, maxError);
+      totals.maxError = std::max(totals.maxError, (int) *std::max_element(maxLanes, maxLanes + 16));
+#endif
+      for (; p < count; p++)
+      {
+         int worst = 0;
+         for (int c = 0; c < 3; c++)
+         {
+            int d = std::abs((int) a[p * 3 + c] - (int) b[p * 3 + c]);
+            worst = std::max(worst, d);
+            totals.errors += d;
+            totals.squares += d * d;
+         }
+         totals.maxError = std::max(totals.maxError, worst);
+         if (worst > threshold)
+         {
+            totals.mismatched++;
+            if (mask) mask[p] = 255;
+         }
+      }
+      totals.pixels += count;
+   }
+}
+
+bool agl::CompareImages(const Image& a, const Image& b, ImageDiff& diff, int threshold,
+   size_t maxMismatched, std::vector<unsigned char>* mask, int numThreads)
+{
+   AGL_PROFILE_SCOPE("CompareImages");
+   memset(&diff, 0, sizeof(diff));
+   diff.width = a.width();
+   diff.height = a.height();
+   diff.sameSize = a.width() == b.width() && a.height() == b.height();
+   if (!diff.sameSize) return false;
+
+   int width = a.width();
+   int height = a.height();
+   threshold = std::min(std::max(threshold, 0), 255);
+   if (mask) mask->assign((size_t) width * height, 0);
+
+   // bands are summed on their own and added up in order at the end
+   int numBands = (height + BandRows - 1) / BandRows;
+   std::vector<Totals> bands(numBands);
+   memset(bands.data(), 0, bands.size() * sizeof(Totals));
+   std::atomic<size_t> mismatched(0);
+   ParallelFor(0, numBands, [&](int band)
+   {
+      Totals& totals = bands[band];
+      int end = std::min((band + 1) * BandRows, height);
+      for (int y = band * BandRows; y < end && mismatched.load() <= maxMismatched; y++)
+      {
+         size_t before = totals.mismatched;
+         size_t offset = (size_t) y * width;
+         CompareRow(a.data() + offset * 3, b.data() + offset * 3, width, threshold, totals,
+            mask ? mask->data() + offset : 0);
+         if (totals.mismatched > before) mismatched += totals.mismatched - before;
+      }
+   }, numThreads);
+
+   unsigned long long errors = 0;
+   unsigned long long squares = 0;
+   for (int i = 0; i < numBands; i++)
+   {
+      diff.pixels += bands[i].pixels;
+      diff.mismatched += bands[i].mismatched;
+      diff.maxError = std::max(diff.maxError, bands[i].maxError);
+      errors += bands[i].errors;
+      squares += bands[i].squares;
+   }
+   diff.stopped = diff.pixels < (size_t) width * height;
+   if (diff.pixels > 0)
+   {
+      double values = 3.0 * diff.pixels;
+      double mse = squares / values;
+      diff.meanError = errors / values;
+      diff.psnr = mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+   }
+   return diff.mismatched <= maxMismatched;
+}
+
+bool agl::SaveDiffImage(const std::string& filename, const Image& a, const Image& b, int threshold,
+   PngLevel level, int numThreads)
+{
+   if (a.width() != b.width() || a.height() != b.height()) return false;
+   int width = a.width();
+   int height = a.height();
+   Image picture(width, height);
+   ParallelFor(0, (height + BandRows - 1) / BandRows, [&](int band)
+   {
+      int end = std::min((band + 1) * BandRows, height);
+      for (size_t i = (size_t) band * BandRows * width; i < (size_t) end * width; i++)
+      {
+         const unsigned char* x = a.data() + i * 3;
+         const unsigned char* y = b.data() + i * 3;
+         unsigned char* out = picture.data() + i * 3;
+         int error = std::max(std::max(std::abs(x[0] - y[0]), std::abs(x[1] - y[1])), std::abs(x[2] - y[2]));
+         if (error > threshold)
+         {
+            out[0] = (unsigned char) (128 + error / 2);
+            out[1] = out[2] = 0;
+         }
+         else if (error > 0)
+         {
+            out[0] = out[1] = (unsigned char) std::min(96 + 16 * error, 255);
+            out[2] = 0;
+         }
+         else
+         {
+            out[0] = out[1] = out[2] = (unsigned char) ((x[0] + x[1] + x[2]) / 9);
+         }
+      }
+   }, numThreads);
+   return picture.save(filename, level);
+}
+
+void agl::PrintImageDiff(std::ostream& out, const ImageDiff& diff)
+{
+   if (!diff.sameSize)
+   {
+      out << "Image diff: the sizes differ" << endl;
+      return;
+   }
+   size_t total = (size_t) diff.width * diff.height;
+   out << "Image diff: " << diff.width << "x" << diff.height << ", " << diff.mismatched << " of "
+      << diff.pixels << " pixels mismatched (" << (diff.pixels ? 100.0 * diff.mismatched / diff.pixels : 0.0)
+      << "%), max error " << diff.maxError << ", mean error " << diff.meanError << ", PSNR "
+      << diff.psnr << " dB";
+   if (diff.stopped) out << "; stopped after " << diff.pixels << " of " << total << " pixels";
+   out << endl;
+}
@@ -0,0 +1,51 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef imagecompare_H_
+#define imagecompare_H_
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "pngwriter.h"
+
+namespace agl {
+
+   struct ImageDiff
+   {
+      int width;
+      int height;
+      size_t pixels;     // compared; fewer than all if stopped
+      size_t mismatched; // pixels with a channel more than the threshold off
+      int maxError;      // the largest difference of a channel, 0 to 255
+      double meanError;  // the mean absolute difference of a channel, 0 to 255
+      double psnr;       // in dB, from the mean squared error; infinite if equal
+      bool sameSize;
+      bool stopped;      // more pixels mismatched than allowed, so the rest were skipped
+   };
+
+   // Compare a with b, channel by channel, for golden image tests.
+   //
+   // A pixel mismatches when any of its channels differs by more than
+   // threshold. Rows are compared 16 pixels at a time with SSE, on bands of
+   // rows on numThreads threads (<= 0 for all cores); bands where nothing
+   // mismatches never leave SSE. Once more than maxMismatched pixels
+   // mismatch, the rows not yet compared are skipped and the statistics cover
+   // only the pixels compared. If mask is given, it gets a byte per pixel,
+   // 255 where the pixel mismatches and 0 elsewhere.
+   // Returns true if the sizes match and at most maxMismatched pixels
+   // mismatch; by default, if none do.
+   bool CompareImages(const Image& a, const Image& b, ImageDiff& diff, int threshold = 0,
+      size_t maxMismatched = 0, std::vector<unsigned char>* mask = 0, int numThreads = 0);
+
+   // Save a picture of where a and b differ as a PNG: a in faded gray,
+   // mismatched pixels in red and smaller differences in yellow, brighter
+   // the larger they are. Returns false if the sizes differ or the file
+   // cannot be written.
+   bool SaveDiffImage(const std::string& filename, const Image& a, const Image& b, int threshold = 0,
+      PngLevel level = PngFastest, int numThreads = 0);
+
+   void PrintImageDiff(std::ostream& out, const ImageDiff& diff);
+}
+
+#endif
@@ -0,0 +1,51 @@
+// Haverford College, Jiajie Ma, 2021
+//
+// image-diff: compare a render with its golden image
+//
+//    image-diff golden.png render.png [threshold] [max mismatched] [diff.png]
+//
+// A pixel mismatches when a channel is more than threshold (by default 0)
+// off. Exits with 0 if at most max mismatched pixels (by default 0) do, 1
+// if more do and 2 if an image cannot be loaded. The diff image is only
+// written when the images don't match.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "image.h"
+#include "imagecompare.h"
+
+using namespace std;
+using namespace agl;
+
+int main(int argc, char** argv)
+{
+   if (argc < 3)
+   {
+      cout << "Usage: image-diff golden.png render.png [threshold] [max mismatched] [diff.png]" << endl;
+      return 2;
+   }
+   int threshold = argc > 3 ? atoi(argv[3]) : 0;
+   size_t maxMismatched = argc > 4 ? (size_t) strtoull(argv[4], 0, 10) : 0;
+   std::string diffName = argc > 5 ? argv[5] : "";
+
+   Image golden, render;
+   if (!golden.load(argv[1]) || !render.load(argv[2]))
+   {
+      cout << "Cannot load " << (golden.width() ? argv[2] : argv[1]) << endl;
+      return 2;
+   }
+
+   ImageDiff diff;
+   auto start = std::chrono::steady_clock::now();
+   bool match = CompareImages(golden, render, diff, threshold, maxMismatched);
+   double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   PrintImageDiff(cout, diff);
+   cout << "Compared in " << ms << " ms" << endl;
+
+   if (!match && !diffName.empty() && SaveDiffImage(diffName, golden, render, threshold))
+   {
+      cout << "Saved " << diffName << endl;
+   }
+   return match ? 0 : 1;
+}
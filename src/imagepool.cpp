@@ -0,0 +1,206 @@
+// Haverford College, Jiajie Ma, 2021
+#include "imagepool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// The smallest size class
+static const size_t MinBytes = 4096;
+
+// Buffers start this far into their block, after the header, to stay aligned
+static const size_t HeaderBytes = 64;
+
+struct ImagePool::Header
+{
+   ImagePool* pool;
+   size_t capacity;
+   int sizeClass;
+};
+
+namespace {
+
+   // Round bytes up to its size class: four steps per power of two
+   size_t ClassCapacity(size_t bytes, int& sizeClass)
+   {
+      if (bytes <= MinBytes)
+      {
+         sizeClass = 0;
+         return MinBytes;
+      }
+      int octave = 0;
+      while ((MinBytes << (octave + 1)) < bytes) octave++;
+      size_t base = MinBytes << octave;
+      size_t step = base / 4;
+      size_t steps = (bytes - base + step - 1) / step; // 1 to 4
+      sizeClass = 1 + octave * 4 + (int) (steps - 1);
+      return base + steps * step;
+   }
+
+   unsigned char* AllocateBlock(size_t size)
+   {
+#ifdef _WIN32
+      return (unsigned char*) _aligned_malloc(size, HeaderBytes);
+#else
+      void* block = 0;
+      if (posix_memalign(&block, HeaderBytes, size) != 0) return 0;
+      return (unsigned char*) block;
+#endif
+   }
+
+   void FreeBlock(void* block)
+   {
+#ifdef _WIN32
+      _aligned_free(block);
+#else
+      free(block);
+#endif
+   }
+}
+
+ImagePool::ImagePool(size_t maxPooledBytes) : myMaxPooledBytes(maxPooledBytes)
+{
+   memset(&myStats, 0, sizeof(myStats));
+}
+
+ImagePool::~ImagePool()
+{
+   trim();
+}
+
+ImagePool& ImagePool::shared()
+{
+   // images in globals may be freed after any static pool would be
+   static ImagePool* pool = new ImagePool();
+   return *pool;
+}
+
+unsigned char* ImagePool::acquire(size_t bytes)
+{
+   int sizeClass;
+   size_t capacity = ClassCapacity(bytes, sizeClass);
+
+   Header* header = 0;
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myStats.acquired++;
+      myStats.bytesInUse += capacity;
+      if (sizeClass < (int) myFree.size() && !myFree[sizeClass].empty())
+      {
+         header = myFree[sizeClass].back();
+         myFree[sizeClass].pop_back();
+         myStats.bytesPooled -= capacity;
+      }
+      else
+      {
+         myStats.allocated++;
+         myStats.peakBytes = std::max(myStats.peakBytes, myStats.bytesInUse + myStats.bytesPooled);
+      }
+   }
+
+   if (!header)
+   {
+      unsigned char* block = AllocateBlock(HeaderBytes + capacity);
+      if (!block)
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         myStats.bytesInUse -= capacity;
+         return 0;
+      }
+      header = (Header*) block;
+      header->pool = this;
+      header->capacity = capacity;
+      header->sizeClass = sizeClass;
+   }
+   return (unsigned char*) header + HeaderBytes;
+}
+
+void ImagePool::release(unsigned char* data)
+{
+   if (!data) return;
+   Header* header = (Header*) (data - HeaderBytes);
+   header->pool->recycle(header);
+}
+
+void ImagePool::recycle(Header* header)
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   myStats.released++;
+   myStats.bytesInUse -= header->capacity;
+   if (myStats.bytesPooled + header->capacity > myMaxPooledBytes)
+   {
+      myStats.freed++;
+      FreeBlock(header);
+      return;
+   }
+   if (header->sizeClass >= (int) myFree.size())
+   {
+      myFree.resize(header->sizeClass + 1);
+   }
+   myFree[header->sizeClass].push_back(header);
+   myStats.bytesPooled += header->capacity;
+}
+
+unsigned char* ImagePool::resize(unsigned char* data, size_t bytes)
+{
+   if (!data) return shared().acquire(bytes);
+
+   Header* header = (Header*) (data - HeaderBytes);
+   if (bytes <= header->capacity) return data;
+
+   unsigned char* moved = header->pool->acquire(bytes);
+   if (!moved) return 0; // data stays valid, as with realloc
+   memcpy(moved, data, header->capacity);
+   release(data);
+   return moved;
+}
+
+size_t ImagePool::capacity(const unsigned char* data)
+{
+   return data ? ((const Header*) (data - HeaderBytes))->capacity : 0;
+}
+
+void ImagePool::trim()
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   for (size_t c = 0; c < myFree.size(); c++)
+   {
+      for (size_t i = 0; i < myFree[c].size(); i++)
+      {
+         myStats.freed++;
+         myStats.bytesPooled -= myFree[c][i]->capacity;
+         FreeBlock(myFree[c][i]);
+      }
+      myFree[c].clear();
+   }
+}
+
+void ImagePool::setMaxPooledBytes(size_t bytes)
+{
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myMaxPooledBytes = bytes;
+      if (myStats.bytesPooled <= bytes) return;
+   }
+   trim(); // simpler than choosing which buffers to keep
+}
+
+ImagePoolStats ImagePool::stats() const
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   return myStats;
+}
+
+void ImagePool::printStats(std::ostream& out) const
+{
+   ImagePoolStats s = stats();
+   out << "Image pool: " << s.acquired << " buffers acquired, " << s.allocated << " allocated ("
+      << 100.0 * s.reuseRate() << "% reused), " << s.bytesInUse / (1024.0 * 1024.0) << " MB in use, "
+      << s.bytesPooled / (1024.0 * 1024.0) << " MB pooled, peak "
+      << s.peakBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+}
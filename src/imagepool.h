@@ -0,0 +1,83 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef imagepool_H_
+#define imagepool_H_
+
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace agl {
+
+   struct ImagePoolStats
+   {
+      long long acquired;  // buffers handed out
+      long long allocated; // of those, newly allocated
+      long long released;  // buffers handed back
+      long long freed;     // of those, freed rather than kept
+      size_t bytesInUse;   // capacity handed out and not yet released
+      size_t bytesPooled;  // capacity kept for reuse
+      size_t peakBytes;    // most bytes in use and pooled at once
+
+      double reuseRate() const { return acquired > 0 ? (double) (acquired - allocated) / acquired : 0.0; }
+   };
+
+   // Recycles pixel storage, so images of the sizes a program keeps using,
+   // such as its frames, stop allocating after the first few.
+   //
+   // Requests are rounded up to a size class, four per power of two from
+   // 4 KB (at most 25% waste), and released buffers wait on a free list per
+   // class until a request of that class comes again. Buffers are 64 byte
+   // aligned, and remember their pool, so release needs only the pointer.
+   // Pooled bytes are capped; buffers released over the cap are freed.
+   // Safe to use from several threads.
+   class ImagePool
+   {
+   public:
+      explicit ImagePool(size_t maxPooledBytes = 256 * 1024 * 1024);
+
+      // Frees the pooled buffers; buffers in use must be released first
+      virtual ~ImagePool();
+
+      ImagePool(const ImagePool&) = delete;
+      ImagePool& operator=(const ImagePool&) = delete;
+
+      // The pool of agl::Image and stb_image. It is never destroyed.
+      static ImagePool& shared();
+
+      // Return at least bytes of uninitialized storage, or 0 if out of memory
+      unsigned char* acquire(size_t bytes);
+
+      // Hand data back to the pool it came from; data may be 0
+      static void release(unsigned char* data);
+
+      // Like realloc: keep data if its class holds bytes, else move it into
+      // a new buffer from the same pool (the shared one if data is 0)
+      static unsigned char* resize(unsigned char* data, size_t bytes);
+
+      // The usable size of data
+      static size_t capacity(const unsigned char* data);
+
+      // Free every pooled buffer
+      void trim();
+
+      void setMaxPooledBytes(size_t bytes);
+      size_t maxPooledBytes() const { return myMaxPooledBytes; }
+
+      ImagePoolStats stats() const;
+      void printStats(std::ostream& out) const;
+
+   private:
+      struct Header;
+
+      void recycle(Header* header);
+
+   private:
+      mutable std::mutex myMutex;
+      std::vector<std::vector<Header*> > myFree; // by size class
+      size_t myMaxPooledBytes;
+      ImagePoolStats myStats;
+   };
+}
+
+#endif
@@ -3,24 +3,166 @@
 #include "stdio.h"
 #include "string.h"
 #include "stdlib.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <new>
+#include <utility>
+#include <vector>
+#include "meshtransform.h"
+#include "plyheader.h"
+#include "profiler.h"
+#include "stream.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 using namespace glm;
 using namespace agl;
 
 static const int max_line = 65535;
+static const size_t array_alignment = 64;
+static size_t huge_page_threshold = 32 << 20;
 
-Mesh::Mesh() 
+static size_t AlignUp(size_t size, size_t alignment)
+{
+   return (size + alignment - 1) / alignment * alignment;
+}
+
+// Allocate size bytes aligned for SIMD; very large blocks ask for huge pages
+static unsigned char* AllocateBlock(size_t& size, bool& hugePages)
+{
+   hugePages = false;
+#ifdef __linux__
+   if (huge_page_threshold > 0 && size >= huge_page_threshold)
+   {
+      size_t rounded = AlignUp(size, 2 << 20);
+      void* block = mmap(0, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (block != MAP_FAILED)
+      {
+         madvise(block, rounded, MADV_HUGEPAGE);
+         size = rounded;
+         hugePages = true;
+         return (unsigned char*) block;
+      }
+   }
+#endif
+#ifdef _WIN32
+   return (unsigned char*) _aligned_malloc(size, array_alignment);
+#else
+   void* block = 0;
+   if (posix_memalign(&block, array_alignment, size) != 0) return 0;
+   return (unsigned char*) block;
+#endif
+}
+
+static void FreeBlock(unsigned char* block, size_t size, bool hugePages)
+{
+#ifdef __linux__
+   if (hugePages)
+   {
+      munmap(block, size);
+      return;
+   }
+#endif
+#ifdef _WIN32
+   _aligned_free(block);
+#else
+   free(block);
+#endif
+}
+
+Mesh::Mesh()
 {
    v = 0;
    f = 0;
-   _vertices = new float[0];
-   _normals = new float[0];
-   _colors = new float[0];
-   _faces = new unsigned int[0];
+   _vertices = 0;
+   _normals = 0;
+   _colors = 0;
+   _faces = 0;
+   minpos = maxpos = glm::vec3(0);
+   _block = 0;
+   _blockSize = 0;
+   _hugePages = false;
+}
+
+Mesh::Mesh(const Mesh& orig) : Mesh()
+{
+   *this = orig;
+}
+
+Mesh& Mesh::operator=(const Mesh& orig)
+{
+   if (&orig == this)
+   {
+      return *this;
+   }
+
+   // copy into a new mesh first, so this one is unchanged if memory runs out
+   Mesh copy;
+   if (!copy.copyFrom(orig))
+   {
+      throw std::bad_alloc();
+   }
+   *this = std::move(copy);
+   return *this;
+}
+
+// Replace the contents with a copy of orig's arrays
+// Returns false, leaving this mesh empty, if there is not enough memory
+bool Mesh::copyFrom(const Mesh& orig)
+{
+   if (!allocate(orig.v, orig.f, orig.hasNormals(), orig.hasColors()))
+   {
+      return false;
+   }
+   size_t vsize = 3 * (size_t) v * sizeof(float);
+   if (v > 0)
+   {
+      memcpy(_vertices, orig._vertices, vsize);
+      if (_normals) memcpy(_normals, orig._normals, vsize);
+      if (_colors) memcpy(_colors, orig._colors, vsize);
+   }
+   if (f > 0)
+   {
+      memcpy(_faces, orig._faces, 3 * (size_t) f * sizeof(unsigned int));
+   }
+   minpos = orig.minpos;
+   maxpos = orig.maxpos;
+   return true;
+}
+
+Mesh::Mesh(Mesh&& orig) noexcept : Mesh()
+{
+   *this = std::move(orig);
+}
+
+Mesh& Mesh::operator=(Mesh&& orig) noexcept
+{
+   if (&orig == this)
+   {
+      return *this;
+   }
+
+   clear();
+   v = orig.v;
+   f = orig.f;
+   _vertices = orig._vertices;
+   _normals = orig._normals;
+   _colors = orig._colors;
+   _faces = orig._faces;
+   minpos = orig.minpos;
+   maxpos = orig.maxpos;
+   _block = orig._block;
+   _blockSize = orig._blockSize;
+   _hugePages = orig._hugePages;
+
+   // leave orig empty, without freeing what we took
+   orig._block = 0;
+   orig.clear();
+   return *this;
 }
 
 Mesh::~Mesh()
@@ -28,235 +170,344 @@ Mesh::~Mesh()
    clear();
 }
 
+void Mesh::setHugePageThreshold(size_t bytes)
+{
+   huge_page_threshold = bytes;
+}
+
+bool Mesh::allocate(int numVertices, int numTriangles, bool withNormals, bool withColors)
+{
+   clear();
+
+   // one block: positions | normals | colors | faces, each 64 byte aligned
+   size_t vsize = AlignUp(3 * (size_t) numVertices * sizeof(float), array_alignment);
+   size_t fsize = AlignUp(3 * (size_t) numTriangles * sizeof(unsigned int), array_alignment);
+   size_t size = vsize * (1 + (withNormals ? 1 : 0) + (withColors ? 1 : 0)) + fsize;
+   if (size == 0)
+   {
+      return true;
+   }
+
+   _block = AllocateBlock(size, _hugePages);
+   if (!_block)
+   {
+      cout << "ERROR: Out of memory allocating a mesh of " << size << " bytes" << std::endl;
+      return false;
+   }
+   _blockSize = size;
+
+   unsigned char* next = _block;
+   _vertices = (float*) next;
+   next += vsize;
+   if (withNormals)
+   {
+      _normals = (float*) next;
+      next += vsize;
+   }
+   if (withColors)
+   {
+      _colors = (float*) next;
+      next += vsize;
+   }
+   _faces = (unsigned int*) next;
+   v = numVertices;
+   f = numTriangles;
+   return true;
+}
+
 bool Mesh::loadPLY(const std::string& filename)
 {
-   ifstream file(filename);
+   return loadPLY(filename, PreviewCallback());
+}
+
+bool Mesh::loadPLY(std::istream& file, const std::string& filename)
+{
+   return loadPLY(file, filename, PreviewCallback());
+}
+
+bool Mesh::loadPLY(const std::string& filename, const PreviewCallback& preview, int previewPoints)
+{
+   InputStream file(filename);
    if (!file)
    {
       cout << "ERROR: Cannot load file: " << filename << std::endl;
       return false;
    }
 
+   if (!loadPLY(file, filename, preview, previewPoints))
+   {
+      return false;
+   }
+   if (file.failed())
+   {
+      // the decompressor or the underlying read failed part way through
+      cout << "ERROR: " << filename << " is truncated or corrupt" << std::endl;
+      clear();
+      return false;
+   }
+   return true;
+}
+
+bool Mesh::loadPLY(std::istream& file, const std::string& filename,
+   const PreviewCallback& preview, int previewPoints)
+{
+   AGL_PROFILE_SCOPE("Mesh::loadPLY");
+
    // make sure the arrays are empty
    clear();
 
-   // initialize a bin that reads all unnecessary information
-   string line;
-   file >> line;
-
-   if (line != "ply"){
+   PlyHeader header;
+   if (!header.read(file)){
       cout << "ERROR: " << filename << " is not a ply file!" << std::endl;
       return false;
    }
-   
-   // skip the ascii line
-   while (line != "element"){
-      file.ignore(max_line, '\n');
-      file >> line;
+   if (header.format != "ascii"){
+      cout << "ERROR: " << filename << " is not an ascii ply file!" << std::endl;
+      return false;
    }
-   
-   file >> line;
-   file >> v;
-   
-   while (line != "element"){
-      file.ignore(max_line, '\n');
-      file >> line;
+
+   const PlyElement* vertex = header.element("vertex");
+   int x = vertex ? vertex->find("x") : -1;
+   int y = vertex ? vertex->find("y") : -1;
+   int z = vertex ? vertex->find("z") : -1;
+   if (x < 0 || y < 0 || z < 0){
+      cout << "ERROR: " << filename << " has no vertex positions!" << std::endl;
+      return false;
    }
+   int nx = vertex->find("nx"), ny = vertex->find("ny"), nz = vertex->find("nz");
+   int red = vertex->find("red"), green = vertex->find("green"), blue = vertex->find("blue");
+   bool withNormals = (nx >= 0 && ny >= 0 && nz >= 0);
+   bool withColors = (red >= 0 && green >= 0 && blue >= 0);
 
-   file >> line;
-   file >> f;
+   // size every array from the header, in a single allocation
+   if (!allocate(header.numVertices(), header.numFaces(), true, withColors)){
+      return false;
+   }
 
-   // skip to the end of the header
-   while (line != "end_header"){
-      file.ignore(max_line, '\n');
-      file >> line;
+   // 8 bit colors are scaled to [0, 1]
+   float colorScale = 1.0f;
+   if (withColors && (vertex->properties[red].type == "uchar" || vertex->properties[red].type == "uint8")){
+      colorScale = 1.0f / 255.0f;
    }
 
-   file.ignore(max_line, '\n');
-   
-   // read the vertices and normals
-   _vertices = new float[3 * v];
-   _normals = new float[3 * v];
-   _colors = new float[3 * v];
-   for (int i = 0; i < v; i++){
-      // read the vertices
-      file >> _vertices[3*i + 0];
-      file >> _vertices[3*i + 1];
-      file >> _vertices[3*i + 2];
-      file >> _normals[3*i + 0];
-      file >> _normals[3*i + 1];
-      file >> _normals[3*i + 2];
-      
-      file.ignore(max_line, '\n');
-
-      // keep track of the maximum/minimum value of x,y,z
-      if (i == 0){
-         minpos[0] = _vertices[0];
-         minpos[1] = _vertices[1];
-         minpos[2] = _vertices[2];
-         maxpos[0] = _vertices[0];
-         maxpos[1] = _vertices[1];
-         maxpos[2] = _vertices[2];
-      }
-      else{
-         if (_vertices[3*i + 0] < minpos[0]){
-            minpos[0] = _vertices[3*i + 0];
-         }
-         if (_vertices[3*i + 1] < minpos[1]){
-            minpos[1] = _vertices[3*i + 1];
-         }
-         if (_vertices[3*i + 2] < minpos[2]){
-            minpos[2] = _vertices[3*i + 2];
-         }
-         if (_vertices[3*i + 0] > maxpos[0]){
-            maxpos[0] = _vertices[3*i + 0];
+   // triangles beyond the first of each polygon with more than 3 sides
+   vector<unsigned int> extra;
+   bool badIndex = false;
+
+   for (size_t e = 0; e < header.elements.size(); e++){
+      const PlyElement& element = header.elements[e];
+      int numProperties = (int) element.properties.size();
+
+      if (element.name == "vertex"){
+         // previews only help if the faces still take a while
+         int previewStep = (preview && f > 0) ? std::max(v / 4, 1) : v + 1;
+         vector<float> values(numProperties);
+         for (int i = 0; i < v; i++){
+            for (int p = 0; p < numProperties; p++){
+               if (element.properties[p].countType.empty()){
+                  file >> values[p];
+               }
+               else{
+                  // lists on vertices are not used; skip their values
+                  int n = 0;
+                  file >> n;
+                  float ignored;
+                  for (int k = 0; k < n; k++) file >> ignored;
+               }
+            }
+
+            _vertices[3*i + 0] = values[x];
+            _vertices[3*i + 1] = values[y];
+            _vertices[3*i + 2] = values[z];
+            if (withNormals){
+               _normals[3*i + 0] = values[nx];
+               _normals[3*i + 1] = values[ny];
+               _normals[3*i + 2] = values[nz];
+            }
+            if (withColors){
+               _colors[3*i + 0] = values[red] * colorScale;
+               _colors[3*i + 1] = values[green] * colorScale;
+               _colors[3*i + 2] = values[blue] * colorScale;
+            }
+
+            if ((i + 1) % previewStep == 0 && !file.fail()){
+               Mesh points;
+               makePreview(i + 1, previewPoints, withNormals, points);
+               preview(points);
+            }
          }
-         if (_vertices[3*i + 1] > maxpos[1]){
-            maxpos[1] = _vertices[3*i + 1];
+      }
+      else if (element.name == "face"){
+         vector<unsigned int> polygon;
+         for (int i = 0; i < f; i++){
+            bool read = false;
+            for (int p = 0; p < numProperties; p++){
+               if (element.properties[p].countType.empty()){
+                  float ignored;
+                  file >> ignored;
+                  continue;
+               }
+
+               int n = 0;
+               file >> n;
+               polygon.resize(n);
+               for (int k = 0; k < n; k++){
+                  file >> polygon[k];
+                  badIndex = badIndex || polygon[k] >= (unsigned int) v;
+               }
+               if (read) continue; // only the first list holds the vertex indices
+               read = true;
+
+               // triangulate polygons as a fan around their first vertex
+               for (int k = 0; k < 3; k++){
+                  _faces[3*i + k] = (n >= 3) ? polygon[k] : 0;
+               }
+               for (int k = 3; k < n; k++){
+                  extra.push_back(polygon[0]);
+                  extra.push_back(polygon[k - 1]);
+                  extra.push_back(polygon[k]);
+               }
+            }
          }
-         if (_vertices[3*i + 2] > maxpos[2]){
-            maxpos[2] = _vertices[3*i + 2];
+      }
+      else{
+         // skip elements we don't use, one line each
+         for (int i = 0; i < element.count; i++){
+            file >> ws;
+            file.ignore(max_line, '\n');
          }
       }
    }
 
-   // read the faces (triangles)
-   _faces = new unsigned int[3*f];
-   for (int i = 0; i < f; i++){
-      file >> line;
-      file >> _faces[3*i + 0];
-      file >> _faces[3*i + 1];
-      file >> _faces[3*i + 2];
+   if (file.fail()){
+      cout << "ERROR: " << filename << " is truncated or corrupt" << std::endl;
+      clear();
+      return false;
+   }
+   if (badIndex){
+      cout << "ERROR: " << filename << " has faces that use missing vertices" << std::endl;
+      clear();
+      return false;
+   }
 
-      file.ignore(max_line, '\n');
+   if (!extra.empty()){
+      Mesh grown;
+      if (!grown.allocate(v, f + (int) (extra.size() / 3), true, withColors)){
+         clear();
+         return false;
+      }
+      memcpy(grown._vertices, _vertices, 3 * (size_t) v * sizeof(float));
+      memcpy(grown._normals, _normals, 3 * (size_t) v * sizeof(float));
+      if (withColors) memcpy(grown._colors, _colors, 3 * (size_t) v * sizeof(float));
+      memcpy(grown._faces, _faces, 3 * (size_t) f * sizeof(unsigned int));
+      memcpy(grown._faces + 3 * (size_t) f, &extra[0], extra.size() * sizeof(unsigned int));
+      *this = std::move(grown);
    }
 
+   if (!withNormals){
+      computeNormals();
+   }
+   computeBounds();
    return true;
 }
 
 bool Mesh::loadwithColor(const std::string& filename)
 {
-   ifstream file(filename);
-   if (!file)
-   {
-      cout << "ERROR: Cannot load file: " << filename << std::endl;
-      return false;
-   }
-
-   // make sure the arrays are empty
-   clear();
+   return loadPLY(filename);
+}
 
-   // initialize a bin that reads all unnecessary information
-   string line;
-   file >> line;
+bool Mesh::loadwithColor(std::istream& file, const std::string& filename)
+{
+   return loadPLY(file, filename);
+}
 
-   if (line != "ply"){
-      cout << "ERROR: " << filename << " is not a ply file!" << std::endl;
-      return false;
-   }
-   
-   // skip the ascii line
-   while (line != "element"){
-      file.ignore(max_line, '\n');
-      file >> line;
+void Mesh::makePreview(int numRead, int maxPoints, bool withNormals, Mesh& preview) const
+{
+   // every stride-th vertex; normals are only known if the file has them
+   int stride = std::max((numRead + maxPoints - 1) / std::max(maxPoints, 1), 1);
+   int count = (numRead + stride - 1) / stride;
+   if (!preview.allocate(count, 0, withNormals, _colors != 0)){
+      return;
    }
-   
-   file >> line;
-   file >> v;
-   
-   while (line != "element"){
-      file.ignore(max_line, '\n');
-      file >> line;
+   for (int i = 0; i < count; i++){
+      for (int k = 0; k < 3; k++){
+         preview._vertices[3*i + k] = _vertices[3*i*stride + k];
+         if (withNormals) preview._normals[3*i + k] = _normals[3*i*stride + k];
+         if (_colors) preview._colors[3*i + k] = _colors[3*i*stride + k];
+      }
    }
+   preview.computeBounds();
+}
 
-   file >> line;
-   file >> f;
-
-   // skip to the end of the header
-   while (line != "end_header"){
-      file.ignore(max_line, '\n');
-      file >> line;
+void Mesh::computeBounds()
+{
+   if (v == 0){
+      minpos = maxpos = glm::vec3(0);
+      return;
    }
 
-   file.ignore(max_line, '\n');
-   
-   // read the vertices and normals
-   _vertices = new float[3 * v];
-   _normals = new float[3 * v];
-   _colors = new float[3 * v];
-   for (int i = 0; i < v; i++){
-      // read the vertices
-      file >> _vertices[3*i + 0];
-      file >> _vertices[3*i + 1];
-      file >> _vertices[3*i + 2];
-
-      file >> _colors[3*i + 0];
-      file >> _colors[3*i + 1];
-      file >> _colors[3*i + 2];
-      _colors[3*i + 0] = _colors[3*i + 0]/255.0f;
-      _colors[3*i + 1] = _colors[3*i + 1]/255.0f;
-      _colors[3*i + 2] = _colors[3*i + 2]/255.0f;
-      
-      file.ignore(max_line, '\n');
-
-      // keep track of the maximum/minimum value of x,y,z
-      if (i == 0){
-         minpos[0] = _vertices[0];
-         minpos[1] = _vertices[1];
-         minpos[2] = _vertices[2];
-         maxpos[0] = _vertices[0];
-         maxpos[1] = _vertices[1];
-         maxpos[2] = _vertices[2];
+   // keep track of the maximum/minimum value of x,y,z
+   minpos = maxpos = glm::vec3(_vertices[0], _vertices[1], _vertices[2]);
+   for (int i = 1; i < v; i++){
+      for (int k = 0; k < 3; k++){
+         float value = _vertices[3*i + k];
+         if (value < minpos[k]) minpos[k] = value;
+         if (value > maxpos[k]) maxpos[k] = value;
       }
-      else{
-         if (_vertices[3*i + 0] < minpos[0]){
-            minpos[0] = _vertices[3*i + 0];
-         }
-         if (_vertices[3*i + 1] < minpos[1]){
-            minpos[1] = _vertices[3*i + 1];
-         }
-         if (_vertices[3*i + 2] < minpos[2]){
-            minpos[2] = _vertices[3*i + 2];
-         }
-         if (_vertices[3*i + 0] > maxpos[0]){
-            maxpos[0] = _vertices[3*i + 0];
-         }
-         if (_vertices[3*i + 1] > maxpos[1]){
-            maxpos[1] = _vertices[3*i + 1];
-         }
-         if (_vertices[3*i + 2] > maxpos[2]){
-            maxpos[2] = _vertices[3*i + 2];
-         }
+   }
+}
+
+bool Mesh::transform(const glm::mat4& matrix, int numThreads)
+{
+   AGL_PROFILE_SCOPE("Mesh::transform");
+
+   // external arrays may be read-only, such as a mapped model pack
+   if (!_block && v > 0)
+   {
+      Mesh copy;
+      if (!copy.copyFrom(*this))
+      {
+         return false;
       }
+      *this = std::move(copy);
+   }
+   TransformPoints(matrix, _vertices, _vertices, v, false, numThreads);
+   if (_normals)
+   {
+      glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+      TransformNormals(normalMatrix, _normals, _normals, v, true, numThreads);
    }
+   computeBounds();
+   return true;
+}
 
-   // read the faces (triangles)
-   _faces = new unsigned int[3*f];
+void Mesh::computeNormals()
+{
+   AGL_PROFILE_SCOPE("Mesh::computeNormals");
+
+   // approximate the normals by summing the area weighted normals of adjacent faces
+   memset(_normals, 0, 3 * (size_t) v * sizeof(float));
    for (int i = 0; i < f; i++){
-      file >> line;
-      file >> _faces[3*i + 0];
-      file >> _faces[3*i + 1];
-      file >> _faces[3*i + 2];
-
-      // approximate the normals
-      glm::vec3 a = glm::vec3(_vertices[3*_faces[3*i + 0]], _vertices[3*_faces[3*i + 0] + 1], _vertices[3*_faces[3*i + 0] + 2]);
-      glm::vec3 b = glm::vec3(_vertices[3*_faces[3*i + 1]], _vertices[3*_faces[3*i + 1] + 1], _vertices[3*_faces[3*i + 1] + 2]);
-      glm::vec3 c = glm::vec3(_vertices[3*_faces[3*i + 2]], _vertices[3*_faces[3*i + 2] + 1], _vertices[3*_faces[3*i + 2] + 2]);
-      glm::vec3 tnorm = glm::normalize(glm::cross(b-a, c-a));
-      _normals[_faces[3*i + 0]] = tnorm[0];
-      _normals[_faces[3*i + 0] + 1] = tnorm[1];
-      _normals[_faces[3*i + 0] + 2] = tnorm[2];
-      _normals[_faces[3*i + 1]] = tnorm[0];
-      _normals[_faces[3*i + 1] + 1] = tnorm[1];
-      _normals[_faces[3*i + 1] + 2] = tnorm[2];
-      _normals[_faces[3*i + 2]] = tnorm[0];
-      _normals[_faces[3*i + 2] + 1] = tnorm[1];
-      _normals[_faces[3*i + 2] + 2] = tnorm[2];
-
-      file.ignore(max_line, '\n');
+      unsigned int ia = _faces[3*i + 0], ib = _faces[3*i + 1], ic = _faces[3*i + 2];
+      glm::vec3 a = glm::vec3(_vertices[3*ia], _vertices[3*ia + 1], _vertices[3*ia + 2]);
+      glm::vec3 b = glm::vec3(_vertices[3*ib], _vertices[3*ib + 1], _vertices[3*ib + 2]);
+      glm::vec3 c = glm::vec3(_vertices[3*ic], _vertices[3*ic + 1], _vertices[3*ic + 2]);
+      glm::vec3 tnorm = glm::cross(b - a, c - a);
+      for (int k = 0; k < 3; k++){
+         _normals[3*ia + k] += tnorm[k];
+         _normals[3*ib + k] += tnorm[k];
+         _normals[3*ic + k] += tnorm[k];
+      }
    }
 
-   return true;
+   for (int i = 0; i < v; i++){
+      glm::vec3 n = glm::vec3(_normals[3*i], _normals[3*i + 1], _normals[3*i + 2]);
+      float len = glm::length(n);
+      n = (len > 0.0f) ? n / len : glm::vec3(0, 1, 0);
+      _normals[3*i + 0] = n[0];
+      _normals[3*i + 1] = n[1];
+      _normals[3*i + 2] = n[2];
+   }
 }
 
 glm::vec3 Mesh::getMinBounds() const
@@ -299,12 +550,40 @@ unsigned int* Mesh::indices() const
    return _faces;
 }
 
+size_t Mesh::memoryFootprint() const
+{
+   return sizeof(*this) + (_block ? _blockSize : 0);
+}
+
+void Mesh::setExternalData(int numVertices, int numTriangles,
+   float* positions, float* normals, float* colors, unsigned int* indices,
+   const glm::vec3& minBounds, const glm::vec3& maxBounds)
+{
+   clear();
+   v = numVertices;
+   f = numTriangles;
+   _vertices = positions;
+   _normals = normals;
+   _colors = colors;
+   _faces = indices;
+   minpos = minBounds;
+   maxpos = maxBounds;
+}
+
 void Mesh::clear()
 {
    // clean up the memory
-   delete[] _vertices;
-   delete[] _normals;
-   delete[] _faces;
-   delete[] _colors;
+   if (_block)
+   {
+      FreeBlock(_block, _blockSize, _hugePages);
+   }
+   _block = 0;
+   _blockSize = 0;
+   _hugePages = false;
+   _vertices = 0;
+   _normals = 0;
+   _faces = 0;
+   _colors = 0;
+   v = 0;
+   f = 0;
 }
-
@@ -2,6 +2,8 @@
 #ifndef meshmodel_H_
 #define meshmodel_H_
 
+#include <cstddef>
+#include <functional>
 #include "AGLM.h"
 
 namespace agl {
@@ -11,14 +13,42 @@ namespace agl {
 
       Mesh();
 
+      // Deep copy; the copy always owns its arrays
+      // Throws std::bad_alloc, leaving this mesh unchanged, if there is not enough memory
+      Mesh(const Mesh& orig);
+      Mesh& operator=(const Mesh& orig);
+
+      // Take the arrays of orig, leaving it empty
+      Mesh(Mesh&& orig) noexcept;
+      Mesh& operator=(Mesh&& orig) noexcept;
+
       virtual ~Mesh();
 
+      // Receives point clouds of the vertices read so far while a model loads
+      typedef std::function<void(const Mesh& preview)> PreviewCallback;
+
       // Initialize this object with the given file
       // Returns true if successfull. false otherwise.
+      // The file may be gzip compressed; "-" reads from stdin
+      // Colors are read if the file has them; normals are computed if it doesn't
       bool loadPLY(const std::string& filename);
 
+      // Initialize this object from a stream, such as a pipe
+      // filename is only used for error messages
+      bool loadPLY(std::istream& file, const std::string& filename);
+
+      // Same as loadPLY, but while the vertices are read, preview is called
+      // after every quarter of them with at most previewPoints of the vertices
+      // read so far, evenly spaced in the file. The previews have no faces, and
+      // are only made for models with faces left to read.
+      bool loadPLY(const std::string& filename, const PreviewCallback& preview, int previewPoints = 1 << 16);
+      bool loadPLY(std::istream& file, const std::string& filename,
+         const PreviewCallback& preview, int previewPoints = 1 << 16);
+
       // load a specific .ply file that contains color information (instead of normals)
+      // Same as loadPLY, which now reads colors whenever they are present
       bool loadwithColor(const std::string& filename);
+      bool loadwithColor(std::istream& file, const std::string& filename);
 
       // Return the minimum point of the axis-aligned bounding box
       glm::vec3 getMinBounds() const;
@@ -32,21 +62,59 @@ namespace agl {
       // Positions in this model
       float* positions() const;
 
-      // Normals in this model
+      // Normals in this model, 0 if there are none
       float* normals() const;
 
-      // Colors in this model
+      // Colors in this model, 0 if there are none
       float* colors() const;
 
+      // Return true if this model has normals
+      bool hasNormals() const { return _normals != 0; }
+
+      // Return true if this model has per-vertex colors
+      bool hasColors() const { return _colors != 0; }
+
       // Return number of faces in this model
       int numTriangles() const;
 
       // face indices in this model
       unsigned int* indices() const;
 
+      // Return the bytes of memory this mesh owns, including the object itself.
+      // Meshes using external data (see setExternalData) own none of their arrays.
+      size_t memoryFootprint() const;
+
+      // Allocate room for the given counts in one block, discarding the current data.
+      // Arrays for normals and colors exist only if requested.
+      // Returns false, leaving the mesh empty, if there is not enough memory.
+      bool allocate(int numVertices, int numTriangles, bool withNormals, bool withColors);
+
+      // Use arrays owned by someone else, such as a memory mapped model pack.
+      // The arrays must outlive this mesh (or the next clear) and are never freed here.
+      // normals and colors may be 0 if the model has none.
+      void setExternalData(int numVertices, int numTriangles,
+         float* positions, float* normals, float* colors, unsigned int* indices,
+         const glm::vec3& minBounds, const glm::vec3& maxBounds);
+
+      // Transform the positions by matrix and the normals by its inverse
+      // transpose, renormalized, with the kernels of meshtransform.h; then
+      // recompute the bounds. Meshes using external data first copy it.
+      // Returns false, leaving the mesh unchanged, if the copy cannot be allocated.
+      bool transform(const glm::mat4& matrix, int numThreads = 0);
+
+      // Blocks of at least this many bytes are backed by huge pages where the
+      // OS supports it (Linux transparent huge pages). 0 disables huge pages.
+      static void setHugePageThreshold(size_t bytes);
+
       // free all memories for member variables
       void clear();
 
+   protected:
+      bool copyFrom(const Mesh& orig);
+      void makePreview(int numRead, int maxPoints, bool withNormals, Mesh& preview) const;
+      void computeBounds();
+      void computeNormals();
+
    protected:
       int v; // number of vertices
       int f; // number of faces/polygons
@@ -56,6 +124,9 @@ namespace agl {
       unsigned int* _faces; // list of faces
       glm::vec3 minpos; // minimum values of x, y, and z
       glm::vec3 maxpos; // maximum values of x, y, and z
+      unsigned char* _block; // the single allocation holding every array, 0 if not owned
+      size_t _blockSize; // bytes reserved for _block
+      bool _hugePages; // true if _block was mapped for huge pages
    };
 }
 
@@ -0,0 +1,311 @@
+// Haverford College, Jiajie Ma, 2021
+#include "meshbuffer.h"
+#include "profiler.h"
+#include "uniforms.h"
+
+using namespace std;
+using namespace agl;
+
+RangeAllocator::RangeAllocator() : myCapacity(0), myUsed(0)
+{
+}
+
+void RangeAllocator::reset(size_t capacity)
+{
+   myFree.clear();
+   myCapacity = capacity;
+   myUsed = 0;
+   if (capacity > 0)
+   {
+      myFree[0] = capacity;
+   }
+}
+
+size_t RangeAllocator::allocate(size_t size)
+{
+   if (size == 0) return npos;
+   for (std::map<size_t, size_t>::iterator it = myFree.begin(); it != myFree.end(); ++it)
+   {
+      if (it->second < size) continue;
+
+      size_t offset = it->first;
+      size_t left = it->second - size;
+      myFree.erase(it);
+      if (left > 0)
+      {
+         myFree[offset + size] = left;
+      }
+      myUsed += size;
+      return offset;
+   }
+   return npos;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+   if (size == 0) return;
+   myUsed -= size;
+
+   // merge with the free range after, then the one before
+   std::map<size_t, size_t>::iterator next = myFree.lower_bound(offset);
+   if (next != myFree.end() && offset + size == next->first)
+   {
+      size += next->second;
+      next = myFree.erase(next);
+   }
+   if (next != myFree.begin())
+   {
+      std::map<size_t, size_t>::iterator prev = next;
+      --prev;
+      if (prev->first + prev->second == offset)
+      {
+         prev->second += size;
+         return;
+      }
+   }
+   myFree[offset] = size;
+}
+
+size_t RangeAllocator::largestFree() const
+{
+   size_t largest = 0;
+   for (std::map<size_t, size_t>::const_iterator it = myFree.begin(); it != myFree.end(); ++it)
+   {
+      largest = std::max(largest, it->second);
+   }
+   return largest;
+}
+
+static float Fragmentation(size_t capacity, size_t used, size_t largestFree)
+{
+   size_t free = capacity - used;
+   if (free == 0) return 0.0f;
+   return 1.0f - (float) largestFree / (float) free;
+}
+
+float MeshBufferStats::vertexFragmentation() const
+{
+   return Fragmentation(vertexCapacity, vertexUsed, vertexLargestFree);
+}
+
+float MeshBufferStats::indexFragmentation() const
+{
+   return Fragmentation(indexCapacity, indexUsed, indexLargestFree);
+}
+
+MeshBuffer::MeshBuffer() :
+   myElements(0), myImmutable(false), myDrawCount(0), myBytesUploaded(0), myEvictions(0)
+{
+   myBuffers[0] = myBuffers[1] = myBuffers[2] = 0;
+}
+
+MeshBuffer::~MeshBuffer()
+{
+   release();
+}
+
+bool MeshBuffer::create(size_t maxVertices, size_t maxIndices)
+{
+   release();
+
+#ifdef APPLE
+   myImmutable = false; // macOS stops at GL 4.1
+#else
+   myImmutable = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+
+   glGenBuffers(3, myBuffers);
+   glGenBuffers(1, &myElements);
+
+   GLsizeiptr vertexBytes = (GLsizeiptr) (maxVertices * 3 * sizeof(float));
+   GLsizeiptr indexBytes = (GLsizeiptr) (maxIndices * sizeof(unsigned int));
+   for (int i = 0; i < 4; i++)
+   {
+      // GL_COPY_WRITE_BUFFER leaves the bindings of the current vertex array alone
+      glBindBuffer(GL_COPY_WRITE_BUFFER, i < 3 ? myBuffers[i] : myElements);
+      GLsizeiptr bytes = i < 3 ? vertexBytes : indexBytes;
+      if (myImmutable)
+      {
+         // written only by glBufferSubData when a mesh is added
+         glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_DYNAMIC_STORAGE_BIT);
+      }
+      else
+      {
+         glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+      }
+   }
+
+   if (glGetError() == GL_OUT_OF_MEMORY)
+   {
+      std::cout << "Cannot allocate " << (vertexBytes * 3 + indexBytes) / (1024 * 1024)
+         << " MB of buffers" << std::endl;
+      release();
+      return false;
+   }
+
+   myVertices.reset(maxVertices);
+   myIndices.reset(maxIndices);
+   return true;
+}
+
+void MeshBuffer::release()
+{
+   if (myElements)
+   {
+      glDeleteBuffers(3, myBuffers);
+      glDeleteBuffers(1, &myElements);
+      myBuffers[0] = myBuffers[1] = myBuffers[2] = 0;
+      myElements = 0;
+   }
+   mySlots.clear();
+   myVertices.reset(0);
+   myIndices.reset(0);
+   myBytesUploaded = 0;
+   myEvictions = 0;
+}
+
+bool MeshBuffer::add(int key, const Mesh& mesh)
+{
+   // tryAdd fails on these no matter how much is evicted
+   if (!myElements || mesh.numVertices() == 0 || mesh.numTriangles() == 0 ||
+      (size_t) mesh.numVertices() > myVertices.capacity() ||
+      (size_t) mesh.numTriangles() * 3 > myIndices.capacity())
+   {
+      return false;
+   }
+
+   remove(key);
+   while (!tryAdd(key, mesh))
+   {
+      if (!evictOldest()) return false;
+   }
+   return true;
+}
+
+bool MeshBuffer::tryAdd(int key, const Mesh& mesh)
+{
+   if (!myElements || mesh.numVertices() == 0) return false;
+   remove(key);
+
+   size_t numVertices = mesh.numVertices();
+   size_t numIndices = (size_t) mesh.numTriangles() * 3;
+   size_t firstVertex = myVertices.allocate(numVertices);
+   if (firstVertex == RangeAllocator::npos) return false;
+   size_t firstIndex = myIndices.allocate(numIndices);
+   if (firstIndex == RangeAllocator::npos)
+   {
+      myVertices.free(firstVertex, numVertices);
+      return false;
+   }
+
+   MeshSlot slot;
+   slot.firstVertex = firstVertex;
+   slot.numVertices = numVertices;
+   slot.firstIndex = firstIndex;
+   slot.numIndices = numIndices;
+   slot.streams = PositionStream;
+   slot.minBounds = mesh.getMinBounds();
+   slot.maxBounds = mesh.getMaxBounds();
+   slot.lastDraw = myDrawCount;
+
+   // indices stay relative to the mesh; the draw adds firstVertex
+   const float* data[3] = {mesh.positions(), mesh.normals(), mesh.colors()};
+   GLintptr vertexOffset = (GLintptr) (firstVertex * 3 * sizeof(float));
+   GLsizeiptr vertexBytes = (GLsizeiptr) (numVertices * 3 * sizeof(float));
+   for (int i = 0; i < 3; i++)
+   {
+      if (!data[i]) continue;
+      glBindBuffer(GL_COPY_WRITE_BUFFER, myBuffers[i]);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, vertexOffset, vertexBytes, data[i]);
+      slot.streams |= 1u << i;
+      myBytesUploaded += vertexBytes;
+      ProfileCount(BytesUploaded, vertexBytes);
+   }
+
+   GLsizeiptr indexBytes = (GLsizeiptr) (numIndices * sizeof(unsigned int));
+   glBindBuffer(GL_COPY_WRITE_BUFFER, myElements);
+   glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) (firstIndex * sizeof(unsigned int)),
+      indexBytes, mesh.indices());
+   myBytesUploaded += indexBytes;
+   ProfileCount(BytesUploaded, indexBytes);
+
+   mySlots[key] = slot;
+   return true;
+}
+
+void MeshBuffer::remove(int key)
+{
+   std::unordered_map<int, MeshSlot>::iterator it = mySlots.find(key);
+   if (it == mySlots.end()) return;
+
+   myVertices.free(it->second.firstVertex, it->second.numVertices);
+   myIndices.free(it->second.firstIndex, it->second.numIndices);
+   mySlots.erase(it);
+}
+
+const MeshSlot* MeshBuffer::find(int key) const
+{
+   std::unordered_map<int, MeshSlot>::const_iterator it = mySlots.find(key);
+   return it == mySlots.end() ? 0 : &it->second;
+}
+
+bool MeshBuffer::draw(int key)
+{
+   std::unordered_map<int, MeshSlot>::iterator it = mySlots.find(key);
+   if (it == mySlots.end()) return false;
+
+   MeshSlot& slot = it->second;
+   slot.lastDraw = ++myDrawCount;
+   glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei) slot.numIndices, GL_UNSIGNED_INT,
+      (void*) (slot.firstIndex * sizeof(unsigned int)), (GLint) slot.firstVertex);
+   ProfileCount(DrawCalls, 1);
+   ProfileCount(TrianglesSubmitted, (long long) slot.numIndices / 3);
+   return true;
+}
+
+bool MeshBuffer::evictOldest()
+{
+   std::unordered_map<int, MeshSlot>::iterator oldest = mySlots.end();
+   for (std::unordered_map<int, MeshSlot>::iterator it = mySlots.begin(); it != mySlots.end(); ++it)
+   {
+      if (oldest == mySlots.end() || it->second.lastDraw < oldest->second.lastDraw)
+      {
+         oldest = it;
+      }
+   }
+   if (oldest == mySlots.end()) return false;
+
+   remove(oldest->first);
+   myEvictions++;
+   return true;
+}
+
+MeshBufferStats MeshBuffer::stats() const
+{
+   MeshBufferStats stats;
+   stats.numMeshes = (int) mySlots.size();
+   stats.vertexCapacity = myVertices.capacity();
+   stats.vertexUsed = myVertices.used();
+   stats.vertexLargestFree = myVertices.largestFree();
+   stats.vertexFreeRanges = myVertices.numFreeRanges();
+   stats.indexCapacity = myIndices.capacity();
+   stats.indexUsed = myIndices.used();
+   stats.indexLargestFree = myIndices.largestFree();
+   stats.indexFreeRanges = myIndices.numFreeRanges();
+   stats.bytesUploaded = myBytesUploaded;
+   stats.evictions = myEvictions;
+   return stats;
+}
+
+void MeshBuffer::printStats(std::ostream& out) const
+{
+   MeshBufferStats s = stats();
+   out << "Mesh buffer: " << s.numMeshes << " meshes, " << s.bytesUploaded / (1024.0 * 1024.0)
+      << " MB uploaded, " << s.evictions << " evictions" << (myImmutable ? "" : " (mutable storage)") << "\n";
+   out << "  vertices: " << s.vertexUsed << " / " << s.vertexCapacity << " used ("
+      << (s.vertexCapacity ? 100.0 * s.vertexUsed / s.vertexCapacity : 0.0) << "%), "
+      << s.vertexFreeRanges << " free ranges, fragmentation " << 100.0f * s.vertexFragmentation() << "%\n";
+   out << "  indices:  " << s.indexUsed << " / " << s.indexCapacity << " used ("
+      << (s.indexCapacity ? 100.0 * s.indexUsed / s.indexCapacity : 0.0) << "%), "
+      << s.indexFreeRanges << " free ranges, fragmentation " << 100.0f * s.indexFragmentation() << "%\n";
+}
@@ -0,0 +1,148 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef meshbuffer_H_
+#define meshbuffer_H_
+
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include "AGL.h"
+#include "AGLM.h"
+#include "mesh.h"
+
+namespace agl {
+
+   // Hands out ranges of a fixed capacity, first fit. Freed ranges are
+   // merged with their free neighbours.
+   class RangeAllocator
+   {
+   public:
+      RangeAllocator();
+
+      // Forget every range; the whole capacity is free
+      void reset(size_t capacity);
+
+      // Return the offset of a new range of size units, or npos if no free
+      // range is large enough
+      size_t allocate(size_t size);
+
+      // Return a range given by allocate
+      void free(size_t offset, size_t size);
+
+      size_t capacity() const { return myCapacity; }
+      size_t used() const { return myUsed; }
+      size_t largestFree() const;
+      int numFreeRanges() const { return (int) myFree.size(); }
+
+      static const size_t npos = (size_t) -1;
+
+   private:
+      std::map<size_t, size_t> myFree; // offset -> size
+      size_t myCapacity;
+      size_t myUsed;
+   };
+
+   // Where a mesh lives inside a MeshBuffer
+   struct MeshSlot
+   {
+      size_t firstVertex;   // added to every index when drawing
+      size_t numVertices;
+      size_t firstIndex;
+      size_t numIndices;
+      unsigned int streams; // VertexStream flags the mesh filled in
+      glm::vec3 minBounds;
+      glm::vec3 maxBounds;
+      unsigned long long lastDraw; // draw counter, for eviction
+   };
+
+   // Occupancy of a MeshBuffer
+   struct MeshBufferStats
+   {
+      int numMeshes;
+      size_t vertexCapacity;   // in vertices
+      size_t vertexUsed;
+      size_t vertexLargestFree;
+      int vertexFreeRanges;
+      size_t indexCapacity;    // in indices
+      size_t indexUsed;
+      size_t indexLargestFree;
+      int indexFreeRanges;
+      long long bytesUploaded; // since the buffer was created
+      int evictions;
+
+      // Share of the free space that is not in the largest free range, 0..1
+      float vertexFragmentation() const;
+      float indexFragmentation() const;
+   };
+
+   // Keeps many meshes on the GPU at once, in one buffer per vertex stream
+   // and one element buffer, all allocated once.
+   //
+   // Each mesh is uploaded once into its own ranges of these buffers.
+   // Drawing a mesh that is already resident only changes draw parameters:
+   // glDrawElementsBaseVertex with the mesh's first index and first vertex.
+   // When the buffers are full, the meshes drawn least recently are evicted
+   // to make room.
+   //
+   // Storage is immutable (glBufferStorage) where the driver supports it, and
+   // a single glBufferData otherwise.
+   class MeshBuffer
+   {
+   public:
+      MeshBuffer();
+      virtual ~MeshBuffer();
+
+      MeshBuffer(const MeshBuffer&) = delete;
+      MeshBuffer& operator=(const MeshBuffer&) = delete;
+
+      // Allocate room for maxVertices vertices (positions, normals and
+      // colors) and maxIndices indices. Returns true if successfull.
+      bool create(size_t maxVertices, size_t maxIndices);
+
+      // Delete the buffers and forget every mesh
+      void release();
+
+      // Upload mesh under key, evicting the least recently drawn meshes if
+      // needed. Returns false, without evicting, if the mesh has no triangles
+      // or can't fit even in an empty buffer.
+      bool add(int key, const Mesh& mesh);
+
+      // Like add, but never evicts. Returns false if there is no room.
+      bool tryAdd(int key, const Mesh& mesh);
+
+      // Free the ranges of the mesh under key
+      void remove(int key);
+
+      // Return the slot of the mesh under key, 0 if it isn't resident
+      const MeshSlot* find(int key) const;
+
+      // Draw the mesh under key with the current program and a vertex
+      // array reading the buffers below. Returns false if it isn't resident.
+      bool draw(int key);
+
+      GLuint positions() const { return myBuffers[0]; }
+      GLuint normals() const { return myBuffers[1]; }
+      GLuint colors() const { return myBuffers[2]; }
+      GLuint elements() const { return myElements; }
+      bool isImmutable() const { return myImmutable; }
+
+      MeshBufferStats stats() const;
+      void printStats(std::ostream& out) const;
+
+   private:
+      bool evictOldest();
+
+   private:
+      GLuint myBuffers[3];
+      GLuint myElements;
+      bool myImmutable;
+      RangeAllocator myVertices;
+      RangeAllocator myIndices;
+      std::unordered_map<int, MeshSlot> mySlots;
+      unsigned long long myDrawCount;
+      long long myBytesUploaded;
+      int myEvictions;
+   };
+}
+
+#endif
@@ -0,0 +1,678 @@
+// Haverford College, Jiajie Ma, 2021
+#include "meshtransform.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_TRANSFORM_SSE
+#include <emmintrin.h>
+#endif
+
+// AVX2 and AVX-512 kernels are built for their targets alone and only run
+// where the CPU has them
+#if defined(AGL_TRANSFORM_SSE) && (defined(__GNUC__) || defined(_MSC_VER))
+#define AGL_TRANSFORM_AVX
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define AGL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define AGL_TARGET(isa)
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Vertices transformed by each parallel task
+static const size_t ParallelVertices = 1 << 16;
+
+namespace {
+
+   // The transform of a span of vertices
+   struct Job
+   {
+      const float* in[3];  // x, y and z; interleaved ones start at in[0]
+      float* out[3];
+      bool interleaved;
+      bool divide;         // by w
+      bool normalize;
+      float m[16];         // columns, as in glm; normals have no translation
+   };
+
+   typedef void (*Kernel)(const Job& job, size_t begin, size_t end);
+
+   void ScalarKernel(const Job& job, size_t begin, size_t end)
+   {
+      const float* m = job.m;
+      for (size_t i = begin; i < end; i++)
+      {
+         float x, y, z;
+         if (job.interleaved)
+         {
+            x = job.in[0][3 * i];
+            y = job.in[0][3 * i + 1];
+            z = job.in[0][3 * i + 2];
+         }
+         else
+         {
+            x = job.in[0][i];
+            y = job.in[1][i];
+            z = job.in[2][i];
+         }
+         float ox = m[0] * x + m[4] * y + m[8] * z + m[12];
+         float oy = m[1] * x + m[5] * y + m[9] * z + m[13];
+         float oz = m[2] * x + m[6] * y + m[10] * z + m[14];
+         if (job.divide)
+         {
+            float inverse = 1.0f / (m[3] * x + m[7] * y + m[11] * z + m[15]);
+            ox *= inverse;
+            oy *= inverse;
+            oz *= inverse;
+         }
+         if (job.normalize)
+         {
+            float inverse = 1.0f / std::sqrt(std::max(ox * ox + oy * oy + oz * oz, FLT_MIN));
+            ox *= inverse;
+            oy *= inverse;
+            oz *= inverse;
+         }
+         if (job.interleaved)
+         {
+            job.out[0][3 * i] = ox;
+            job.out[0][3 * i + 1] = oy;
+            job.out[0][3 * i + 2] = oz;
+         }
+         else
+         {
+            job.out[0][i] = ox;
+            job.out[1][i] = oy;
+            job.out[2][i] = oz;
+         }
+      }
+   }
+
+#ifdef AGL_TRANSFORM_SSE
+   // Four interleaved points, x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3, to
+   // x, y and z. _mm256_shuffle_ps shuffles each 128 bits the same way, so
+   // the AVX2 kernel uses the same masks.
+   const int ShuffleT = _MM_SHUFFLE(2, 1, 3, 2); // b, c: x2 y2 x3 y3
+   const int ShuffleX = _MM_SHUFFLE(2, 0, 3, 0); // a, t
+   const int ShuffleU = _MM_SHUFFLE(1, 0, 2, 1); // a, b: y0 z0 y1 z1
+   const int ShuffleY = _MM_SHUFFLE(3, 1, 2, 0); // u, t
+   const int ShuffleZ = _MM_SHUFFLE(3, 0, 3, 1); // u, c
+
+   // And back, from x y pairs and z
+   const int ShuffleZX = _MM_SHUFFLE(2, 2, 0, 0); // z, xy01: z0 z0 x1 x1
+   const int ShuffleA = _MM_SHUFFLE(2, 0, 1, 0);  // xy01, zx
+   const int ShuffleYZ = _MM_SHUFFLE(1, 1, 3, 3); // xy01, z: y1 y1 z1 z1
+   const int ShuffleB = _MM_SHUFFLE(1, 0, 2, 0);  // yz, xy23
+   const int ShuffleZX3 = _MM_SHUFFLE(2, 2, 2, 2); // z, xy23: z2 z2 x3 x3
+   const int ShuffleYZ3 = _MM_SHUFFLE(3, 3, 3, 3); // xy23, z: y3 y3 z3 z3
+   const int ShuffleC = _MM_SHUFFLE(2, 0, 2, 0);  // zx3, yz3
+
+   inline void LoadPoints(const float* p, __m128& x, __m128& y, __m128& z)
+   {
+      __m128 a = _mm_loadu_ps(p);
+      __m128 b = _mm_loadu_ps(p + 4);
+      __m128 c = _mm_loadu_ps(p + 8);
+      __m128 t = _mm_shuffle_ps(b, c, ShuffleT);
+      __m128 u = _mm_shuffle_ps(a, b, ShuffleU);
+      x = _mm_shuffle_ps(a, t, ShuffleX);
+      y = _mm_shuffle_ps(u, t, ShuffleY);
+      z = _mm_shuffle_ps(u, c, ShuffleZ);
+   }
+
+   inline void StorePoints(float* p, __m128 x, __m128 y, __m128 z)
+   {
+      __m128 xy01 = _mm_unpacklo_ps(x, y);
+      __m128 xy23 = _mm_unpackhi_ps(x, y);
+      _mm_storeu_ps(p, _mm_shuffle_ps(xy01, _mm_shuffle_ps(z, xy01, ShuffleZX), ShuffleA));
+      _mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(xy01, z, ShuffleYZ), xy23, ShuffleB));
+      _mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, xy23, ShuffleZX3),
+         _mm_shuffle_ps(xy23, z, ShuffleYZ3), ShuffleC));
+   }
+
+   void SseKernel(const Job& job, size_t begin, size_t end)
+   {
+      __m128 c[16];
+      for (int k = 0; k < 16; k++) c[k] = _mm_set1_ps(job.m[k]);
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 tiny = _mm_set1_ps(FLT_MIN);
+      size_t i = begin;
+      for (; i + 4 <= end; i += 4)
+      {
+         __m128 x, y, z;
+         if (job.interleaved)
+         {
+            LoadPoints(job.in[0] + 3 * i, x, y, z);
+         }
+         else
+         {
+            x = _mm_loadu_ps(job.in[0] + i);
+            y = _mm_loadu_ps(job.in[1] + i);
+            z = _mm_loadu_ps(job.in[2] + i);
+         }
+
+         __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], x), _mm_mul_ps(c[4], y)), _mm_add_ps(_mm_mul_ps(c[8], z), c[12]));
+         __m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[1], x), _mm_mul_ps(c[5], y)), _mm_add_ps(_mm_mul_ps(c[9], z), c[13]));
+         __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[2], x), _mm_mul_ps(c[6], y)), _mm_add_ps(_mm_mul_ps(c[10], z), c[14]));
+         if (job.divide)
+         {
+            __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[3], x), _mm_mul_ps(c[7], y)), _mm_add_ps(_mm_mul_ps(c[11], z), c[15]));
+            __m128 inverse = _mm_div_ps(one, w);
+            ox = _mm_mul_ps(ox, inverse);
+            oy = _mm_mul_ps(oy, inverse);
+            oz = _mm_mul_ps(oz, inverse);
+         }
+         if (job.normalize)
+         {
+            __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz));
+            __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(length2, tiny)));
+            ox = _mm_mul_ps(ox, inverse);
+            oy = _mm_mul_ps(oy, inverse);
+            oz = _mm_mul_ps(oz, inverse);
+         }
+
+         if (job.interleaved)
+         {
+            StorePoints(job.out[0] + 3 * i, ox, oy, oz);
+         }
+         else
+         {
+            _mm_storeu_ps(job.out[0] + i, ox);
+            _mm_storeu_ps(job.out[1] + i, oy);
+            _mm_storeu_ps(job.out[2] + i, oz);
+         }
+      }
+      ScalarKernel(job, i, end);
+   }
+#endif
+
+#ifdef AGL_TRANSFORM_AVX
+   // Two groups of four points, one in each half
+   AGL_TARGET("avx2,fma")
+   inline void LoadPoints(const float* p, __m256& x, __m256& y, __m256& z)
+   {
+      __m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + 12), 1);
+      __m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 16), 1);
+      __m256 c = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 20), 1);
+      __m256 t = _mm256_shuffle_ps(b, c, ShuffleT);
+      __m256 u = _mm256_shuffle_ps(a, b, ShuffleU);
+      x = _mm256_shuffle_ps(a, t, ShuffleX);
+      y = _mm256_shuffle_ps(u, t, ShuffleY);
+      z = _mm256_shuffle_ps(u, c, ShuffleZ);
+   }
+
+   AGL_TARGET("avx2,fma")
+   inline void StorePoints(float* p, __m256 x, __m256 y, __m256 z)
+   {
+      __m256 xy01 = _mm256_unpacklo_ps(x, y);
+      __m256 xy23 = _mm256_unpackhi_ps(x, y);
+      __m256 a = _mm256_shuffle_ps(xy01, _mm256_shuffle_ps(z, xy01, ShuffleZX), ShuffleA);
+      __m256 b = _mm256_shuffle_ps(_mm256_shuffle_ps(xy01, z, ShuffleYZ), xy23, ShuffleB);
+      __m256 c = _mm256_shuffle_ps(_mm256_shuffle_ps(z, xy23, ShuffleZX3),
+         _mm256_shuffle_ps(xy23, z, ShuffleYZ3), ShuffleC);
+      _mm_storeu_ps(p, _mm256_castps256_ps128(a));
+      _mm_storeu_ps(p + 4, _mm256_castps256_ps128(b));
+      _mm_storeu_ps(p + 8, _mm256_castps256_ps128(c));
+      _mm_storeu_ps(p + 12, _mm256_extractf128_ps(a, 1));
+      _mm_storeu_ps(p + 16, _mm256_extractf128_ps(b, 1));
+      _mm_storeu_ps(p + 20, _mm256_extractf128_ps(c, 1));
+   }
+
+   AGL_TARGET("avx2,fma")
+   void Avx2Kernel(const Job& job, size_t begin, size_t end)
+   {
+      __m256 c[16];
+      for (int k = 0; k < 16; k++) c[k] = _mm256_set1_ps(job.m[k]);
+      const __m256 one = _mm256_set1_ps(1.0f);
+      const __m256 tiny = _mm256_set1_ps(FLT_MIN);
+      size_t i = begin;
+      for (; i + 8 <= end; i += 8)
+      {
+         __m256 x, y, z;
+         if (job.interleaved)
+         {
+            LoadPoints(job.in[0] + 3 * i, x, y, z);
+         }
+         else
+         {
+            x = _mm256_loadu_ps(job.in[0] + i);
+            y = _mm256_loadu_ps(job.in[1] + i);
+            z = _mm256_loadu_ps(job.in[2] + i);
+         }
+
+         __m256 ox = _mm256_fmadd_ps(c[0], x, _mm256_fmadd_ps(c[4], y, _mm256_fmadd_ps(c[8], z, c[12])));
+         __m256 oy = _mm256_fmadd_ps(c[1], x, _mm256_fmadd_ps(c[5], y, _mm256_fmadd_ps(c[9], z, c[13])));
+         __m256 oz = _mm256_fmadd_ps(c[2], x, _mm256_fmadd_ps(c[6], y, _mm256_fmadd_ps(c[10], z, c[14])));
+         if (job.divide)
+         {
+            __m256 w = _mm256_fmadd_ps(c[3], x, _mm256_fmadd_ps(c[7], y, _mm256_fmadd_ps(c[11], z, c[15])));
+            __m256 inverse = _mm256_div_ps(one, w);
+            ox = _mm256_mul_ps(ox, inverse);
+            oy = _mm256_mul_ps(oy, inverse);
+            oz = _mm256_mul_ps(oz, inverse);
+         }
+         if (job.normalize)
+         {
+            __m256 length2 = _mm256_fmadd_ps(ox, ox, _mm256_fmadd_ps(oy, oy, _mm256_mul_ps(oz, oz)));
+            __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(length2, tiny)));
+            ox = _mm256_mul_ps(ox, inverse);
+            oy = _mm256_mul_ps(oy, inverse);
+            oz = _mm256_mul_ps(oz, inverse);
+         }
+
+         if (job.interleaved)
+         {
+            StorePoints(job.out[0] + 3 * i, ox, oy, oz);
+         }
+         else
+         {
+            _mm256_storeu_ps(job.out[0] + i, ox);
+            _mm256_storeu_ps(job.out[1] + i, oy);
+            _mm256_storeu_ps(job.out[2] + i, oz);
+         }
+      }
+      SseKernel(job, i, end);
+   }
+
+   AGL_TARGET("avx512f")
+   void Avx512Kernel(const Job& job, size_t begin, size_t end)
+   {
+      __m512 c[16];
+      for (int k = 0; k < 16; k++) c[k] = _mm512_set1_ps(job.m[k]);
+      const __m512 one = _mm512_set1_ps(1.0f);
+      const __m512 tiny = _mm512_set1_ps(FLT_MIN);
+
+      // 16 points are three vectors; each coordinate is picked from the
+      // first two, then the third, and each vector back from x and y, then z
+      __m512i gather[3][2], scatter[3][2];
+      for (int k = 0; k < 3; k++)
+      {
+         int first[16], second[16], pairs[16], third[16];
+         for (int lane = 0; lane < 16; lane++)
+         {
+            int from = 3 * lane + k;
+            first[lane] = from < 32 ? from : 0;
+            second[lane] = from < 32 ? lane : from - 16;
+            int to = 16 * k + lane;
+            pairs[lane] = to % 3 == 0 ? to / 3 : 16 + to / 3;
+            third[lane] = to % 3 == 2 ? 16 + to / 3 : lane;
+         }
+         gather[k][0] = _mm512_loadu_si512(first);
+         gather[k][1] = _mm512_loadu_si512(second);
+         scatter[k][0] = _mm512_loadu_si512(pairs);
+         scatter[k][1] = _mm512_loadu_si512(third);
+      }
+
+      size_t i = begin;
+      for (; i + 16 <= end; i += 16)
+      {
+         __m512 x, y, z;
+         if (job.interleaved)
+         {
+            const float* p = job.in[0] + 3 * i;
+            __m512 a = _mm512_loadu_ps(p);
+            __m512 b = _mm512_loadu_ps(p + 16);
+            __m512 cc = _mm512_loadu_ps(p + 32);
+            x = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, gather[0][0], b), gather[0][1], cc);
+            y = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, gather[1][0], b), gather[1][1], cc);
+            z = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, gather[2][0], b), gather[2][1], cc);
+         }
+         else
+         {
+            x = _mm512_loadu_ps(job.in[0] + i);
+            y = _mm512_loadu_ps(job.in[1] + i);
+            z = _mm512_loadu_ps(job.in[2] + i);
+         }
+
+         __m512 ox = _mm512_fmadd_ps(c[0], x, _mm512_fmadd_ps(c[4], y, _mm512_fmadd_ps(c[8], z, c[12])));
+         __m512 oy = _mm512_fmadd_ps(c[1], x, _mm512_fmadd_ps(c[5], y, _mm512_fmadd_ps(c[9], z, c[13])));
+         __m512 oz = _mm512_fmadd_ps(c[2], x, _mm512_fmadd_ps(c[6], y, _mm512_fmadd_ps(c[10], z, c[14])));
+         if (job.divide)
+         {
+            __m512 w = _mm512_fmadd_ps(c[3], x, _mm512_fmadd_ps(c[7], y, _mm512_fmadd_ps(c[11], z, c[15])));
+            __m512 inverse = _mm512_div_ps(one, w);
+            ox = _mm512_mul_ps(ox, inverse);
+            oy = _mm512_mul_ps(oy, inverse);
+            oz = _mm512_mul_ps(oz, inverse);
+         }
+         if (job.normalize)
+         {
+            __m512 length2 = _mm512_fmadd_ps(ox, ox, _mm512_fmadd_ps(oy, oy, _mm512_mul_ps(oz, oz)));
+            __m512 inverse = _mm512_div_ps(one, _mm512_sqrt_ps(_mm512_max_ps(length2, tiny)));
+            ox = _mm512_mul_ps(ox, inverse);
+            oy = _mm512_mul_ps(oy, inverse);
+            oz = _mm512_mul_ps(oz, inverse);
+         }
+
+         if (job.interleaved)
+         {
+            float* p = job.out[0] + 3 * i;
+            for (int k = 0; k < 3; k++)
+            {
+               __m512 v = _mm512_permutex2var_ps(_mm512_permutex2var_ps(ox, scatter[k][0], oy), scatter[k][1], oz);
+               _mm512_storeu_ps(p + 16 * k, v);
+            }
+         }
+         else
+         {
+            _mm512_storeu_ps(job.out[0] + i, ox);
+            _mm512_storeu_ps(job.out[1] + i, oy);
+            _mm512_storeu_ps(job.out[2] + i, oz);
+         }
+      }
+      Avx2Kernel(job, i, end);
+   }
+#endif
+
+   // The boxes of a span, as min and max corners
+   struct BoundsJob
+   {
+      const float* mins;
+      const float* maxs;
+      float* outMins;
+      float* outMaxs;
+      float m[16];
+   };
+
+   typedef void (*BoundsKernel)(const BoundsJob& job, size_t begin, size_t end);
+
+   void ScalarBoundsKernel(const BoundsJob& job, size_t begin, size_t end)
+   {
+      const float* m = job.m;
+      for (size_t i = begin; i < end; i++)
+      {
+         float low[3] = {m[12], m[13], m[14]};
+         float high[3] = {m[12], m[13], m[14]};
+         for (int col = 0; col < 3; col++)
+         {
+            float min = job.mins[3 * i + col];
+            float max = job.maxs[3 * i + col];
+            for (int row = 0; row < 3; row++)
+            {
+               float a = m[4 * col + row] * min;
+               float b = m[4 * col + row] * max;
+               low[row] += std::min(a, b);
+               high[row] += std::max(a, b);
+            }
+         }
+         for (int k = 0; k < 3; k++)
+         {
+            job.outMins[3 * i + k] = low[k];
+            job.outMaxs[3 * i + k] = high[k];
+         }
+      }
+   }
+
+#ifdef AGL_TRANSFORM_SSE
+   // The same on the x, y and z of four boxes at a time; the sums run in
+   // the same order, so every level gives the same boxes
+   void SseBoundsKernel(const BoundsJob& job, size_t begin, size_t end)
+   {
+      __m128 c[16];
+      for (int k = 0; k < 16; k++) c[k] = _mm_set1_ps(job.m[k]);
+      size_t i = begin;
+      for (; i + 4 <= end; i += 4)
+      {
+         __m128 mins[3], maxs[3], low[3], high[3];
+         LoadPoints(job.mins + 3 * i, mins[0], mins[1], mins[2]);
+         LoadPoints(job.maxs + 3 * i, maxs[0], maxs[1], maxs[2]);
+         for (int row = 0; row < 3; row++)
+         {
+            low[row] = high[row] = c[12 + row];
+            for (int col = 0; col < 3; col++)
+            {
+               __m128 a = _mm_mul_ps(c[4 * col + row], mins[col]);
+               __m128 b = _mm_mul_ps(c[4 * col + row], maxs[col]);
+               low[row] = _mm_add_ps(low[row], _mm_min_ps(a, b));
+               high[row] = _mm_add_ps(high[row], _mm_max_ps(a, b));
+            }
+         }
+         StorePoints(job.outMins + 3 * i, low[0], low[1], low[2]);
+         StorePoints(job.outMaxs + 3 * i, high[0], high[1], high[2]);
+      }
+      ScalarBoundsKernel(job, i, end);
+   }
+#endif
+
+#ifdef AGL_TRANSFORM_AVX
+   // Eight boxes at a time, without fused multiply-adds to match the others.
+   // AVX-512 uses this one too: loading 16 boxes costs about what it saves.
+   AGL_TARGET("avx2,fma")
+   void Avx2BoundsKernel(const BoundsJob& job, size_t begin, size_t end)
+   {
+      __m256 c[16];
+      for (int k = 0; k < 16; k++) c[k] = _mm256_set1_ps(job.m[k]);
+      size_t i = begin;
+      for (; i + 8 <= end; i += 8)
+      {
+         __m256 mins[3], maxs[3], low[3], high[3];
+         LoadPoints(job.mins + 3 * i, mins[0], mins[1], mins[2]);
+         LoadPoints(job.maxs + 3 * i, maxs[0], maxs[1], maxs[2]);
+         for (int row = 0; row < 3; row++)
+         {
+            low[row] = high[row] = c[12 + row];
+            for (int col = 0; col < 3; col++)
+            {
+               __m256 a = _mm256_mul_ps(c[4 * col + row], mins[col]);
+               __m256 b = _mm256_mul_ps(c[4 * col + row], maxs[col]);
+               low[row] = _mm256_add_ps(low[row], _mm256_min_ps(a, b));
+               high[row] = _mm256_add_ps(high[row], _mm256_max_ps(a, b));
+            }
+         }
+         StorePoints(job.outMins + 3 * i, low[0], low[1], low[2]);
+         StorePoints(job.outMaxs + 3 * i, high[0], high[1], high[2]);
+      }
+      SseBoundsKernel(job, i, end);
+   }
+#endif
+
+   SimdLevel Detect()
+   {
+#if defined(AGL_TRANSFORM_AVX) && defined(__GNUC__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) return Avx512Simd;
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Avx2Simd;
+#elif defined(AGL_TRANSFORM_AVX)
+      // the CPU must have the instructions and the OS must save the registers
+      int info[4];
+      __cpuid(info, 0);
+      int maxLeaf = info[0];
+      __cpuid(info, 1);
+      bool osSaves = (info[2] >> 27) & 1;
+      bool fma = (info[2] >> 12) & 1;
+      if (maxLeaf >= 7 && osSaves)
+      {
+         unsigned long long xcr0 = _xgetbv(0);
+         __cpuidex(info, 7, 0);
+         if (((info[1] >> 16) & 1) && (xcr0 & 0xE6) == 0xE6) return Avx512Simd;
+         if (((info[1] >> 5) & 1) && fma && (xcr0 & 0x6) == 0x6) return Avx2Simd;
+      }
+#endif
+#ifdef AGL_TRANSFORM_SSE
+      return SseSimd;
+#else
+      return ScalarSimd;
+#endif
+   }
+
+   std::atomic<int> theLevel(-1);
+
+   Kernel KernelFor(SimdLevel level)
+   {
+      switch (level)
+      {
+#ifdef AGL_TRANSFORM_AVX
+      case Avx512Simd: return Avx512Kernel;
+      case Avx2Simd: return Avx2Kernel;
+#endif
+#ifdef AGL_TRANSFORM_SSE
+      case SseSimd: return SseKernel;
+#endif
+      default: return ScalarKernel;
+      }
+   }
+
+   BoundsKernel BoundsKernelFor(SimdLevel level)
+   {
+      switch (level)
+      {
+#ifdef AGL_TRANSFORM_AVX
+      case Avx512Simd:
+      case Avx2Simd: return Avx2BoundsKernel;
+#endif
+#ifdef AGL_TRANSFORM_SSE
+      case SseSimd: return SseBoundsKernel;
+#endif
+      default: return ScalarBoundsKernel;
+      }
+   }
+
+   void Run(const Job& job, size_t count, int numThreads)
+   {
+      Kernel kernel = KernelFor(TransformSimdLevel());
+      if (count < 2 * ParallelVertices || numThreads == 1)
+      {
+         kernel(job, 0, count);
+         return;
+      }
+      int numChunks = (int) ((count + ParallelVertices - 1) / ParallelVertices);
+      ParallelFor(0, numChunks, [&](int chunk)
+      {
+         size_t first = chunk * ParallelVertices;
+         kernel(job, first, std::min(first + ParallelVertices, count));
+      }, numThreads);
+   }
+
+   Job MakeJob(const glm::mat4& matrix, bool divide, bool normalize)
+   {
+      Job job;
+      for (int col = 0; col < 4; col++)
+      {
+         for (int row = 0; row < 4; row++) job.m[4 * col + row] = matrix[col][row];
+      }
+      job.divide = divide;
+      job.normalize = normalize;
+      return job;
+   }
+}
+
+SimdLevel agl::DetectSimdLevel()
+{
+   static const SimdLevel level = Detect();
+   return level;
+}
+
+SimdLevel agl::TransformSimdLevel()
+{
+   int level = theLevel.load();
+   return level < 0 ? DetectSimdLevel() : (SimdLevel) level;
+}
+
+void agl::SetTransformSimdLevel(SimdLevel level)
+{
+   theLevel = (int) std::min(level, DetectSimdLevel());
+}
+
+const char* agl::SimdLevelName(SimdLevel level)
+{
+   static const char* names[] = {"scalar", "SSE", "AVX2", "AVX-512"};
+   return names[level];
+}
+
+void agl::TransformPoints(const glm::mat4& matrix, const float* in, float* out, size_t count,
+   bool divide, int numThreads)
+{
+   Job job = MakeJob(matrix, divide, false);
+   job.interleaved = true;
+   job.in[0] = in;
+   job.out[0] = out;
+   Run(job, count, numThreads);
+}
+
+void agl::TransformPoints(const glm::mat4& matrix, const float* inX, const float* inY, const float* inZ,
+   float* outX, float* outY, float* outZ, size_t count, bool divide, int numThreads)
+{
+   Job job = MakeJob(matrix, divide, false);
+   job.interleaved = false;
+   job.in[0] = inX;
+   job.in[1] = inY;
+   job.in[2] = inZ;
+   job.out[0] = outX;
+   job.out[1] = outY;
+   job.out[2] = outZ;
+   Run(job, count, numThreads);
+}
+
+void agl::TransformNormals(const glm::mat3& matrix, const float* in, float* out, size_t count,
+   bool normalize, int numThreads)
+{
+   Job job = MakeJob(glm::mat4(matrix), false, normalize);
+   job.interleaved = true;
+   job.in[0] = in;
+   job.out[0] = out;
+   Run(job, count, numThreads);
+}
+
+void agl::TransformNormals(const glm::mat3& matrix, const float* inX, const float* inY, const float* inZ,
+   float* outX, float* outY, float* outZ, size_t count, bool normalize, int numThreads)
+{
+   Job job = MakeJob(glm::mat4(matrix), false, normalize);
+   job.interleaved = false;
+   job.in[0] = inX;
+   job.in[1] = inY;
+   job.in[2] = inZ;
+   job.out[0] = outX;
+   job.out[1] = outY;
+   job.out[2] = outZ;
+   Run(job, count, numThreads);
+}
+
+void agl::TransformBounds(const glm::mat4& matrix, const float* mins, const float* maxs,
+   float* outMins, float* outMaxs, size_t count, int numThreads)
+{
+   BoundsJob job;
+   Job transform = MakeJob(matrix, false, false);
+   std::copy(transform.m, transform.m + 16, job.m);
+   job.mins = mins;
+   job.maxs = maxs;
+   job.outMins = outMins;
+   job.outMaxs = outMaxs;
+
+   BoundsKernel kernel = BoundsKernelFor(TransformSimdLevel());
+   if (count < 2 * ParallelVertices || numThreads == 1)
+   {
+      kernel(job, 0, count);
+      return;
+   }
+   int numChunks = (int) ((count + ParallelVertices - 1) / ParallelVertices);
+   ParallelFor(0, numChunks, [&](int chunk)
+   {
+      size_t first = chunk * ParallelVertices;
+      kernel(job, first, std::min(first + ParallelVertices, count));
+   }, numThreads);
+}
+
+void agl::TransformBounds(const glm::mat4& matrix, const glm::vec3& min, const glm::vec3& max,
+   glm::vec3& outMin, glm::vec3& outMax)
+{
+   float low[3], high[3];
+   BoundsJob job;
+   Job transform = MakeJob(matrix, false, false);
+   std::copy(transform.m, transform.m + 16, job.m);
+   job.mins = &min[0];
+   job.maxs = &max[0];
+   job.outMins = low;
+   job.outMaxs = high;
+   ScalarBoundsKernel(job, 0, 1);
+   outMin = glm::vec3(low[0], low[1], low[2]);
+   outMax = glm::vec3(high[0], high[1], high[2]);
+}
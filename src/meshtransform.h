@@ -0,0 +1,69 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef meshtransform_H_
+#define meshtransform_H_
+
+#include <cstddef>
+#include "AGLM.h"
+
+namespace agl {
+
+   // Vector instruction sets, from least to most capable
+   enum SimdLevel
+   {
+      ScalarSimd,
+      SseSimd,   // 4 vertices at a time
+      Avx2Simd,  // 8, with fused multiply-adds
+      Avx512Simd // 16
+   };
+
+   // The best level both the CPU and the build support, checked once
+   SimdLevel DetectSimdLevel();
+
+   // The level the transforms use, DetectSimdLevel() unless lowered, such as
+   // to compare levels; levels above DetectSimdLevel() are lowered to it
+   SimdLevel TransformSimdLevel();
+   void SetTransformSimdLevel(SimdLevel level);
+
+   const char* SimdLevelName(SimdLevel level);
+
+   // Transform count points by matrix, as (x, y, z, 1). With divide, each is
+   // then divided by its w, as when projecting to normalized device
+   // coordinates. Points are x, y, z triples (AoS), as in Mesh::positions();
+   // out may be in.
+   //
+   // The kernel for TransformSimdLevel() is picked at run time, and AVX2 and
+   // AVX-512 are used even if the rest of the program is built for SSE
+   // only. Interleaved points are loaded a few vectors at a time and
+   // shuffled into separate x, y and z registers, and back. Arrays of more
+   // than 128K points are split across numThreads threads (<= 0 for all cores).
+   void TransformPoints(const glm::mat4& matrix, const float* in, float* out, size_t count,
+      bool divide = false, int numThreads = 0);
+
+   // The same with x, y and z in separate arrays (SoA)
+   void TransformPoints(const glm::mat4& matrix, const float* inX, const float* inY, const float* inZ,
+      float* outX, float* outY, float* outZ, size_t count, bool divide = false, int numThreads = 0);
+
+   // Transform count normals by matrix, usually the inverse transpose of the
+   // points' matrix (glm::inverseTranspose(glm::mat3(m))), and with
+   // normalize, scale them back to unit length. Zero normals stay zero.
+   void TransformNormals(const glm::mat3& matrix, const float* in, float* out, size_t count,
+      bool normalize = true, int numThreads = 0);
+
+   // The same with x, y and z in separate arrays (SoA)
+   void TransformNormals(const glm::mat3& matrix, const float* inX, const float* inY, const float* inZ,
+      float* outX, float* outY, float* outZ, size_t count, bool normalize = true, int numThreads = 0);
+
+   // The axis-aligned boxes around count boxes transformed by an affine
+   // matrix; the corners are x, y, z triples and out may be in. Each column
+   // of the matrix adds the smaller and the larger of its products with the
+   // corner's coordinates (Arvo, Graphics Gems), instead of transforming 8
+   // corners. Like the points, corners are shuffled into x, y and z
+   // registers, 4 or 8 boxes at a time, and arrays are split across threads.
+   void TransformBounds(const glm::mat4& matrix, const float* mins, const float* maxs,
+      float* outMins, float* outMaxs, size_t count, int numThreads = 0);
+
+   void TransformBounds(const glm::mat4& matrix, const glm::vec3& min, const glm::vec3& max,
+      glm::vec3& outMin, glm::vec3& outMax);
+}
+
+#endif
@@ -4,11 +4,29 @@
 #include "AGL.h"
 #include "AGLM.h"
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <vector>
+#include "capture.h"
+#include "catalog.h"
+#include "glcalls.h"
 #include "mesh.h"
+#include "meshbuffer.h"
+#include "modelpack.h"
 #include "osutils.h"
+#include "profiler.h"
+#include "shader.h"
+#include "rendermode.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "sharedstore.h"
+#include "tiledrenderer.h"
+#include "turntable.h"
+#include "uniforms.h"
+#include "uploader.h"
 
 using namespace std;
 using namespace glm;
@@ -16,22 +34,154 @@ using namespace agl;
 
 // globals
 Mesh theModel;
+ModelCatalog theCatalog;
+std::string theCatalogFile;      // where theCatalog was loaded from and is saved to
+ModelPack thePack;
+vector<int> thePackIds;          // pack entry of each model, -1 if it must be read from its file
+SharedMeshStore theStore;
 int theCurrentModel = 0;
 vector<string> theModelNames;
 const float cameraSpeed = 0.25f;
 float lastX, lastY, dist, azimuth, elevation;
 bool control = false, zoom = false;
 glm::vec3 lookfrom;
+int theBenchmarkFrames = 0;
+RenderModes theModes;
+int theRenderMode = 0;
+vector<glm::vec3> theModelColors; // diffuse colors for modes that pick one per model
+MeshBuffer theMeshBuffer;
+size_t theMeshBufferSize = 0; // in MB; 0 draws from per-model buffers
+Scene theScene;
+bool theGallery = false;       // --gallery: every resident model in a grid
+int theNumInstances = 0;       // --instances N: N copies of the first model
+bool theOcclusion = false;     // --occlusion: cull scene instances hidden behind nearer ones
+unsigned int theSceneStreams;  // vertex streams every model in the scene has
+MeshUploader theUploader;
+GLFWwindow* theUploadWindow = 0; // hidden; its context is shared with the main window
+int theShownModel = 0;         // the model on screen; lags theCurrentModel while uploading
+double theSwitchStart = 0;     // when the last model switch was requested
+double theLongestFrame = 0;    // longest frame since then, in seconds
+bool theSyncUpload = false;    // --sync-upload: load and upload on the render thread
+double thePreviewMs = -1;      // when the first preview of the last switch was drawn, -1 if none
+bool thePreviewPending = false; // a first preview was swapped in and is drawn this frame
+RenderScheduler theScheduler;  // draws only when something changed
+bool theContinuous = false;    // --continuous: draw every frame, as if animating
+std::string theTraceFile;      // --trace: where the profile goes; empty when not profiling
+GpuTimer theGpuTimer;          // times the draw on the GPU while profiling
+FrameCapture theCapture;       // saves frames without stalling the render loop
+double theCaptureFps = 30;     // --capture: frames per second saved by V
+int theScreenshots = 0;        // screenshots taken so far, for their names
+int theTurntableFrames = 0;    // --turntable N: save N views around each model, then exit
+int theTurntableWidth = 1024;  // size of the turntable frames
+int theTurntableHeight = 1024;
+int thePosterWidth = 0;        // --poster WxH: save one image this big a tile at a time, then exit
+int thePosterHeight = 0;
+std::string thePosterFile = "poster.png";
+
+// Models with files at least this big are shown as point clouds while they load
+static const long long PreviewBytes = 1 << 20;
 
 // OpenGL IDs
 GLuint theVboPosId;
 GLuint theVboNormalId;
+GLuint theVboColorId;
 GLuint theElementbuffer;
 
+static bool ReadModel(int modelId, Mesh& mesh,
+   const Mesh::PreviewCallback& preview = Mesh::PreviewCallback())
+{
+   AGL_PROFILE_SCOPE("ReadModel");
+
+   // small models load faster than a preview would help
+   int catalogId = theCatalog.find(theModelNames[modelId]);
+   Mesh::PreviewCallback coarse = (catalogId >= 0 &&
+      theCatalog.model(catalogId).fileSize >= PreviewBytes) ? preview : Mesh::PreviewCallback();
+
+   bool loaded;
+   if (thePackIds[modelId] >= 0)
+   {
+      // the pack is already decoded; only the pages of this model are read
+      loaded = thePack.get(thePackIds[modelId], mesh);
+   }
+   else if (theStore.isOpen())
+   {
+      // reuse the copy another viewer already decoded, or decode and share it
+      const std::string& name = theModelNames[modelId];
+      loaded = theStore.acquire(name, mesh, [&name, &coarse](Mesh& decoded)
+      {
+         return decoded.loadPLY(name, coarse);
+      });
+   }
+   else
+   {
+      loaded = mesh.loadPLY(theModelNames[modelId], coarse);
+   }
+   return loaded;
+}
+
+// Bounds are only known once the whole model has been read. The catalog is
+// only written on the render thread; the upload thread just looks models up.
+static void RecordBounds(int modelId, const Mesh& mesh)
+{
+   int catalogId = theCatalog.find(theModelNames[modelId]);
+   if (catalogId >= 0)
+   {
+      theCatalog.setBounds(catalogId, mesh.getMinBounds(), mesh.getMaxBounds());
+   }
+}
+
 static void LoadModel(int modelId)
 {
+   AGL_PROFILE_SCOPE("LoadModel");
    assert(modelId >= 0 && modelId < theModelNames.size());
-   theModel.loadPLY(theModelNames[theCurrentModel]);
+   if (theMeshBufferSize > 0)
+   {
+      // a resident model is drawn straight from the mesh buffer, without any upload
+      if (theMeshBuffer.find(modelId))
+      {
+         theShownModel = modelId;
+         return;
+      }
+
+      // the shown model stays if the new one can't be loaded
+      Mesh mesh;
+      if (!ReadModel(modelId, mesh))
+      {
+         cout << "Cannot load " << theModelNames[modelId] << endl;
+         return;
+      }
+      RecordBounds(modelId, mesh);
+      theModel = std::move(mesh);
+      theShownModel = modelId;
+      if (!theMeshBuffer.add(modelId, theModel))
+      {
+         cout << theModelNames[modelId] << " does not fit in the mesh buffer" << endl;
+      }
+      return;
+   }
+
+   if (theUploader.isRunning())
+   {
+      // the current model stays on screen until the new one is on the GPU
+      theSwitchStart = glfwGetTime();
+      theLongestFrame = 0;
+      thePreviewMs = -1;
+      theUploader.request(modelId, [modelId](Mesh& mesh, const Mesh::PreviewCallback& preview)
+      {
+         return ReadModel(modelId, mesh, preview);
+      });
+      return;
+   }
+
+   Mesh mesh;
+   if (!ReadModel(modelId, mesh))
+   {
+      cout << "Cannot load " << theModelNames[modelId] << endl;
+      return;
+   }
+   RecordBounds(modelId, mesh);
+   theModel = std::move(mesh);
+   theShownModel = modelId;
 
    glBindBuffer(GL_ARRAY_BUFFER, theVboPosId);
    glBufferData(GL_ARRAY_BUFFER, theModel.numVertices() * 3 * sizeof(float), theModel.positions(), GL_DYNAMIC_DRAW);
@@ -39,19 +189,29 @@ static void LoadModel(int modelId)
    glBindBuffer(GL_ARRAY_BUFFER, theVboNormalId);
    glBufferData(GL_ARRAY_BUFFER, theModel.numVertices() * 3 * sizeof(float), theModel.normals(), GL_DYNAMIC_DRAW);
 
+   // modes that read colors are not used for models without them
+   if (theModel.hasColors())
+   {
+      glBindBuffer(GL_ARRAY_BUFFER, theVboColorId);
+      glBufferData(GL_ARRAY_BUFFER, theModel.numVertices() * 3 * sizeof(float), theModel.colors(), GL_DYNAMIC_DRAW);
+   }
+
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theElementbuffer);
    glBufferData(GL_ELEMENT_ARRAY_BUFFER, theModel.numTriangles() * 3 * sizeof(unsigned int), theModel.indices(), GL_DYNAMIC_DRAW);
+   ProfileCount(BytesUploaded, (long long) theModel.numVertices() * (theModel.hasColors() ? 9 : 6) * sizeof(float) +
+      (long long) theModel.numTriangles() * 3 * sizeof(unsigned int));
 }
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
    if (action != GLFW_PRESS) return;
+   theScheduler.invalidate();
 
    if (key == GLFW_KEY_ESCAPE)
    {
       glfwSetWindowShouldClose(window, GLFW_TRUE);
    }
-   else if (key == 'P')
+   else if (key == 'P' && theScene.size() == 0)
    {
       if (--theCurrentModel < 0)
       {
@@ -63,7 +223,7 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
       elevation = 0;
       dist = 3.0f;
    }
-   else if (key == 'N')
+   else if (key == 'N' && theScene.size() == 0)
    {
       theCurrentModel = (theCurrentModel + 1) % theModelNames.size(); 
       cout << "Current file: " << theModelNames[theCurrentModel] << endl;
@@ -72,6 +232,45 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
       elevation = 0;
       dist = 3.0f;
    }
+   else if (key == 'M' && theMeshBufferSize > 0)
+   {
+      theMeshBuffer.printStats(cout);
+   }
+   else if (key == 'F')
+   {
+      theScheduler.printStats(cout);
+      theScheduler.resetStats();
+   }
+   else if (key == 'C')
+   {
+      char filename[32];
+      snprintf(filename, sizeof(filename), "screenshot-%03d.png", theScreenshots++);
+      theCapture.screenshot(filename);
+      cout << "Saving " << filename << endl;
+   }
+   else if (key == 'V')
+   {
+      if (theCapture.capturing())
+      {
+         theCapture.stop();
+         theCapture.printStats(cout);
+      }
+      else
+      {
+         theCapture.start("capture-", theCaptureFps);
+         cout << "Saving " << theCaptureFps << " frames per second as capture-NNNNN.png" << endl;
+      }
+   }
+   else if (key == 'T' && !theTraceFile.empty())
+   {
+      WriteChromeTrace(theTraceFile);
+   }
+   else if (key >= '1' && key < '1' + theModes.size())
+   {
+      // only the program and vertex array change; the model stays on the GPU
+      theRenderMode = key - '1';
+      cout << "Render mode: " << theModes.mode(theRenderMode).name << endl;
+   }
 }
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -81,6 +280,13 @@ static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	
    // Set Viewport to window dimensions
    glViewport(0, 0, width, height);
+   theScheduler.invalidate();
+}
+
+static void window_refresh_callback(GLFWwindow* window)
+{
+   // the window was uncovered or needs its contents again
+   theScheduler.invalidate();
 }
 
 static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -112,6 +318,7 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 {
    if (control)
    {
+      theScheduler.invalidate(); // the camera moves
       if (zoom){
          // zoom in/out with shift and cursor
          float distDelta = ypos - lastY;
@@ -148,91 +355,338 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
    lastY = ypos;
 }
 
-static void PrintShaderErrors(GLuint id, const std::string label)
+static void LoadModels(const std::string& dir)
 {
-   std::cerr << label << " failed\n";
-   GLint logLen;
-   glGetShaderiv(id, GL_INFO_LOG_LENGTH, &logLen);
-   if (logLen > 0)
+   // only new or changed files have their headers read
+   theCatalogFile = dir + "models.catalog";
+   theCatalog.load(theCatalogFile);
+   theCatalog.scan(dir);
+
+   // prefer a pack built by mesh-pack: one mapping instead of a file per model
+   std::map<std::string, int> packed;
+   if (thePack.open(dir + "models.pack"))
+   {
+      for (int i = 0; i < thePack.size(); i++)
+      {
+         packed[thePack.name(i)] = i;
+      }
+   }
+
+   int stale = 0;
+   for (int i = 0; i < theCatalog.size(); i++)
    {
-      char* log = (char*)malloc(logLen);
-      GLsizei written;
-      glGetShaderInfoLog(id, logLen, &written, log);
-      std::cerr << "Shader log: " << log << std::endl;
-      free(log);
+      const ModelInfo& info = theCatalog.model(i);
+      if (!info.valid) continue;
+
+      // entries packed from another version of the file are ignored
+      std::map<std::string, int>::iterator it = packed.find(info.path);
+      int packId = -1;
+      if (it != packed.end())
+      {
+         const PackEntry& e = thePack.entry(it->second);
+         if (e.sourceSize == info.fileSize && e.sourceModified == info.modified) packId = it->second;
+      }
+      if (thePack.isOpen() && packId < 0) stale++;
+
+      theModelNames.push_back(theCatalog.fullPath(i));
+      theModelColors.push_back(glm::vec3(rand(), rand(), rand()) / float(RAND_MAX));
+      thePackIds.push_back(packId);
+   }
+   if (stale > 0)
+   {
+      cout << stale << " models changed since " << dir << "models.pack was built; re-run mesh-pack" << endl;
+   }
+   if (theCatalog.modified())
+   {
+      theCatalog.save(theCatalogFile);
    }
 }
 
-static std::string LoadShaderFromFile(const std::string& fileName)
+// Draw the model or preview the upload thread finished, and delete the old buffers
+static void SwapInModel(UploadedMesh& uploaded)
 {
-   std::ifstream file(fileName);
-   if (!file)
+   if (!uploaded.loaded)
    {
-      std::cout << "Cannot load file: " << fileName << std::endl;
-      return "";
+      cout << "Cannot load " << theModelNames[uploaded.key] << endl;
+      MeshUploader::releaseBuffers(uploaded);
+      return;
    }
 
-   std::stringstream code;
-   code << file.rdbuf();
-   file.close();
+   GLuint old[4] = {theVboPosId, theVboNormalId, theVboColorId, theElementbuffer};
+   theVboPosId = uploaded.buffers[0];
+   theVboNormalId = uploaded.buffers[1];
+   theVboColorId = uploaded.buffers[2];
+   theElementbuffer = uploaded.elements;
+   theModes.attach(theVboPosId, theVboNormalId, theVboColorId, theElementbuffer, theScene.instanceBuffer());
+   glDeleteBuffers(4, old);
+
+   theModel = std::move(uploaded.mesh);
+   theShownModel = uploaded.key;
+   if (uploaded.preview)
+   {
+      // reported once the preview is on screen
+      thePreviewPending = thePreviewMs < 0 && uploaded.key == theCurrentModel;
+      return;
+   }
+   RecordBounds(uploaded.key, theModel);
 
-   return code.str();
+   double switchMs = 1000.0 * (glfwGetTime() - theSwitchStart);
+   cout << "Switched in " << switchMs << " ms (first pixels after "
+      << (thePreviewMs < 0 ? switchMs : thePreviewMs) << " ms, read "
+      << uploaded.loadMs << " ms, upload " << uploaded.uploadMs << " ms, "
+      << uploaded.bytes / 1024 << " KB in " << uploaded.slices << " slices), longest frame "
+      << 1000.0 * theLongestFrame << " ms" << endl;
 }
 
-static void LoadModels(const std::string& dir)
+// Center the model at the origin and scale it to fit in a 2x2x2 box
+static glm::mat4 FitTransform(int modelId, const glm::vec3& minpos, const glm::vec3& maxpos)
 {
-   std::vector<std::string> filenames = GetFilenamesInDir(dir, "ply");
-   for (int i = 0; i < filenames.size(); i++)
-   {
-      std::string filename = filenames[i];
-      theModelNames.push_back(dir+filename);
+   glm::vec3 center = 0.5f * (maxpos + minpos);
+   glm::mat4 translation = glm::translate(glm::mat4(1), -center);
+   float xsize = maxpos[0]-minpos[0];
+   float ysize = maxpos[1]-minpos[1];
+   float zsize = maxpos[2]-minpos[2];
+   float scalefactor = std::min(2.0f/xsize, std::min(2.0f/ysize, 2.0f/zsize));
+   glm::mat4 scalematrix = glm::scale(glm::mat4(1), glm::vec3(scalefactor));
+   if (theModelNames[modelId] == "../models/pikachu_color.ply" || theModelNames[modelId] == "../models/saratoga.ply"){
+      // these models are stored z-up
+      glm::mat4 rotate = glm::rotate(glm::mat4(1), radians(-90.0f), glm::vec3(1, 0, 0));
+      return rotate * scalematrix * translation;
    }
+   return scalematrix * translation;
 }
 
-static GLuint LoadShader(const std::string& vertex, const std::string& fragment)
+// --gallery and --instances: place resident models on a grid, 3 units apart.
+// Returns the distance the camera needs to see the whole grid.
+static float BuildScene()
 {
-   GLint result;
-   std::string vertexShader = LoadShaderFromFile(vertex);
-   const char* vertexShaderRaw = vertexShader.c_str();
-   GLuint vshaderId = glCreateShader(GL_VERTEX_SHADER);
-   glShaderSource(vshaderId, 1, &vertexShaderRaw, NULL);
-   glCompileShader(vshaderId);
-   glGetShaderiv(vshaderId, GL_COMPILE_STATUS, &result);
-   if (result == GL_FALSE)
-   {
-      PrintShaderErrors(vshaderId, "Vertex shader");
-      return -1;
+   std::vector<int> models;
+   for (int i = 0; i < (int) theModelNames.size(); i++)
+   {
+      if (theMeshBuffer.find(i)) models.push_back(i);
    }
+   if (models.empty()) return 3.0f;
 
-   std::string fragmentShader = LoadShaderFromFile(fragment);
-   const char* fragmentShaderRaw = fragmentShader.c_str();
-   GLuint fshaderId = glCreateShader(GL_FRAGMENT_SHADER);
-   glShaderSource(fshaderId, 1, &fragmentShaderRaw, NULL);
-   glCompileShader(fshaderId);
-   glGetShaderiv(fshaderId, GL_COMPILE_STATUS, &result);
-   if (result == GL_FALSE)
+   const float spacing = 3.0f;
+   theSceneStreams = PositionStream | NormalStream | ColorStream;
+   if (theGallery)
    {
-      PrintShaderErrors(fshaderId, "Fragment shader");
-      return -1;
+      // one of each model, on a square in the xz plane
+      int cols = (int) std::ceil(std::sqrt((float) models.size()));
+      int rows = ((int) models.size() + cols - 1) / cols;
+      for (int i = 0; i < (int) models.size(); i++)
+      {
+         const MeshSlot* slot = theMeshBuffer.find(models[i]);
+         glm::vec3 position(spacing * (i % cols - 0.5f * (cols - 1)), 0.0f,
+            spacing * (i / cols - 0.5f * (rows - 1)));
+         theScene.add(theMeshBuffer, models[i],
+            glm::translate(glm::mat4(1), position) * FitTransform(models[i], slot->minBounds, slot->maxBounds));
+         theSceneStreams &= slot->streams;
+      }
+      return spacing * std::max(cols, rows);
    }
 
-   GLuint shaderId = glCreateProgram();
-   glAttachShader(shaderId, vshaderId);
-   glAttachShader(shaderId, fshaderId);
-   glLinkProgram(shaderId);
-   glGetShaderiv(shaderId, GL_LINK_STATUS, &result);
-   if (result == GL_FALSE)
+   // copies of the first model, on a cube
+   const MeshSlot* slot = theMeshBuffer.find(models[0]);
+   glm::mat4 fit = FitTransform(models[0], slot->minBounds, slot->maxBounds);
+   int side = (int) std::ceil(std::cbrt((float) theNumInstances));
+   for (int i = 0; i < theNumInstances; i++)
    {
-      PrintShaderErrors(shaderId, "Shader link");
-      return -1;
+      glm::vec3 position(i % side, (i / side) % side, i / (side * side));
+      position = spacing * (position - glm::vec3(0.5f * (side - 1)));
+      theScene.add(theMeshBuffer, models[0], glm::translate(glm::mat4(1), position) * fit);
    }
-   return shaderId;
+   theSceneStreams &= slot->streams;
+   return spacing * side;
 }
 
+// Print the scene statistics about once a second
+static void ReportScene()
+{
+   static double start = glfwGetTime();
+   static int frames = 0;
+   static long long instances = 0, drawCalls = 0;
+   static long long triangles = 0, occludedTriangles = 0;
+   static double cullMs = 0, occlusionMs = 0;
+
+   const SceneStats& stats = theScene.stats();
+   frames++;
+   instances += stats.visible;
+   drawCalls += stats.drawCalls;
+   cullMs += stats.cullMs;
+   triangles += stats.triangles;
+   occludedTriangles += stats.occludedTriangles;
+   occlusionMs += stats.occlusionMs;
+
+   double elapsed = glfwGetTime() - start;
+   if (elapsed < 1.0) return;
+
+   cout << "Scene: " << stats.instances << " instances, " << stats.visible << " visible in "
+      << stats.commands << " commands, " << (double) drawCalls / frames << " draw calls per frame, "
+      << instances / elapsed << " instances/s, " << frames / elapsed << " fps, culling "
+      << cullMs / frames << " ms" << endl;
+   if (theScene.occlusionEnabled())
+   {
+      cout << "Occlusion: " << stats.occluded << " instances hidden behind " << stats.occluders
+         << " occluders, " << 100.0 * occludedTriangles / std::max(triangles + occludedTriangles, 1LL)
+         << "% of the triangles in the frustum culled in " << occlusionMs / frames << " ms" << endl;
+   }
+   start = glfwGetTime();
+   frames = 0;
+   instances = drawCalls = 0;
+   triangles = occludedTriangles = 0;
+   cullMs = occlusionMs = 0;
+}
+
+// --benchmark: render theBenchmarkFrames frames without uniform caching, then
+// as many with it, and print the GL calls issued per frame for each
+static void BenchmarkFrame(GLFWwindow* window)
+{
+   static int frame = 0;
+   static double start = 0;
+
+   int frames = theBenchmarkFrames;
+   if (frame == 0)
+   {
+      ShaderProgram::setCaching(false);
+      ResetGLCallCounts();
+      start = glfwGetTime();
+   }
+   else if (frame == frames || frame == 2 * frames)
+   {
+      double elapsed = glfwGetTime() - start;
+      cout << (frame == frames ? "Without" : "With") << " uniform caching: "
+         << 1000.0 * elapsed / frames << " ms per frame, GL calls per frame:\n";
+      PrintGLCallCounts(cout, frames);
+
+      ShaderProgram::setCaching(true);
+      ResetGLCallCounts();
+      start = glfwGetTime();
+      if (frame == 2 * frames)
+      {
+         glfwSetWindowShouldClose(window, GLFW_TRUE);
+      }
+   }
+   frame++;
+
+   // keep the camera moving so the frame data changes every frame
+   azimuth += 360.0f / frames;
+}
 
 int main(int argc, char** argv)
 {
    GLFWwindow* window;
+   std::string startMode = "phong";
+
+   for (int i = 1; i < argc; i++)
+   {
+      std::string arg = argv[i];
+      if (arg == "--shared" && i + 1 < argc)
+      {
+         // --shared <name>: share decoded models with other viewers on this host
+         theStore.open(argv[++i]);
+      }
+      else if (arg == "--mode" && i + 1 < argc)
+      {
+         // --mode <name>: start in the named render mode
+         startMode = argv[++i];
+      }
+      else if (arg == "--megabuffer")
+      {
+         // --megabuffer [MB]: keep every model that fits in one set of GPU buffers
+         theMeshBufferSize = 256;
+         if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+         {
+            theMeshBufferSize = atoi(argv[++i]);
+         }
+      }
+      else if (arg == "--gallery")
+      {
+         // --gallery: draw every model at once, on a grid
+         theGallery = true;
+      }
+      else if (arg == "--instances" && i + 1 < argc)
+      {
+         // --instances N: draw N copies of the first model
+         theNumInstances = std::max(atoi(argv[++i]), 1);
+      }
+      else if (arg == "--fps" && i + 1 < argc)
+      {
+         // --fps N: draw at most N frames per second while the view changes; 0 is unlimited
+         theScheduler.setTargetFps(std::max(atof(argv[++i]), 0.0));
+      }
+      else if (arg == "--continuous")
+      {
+         // --continuous: draw every frame even when nothing changes
+         theContinuous = true;
+      }
+      else if (arg == "--occlusion")
+      {
+         // --occlusion: in scenes, skip instances hidden behind the nearest ones
+         theOcclusion = true;
+      }
+      else if (arg == "--trace")
+      {
+         // --trace [file]: profile, writing a Chrome trace on T and at exit
+         theTraceFile = "trace.json";
+         if (i + 1 < argc && argv[i + 1][0] != '-')
+         {
+            theTraceFile = argv[++i];
+         }
+      }
+      else if (arg == "--capture")
+      {
+         // --capture [fps]: save frames from the start, at fps frames per second
+         if (i + 1 < argc && atof(argv[i + 1]) > 0)
+         {
+            theCaptureFps = atof(argv[++i]);
+         }
+         theCapture.start("capture-", theCaptureFps);
+      }
+      else if (arg == "--turntable" && i + 1 < argc)
+      {
+         // --turntable N [WxH]: save N views around each model offscreen, then exit
+         theTurntableFrames = std::max(atoi(argv[++i]), 1);
+         if (i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &theTurntableWidth, &theTurntableHeight) == 2)
+         {
+            i++;
+         }
+         theSyncUpload = true; // every model is loaded before it is drawn
+      }
+      else if (arg == "--poster" && i + 1 < argc)
+      {
+         // --poster WxH [file]: save the first model, or the scene, at any size, then exit
+         if (sscanf(argv[++i], "%dx%d", &thePosterWidth, &thePosterHeight) != 2 ||
+            thePosterWidth <= 0 || thePosterHeight <= 0)
+         {
+            thePosterWidth = thePosterHeight = 0;
+         }
+         if (i + 1 < argc && argv[i + 1][0] != '-')
+         {
+            thePosterFile = argv[++i];
+         }
+         theSyncUpload = true;
+      }
+      else if (arg == "--sync-upload")
+      {
+         // --sync-upload: load models on the render thread, stalling it
+         theSyncUpload = true;
+      }
+      else if (arg == "--benchmark")
+      {
+         // --benchmark [frames]: count GL calls per frame, then exit
+         theBenchmarkFrames = 300;
+         if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+         {
+            theBenchmarkFrames = atoi(argv[++i]);
+         }
+      }
+   }
+
+   if ((theGallery || theNumInstances > 0) && theMeshBufferSize == 0)
+   {
+      theMeshBufferSize = 256; // scenes draw from the mesh buffer
+   }
 
    if (!glfwInit())
    {
@@ -246,7 +700,11 @@ int main(int argc, char** argv)
    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
    /* Create a windowed mode window and its OpenGL context */
+   // turntables and posters draw offscreen, so their window is never shown
+   bool offscreen = theTurntableFrames > 0 || thePosterWidth > 0;
+   glfwWindowHint(GLFW_VISIBLE, offscreen ? GLFW_FALSE : GLFW_TRUE);
    window = glfwCreateWindow(500, 500, "Mesh Viewer", NULL, NULL);
+   glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
    if (!window)
    {
       glfwTerminate();
@@ -261,6 +719,7 @@ int main(int argc, char** argv)
    glfwSetMouseButtonCallback(window, mouse_button_callback);
    glfwSetScrollCallback(window, scroll_callback);
    glfwSetCursorPosCallback(window, cursor_position_callback);
+   glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
 #ifndef APPLE
    if (glewInit() != GLEW_OK)
@@ -269,60 +728,153 @@ int main(int argc, char** argv)
    }
 #endif
 
+   if (!theTraceFile.empty())
+   {
+      SetProfileThreadName("render");
+      EnableProfiling(true);
+   }
+
+   if (theBenchmarkFrames > 0)
+   {
+      EnableGLCallCounting();
+      glfwSwapInterval(0); // don't wait for vsync
+      theScheduler.setTargetFps(0);
+   }
+
+   theCapture.create(); // C saves a screenshot, V starts and stops capturing
+
    glEnable(GL_DEPTH_TEST);
    glEnable(GL_CULL_FACE);
    glClearColor(0, 0, 0, 1);
+   glPointSize(2.0f); // previews are drawn as points
 
-   glGenBuffers(1, &theVboPosId);
-   glGenBuffers(1, &theVboNormalId);
-   glGenBuffers(1, &theElementbuffer);
-
-   GLuint vaoId;
-   glGenVertexArrays(1, &vaoId);
-   glBindVertexArray(vaoId);
-
-   glEnableVertexAttribArray(0); // 0 -> Sending VertexPositions to array #0 in the active shader
-   glBindBuffer(GL_ARRAY_BUFFER, theVboPosId); // always bind before setting data
-   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
+   if (theMeshBufferSize > 0)
+   {
+      // 36 bytes per vertex for three streams and about two triangles per vertex,
+      // 24 bytes of indices: 60% of the space for vertices, 40% for indices
+      size_t bytes = theMeshBufferSize * 1024 * 1024;
+      if (!theMeshBuffer.create(bytes * 6 / 10 / 36, bytes * 4 / 10 / 4))
+      {
+         glfwTerminate();
+         return -1;
+      }
+      theVboPosId = theMeshBuffer.positions();
+      theVboNormalId = theMeshBuffer.normals();
+      theVboColorId = theMeshBuffer.colors();
+      theElementbuffer = theMeshBuffer.elements();
+   }
+   else
+   {
+      glGenBuffers(1, &theVboPosId);
+      glGenBuffers(1, &theVboNormalId);
+      glGenBuffers(1, &theVboColorId);
+      glGenBuffers(1, &theElementbuffer);
+   }
 
-   glEnableVertexAttribArray(1); // 1 -> Sending Normals to array #1 in the active shader
-   glBindBuffer(GL_ARRAY_BUFFER, theVboNormalId); // always bind before setting data
-   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
+   // every render mode comes from one source; keys 1-5 switch between them
+   double shaderStart = glfwGetTime();
+   bool sceneMode = theGallery || theNumInstances > 0;
+   if (sceneMode)
+   {
+      theScene.create();
+   }
+   theScene.enableOcclusion(theOcclusion);
+   theModes.addDefaults(sceneMode); // scenes draw every model with its own matrix
+   theModes.submit("../shaders/mesh.glsl", "../shaders/cache/"); // the driver compiles while the first model loads
+   theModes.attach(theVboPosId, theVboNormalId, theVboColorId, theElementbuffer, theScene.instanceBuffer());
+   theRenderMode = std::max(theModes.find(startMode), 0);
 
    LoadModels("../models/");
+   if (theMeshBufferSize > 0)
+   {
+      // upload models in order until the buffer is full; the rest come in
+      // when viewed, replacing the models drawn least recently
+      double start = glfwGetTime();
+      int count = 0;
+      Mesh mesh;
+      while (count < (int) theModelNames.size() && ReadModel(count, mesh) &&
+         theMeshBuffer.tryAdd(count, mesh))
+      {
+         RecordBounds(count, mesh);
+         if (theOcclusion)
+         {
+            theScene.setOccluder(count, mesh); // the CPU copy is only around now
+         }
+         count++;
+      }
+      cout << "Uploaded " << count << " of " << theModelNames.size() << " models in "
+         << 1000.0 * (glfwGetTime() - start) << " ms" << endl;
+      theMeshBuffer.printStats(cout);
+   }
+   if (theMeshBufferSize == 0 && !theSyncUpload)
+   {
+      // a hidden window gives the upload thread a context sharing our buffers;
+      // even the first model is then read in the background, behind a preview
+      glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+      theUploadWindow = glfwCreateWindow(1, 1, "Upload", NULL, window);
+      glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+      if (theUploadWindow && theUploader.start(
+         [] { glfwMakeContextCurrent(theUploadWindow); return true; },
+         [] { glfwMakeContextCurrent(NULL); }))
+      {
+         cout << "Models are uploaded on a background thread" << endl;
+      }
+   }
+
    LoadModel(0);
 
-   GLuint shaderId = LoadShader("../shaders/phong.vs", "../shaders/phong.fs");
-   glUseProgram(shaderId);
+   float sceneDist = 0;
+   if (sceneMode)
+   {
+      sceneDist = BuildScene();
+      cout << "Scene: " << theScene.size() << " instances, "
+         << (theScene.usesIndirect() ? "multi-draw indirect" : "one draw per model") << endl;
+   }
+
+   if (!theModes.finish())
+   {
+      theModes.release();
+      theScene.release();
+      theMeshBuffer.release();
+      glfwTerminate();
+      return -1;
+   }
+   cout << "Shaders: " << theModes.shaders().numCached() << " from cache, "
+      << theModes.shaders().numCompiled() << " compiled in "
+      << 1000.0 * (glfwGetTime() - shaderStart) << " ms" << endl;
+
+   // per-frame and per-material uniforms each live in one buffer
+   UniformBuffer frameBuffer, materialBuffer;
+   frameBuffer.create(sizeof(FrameUniforms), FrameBinding);
+   materialBuffer.create(sizeof(MaterialUniforms), MaterialBinding);
+
+   // the light position and material come from the render mode
+   FrameUniforms frame = FrameUniforms();
+   frame.lightColor = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+   MaterialUniforms material = MaterialUniforms();
 
    // set up the viewer
-   GLuint mvpId = glGetUniformLocation(shaderId, "MVP");
-   GLuint mvId = glGetUniformLocation(shaderId, "ModelViewMatrix");
-   GLuint nmvId = glGetUniformLocation(shaderId, "NormalMatrix");
-   dist = 3.0f;
+   dist = sceneMode ? sceneDist : 3.0f;
    azimuth = 0;
    elevation = 0;
    lastX = 250.0f;
    lastY = 250.0f;
    glm::mat4 transform(1.0); // initialize to identity
-   glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+   glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, std::max(100.0f, 4.0f * sceneDist));
 
-   // Loop until the user closes the window 
-   while (!glfwWindowShouldClose(window))
+   int unlitMode = std::max(theModes.find("unlit"), 0);
+
+   // draw the model, or the scene, seen from azimuth and elevation
+   auto drawView = [&](const glm::mat4& projection)
    {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the buffers
 
       // enable camera control
-      glm::vec3 minpos = theModel.getMinBounds();
-      glm::vec3 maxpos = theModel.getMaxBounds();
-      glm::vec3 center = 0.5f * (maxpos + minpos);
-      glm::mat4 translation = glm::translate(glm::mat4(1), -center);
-      float xsize = maxpos[0]-minpos[0];
-      float ysize = maxpos[1]-minpos[1];
-      float zsize = maxpos[2]-minpos[2];
-      float scalefactor = std::min(2.0f/xsize, std::min(2.0f/ysize, 2.0f/zsize));
-      glm::mat4 scalematrix = glm::scale(glm::mat4(1), glm::vec3(scalefactor));
-      transform = scalematrix * translation;
+      const MeshSlot* slot = theMeshBuffer.find(theShownModel);
+      glm::vec3 minpos = slot ? slot->minBounds : theModel.getMinBounds();
+      glm::vec3 maxpos = slot ? slot->maxBounds : theModel.getMaxBounds();
+      // scene instances bring their own transforms
+      transform = sceneMode ? glm::mat4(1) : FitTransform(theShownModel, minpos, maxpos);
 
       lookfrom.x = dist * sin(glm::radians(azimuth)) * cos(glm::radians(elevation));
       lookfrom.z = dist * cos(glm::radians(azimuth)) * cos(glm::radians(elevation));
@@ -331,28 +883,189 @@ int main(int argc, char** argv)
       glm::mat4 mvp = projection * camera * transform;
       glm::mat4 mv = camera * transform;
       glm::mat3 nmv = glm::mat3(glm::vec3(mv[0]), glm::vec3(mv[1]), glm::vec3(mv[2]));
-      glUniformMatrix3fv(nmvId, 1, GL_FALSE, &nmv[0][0]);
-      glUniformMatrix4fv(mvId, 1, GL_FALSE, &mv[0][0]);
-      glUniformMatrix4fv(mvpId, 1, GL_FALSE, &mvp[0][0]);
+      frame.mvp = mvp;
+      frame.modelView = mv;
+      frame.normalMatrix = glm::mat4(nmv);
 
-      glUniform3f(glGetUniformLocation(shaderId, "Material.Ks"), 1.0f, 1.0f, 1.0f);
-      glUniform3f(glGetUniformLocation(shaderId, "Material.Kd"), 0.4f, 0.6f, 1.0f);
-      glUniform3f(glGetUniformLocation(shaderId, "Material.Ka"), 0.1f, 0.1f, 0.1f);
-      glUniform1f(glGetUniformLocation(shaderId, "Material.shininess"), 80.0f);
-      glUniform4f(glGetUniformLocation(shaderId, "Light.position"), 100.0f, 100.0f, 100.0f, 1.0f);
-      glUniform3f(glGetUniformLocation(shaderId, "Light.color"), 1.0f, 1.0f, 1.0f);
+      // fall back to phong for models without the streams the mode reads
+      bool supported = sceneMode ? theModes.supports(theRenderMode, theSceneStreams) :
+         slot ? theModes.supports(theRenderMode, slot->streams) :
+         theModes.supports(theRenderMode, theModel);
+      int mode = supported ? theRenderMode : 0;
+      if (!sceneMode && !slot && !theModes.supports(mode, theModel))
+      {
+         mode = unlitMode; // previews of models without normals in the file
+      }
+      theModes.use(mode, frame, material);
+      if (theModes.mode(mode).modelColor)
+      {
+         material.kd = glm::vec4(theModelColors[theShownModel], 0.0f);
+      }
 
-      // Draw primitive
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theElementbuffer);
-      glDrawElements(GL_TRIANGLES, theModel.numTriangles() * 3, GL_UNSIGNED_INT, (void*)0);
+      // unchanged data is not uploaded again
+      frameBuffer.update(&frame);
+      materialBuffer.update(&material);
+
+      // Draw primitive; the mode's vertex array holds the element buffer
+      theGpuTimer.begin("draw");
+      if (sceneMode)
+      {
+         theScene.update(theMeshBuffer, mvp);
+         theScene.draw();
+      }
+      else if (theMeshBufferSize > 0)
+      {
+         theMeshBuffer.draw(theShownModel);
+      }
+      else if (theModel.numTriangles() == 0)
+      {
+         // a preview: some of the vertices read so far
+         glDrawArrays(GL_POINTS, 0, theModel.numVertices());
+         ProfileCount(DrawCalls, 1);
+      }
+      else
+      {
+         glDrawElements(GL_TRIANGLES, theModel.numTriangles() * 3, GL_UNSIGNED_INT, (void*)0);
+         ProfileCount(DrawCalls, 1);
+         ProfileCount(TrianglesSubmitted, theModel.numTriangles());
+      }
+      theGpuTimer.end();
+   };
 
-      // Swap front and back buffers
-      glfwSwapBuffers(window);
+   if (theTurntableFrames > 0)
+   {
+      // --turntable: the orbit azimuth drives, at even steps, into files instead of the window
+      TurntableExporter turntable;
+      if (turntable.create(theTurntableWidth, theTurntableHeight))
+      {
+         glm::mat4 turntableProjection = glm::perspective(glm::radians(60.0f),
+            (float) theTurntableWidth / theTurntableHeight, 0.1f, std::max(100.0f, 4.0f * sceneDist));
+         int count = sceneMode ? 1 : (int) theModelNames.size();
+         for (int i = 0; i < count; i++)
+         {
+            std::string prefix = "turntable-scene-";
+            if (!sceneMode)
+            {
+               if (i != theShownModel) LoadModel(i);
+               prefix = "turntable-" + PruneName(theModelNames[i]) + "-";
+            }
+            cout << "Saving " << theTurntableFrames << " " << theTurntableWidth << "x"
+               << theTurntableHeight << " views as " << prefix << "NNN.png" << endl;
+            turntable.run(prefix, theTurntableFrames, [&](float angle)
+            {
+               azimuth = angle;
+               drawView(turntableProjection);
+            });
+            turntable.printStats(cout);
+         }
+      }
+      turntable.release();
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+   }
 
-      // Poll for and process events
-      glfwPollEvents();
+   if (thePosterWidth > 0)
+   {
+      // --poster: larger than any framebuffer, so drawn in tiles, each with its part of the projection
+      TiledRenderer poster;
+      if (poster.create())
+      {
+         glm::mat4 posterProjection = glm::perspective(glm::radians(60.0f),
+            (float) thePosterWidth / thePosterHeight, 0.1f, std::max(100.0f, 4.0f * sceneDist));
+         cout << "Saving a " << thePosterWidth << "x" << thePosterHeight << " poster as "
+            << thePosterFile << endl;
+         poster.render(thePosterFile, thePosterWidth, thePosterHeight, posterProjection, drawView);
+         poster.printStats(cout);
+      }
+      poster.release();
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
    }
 
+   // Loop until the user closes the window 
+   double lastFrame = glfwGetTime();
+   while (!glfwWindowShouldClose(window))
+   {
+      // sleep until something changes; uploads and captures in progress need frames
+      theScheduler.setAnimating(theContinuous || theBenchmarkFrames > 0 || theUploader.busy() ||
+         theCapture.busy());
+      if (!theScheduler.wait()) continue;
+      AGL_PROFILE_SCOPE("frame");
+      theGpuTimer.collect();
+
+      double now = glfwGetTime();
+      if (theUploader.isRunning())
+      {
+         UploadedMesh uploaded;
+         if (theUploader.poll(uploaded))
+         {
+            SwapInModel(uploaded);
+         }
+         else if (theUploader.busy())
+         {
+            // the loop may have been idle before the switch started
+            theLongestFrame = std::max(theLongestFrame, now - std::max(lastFrame, theSwitchStart));
+         }
+      }
+      lastFrame = now;
+
+      if (theBenchmarkFrames > 0)
+      {
+         BenchmarkFrame(window);
+      }
+
+      drawView(projection);
+      if (sceneMode)
+      {
+         ReportScene();
+      }
+
+      // queue a readback of the finished frame, if one is due
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      theCapture.frame(width, height, glfwGetTime());
+
+      // Swap front and back buffers; events are handled by the scheduler
+      {
+         AGL_PROFILE_SCOPE("swap");
+         glfwSwapBuffers(window);
+      }
+      ProfileFrame();
+
+      if (thePreviewPending)
+      {
+         thePreviewMs = 1000.0 * (glfwGetTime() - theSwitchStart);
+         thePreviewPending = false;
+         cout << "Preview of " << theModelNames[theShownModel] << ": " << theModel.numVertices()
+            << " points on screen after " << thePreviewMs << " ms" << endl;
+      }
+   }
+   theScheduler.printStats(cout);
+   if (!theTraceFile.empty())
+   {
+      theGpuTimer.collect();
+      WriteChromeTrace(theTraceFile);
+   }
+
+   // the upload thread reads the catalog, so it stops before the catalog is saved
+   theUploader.stop();
+   if (theCatalog.modified() && !theCatalogFile.empty())
+   {
+      theCatalog.save(theCatalogFile);
+   }
+
+   // GL objects must go before the context does
+   theCapture.release();
+   if (theCapture.stats().due > 0)
+   {
+      theCapture.printStats(cout);
+   }
+   if (theUploadWindow)
+   {
+      glfwDestroyWindow(theUploadWindow);
+   }
+   theGpuTimer.release();
+   theModes.release();
+   frameBuffer.release();
+   materialBuffer.release();
    glfwTerminate();
    return 0;
 }
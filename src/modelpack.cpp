@@ -0,0 +1,290 @@
+// Haverford College, Jiajie Ma, 2021
+#include "modelpack.h"
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+static const char pack_magic[8] = "AGLPACK";
+static const uint32_t pack_version = 2;
+static const uint32_t pack_byte_order = 0x01020304;
+static const size_t model_alignment = 4096;
+static const size_t array_alignment = 64;
+
+//--------------------------------------------------------------------
+// ModelPack
+
+// Return true if size bytes at offset lie inside the file and offset is
+// aligned for the floats and indices stored there. Written so that
+// nothing can overflow.
+static bool InFile(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+   return offset % 4 == 0 && offset <= fileSize && size <= fileSize - offset;
+}
+
+ModelPack::ModelPack() : myData(0), mySize(0), myEntries(0)
+{
+#ifdef _WIN32
+   myFile = INVALID_HANDLE_VALUE;
+   myMapping = 0;
+#endif
+}
+
+ModelPack::~ModelPack()
+{
+   close();
+}
+
+bool ModelPack::open(const std::string& filename)
+{
+   close();
+
+#ifdef _WIN32
+   myFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+   if (myFile == INVALID_HANDLE_VALUE) return false;
+
+   LARGE_INTEGER size;
+   GetFileSizeEx(myFile, &size);
+   mySize = (size_t) size.QuadPart;
+   myMapping = CreateFileMappingA(myFile, NULL, PAGE_READONLY, 0, 0, NULL);
+   if (myMapping)
+   {
+      myData = (unsigned char*) MapViewOfFile(myMapping, FILE_MAP_READ, 0, 0, 0);
+   }
+#else
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0) return false;
+
+   struct stat info;
+   if (fstat(fd, &info) == 0 && info.st_size > 0)
+   {
+      mySize = (size_t) info.st_size;
+      void* data = mmap(0, mySize, PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED)
+      {
+         myData = (unsigned char*) data;
+         // models are viewed one at a time; don't read ahead into the next ones
+         madvise(data, mySize, MADV_RANDOM);
+      }
+   }
+   ::close(fd); // the mapping keeps the file alive
+#endif
+
+   if (!myData)
+   {
+      cout << "ERROR: Cannot map model pack: " << filename << endl;
+      close();
+      return false;
+   }
+
+   const PackHeader* header = (const PackHeader*) myData;
+   if (mySize < sizeof(PackHeader) || memcmp(header->magic, pack_magic, sizeof(pack_magic)) != 0 ||
+      header->version != pack_version || header->byteOrder != pack_byte_order ||
+      header->fileSize != mySize || header->tocOffset % 8 != 0 ||
+      !InFile(header->tocOffset, (uint64_t) header->numModels * sizeof(PackEntry), mySize))
+   {
+      cout << "ERROR: " << filename << " is not a valid model pack!" << endl;
+      close();
+      return false;
+   }
+   myEntries = (const PackEntry*) (myData + header->tocOffset);
+
+   // check every array lies inside the file, so get() never faults
+   for (int i = 0; i < size(); i++)
+   {
+      const PackEntry& e = myEntries[i];
+      uint64_t v = 3ull * e.numVertices * sizeof(float);
+      uint64_t f = 3ull * e.numTriangles * sizeof(unsigned int);
+      if (!InFile(e.positions, v, mySize) || !InFile(e.indices, f, mySize) ||
+         (e.normals && !InFile(e.normals, v, mySize)) ||
+         (e.colors && !InFile(e.colors, v, mySize)) ||
+         e.name[sizeof(e.name) - 1] != 0)
+      {
+         cout << "ERROR: " << filename << " has a corrupt table of contents!" << endl;
+         close();
+         return false;
+      }
+   }
+   return true;
+}
+
+void ModelPack::close()
+{
+#ifdef _WIN32
+   if (myData) UnmapViewOfFile(myData);
+   if (myMapping) CloseHandle(myMapping);
+   if (myFile != INVALID_HANDLE_VALUE) CloseHandle(myFile);
+   myMapping = 0;
+   myFile = INVALID_HANDLE_VALUE;
+#else
+   if (myData) munmap(myData, mySize);
+#endif
+   myData = 0;
+   mySize = 0;
+   myEntries = 0;
+}
+
+int ModelPack::size() const
+{
+   return myData ? (int) ((const PackHeader*) myData)->numModels : 0;
+}
+
+std::string ModelPack::name(int i) const
+{
+   return myEntries[i].name;
+}
+
+const PackEntry& ModelPack::entry(int i) const
+{
+   return myEntries[i];
+}
+
+bool ModelPack::get(int i, Mesh& mesh) const
+{
+   if (i < 0 || i >= size()) return false;
+
+   const PackEntry& e = myEntries[i];
+   float* positions = (float*) (myData + e.positions);
+   float* normals = e.normals ? (float*) (myData + e.normals) : 0;
+   float* colors = e.colors ? (float*) (myData + e.colors) : 0;
+   unsigned int* indices = (unsigned int*) (myData + e.indices);
+
+#ifndef _WIN32
+   // the model is about to be uploaded; start reading its pages now
+   uint64_t end = e.indices + 3ull * e.numTriangles * sizeof(unsigned int);
+   uint64_t start = e.positions & ~(uint64_t) (model_alignment - 1);
+   madvise(myData + start, (size_t) (end - start), MADV_WILLNEED);
+#endif
+
+   mesh.setExternalData(e.numVertices, e.numTriangles, positions, normals, colors, indices,
+      glm::vec3(e.minBounds[0], e.minBounds[1], e.minBounds[2]),
+      glm::vec3(e.maxBounds[0], e.maxBounds[1], e.maxBounds[2]));
+   return true;
+}
+
+//--------------------------------------------------------------------
+// ModelPackWriter
+
+ModelPackWriter::ModelPackWriter() : myFile(0), myOffset(0)
+{
+}
+
+ModelPackWriter::~ModelPackWriter()
+{
+   if (myFile) fclose(myFile);
+}
+
+bool ModelPackWriter::open(const std::string& filename)
+{
+   myFile = fopen(filename.c_str(), "wb");
+   if (!myFile)
+   {
+      cout << "ERROR: Cannot write model pack: " << filename << endl;
+      return false;
+   }
+   myOffset = 0;
+   myEntries.clear();
+
+   // the header is rewritten with the real counts by close()
+   PackHeader header;
+   memset(&header, 0, sizeof(header));
+   return write(&header, sizeof(header));
+}
+
+bool ModelPackWriter::write(const void* data, size_t size)
+{
+   if (size > 0 && fwrite(data, 1, size, myFile) != size) return false;
+   myOffset += size;
+   return true;
+}
+
+bool ModelPackWriter::pad(size_t alignment)
+{
+   static const char zeros[model_alignment] = {0};
+   size_t padding = (alignment - myOffset % alignment) % alignment;
+   return write(zeros, padding);
+}
+
+bool ModelPackWriter::add(const std::string& name, const Mesh& mesh,
+   long long sourceSize, long long sourceModified)
+{
+   if (!myFile) return false;
+   if (name.size() >= sizeof(PackEntry().name))
+   {
+      cout << "ERROR: model name is too long for a pack: " << name << endl;
+      return false;
+   }
+
+   PackEntry e;
+   memset(&e, 0, sizeof(e));
+   strcpy(e.name, name.c_str());
+   e.numVertices = mesh.numVertices();
+   e.numTriangles = mesh.numTriangles();
+   e.sourceSize = sourceSize;
+   e.sourceModified = sourceModified;
+   for (int k = 0; k < 3; k++)
+   {
+      e.minBounds[k] = mesh.getMinBounds()[k];
+      e.maxBounds[k] = mesh.getMaxBounds()[k];
+   }
+
+   size_t vsize = 3 * (size_t) e.numVertices * sizeof(float);
+   size_t fsize = 3 * (size_t) e.numTriangles * sizeof(unsigned int);
+   bool ok = pad(model_alignment);
+
+   e.positions = myOffset;
+   ok = ok && write(mesh.positions(), vsize) && pad(array_alignment);
+   if (mesh.hasNormals())
+   {
+      e.normals = myOffset;
+      e.flags |= ModelPack::HasNormals;
+      ok = ok && write(mesh.normals(), vsize) && pad(array_alignment);
+   }
+   if (mesh.hasColors())
+   {
+      e.colors = myOffset;
+      e.flags |= ModelPack::HasColors;
+      ok = ok && write(mesh.colors(), vsize) && pad(array_alignment);
+   }
+   e.indices = myOffset;
+   ok = ok && write(mesh.indices(), fsize);
+
+   if (!ok)
+   {
+      cout << "ERROR: Cannot write " << name << " to model pack" << endl;
+      return false;
+   }
+   myEntries.push_back(e);
+   return true;
+}
+
+bool ModelPackWriter::close()
+{
+   if (!myFile) return false;
+
+   bool ok = pad(array_alignment);
+   PackHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, pack_magic, sizeof(pack_magic));
+   header.version = pack_version;
+   header.byteOrder = pack_byte_order;
+   header.numModels = (uint32_t) myEntries.size();
+   header.tocOffset = myOffset;
+   ok = ok && write(myEntries.empty() ? 0 : &myEntries[0], myEntries.size() * sizeof(PackEntry));
+   header.fileSize = myOffset;
+
+   ok = ok && fseek(myFile, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, myFile) == 1;
+   ok = (fclose(myFile) == 0) && ok;
+   myFile = 0;
+   return ok;
+}
@@ -0,0 +1,122 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef modelpack_H_
+#define modelpack_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "mesh.h"
+
+namespace agl {
+
+   // A model pack is a single file holding many decoded meshes:
+   //
+   //   PackHeader | model 0 | model 1 | ... | PackEntry[numModels]
+   //
+   // Every model starts on a page boundary and each of its arrays on a
+   // 64 byte boundary, so a memory mapped pack can be used in place and
+   // only the pages of models that are actually drawn are ever read.
+   // Integers and floats are stored in the byte order of the writer.
+   // Each entry records the size and modification time of the file it was
+   // decoded from, so readers can tell when a model changed after packing.
+
+   struct PackHeader
+   {
+      char magic[8];        // "AGLPACK"
+      uint32_t version;
+      uint32_t byteOrder;   // 0x01020304 as written by the builder
+      uint32_t numModels;
+      uint32_t reserved;
+      uint64_t tocOffset;   // offset of the PackEntry table
+      uint64_t fileSize;
+   };
+
+   struct PackEntry
+   {
+      char name[128];       // path relative to the model directory
+      uint32_t numVertices;
+      uint32_t numTriangles;
+      uint32_t flags;       // HasNormals | HasColors
+      uint32_t reserved;
+      float minBounds[3];
+      float maxBounds[3];
+      uint64_t positions;   // offsets of each array, 0 if absent
+      uint64_t normals;
+      uint64_t colors;
+      uint64_t indices;
+      int64_t sourceSize;   // of the .ply file, in bytes
+      int64_t sourceModified; // of the .ply file, seconds since the epoch
+   };
+
+   // Read-only, memory mapped model pack
+   class ModelPack
+   {
+   public:
+      enum Flags { HasNormals = 1, HasColors = 2 };
+
+      ModelPack();
+      virtual ~ModelPack();
+
+      // Map the given pack and check its table of contents
+      // Returns true if successfull. false otherwise.
+      bool open(const std::string& filename);
+
+      void close();
+
+      // Return true if a pack is mapped
+      bool isOpen() const { return myData != 0; }
+
+      // Return number of models in the pack
+      int size() const;
+
+      // Return the name of model i, relative to the model directory
+      std::string name(int i) const;
+
+      // Return the table of contents entry of model i
+      const PackEntry& entry(int i) const;
+
+      // Point mesh at the arrays of model i without copying them. The mesh
+      // is valid until this pack is closed and must not be written to.
+      bool get(int i, Mesh& mesh) const;
+
+   private:
+      unsigned char* myData;
+      size_t mySize;
+      const PackEntry* myEntries;
+#ifdef _WIN32
+      void* myFile;
+      void* myMapping;
+#endif
+   };
+
+   // Builds a pack one model at a time, so only one mesh is in memory at once
+   class ModelPackWriter
+   {
+   public:
+      ModelPackWriter();
+      virtual ~ModelPackWriter();
+
+      // Returns true if successfull. false otherwise.
+      bool open(const std::string& filename);
+
+      // Append a mesh with whichever of normals and colors it has, along with
+      // the size and modification time of the file it was loaded from
+      bool add(const std::string& name, const Mesh& mesh,
+         long long sourceSize, long long sourceModified);
+
+      // Write the table of contents and close the file
+      bool close();
+
+   private:
+      bool write(const void* data, size_t size);
+      bool pad(size_t alignment);
+
+   private:
+      FILE* myFile;
+      uint64_t myOffset;
+      std::vector<PackEntry> myEntries;
+   };
+}
+
+#endif
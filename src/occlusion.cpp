@@ -0,0 +1,375 @@
+// Haverford College, Jiajie Ma, 2021
+#include "occlusion.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_OCCLUSION_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Rows of the depth buffer filled by each parallel task
+static const int BandRows = 8;
+
+OccluderMesh agl::MakeOccluder(const Mesh& mesh, int maxTriangles)
+{
+   OccluderMesh occluder;
+   int n = mesh.numVertices();
+   int numTriangles = mesh.numTriangles();
+   if (n == 0 || numTriangles == 0 || maxTriangles < 1) return occluder;
+
+   // twice the area of every triangle that has any
+   const float* positions = mesh.positions();
+   const unsigned int* indices = mesh.indices();
+   std::vector<std::pair<float, int> > areas;
+   areas.reserve(numTriangles);
+   for (int i = 0; i < numTriangles; i++)
+   {
+      const float* a = positions + 3 * indices[3*i];
+      const float* b = positions + 3 * indices[3*i + 1];
+      const float* c = positions + 3 * indices[3*i + 2];
+      glm::vec3 ab(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+      glm::vec3 ac(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+      float area = glm::length(glm::cross(ab, ac));
+      if (area > 0.0f) areas.push_back(std::make_pair(area, i));
+   }
+
+   // the largest triangles, in their order in the mesh
+   int count = std::min((int) areas.size(), maxTriangles);
+   std::nth_element(areas.begin(), areas.begin() + count, areas.end(),
+      std::greater<std::pair<float, int> >());
+   std::vector<int> kept(count);
+   for (int i = 0; i < count; i++)
+   {
+      kept[i] = areas[i].second;
+   }
+   std::sort(kept.begin(), kept.end());
+
+   // only the vertices they use are copied
+   std::vector<unsigned int> vertexOf(n, ~0u);
+   occluder.indices.reserve(3 * (size_t) count);
+   for (int i = 0; i < count; i++)
+   {
+      for (int k = 0; k < 3; k++)
+      {
+         unsigned int v = indices[3 * kept[i] + k];
+         if (vertexOf[v] == ~0u)
+         {
+            vertexOf[v] = (unsigned int) occluder.positions.size();
+            occluder.positions.push_back(glm::vec3(positions[3*v], positions[3*v + 1], positions[3*v + 2]));
+         }
+         occluder.indices.push_back(vertexOf[v]);
+      }
+   }
+   return occluder;
+}
+
+OcclusionBuffer::OcclusionBuffer() : myWidth(0), myHeight(0)
+{
+   myStats = OcclusionStats();
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+}
+
+void OcclusionBuffer::create(int width, int height)
+{
+   myWidth = std::max((width + 3) / 4 * 4, 4);
+   myHeight = std::max(height, 1);
+
+   // each level halves the one below, down to a single texel
+   myLevels.clear();
+   int w = myWidth, h = myHeight;
+   for (;;)
+   {
+      Level level;
+      level.width = w;
+      level.height = h;
+      level.depths.assign((size_t) w * h, 1.0f);
+      myLevels.push_back(level);
+      if (w == 1 && h == 1) break;
+      w = std::max((w + 1) / 2, 1);
+      h = std::max((h + 1) / 2, 1);
+   }
+}
+
+void OcclusionBuffer::begin(const glm::mat4& viewProjection)
+{
+   if (myLevels.empty())
+   {
+      create();
+   }
+   myViewProjection = viewProjection;
+   myOccluders.clear();
+   myStats = OcclusionStats();
+}
+
+void OcclusionBuffer::add(const OccluderMesh& occluder, const glm::mat4& transform)
+{
+   Occluder entry;
+   entry.mesh = &occluder;
+   entry.transform = transform;
+   myOccluders.push_back(entry);
+}
+
+void OcclusionBuffer::rasterize(int numThreads)
+{
+   AGL_PROFILE_SCOPE("OcclusionBuffer::rasterize");
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   int numOccluders = (int) myOccluders.size();
+   myTriangles.resize(numOccluders);
+   ParallelFor(0, numOccluders, [this](int i)
+   {
+      transform(myOccluders[i], myTriangles[i]);
+   }, numThreads);
+
+   myStats.occluders = numOccluders;
+   myStats.triangles = 0;
+   for (int i = 0; i < numOccluders; i++)
+   {
+      myStats.triangles += (int) myTriangles[i].size();
+   }
+
+   // each band gets the triangles that cover its rows
+   int numBands = (myHeight + BandRows - 1) / BandRows;
+   myBands.resize(numBands);
+   for (int b = 0; b < numBands; b++)
+   {
+      myBands[b].clear();
+   }
+   for (int i = 0; i < numOccluders; i++)
+   {
+      const std::vector<ScreenTriangle>& triangles = myTriangles[i];
+      for (size_t t = 0; t < triangles.size(); t++)
+      {
+         for (int b = triangles[t].y0 / BandRows; b <= triangles[t].y1 / BandRows; b++)
+         {
+            myBands[b].push_back(&triangles[t]);
+         }
+      }
+   }
+
+   // bands share no pixels, so they are filled without locks
+   ParallelFor(0, numBands, [this](int band)
+   {
+      rasterizeBand(band);
+   }, numThreads);
+   buildPyramid();
+
+   myStats.rasterMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionBuffer::transform(const Occluder& occluder, std::vector<ScreenTriangle>& triangles) const
+{
+   triangles.clear();
+   const OccluderMesh& mesh = *occluder.mesh;
+   glm::mat4 m = myViewProjection * occluder.transform;
+
+   std::vector<glm::vec4> clip(mesh.positions.size());
+   for (size_t i = 0; i < clip.size(); i++)
+   {
+      clip[i] = m * glm::vec4(mesh.positions[i], 1.0f);
+   }
+
+   float w = (float) myWidth, h = (float) myHeight;
+   for (int i = 0; i < mesh.numTriangles(); i++)
+   {
+      float x[3], y[3], z[3];
+      bool clipped = false;
+      for (int k = 0; k < 3; k++)
+      {
+         const glm::vec4& p = clip[mesh.indices[3*i + k]];
+         clipped = p.w <= 0.0f || p.z < -p.w; // in front of the near plane
+         if (clipped) break;
+         float inv = 1.0f / p.w;
+         x[k] = (p.x * inv * 0.5f + 0.5f) * w;
+         y[k] = (p.y * inv * 0.5f + 0.5f) * h;
+         z[k] = p.z * inv * 0.5f + 0.5f;
+      }
+      if (clipped) continue;
+
+      // pixels whose centers may be inside; none for triangles off the screen
+      ScreenTriangle t;
+      t.y0 = std::max(0, (int) std::ceil(std::min(y[0], std::min(y[1], y[2])) - 0.5f));
+      t.y1 = std::min(myHeight - 1, (int) std::floor(std::max(y[0], std::max(y[1], y[2])) - 0.5f));
+      t.x0 = std::max(0, (int) std::ceil(std::min(x[0], std::min(x[1], x[2])) - 0.5f));
+      t.x1 = std::min(myWidth - 1, (int) std::floor(std::max(x[0], std::max(x[1], x[2])) - 0.5f));
+      if (t.x0 > t.x1 || t.y0 > t.y1) continue;
+      t.x0 &= ~3; // whole groups of four pixels
+
+      // counterclockwise, so the inside is where all edge functions are positive
+      int a = 0, b = 1, c = 2;
+      float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+      if (area == 0.0f) continue;
+      if (area < 0.0f)
+      {
+         std::swap(b, c);
+         area = -area;
+      }
+      const int corners[3] = {a, b, c};
+      for (int k = 0; k < 3; k++)
+      {
+         int from = corners[(k + 1) % 3], to = corners[(k + 2) % 3];
+         t.ea[k] = y[from] - y[to];
+         t.eb[k] = x[to] - x[from];
+         t.ec[k] = -(t.ea[k] * x[from] + t.eb[k] * y[from]);
+      }
+
+      // depth is a plane in window coordinates
+      float dx1 = x[b] - x[a], dy1 = y[b] - y[a], dz1 = z[b] - z[a];
+      float dx2 = x[c] - x[a], dy2 = y[c] - y[a], dz2 = z[c] - z[a];
+      t.dzdx = (dz1 * dy2 - dz2 * dy1) / area;
+      t.dzdy = (dz2 * dx1 - dz1 * dx2) / area;
+      t.zc = z[a] - t.dzdx * x[a] - t.dzdy * y[a];
+      triangles.push_back(t);
+   }
+}
+
+void OcclusionBuffer::rasterizeBand(int band)
+{
+   int firstRow = band * BandRows;
+   int endRow = std::min(firstRow + BandRows, myHeight);
+   float* depths = &myLevels[0].depths[0];
+   std::fill(depths + (size_t) firstRow * myWidth, depths + (size_t) endRow * myWidth, 1.0f);
+
+   const std::vector<const ScreenTriangle*>& triangles = myBands[band];
+   for (size_t i = 0; i < triangles.size(); i++)
+   {
+      const ScreenTriangle& t = *triangles[i];
+      int y0 = std::max(firstRow, t.y0);
+      int y1 = std::min(endRow - 1, t.y1);
+      for (int y = y0; y <= y1; y++)
+      {
+         float py = y + 0.5f;
+         float* row = depths + (size_t) y * myWidth;
+#ifdef AGL_OCCLUSION_SSE
+         __m128 px = _mm_add_ps(_mm_set1_ps(t.x0 + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+         __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.ea[0]), px), _mm_set1_ps(t.eb[0] * py + t.ec[0]));
+         __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.ea[1]), px), _mm_set1_ps(t.eb[1] * py + t.ec[1]));
+         __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.ea[2]), px), _mm_set1_ps(t.eb[2] * py + t.ec[2]));
+         __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.dzdx), px), _mm_set1_ps(t.dzdy * py + t.zc));
+         __m128 step0 = _mm_set1_ps(4.0f * t.ea[0]);
+         __m128 step1 = _mm_set1_ps(4.0f * t.ea[1]);
+         __m128 step2 = _mm_set1_ps(4.0f * t.ea[2]);
+         __m128 stepZ = _mm_set1_ps(4.0f * t.dzdx);
+         __m128 zero = _mm_setzero_ps();
+         for (int x = t.x0; x <= t.x1; x += 4)
+         {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+               _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside))
+            {
+               __m128 old = _mm_loadu_ps(row + x);
+               __m128 nearer = _mm_min_ps(old, z);
+               _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+            e0 = _mm_add_ps(e0, step0);
+            e1 = _mm_add_ps(e1, step1);
+            e2 = _mm_add_ps(e2, step2);
+            z = _mm_add_ps(z, stepZ);
+         }
+#else
+         for (int x = t.x0; x <= t.x1; x++)
+         {
+            float px = x + 0.5f;
+            if (t.ea[0] * px + t.eb[0] * py + t.ec[0] < 0.0f || t.ea[1] * px + t.eb[1] * py + t.ec[1] < 0.0f ||
+               t.ea[2] * px + t.eb[2] * py + t.ec[2] < 0.0f)
+            {
+               continue;
+            }
+            row[x] = std::min(row[x], t.dzdx * px + t.dzdy * py + t.zc);
+         }
+#endif
+      }
+   }
+}
+
+void OcclusionBuffer::buildPyramid()
+{
+   // each texel keeps the farthest of the (up to) four below it
+   for (size_t l = 1; l < myLevels.size(); l++)
+   {
+      const Level& below = myLevels[l - 1];
+      Level& level = myLevels[l];
+      for (int y = 0; y < level.height; y++)
+      {
+         int y0 = 2 * y, y1 = std::min(2 * y + 1, below.height - 1);
+         for (int x = 0; x < level.width; x++)
+         {
+            int x0 = 2 * x, x1 = std::min(2 * x + 1, below.width - 1);
+            const float* row0 = &below.depths[(size_t) y0 * below.width];
+            const float* row1 = &below.depths[(size_t) y1 * below.width];
+            level.depths[(size_t) y * level.width + x] =
+               std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+         }
+      }
+   }
+}
+
+bool OcclusionBuffer::isVisible(const glm::vec3& minBounds, const glm::vec3& maxBounds,
+   const glm::mat4& transform) const
+{
+   if (myStats.triangles == 0) return true;
+
+   // the corners of the box are the first one plus any of its three edges
+   glm::mat4 m = myViewProjection * transform;
+   glm::vec4 base = m * glm::vec4(minBounds, 1.0f);
+   glm::vec3 size = maxBounds - minBounds;
+   glm::vec4 edges[3] = {m[0] * size.x, m[1] * size.y, m[2] * size.z};
+
+   float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+   for (int corner = 0; corner < 8; corner++)
+   {
+      glm::vec4 p = base;
+      if (corner & 1) p += edges[0];
+      if (corner & 2) p += edges[1];
+      if (corner & 4) p += edges[2];
+      if (p.w <= 0.0f || p.z < -p.w) return true; // crosses the near plane
+
+      float inv = 1.0f / p.w;
+      float x = (p.x * inv * 0.5f + 0.5f) * myWidth;
+      float y = (p.y * inv * 0.5f + 0.5f) * myHeight;
+      minX = std::min(minX, x);
+      maxX = std::max(maxX, x);
+      minY = std::min(minY, y);
+      maxY = std::max(maxY, y);
+      minZ = std::min(minZ, p.z * inv * 0.5f + 0.5f);
+   }
+
+   int x0 = std::max(0, (int) std::floor(minX));
+   int x1 = std::min(myWidth - 1, (int) std::floor(maxX));
+   int y0 = std::max(0, (int) std::floor(minY));
+   int y1 = std::min(myHeight - 1, (int) std::floor(maxY));
+   if (x0 > x1 || y0 > y1) return true; // off the screen; left to frustum culling
+
+   // the finest level where the box covers at most two texels each way
+   int l = 0;
+   while (l + 1 < (int) myLevels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+   {
+      l++;
+   }
+   const Level& level = myLevels[l];
+   for (int y = y0 >> l; y <= (y1 >> l); y++)
+   {
+      for (int x = x0 >> l; x <= (x1 >> l); x++)
+      {
+         if (minZ < level.depths[(size_t) y * level.width + x]) return true;
+      }
+   }
+   return false;
+}
+
+float OcclusionBuffer::depth(int x, int y, int level) const
+{
+   const Level& l = myLevels[level];
+   return l.depths[(size_t) y * l.width + x];
+}
@@ -0,0 +1,120 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef occlusion_H_
+#define occlusion_H_
+
+#include <vector>
+#include "AGLM.h"
+#include "mesh.h"
+
+namespace agl {
+
+   // A coarse stand-in for a model, rasterized when the model hides others
+   struct OccluderMesh
+   {
+      std::vector<glm::vec3> positions;
+      std::vector<unsigned int> indices;
+
+      int numTriangles() const { return (int) indices.size() / 3; }
+   };
+
+   // Keep the maxTriangles largest triangles of mesh. They are part of its
+   // surface, so the occluder never hides anything the model itself would
+   // not; simplifying by merging vertices could move triangles outside it.
+   OccluderMesh MakeOccluder(const Mesh& mesh, int maxTriangles = 512);
+
+   // What the last rasterize did
+   struct OcclusionStats
+   {
+      int occluders;   // added since begin
+      int triangles;   // rasterized, after near plane and screen rejection
+      double rasterMs; // transform, rasterization and pyramid
+   };
+
+   // A small software depth buffer for occlusion culling.
+   //
+   // Occluders are rasterized on the CPU into a low resolution depth buffer,
+   // split into horizontal bands that are filled on separate threads, four
+   // pixels at a time with SSE where available. A pyramid of that buffer,
+   // each level holding the farthest depth of four texels below, lets a
+   // bounding box be tested against a few texels: the box is hidden if its
+   // nearest point is behind the farthest occluder everywhere it covers.
+   //
+   // Depths are window z in [0, 1] for the view projection given to begin.
+   // Triangles crossing the near plane are not rasterized, and boxes crossing
+   // it are always visible, so both errors keep objects rather than cull them.
+   class OcclusionBuffer
+   {
+   public:
+      OcclusionBuffer();
+      virtual ~OcclusionBuffer();
+
+      OcclusionBuffer(const OcclusionBuffer&) = delete;
+      OcclusionBuffer& operator=(const OcclusionBuffer&) = delete;
+
+      // Allocate the buffer; width is rounded up to a multiple of 4
+      void create(int width = 256, int height = 128);
+
+      // Clear the depths and start a frame
+      void begin(const glm::mat4& viewProjection);
+
+      // Queue an occluder placed by transform. It is only read by rasterize,
+      // and must stay alive until then.
+      void add(const OccluderMesh& occluder, const glm::mat4& transform);
+
+      // Rasterize the queued occluders and build the pyramid,
+      // on up to numThreads threads (<= 0 uses all cores)
+      void rasterize(int numThreads = 0);
+
+      // Return true unless the box, placed by transform, is hidden behind the
+      // occluders. Safe to call from several threads after rasterize.
+      bool isVisible(const glm::vec3& minBounds, const glm::vec3& maxBounds,
+         const glm::mat4& transform) const;
+
+      int width() const { return myWidth; }
+      int height() const { return myHeight; }
+      int numLevels() const { return (int) myLevels.size(); }
+
+      // Depth of texel (x, y) of a pyramid level; level 0 is the full buffer
+      float depth(int x, int y, int level = 0) const;
+
+      const OcclusionStats& stats() const { return myStats; }
+
+   private:
+      // A triangle in window coordinates, ready to rasterize
+      struct ScreenTriangle
+      {
+         int x0, x1, y0, y1;         // pixels it may cover; x0 is a multiple of 4
+         float ea[3], eb[3], ec[3];  // edge functions, ea * x + eb * y + ec >= 0 inside
+         float dzdx, dzdy, zc;       // depth plane
+      };
+
+      struct Level
+      {
+         int width;
+         int height;
+         std::vector<float> depths;
+      };
+
+      struct Occluder
+      {
+         const OccluderMesh* mesh;
+         glm::mat4 transform;
+      };
+
+      void transform(const Occluder& occluder, std::vector<ScreenTriangle>& triangles) const;
+      void rasterizeBand(int band);
+      void buildPyramid();
+
+   private:
+      int myWidth;
+      int myHeight;
+      glm::mat4 myViewProjection;
+      std::vector<Level> myLevels;
+      std::vector<Occluder> myOccluders;
+      std::vector<std::vector<ScreenTriangle> > myTriangles; // per occluder
+      std::vector<std::vector<const ScreenTriangle*> > myBands; // triangles covering each band of rows
+      OcclusionStats myStats;
+   };
+}
+
+#endif
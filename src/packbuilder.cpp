@@ -0,0 +1,56 @@
+// Haverford College, Jiajie Ma, 2021
+//
+// mesh-pack: decode every model in a directory into one model pack
+//
+//    mesh-pack [model directory] [output file]
+//
+// Defaults to ../models/ and ../models/models.pack, which the viewer
+// maps at startup in place of parsing the .ply files. Models changed since
+// the pack was built are read from their .ply files until it is rebuilt.
+
+#include <iostream>
+#include "catalog.h"
+#include "mesh.h"
+#include "modelpack.h"
+
+using namespace std;
+using namespace agl;
+
+int main(int argc, char** argv)
+{
+   std::string dir = argc > 1 ? argv[1] : "../models/";
+   if (dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') dir += "/";
+   std::string output = argc > 2 ? argv[2] : dir + "models.pack";
+
+   ModelCatalog catalog;
+   catalog.scan(dir);
+
+   ModelPackWriter writer;
+   if (!writer.open(output))
+   {
+      return 1;
+   }
+
+   int count = 0;
+   for (int i = 0; i < catalog.size(); i++)
+   {
+      const ModelInfo& info = catalog.model(i);
+      if (!info.valid) continue;
+
+      Mesh mesh;
+      if (!mesh.loadPLY(catalog.fullPath(i)) || !writer.add(info.path, mesh, info.fileSize, info.modified))
+      {
+         cout << "Skipping " << info.path << endl;
+         continue;
+      }
+      count++;
+   }
+
+   if (!writer.close())
+   {
+      cout << "ERROR: Cannot finish model pack: " << output << endl;
+      return 1;
+   }
+   cout << "Wrote " << count << " models to " << output << endl;
+   return 0;
+}
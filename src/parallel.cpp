@@ -0,0 +1,122 @@
+// Haverford College, Jiajie Ma, 2021
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+   // One ParallelFor call, shared by the caller and the workers that join it
+   struct Job
+   {
+      std::atomic<int> next;
+      int end;
+      const std::function<void(int)>* fn;
+      int seats;   // workers that may still join; guarded by the pool mutex
+      int running; // workers in run(); guarded by the pool mutex
+
+      void run()
+      {
+         for (int i = next++; i < end; i = next++)
+         {
+            (*fn)(i);
+         }
+      }
+   };
+
+   // Threads that live for the rest of the program, so a call costs a wake-up
+   // instead of creating and joining threads. Callers never wait for a worker
+   // that has not joined their job yet, so calls may nest and may come from
+   // several threads at once.
+   class WorkerPool
+   {
+   public:
+      void run(Job& job, int numWorkers)
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         while ((int) myThreads.size() < numWorkers)
+         {
+            myThreads.push_back(std::thread(&WorkerPool::work, this));
+         }
+         job.seats = numWorkers;
+         job.running = 0;
+         myJobs.push_back(&job);
+         if (numWorkers == 1) myWake.notify_one();
+         else myWake.notify_all();
+         lock.unlock();
+
+         job.run();
+
+         // every index is taken; only wait for the workers that joined
+         lock.lock();
+         std::deque<Job*>::iterator it = std::find(myJobs.begin(), myJobs.end(), &job);
+         if (it != myJobs.end()) myJobs.erase(it);
+         myDone.wait(lock, [&job]() { return job.running == 0; });
+      }
+
+   private:
+      void work()
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         for (;;)
+         {
+            myWake.wait(lock, [this]() { return !myJobs.empty(); });
+            Job* job = myJobs.front();
+            if (--job->seats == 0) myJobs.pop_front();
+            job->running++;
+            lock.unlock();
+
+            job->run();
+
+            lock.lock();
+            if (--job->running == 0) myDone.notify_all();
+         }
+      }
+
+   private:
+      std::mutex myMutex;
+      std::condition_variable myWake;
+      std::condition_variable myDone;
+      std::deque<Job*> myJobs; // with seats left
+      std::vector<std::thread> myThreads;
+   };
+
+   // never destroyed: workers may still be waiting when the program exits
+   WorkerPool& Pool()
+   {
+      static WorkerPool* pool = new WorkerPool();
+      return *pool;
+   }
+}
+
+int agl::NumWorkerThreads()
+{
+   unsigned int n = std::thread::hardware_concurrency();
+   return n > 0 ? (int) n : 4;
+}
+
+void agl::ParallelFor(int begin, int end, const std::function<void(int)>& fn, int numThreads)
+{
+   if (end <= begin) return;
+   if (numThreads <= 0) numThreads = NumWorkerThreads();
+   numThreads = std::min(numThreads, end - begin);
+
+   Job job;
+   job.next = begin;
+   job.end = end;
+   job.fn = &fn;
+   if (numThreads <= 1)
+   {
+      job.run();
+      return;
+   }
+
+   // the calling thread is one of the workers
+   Pool().run(job, numThreads - 1);
+}
@@ -0,0 +1,19 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef parallel_H_
+#define parallel_H_
+
+#include <functional>
+
+namespace agl {
+
+   // Return the number of worker threads to use when none is specified
+   int NumWorkerThreads();
+
+   // Call fn(i) for every i in [begin, end) on up to numThreads threads.
+   // Indices are handed out one at a time, so uneven work balances itself.
+   // numThreads <= 0 uses NumWorkerThreads(). Returns when all calls finish.
+   // The threads are kept in a pool between calls; calls may nest.
+   void ParallelFor(int begin, int end, const std::function<void(int)>& fn, int numThreads = 0);
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Haverford College, Jiajie Ma, 2021
+#include "plyheader.h"
+#include <sstream>
+
+using namespace std;
+using namespace agl;
+
+int PlyElement::find(const std::string& property) const
+{
+   for (int i = 0; i < (int) properties.size(); i++)
+   {
+      if (properties[i].name == property) return i;
+   }
+   return -1;
+}
+
+PlyHeader::PlyHeader()
+{
+}
+
+bool PlyHeader::read(std::istream& file)
+{
+   format = "";
+   elements.clear();
+
+   string line;
+   if (!getline(file, line) || line.compare(0, 3, "ply") != 0)
+   {
+      return false;
+   }
+
+   while (getline(file, line))
+   {
+      // tolerate files saved with CRLF line endings
+      if (!line.empty() && line[line.size() - 1] == '\r')
+      {
+         line.erase(line.size() - 1);
+      }
+
+      istringstream words(line);
+      string keyword;
+      words >> keyword;
+      if (keyword == "format")
+      {
+         words >> format;
+      }
+      else if (keyword == "element")
+      {
+         PlyElement element;
+         element.count = 0;
+         words >> element.name >> element.count;
+         elements.push_back(element);
+      }
+      else if (keyword == "property")
+      {
+         if (elements.empty()) return false;
+
+         PlyProperty property;
+         words >> property.type;
+         if (property.type == "list")
+         {
+            words >> property.countType >> property.type;
+         }
+         words >> property.name;
+         elements.back().properties.push_back(property);
+      }
+      else if (keyword == "end_header")
+      {
+         return !format.empty();
+      }
+   }
+   return false;
+}
+
+const PlyElement* PlyHeader::element(const std::string& name) const
+{
+   for (size_t i = 0; i < elements.size(); i++)
+   {
+      if (elements[i].name == name) return &elements[i];
+   }
+   return 0;
+}
+
+int PlyHeader::numVertices() const
+{
+   const PlyElement* e = element("vertex");
+   return e ? e->count : 0;
+}
+
+int PlyHeader::numFaces() const
+{
+   const PlyElement* e = element("face");
+   return e ? e->count : 0;
+}
+
+bool PlyHeader::hasVertexProperty(const std::string& name) const
+{
+   const PlyElement* e = element("vertex");
+   return e && e->find(name) >= 0;
+}
+
+std::string PlyHeader::layout(const std::string& name) const
+{
+   const PlyElement* e = element(name);
+   if (!e) return "";
+
+   string result;
+   for (size_t i = 0; i < e->properties.size(); i++)
+   {
+      const PlyProperty& p = e->properties[i];
+      if (i > 0) result += ",";
+      result += p.name + ":";
+      if (!p.countType.empty()) result += "list:" + p.countType + ":";
+      result += p.type;
+   }
+   return result;
+}
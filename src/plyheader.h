@@ -0,0 +1,58 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef plyheader_H_
+#define plyheader_H_
+
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace agl {
+
+   struct PlyProperty
+   {
+      std::string name;
+      std::string type;      // value type, e.g. float or uchar
+      std::string countType; // type of the list length; empty if not a list
+   };
+
+   struct PlyElement
+   {
+      std::string name;
+      int count;
+      std::vector<PlyProperty> properties;
+
+      // Return the index of the given property, or -1 if it does not exist
+      int find(const std::string& property) const;
+   };
+
+   // The header of a .ply file: everything up to and including end_header
+   class PlyHeader
+   {
+   public:
+      PlyHeader();
+
+      // Parse the header, leaving file positioned at the first line of data
+      // Returns true if successfull. false otherwise.
+      bool read(std::istream& file);
+
+      // Return the given element, or 0 if it does not exist
+      const PlyElement* element(const std::string& name) const;
+
+      // Return number of vertices, or 0 if there is no vertex element
+      int numVertices() const;
+
+      // Return number of faces, or 0 if there is no face element
+      int numFaces() const;
+
+      // Return true if the vertex element has the given property
+      bool hasVertexProperty(const std::string& name) const;
+
+      // Property list of an element as "name:type,..." (lists as "name:list:count:type")
+      std::string layout(const std::string& element) const;
+
+      std::string format; // ascii, binary_little_endian or binary_big_endian
+      std::vector<PlyElement> elements;
+   };
+}
+
+#endif
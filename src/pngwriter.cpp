@@ -0,0 +1,577 @@
+// Haverford College, Jiajie Ma, 2021
+#include "pngwriter.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "parallel.h"
+#include "profiler.h"
+#include "stb/stb_image_write.h"
+#ifdef AGL_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Filtered bytes deflated by each task
+static const size_t BlockBytes = 256 * 1024;
+
+// Deflate looks back at most this far
+static const size_t WindowBytes = 32 * 1024;
+
+#ifndef AGL_HAVE_ZLIB
+// Without zlib, larger images are streamed uncompressed rather than kept for stb_image_write
+static const size_t BufferedBytes = 64 * 1024 * 1024;
+
+// The most a stored deflate block holds
+static const size_t StoredBytes = 65535;
+
+// Stored blocks are gathered into IDATs of about this size
+static const size_t StoredChunkBytes = 4 * 1024 * 1024;
+#endif
+
+// In stb_image_write, without a declaration in its header
+unsigned char* stbi_write_png_to_mem(unsigned char* pixels, int stride_bytes, int x, int y, int n, int* out_len);
+
+namespace {
+
+#ifdef AGL_HAVE_ZLIB
+   unsigned long UpdateCrc(unsigned long crc, const unsigned char* data, size_t size)
+   {
+      return crc32(crc, data, (uInt) size);
+   }
+#else
+   struct CrcTable
+   {
+      unsigned long entries[256];
+
+      CrcTable()
+      {
+         for (unsigned long n = 0; n < 256; n++)
+         {
+            unsigned long c = n;
+            for (int k = 0; k < 8; k++)
+            {
+               c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+         }
+      }
+   };
+
+   // CRC-32 as PNG and zlib compute it, continuing from crc (0 to start)
+   unsigned long UpdateCrc(unsigned long crc, const unsigned char* data, size_t size)
+   {
+      static const CrcTable table;
+      crc ^= 0xffffffffUL;
+      for (size_t i = 0; i < size; i++)
+      {
+         crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      }
+      return crc ^ 0xffffffffUL;
+   }
+
+   // Adler-32, continuing from adler (1 to start)
+   unsigned long UpdateAdler(unsigned long adler, const unsigned char* data, size_t size)
+   {
+      unsigned long a = adler & 0xffff;
+      unsigned long b = adler >> 16;
+      while (size > 0)
+      {
+         // the largest run before the sums could overflow 32 bits
+         size_t n = std::min<size_t>(size, 5552);
+         size -= n;
+         for (; n > 0; n--)
+         {
+            a += *data++;
+            b += a;
+         }
+         a %= 65521;
+         b %= 65521;
+      }
+      return (b << 16) | a;
+   }
+#endif
+
+   void PutBigEndian(unsigned char* out, unsigned long value)
+   {
+      out[0] = (unsigned char) (value >> 24);
+      out[1] = (unsigned char) (value >> 16);
+      out[2] = (unsigned char) (value >> 8);
+      out[3] = (unsigned char) value;
+   }
+
+   unsigned char Paeth(int a, int b, int c)
+   {
+      int p = a + b - c;
+      int pa = abs(p - a);
+      int pb = abs(p - b);
+      int pc = abs(p - c);
+      if (pa <= pb && pa <= pc) return (unsigned char) a;
+      if (pb <= pc) return (unsigned char) b;
+      return (unsigned char) c;
+   }
+
+   // Apply PNG filter type (0-4) to row, whose previous row is prior
+   void FilterRow(int type, const unsigned char* row, const unsigned char* prior,
+      size_t rowBytes, int bpp, unsigned char* out)
+   {
+      size_t i = 0;
+      switch (type)
+      {
+      case 0:
+         memcpy(out, row, rowBytes);
+         break;
+      case 1:
+         for (; i < (size_t) bpp; i++) out[i] = row[i];
+         for (; i < rowBytes; i++) out[i] = (unsigned char) (row[i] - row[i - bpp]);
+         break;
+      case 2:
+         for (; i < rowBytes; i++) out[i] = (unsigned char) (row[i] - prior[i]);
+         break;
+      case 3:
+         for (; i < (size_t) bpp; i++) out[i] = (unsigned char) (row[i] - (prior[i] >> 1));
+         for (; i < rowBytes; i++) out[i] = (unsigned char) (row[i] - ((row[i - bpp] + prior[i]) >> 1));
+         break;
+      default:
+         for (; i < (size_t) bpp; i++) out[i] = (unsigned char) (row[i] - prior[i]);
+         for (; i < rowBytes; i++) out[i] = (unsigned char) (row[i] - Paeth(row[i - bpp], prior[i], prior[i - bpp]));
+         break;
+      }
+   }
+
+   // The usual heuristic: the filter whose bytes, as signed values, sum smallest
+   unsigned long FilterCost(const unsigned char* filtered, size_t rowBytes)
+   {
+      unsigned long sum = 0;
+      for (size_t i = 0; i < rowBytes; i++)
+      {
+         sum += (unsigned long) abs((int) (signed char) filtered[i]);
+      }
+      return sum;
+   }
+}
+
+PngWriter::PngWriter() : myMemory(0), myMemoryStart(0), myWidth(0), myHeight(0), myChannels(0), myLevel(PngDefault),
+   myNumThreads(0), myRows(0), myFailed(false), myStored(false), myAdler(1)
+{
+}
+
+PngWriter::~PngWriter()
+{
+   if (isOpen())
+   {
+      close();
+   }
+}
+
+bool PngWriter::open(const std::string& filename, int width, int height, int channels,
+   PngLevel level, int numThreads)
+{
+   if (isOpen())
+   {
+      close();
+   }
+   if (width <= 0 || height <= 0 || channels < 1 || channels > 4)
+   {
+      cout << "Cannot write a " << width << "x" << height << " PNG with "
+         << channels << " channels" << endl;
+      return false;
+   }
+
+   myFile.open(filename.c_str(), ios::binary);
+   if (!myFile)
+   {
+      cout << "Cannot write " << filename << endl;
+      return false;
+   }
+   myFilename = filename;
+   start(width, height, channels, level, numThreads);
+   return true;
+}
+
+bool PngWriter::open(std::vector<unsigned char>& png, int width, int height, int channels,
+   PngLevel level, int numThreads)
+{
+   if (isOpen())
+   {
+      close();
+   }
+   if (width <= 0 || height <= 0 || channels < 1 || channels > 4)
+   {
+      cout << "Cannot encode a " << width << "x" << height << " PNG with "
+         << channels << " channels" << endl;
+      return false;
+   }
+
+   myMemory = &png;
+   myMemoryStart = png.size();
+   myFilename = "a PNG in memory";
+   start(width, height, channels, level, numThreads);
+   return true;
+}
+
+void PngWriter::start(int width, int height, int channels, PngLevel level, int numThreads)
+{
+   myWidth = width;
+   myHeight = height;
+   myChannels = channels;
+   myLevel = level;
+   myNumThreads = numThreads;
+   myRows = 0;
+   myFailed = false;
+   myAdler = 1;
+   myPrior.assign((size_t) width * channels, 0);
+   myWindow.clear();
+   myPixels.clear();
+   myStored = false;
+
+#ifndef AGL_HAVE_ZLIB
+   // stb_image_write compresses, but needs every row at once
+   myStored = (size_t) width * height * channels > BufferedBytes;
+   if (!myStored) return;
+#endif
+   static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+   static const unsigned char colorTypes[5] = {0, 0, 4, 2, 6};
+   put(signature, sizeof(signature));
+
+   unsigned char header[13];
+   PutBigEndian(header, (unsigned long) width);
+   PutBigEndian(header + 4, (unsigned long) height);
+   header[8] = 8; // bits per channel
+   header[9] = colorTypes[channels];
+   header[10] = header[11] = header[12] = 0; // deflate, adaptive filters, no interlace
+   writeChunk("IHDR", header, sizeof(header));
+
+   // the zlib header may sit in an IDAT of its own
+   static const unsigned char levels[3] = {0x01, 0x9C, 0xDA};
+   unsigned char zlibHeader[2] = {0x78, myStored ? (unsigned char) 0x01 : levels[level]};
+   writeChunk("IDAT", zlibHeader, sizeof(zlibHeader));
+}
+
+void PngWriter::put(const void* data, size_t size)
+{
+   if (myMemory)
+   {
+      const unsigned char* bytes = (const unsigned char*) data;
+      myMemory->insert(myMemory->end(), bytes, bytes + size);
+   }
+   else
+   {
+      myFile.write((const char*) data, size);
+   }
+}
+
+void PngWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+{
+   unsigned char word[4];
+   PutBigEndian(word, (unsigned long) size);
+   put(word, 4);
+   put(type, 4);
+   put(data, size);
+
+   unsigned long crc = UpdateCrc(0L, (const unsigned char*) type, 4);
+   if (size > 0)
+   {
+      crc = UpdateCrc(crc, data, size); // a null data would reset zlib's CRC
+   }
+   PutBigEndian(word, crc);
+   put(word, 4);
+}
+
+void PngWriter::filterRows(const unsigned char* rows, int first, int count, int stride,
+   unsigned char* filtered) const
+{
+   size_t rowBytes = (size_t) myWidth * myChannels;
+   std::vector<unsigned char> trial(myLevel == PngFastest ? 0 : rowBytes);
+   for (int r = first; r < first + count; r++)
+   {
+      const unsigned char* row = rows + (size_t) r * stride;
+      const unsigned char* prior = r > 0 ? row - stride : &myPrior[0];
+      unsigned char* out = filtered + (size_t) r * (rowBytes + 1);
+      if (myLevel == PngFastest)
+      {
+         out[0] = 2;
+         FilterRow(2, row, prior, rowBytes, myChannels, out + 1);
+         continue;
+      }
+
+      // keep the cheapest filter in out, trying the others in trial
+      out[0] = 0;
+      FilterRow(0, row, prior, rowBytes, myChannels, out + 1);
+      unsigned long best = FilterCost(out + 1, rowBytes);
+      for (int type = 1; type < 5; type++)
+      {
+         FilterRow(type, row, prior, rowBytes, myChannels, &trial[0]);
+         unsigned long cost = FilterCost(&trial[0], rowBytes);
+         if (cost < best)
+         {
+            best = cost;
+            out[0] = (unsigned char) type;
+            memcpy(out + 1, &trial[0], rowBytes);
+         }
+      }
+   }
+}
+
+bool PngWriter::write(const unsigned char* rows, int numRows, int stride)
+{
+   AGL_PROFILE_SCOPE("PngWriter::write");
+   if (!isOpen() || myFailed) return false;
+   numRows = std::min(numRows, myHeight - myRows);
+   if (numRows <= 0) return true;
+
+   size_t rowBytes = (size_t) myWidth * myChannels;
+#ifndef AGL_HAVE_ZLIB
+   if (!myStored)
+   {
+      for (int r = 0; r < numRows; r++)
+      {
+         const unsigned char* row = rows + (size_t) r * stride;
+         myPixels.insert(myPixels.end(), row, row + rowBytes);
+      }
+      myRows += numRows;
+      return true;
+   }
+
+   // unfiltered rows in stored blocks; filters only help compression
+   size_t filteredRow = rowBytes + 1;
+   std::vector<unsigned char> filtered(filteredRow * numRows);
+   for (int r = 0; r < numRows; r++)
+   {
+      filtered[r * filteredRow] = 0;
+      memcpy(&filtered[r * filteredRow + 1], rows + (size_t) r * stride, rowBytes);
+   }
+   myAdler = UpdateAdler(myAdler, &filtered[0], filtered.size());
+
+   std::vector<unsigned char> chunk;
+   chunk.reserve(std::min(filtered.size(), StoredChunkBytes) + 5 * (StoredChunkBytes / StoredBytes + 1));
+   for (size_t start = 0; start < filtered.size(); start += StoredBytes)
+   {
+      size_t size = std::min(StoredBytes, filtered.size() - start);
+      unsigned char header[5] = {0x00, (unsigned char) size, (unsigned char) (size >> 8),
+         (unsigned char) ~size, (unsigned char) (~size >> 8)};
+      chunk.insert(chunk.end(), header, header + 5);
+      chunk.insert(chunk.end(), filtered.begin() + start, filtered.begin() + start + size);
+      if (chunk.size() >= StoredChunkBytes || start + size == filtered.size())
+      {
+         writeChunk("IDAT", &chunk[0], chunk.size());
+         chunk.clear();
+      }
+   }
+
+   myRows += numRows;
+   if (!good())
+   {
+      myFailed = true;
+      cout << "Cannot write " << myFilename << endl;
+   }
+   return !myFailed;
+#else
+   // filter every row first: each block is primed with the bytes before it
+   size_t filteredRow = rowBytes + 1;
+   int blockRows = (int) std::max<size_t>(BlockBytes / filteredRow, 1);
+   int numBlocks = (numRows + blockRows - 1) / blockRows;
+   std::vector<unsigned char> filtered(filteredRow * numRows);
+   ParallelFor(0, numBlocks, [&](int b)
+   {
+      int first = b * blockRows;
+      filterRows(rows, first, std::min(blockRows, numRows - first), stride, &filtered[0]);
+   }, myNumThreads);
+
+   static const int zlibLevels[3] = {1, 6, 9};
+   static const int strategies[3] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_FILTERED};
+   std::vector<std::vector<unsigned char> > blocks(numBlocks);
+   std::vector<unsigned long> adlers(numBlocks), crcs(numBlocks);
+   std::vector<int> failed(numBlocks, 0);
+   ParallelFor(0, numBlocks, [&](int b)
+   {
+      size_t start = (size_t) b * blockRows * filteredRow;
+      size_t size = std::min((size_t) blockRows * filteredRow, filtered.size() - start);
+
+      z_stream stream;
+      memset(&stream, 0, sizeof(stream));
+      if (deflateInit2(&stream, zlibLevels[myLevel], Z_DEFLATED, -15, 8, strategies[myLevel]) != Z_OK)
+      {
+         failed[b] = 1;
+         return;
+      }
+
+      // the window before this block, partly from earlier writes
+      std::vector<unsigned char> dictionary;
+      if (start < WindowBytes)
+      {
+         size_t fromWindow = std::min(WindowBytes - start, myWindow.size());
+         dictionary.assign(myWindow.end() - fromWindow, myWindow.end());
+      }
+      size_t fromHere = std::min(start, WindowBytes);
+      dictionary.insert(dictionary.end(), filtered.begin() + (start - fromHere), filtered.begin() + start);
+      if (!dictionary.empty())
+      {
+         deflateSetDictionary(&stream, &dictionary[0], (uInt) dictionary.size());
+      }
+
+      // a sync flush ends on a byte boundary, with an empty stored block
+      std::vector<unsigned char>& out = blocks[b];
+      out.resize(deflateBound(&stream, (uLong) size) + 16);
+      stream.next_in = &filtered[start];
+      stream.avail_in = (uInt) size;
+      stream.next_out = &out[0];
+      stream.avail_out = (uInt) out.size();
+      // the flush is only complete once deflate leaves room in the output
+      int status;
+      for (;;)
+      {
+         status = deflate(&stream, Z_SYNC_FLUSH);
+         if (status != Z_OK || stream.avail_out != 0) break;
+         out.resize(out.size() * 2);
+         stream.next_out = &out[stream.total_out];
+         stream.avail_out = (uInt) (out.size() - stream.total_out);
+      }
+      failed[b] = status != Z_OK;
+      out.resize(stream.total_out);
+      deflateEnd(&stream);
+
+      adlers[b] = adler32(1L, &filtered[start], (uInt) size);
+      crcs[b] = crc32(0L, out.empty() ? Z_NULL : &out[0], (uInt) out.size());
+   }, myNumThreads);
+
+   // join the blocks into one IDAT, whose CRC also covers its type
+   size_t total = 0;
+   unsigned long crc = crc32(0L, (const Bytef*) "IDAT", 4);
+   for (int b = 0; b < numBlocks; b++)
+   {
+      if (failed[b])
+      {
+         myFailed = true;
+         cout << "Cannot compress " << myFilename << endl;
+         return false;
+      }
+      size_t start = (size_t) b * blockRows * filteredRow;
+      size_t size = std::min((size_t) blockRows * filteredRow, filtered.size() - start);
+      myAdler = adler32_combine(myAdler, adlers[b], (z_off_t) size);
+      crc = crc32_combine(crc, crcs[b], (z_off_t) blocks[b].size());
+      total += blocks[b].size();
+   }
+
+   if (total < 0x7fffffff)
+   {
+      unsigned char word[4];
+      PutBigEndian(word, (unsigned long) total);
+      put(word, 4);
+      put("IDAT", 4);
+      for (int b = 0; b < numBlocks; b++)
+      {
+         put(blocks[b].data(), blocks[b].size());
+      }
+      PutBigEndian(word, crc);
+      put(word, 4);
+   }
+   else
+   {
+      // chunks are limited to 2 GB
+      for (int b = 0; b < numBlocks; b++)
+      {
+         writeChunk("IDAT", blocks[b].data(), blocks[b].size());
+      }
+   }
+
+   // later writes are filtered against the last row and primed with the last 32 KB
+   const unsigned char* last = rows + (size_t) (numRows - 1) * stride;
+   myPrior.assign(last, last + rowBytes);
+   myWindow.insert(myWindow.end(), filtered.end() - std::min(filtered.size(), WindowBytes), filtered.end());
+   if (myWindow.size() > WindowBytes)
+   {
+      myWindow.erase(myWindow.begin(), myWindow.end() - WindowBytes);
+   }
+
+   myRows += numRows;
+   if (!good())
+   {
+      myFailed = true;
+      cout << "Cannot write " << myFilename << endl;
+   }
+   return !myFailed;
+#endif
+}
+
+bool PngWriter::close()
+{
+   if (!isOpen()) return false;
+   bool complete = myRows == myHeight && !myFailed;
+   if (myRows != myHeight)
+   {
+      cout << "Only " << myRows << " of " << myHeight << " rows written to " << myFilename << endl;
+   }
+
+   if (myStored)
+   {
+      // an empty final stored block, then the checksum of every filtered byte
+      unsigned char end[9] = {0x01, 0x00, 0x00, 0xff, 0xff};
+      PutBigEndian(end + 5, myAdler);
+      writeChunk("IDAT", end, sizeof(end));
+      writeChunk("IEND", 0, 0);
+      complete = complete && good();
+   }
+   else
+   {
+#ifdef AGL_HAVE_ZLIB
+      // an empty final block with fixed codes, then the checksum of every filtered byte
+      unsigned char end[6] = {0x03, 0x00};
+      PutBigEndian(end + 2, myAdler);
+      writeChunk("IDAT", end, sizeof(end));
+      writeChunk("IEND", 0, 0);
+      complete = complete && good();
+#else
+      if (complete)
+      {
+         int rowBytes = myWidth * myChannels;
+         int size = 0;
+         unsigned char* png = stbi_write_png_to_mem(&myPixels[0], rowBytes, myWidth, myHeight, myChannels, &size);
+         complete = png != 0;
+         if (png)
+         {
+            put(png, size);
+            free(png);
+         }
+         complete = complete && good();
+      }
+      std::vector<unsigned char>().swap(myPixels);
+#endif
+   }
+
+   if (myMemory)
+   {
+      if (!complete)
+      {
+         myMemory->resize(myMemoryStart);
+      }
+      myMemory = 0;
+      return complete;
+   }
+   myFile.close();
+   if (!complete)
+   {
+      remove(myFilename.c_str()); // don't leave a file that can't be read
+   }
+   return complete;
+}
+
+bool agl::WritePng(const std::string& filename, int width, int height, int channels,
+   const unsigned char* pixels, int stride, PngLevel level, int numThreads)
+{
+   PngWriter writer;
+   return writer.open(filename, width, height, channels, level, numThreads) &&
+      writer.write(pixels, height, stride) && writer.close();
+}
+
+bool agl::EncodePng(std::vector<unsigned char>& png, int width, int height, int channels,
+   const unsigned char* pixels, int stride, PngLevel level, int numThreads)
+{
+   png.clear();
+   PngWriter writer;
+   return writer.open(png, width, height, channels, level, numThreads) &&
+      writer.write(pixels, height, stride) && writer.close();
+}
@@ -0,0 +1,97 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef pngwriter_H_
+#define pngwriter_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace agl {
+
+   // Trades encoding time for file size
+   enum PngLevel
+   {
+      PngFastest,  // the Up filter on every row, fastest deflate
+      PngDefault,  // the best of the five filters for each row, default deflate
+      PngSmallest  // the best filter for each row, slowest deflate
+   };
+
+   // Writes a PNG a few rows at a time, so large images can be written
+   // as they are produced.
+   //
+   // Each write filters and deflates its rows in blocks of about 256 KB on
+   // separate threads. A block is a raw deflate stream primed with the 32 KB
+   // before it and ended with a sync flush, so the blocks join into one zlib
+   // stream that compresses almost as well as a serial one. Their Adler-32
+   // and CRC-32 checksums are joined with adler32_combine and crc32_combine.
+   //
+   // Without zlib (AGL_HAVE_ZLIB), the rows are kept until close and written
+   // by stb_image_write on one thread. Images of more than 64 MB are instead
+   // written as they come in stored (uncompressed) deflate blocks, so the
+   // memory used stays bounded however large the image is.
+   class PngWriter
+   {
+   public:
+      PngWriter();
+      virtual ~PngWriter();
+
+      PngWriter(const PngWriter&) = delete;
+      PngWriter& operator=(const PngWriter&) = delete;
+
+      // Start a file of 8-bit pixels with channels 1 (gray), 2 (gray, alpha),
+      // 3 (RGB) or 4 (RGBA). numThreads <= 0 uses all cores.
+      // Returns true if successfull. false otherwise.
+      bool open(const std::string& filename, int width, int height, int channels,
+         PngLevel level = PngDefault, int numThreads = 0);
+
+      // Start a PNG in memory, appended to png, which must outlive the writer
+      // until close. A PNG that isn't finished is taken off again.
+      bool open(std::vector<unsigned char>& png, int width, int height, int channels,
+         PngLevel level = PngDefault, int numThreads = 0);
+
+      // Append numRows rows, top to bottom, stride bytes apart
+      bool write(const unsigned char* rows, int numRows, int stride);
+
+      // Finish the file. Returns false if a write failed or rows are missing.
+      bool close();
+
+      bool isOpen() const { return myFile.is_open() || myMemory != 0; }
+      int rowsWritten() const { return myRows; }
+
+   private:
+      void start(int width, int height, int channels, PngLevel level, int numThreads);
+      void put(const void* data, size_t size);
+      bool good() const { return myMemory != 0 || myFile.good(); }
+      void writeChunk(const char* type, const unsigned char* data, size_t size);
+      void filterRows(const unsigned char* rows, int first, int count, int stride,
+         unsigned char* filtered) const;
+
+   private:
+      std::ofstream myFile;
+      std::vector<unsigned char>* myMemory; // the PNG in memory, or 0
+      size_t myMemoryStart;                 // where it starts in *myMemory
+      std::string myFilename;
+      int myWidth;
+      int myHeight;
+      int myChannels;
+      PngLevel myLevel;
+      int myNumThreads;
+      int myRows;
+      bool myFailed;
+      bool myStored;                       // without zlib: streamed uncompressed, not buffered
+      unsigned long myAdler;               // of the filtered rows so far
+      std::vector<unsigned char> myPrior;  // the last row written, unfiltered
+      std::vector<unsigned char> myWindow; // the last 32 KB of filtered rows
+      std::vector<unsigned char> myPixels; // every row, without zlib
+   };
+
+   // Write pixels as a PNG, rows stride bytes apart. See PngWriter.
+   bool WritePng(const std::string& filename, int width, int height, int channels,
+      const unsigned char* pixels, int stride, PngLevel level = PngDefault, int numThreads = 0);
+
+   // Encode pixels as a PNG into png, replacing its contents. See PngWriter.
+   bool EncodePng(std::vector<unsigned char>& png, int width, int height, int channels,
+      const unsigned char* pixels, int stride, PngLevel level = PngDefault, int numThreads = 0);
+}
+
+#endif
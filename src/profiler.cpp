@@ -0,0 +1,300 @@
+// Haverford College, Jiajie Ma, 2021
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+using namespace std;
+using namespace agl;
+
+// Events each thread keeps; a power of two
+static const size_t RingSize = 1 << 16;
+
+std::atomic<bool> agl::theProfilingEnabled(false);
+
+namespace {
+
+   struct ProfileEvent
+   {
+      const char* name;
+      double start;    // microseconds since the first event
+      double duration; // < 0 for counters
+      long long value; // counters only
+   };
+
+   // Written by one thread, read by WriteChromeTrace
+   struct ThreadRing
+   {
+      ThreadRing() : events(RingSize), written(0), id(0) {}
+
+      std::vector<ProfileEvent> events;
+      std::atomic<unsigned long long> written;
+      int id;
+      std::string name;
+   };
+
+   std::mutex theRingsMutex; // only taken to add a ring, and to export
+   std::vector<ThreadRing*> theRings; // never freed; events outlive their threads
+   thread_local ThreadRing* theRing = 0;
+   ThreadRing* theGpuRing = 0;
+
+   std::atomic<long long> theCounters[NumProfileCounters];
+   long long theLastCounters[NumProfileCounters];
+   const char* theCounterNames[NumProfileCounters] = {"bytes uploaded", "draw calls", "triangles"};
+
+   const std::chrono::steady_clock::time_point theEpoch = std::chrono::steady_clock::now();
+
+   double Now()
+   {
+      return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - theEpoch).count();
+   }
+
+   ThreadRing* NewRing(const std::string& name)
+   {
+      ThreadRing* ring = new ThreadRing();
+      std::lock_guard<std::mutex> lock(theRingsMutex);
+      ring->id = (int) theRings.size() + 1;
+      ring->name = name;
+      theRings.push_back(ring);
+      return ring;
+   }
+
+   ThreadRing* CurrentRing()
+   {
+      if (!theRing)
+      {
+         theRing = NewRing("");
+      }
+      return theRing;
+   }
+
+   void Record(ThreadRing* ring, const char* name, double start, double duration, long long value)
+   {
+      // the only writer of this ring; readers check written before and after copying
+      unsigned long long index = ring->written.load(std::memory_order_relaxed);
+      ProfileEvent& event = ring->events[index & (RingSize - 1)];
+      event.name = name;
+      event.start = start;
+      event.duration = duration;
+      event.value = value;
+      ring->written.store(index + 1, std::memory_order_release);
+   }
+
+   void WriteString(std::ostream& out, const std::string& text)
+   {
+      out << '"';
+      for (size_t i = 0; i < text.size(); i++)
+      {
+         if (text[i] == '"' || text[i] == '\\') out << '\\';
+         out << text[i];
+      }
+      out << '"';
+   }
+}
+
+void agl::EnableProfiling(bool enable)
+{
+   if (enable && !ProfilingEnabled())
+   {
+      for (int i = 0; i < NumProfileCounters; i++)
+      {
+         theLastCounters[i] = theCounters[i].load();
+      }
+   }
+   theProfilingEnabled.store(enable);
+}
+
+void agl::SetProfileThreadName(const std::string& name)
+{
+   ThreadRing* ring = CurrentRing();
+   std::lock_guard<std::mutex> lock(theRingsMutex);
+   ring->name = name;
+}
+
+void agl::ProfileCount(ProfileCounter counter, long long amount)
+{
+   if (!ProfilingEnabled()) return;
+   theCounters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+long long agl::ProfileCounterValue(ProfileCounter counter)
+{
+   return theCounters[counter].load();
+}
+
+void agl::ProfileFrame()
+{
+   if (!ProfilingEnabled()) return;
+
+   ThreadRing* ring = CurrentRing();
+   double now = Now();
+   for (int i = 0; i < NumProfileCounters; i++)
+   {
+      long long value = theCounters[i].load(std::memory_order_relaxed);
+      Record(ring, theCounterNames[i], now, -1.0, value - theLastCounters[i]);
+      theLastCounters[i] = value;
+   }
+}
+
+bool agl::WriteChromeTrace(const std::string& filename)
+{
+   std::ofstream out(filename.c_str());
+   if (!out)
+   {
+      std::cout << "Cannot write " << filename << std::endl;
+      return false;
+   }
+
+   std::lock_guard<std::mutex> lock(theRingsMutex);
+   out << std::fixed << std::setprecision(3); // microseconds
+   out << "{\"traceEvents\":[\n";
+   bool first = true;
+   size_t numEvents = 0;
+   for (size_t r = 0; r < theRings.size(); r++)
+   {
+      ThreadRing& ring = *theRings[r];
+      if (!ring.name.empty())
+      {
+         out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << ring.id << ",\"args\":{\"name\":";
+         WriteString(out, ring.name);
+         out << "}}";
+         first = false;
+      }
+
+      // copy what is there, then drop anything the writer may have overwritten meanwhile
+      unsigned long long end = ring.written.load(std::memory_order_acquire);
+      unsigned long long begin = end > RingSize ? end - RingSize : 0;
+      std::vector<ProfileEvent> events;
+      for (unsigned long long i = begin; i < end; i++)
+      {
+         events.push_back(ring.events[i & (RingSize - 1)]);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      unsigned long long now = ring.written.load(std::memory_order_relaxed);
+      size_t skip = now >= RingSize && now - RingSize + 1 > begin ?
+         (size_t) std::min<unsigned long long>(now - RingSize + 1 - begin, events.size()) : 0;
+
+      for (size_t i = skip; i < events.size(); i++)
+      {
+         const ProfileEvent& event = events[i];
+         out << (first ? "" : ",\n") << "{\"name\":";
+         WriteString(out, event.name);
+         if (event.duration < 0)
+         {
+            out << ",\"ph\":\"C\",\"pid\":1,\"tid\":" << ring.id << ",\"ts\":" << event.start
+               << ",\"args\":{\"value\":" << event.value << "}}";
+         }
+         else
+         {
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.id << ",\"ts\":" << event.start
+               << ",\"dur\":" << event.duration << "}";
+         }
+         first = false;
+         numEvents++;
+      }
+   }
+   out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+   std::cout << "Wrote " << numEvents << " events to " << filename << std::endl;
+   return (bool) out;
+}
+
+ProfileScope::ProfileScope(const char* name) : myName(name), myStart(-1.0)
+{
+   if (ProfilingEnabled())
+   {
+      myStart = Now();
+   }
+}
+
+ProfileScope::~ProfileScope()
+{
+   if (myStart >= 0.0)
+   {
+      Record(CurrentRing(), myName, myStart, Now() - myStart, 0);
+   }
+}
+
+GpuTimer::GpuTimer() : myOpen(false)
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+}
+
+void GpuTimer::begin(const char* name)
+{
+   if (!ProfilingEnabled() || myOpen) return;
+
+   Interval interval;
+   if (myFreeQueries.empty())
+   {
+      glGenQueries(1, &interval.query);
+   }
+   else
+   {
+      interval.query = myFreeQueries.back();
+      myFreeQueries.pop_back();
+   }
+   interval.name = name;
+   interval.start = Now();
+   glBeginQuery(GL_TIME_ELAPSED, interval.query);
+   myPending.push_back(interval);
+   myOpen = true;
+}
+
+void GpuTimer::end()
+{
+   if (!myOpen) return;
+   glEndQuery(GL_TIME_ELAPSED);
+   myOpen = false;
+}
+
+void GpuTimer::collect()
+{
+   if (myPending.empty()) return;
+   if (!theGpuRing)
+   {
+      theGpuRing = NewRing("GPU");
+   }
+
+   // queries finish in order; stop at the first one that isn't ready
+   size_t done = 0;
+   size_t closed = myPending.size() - (myOpen ? 1 : 0);
+   for (; done < closed; done++)
+   {
+      Interval& interval = myPending[done];
+      GLint available = 0;
+      glGetQueryObjectiv(interval.query, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) break;
+
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(interval.query, GL_QUERY_RESULT, &nanoseconds);
+      Record(theGpuRing, interval.name, interval.start, nanoseconds / 1000.0, 0);
+      myFreeQueries.push_back(interval.query);
+   }
+   myPending.erase(myPending.begin(), myPending.begin() + done);
+}
+
+void GpuTimer::release()
+{
+   if (myOpen)
+   {
+      end();
+   }
+   for (size_t i = 0; i < myPending.size(); i++)
+   {
+      myFreeQueries.push_back(myPending[i].query);
+   }
+   myPending.clear();
+   if (!myFreeQueries.empty())
+   {
+      glDeleteQueries((GLsizei) myFreeQueries.size(), &myFreeQueries[0]);
+      myFreeQueries.clear();
+   }
+}
@@ -0,0 +1,111 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef profiler_H_
+#define profiler_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "AGL.h"
+
+namespace agl {
+
+   // Frame instrumentation, exported as a Chrome trace (chrome://tracing or
+   // ui.perfetto.dev).
+   //
+   // Every thread records into its own ring buffer, so recording takes no
+   // lock; a full ring overwrites its oldest events. While profiling is
+   // disabled, a scope costs one relaxed atomic load.
+
+   // Per-frame counters, shown as graphs in the trace
+   enum ProfileCounter
+   {
+      BytesUploaded,
+      DrawCalls,
+      TrianglesSubmitted,
+      NumProfileCounters
+   };
+
+   extern std::atomic<bool> theProfilingEnabled;
+
+   // Start or stop recording
+   void EnableProfiling(bool enable);
+
+   inline bool ProfilingEnabled()
+   {
+      return theProfilingEnabled.load(std::memory_order_relaxed);
+   }
+
+   // Name the calling thread in the trace
+   void SetProfileThreadName(const std::string& name);
+
+   // Add amount to a counter
+   void ProfileCount(ProfileCounter counter, long long amount);
+
+   // Total of a counter since profiling started
+   long long ProfileCounterValue(ProfileCounter counter);
+
+   // Record how much each counter grew since the last call; call once a frame
+   void ProfileFrame();
+
+   // Write every recorded event as Chrome trace-event JSON.
+   // Returns true if successfull. false otherwise.
+   bool WriteChromeTrace(const std::string& filename);
+
+   // Times the enclosing scope on the CPU. name must outlive the trace,
+   // as string literals do.
+   class ProfileScope
+   {
+   public:
+      explicit ProfileScope(const char* name);
+      ~ProfileScope();
+
+      ProfileScope(const ProfileScope&) = delete;
+      ProfileScope& operator=(const ProfileScope&) = delete;
+
+   private:
+      const char* myName;
+      double myStart; // microseconds, < 0 when not recording
+   };
+
+#define AGL_PROFILE_CONCAT2(a, b) a##b
+#define AGL_PROFILE_CONCAT(a, b) AGL_PROFILE_CONCAT2(a, b)
+#define AGL_PROFILE_SCOPE(name) agl::ProfileScope AGL_PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+   // Times GPU work with GL_TIME_ELAPSED queries, one begin/end pair per
+   // interval. Results are read a few frames later, without waiting, and go
+   // to a "GPU" track that starts each interval when its commands were
+   // issued. Intervals can't nest. Use on the thread that owns the context.
+   class GpuTimer
+   {
+   public:
+      GpuTimer();
+      virtual ~GpuTimer();
+
+      GpuTimer(const GpuTimer&) = delete;
+      GpuTimer& operator=(const GpuTimer&) = delete;
+
+      // Start and end an interval; name must outlive the trace
+      void begin(const char* name);
+      void end();
+
+      // Record the intervals the GPU has finished; call once a frame
+      void collect();
+
+      // Delete the queries
+      void release();
+
+   private:
+      struct Interval
+      {
+         GLuint query;
+         const char* name;
+         double start; // CPU time of begin, in microseconds
+      };
+
+      std::vector<Interval> myPending;
+      std::vector<GLuint> myFreeQueries;
+      bool myOpen;
+   };
+}
+
+#endif
@@ -0,0 +1,175 @@
+// Haverford College, Jiajie Ma, 2021
+#include "rendermode.h"
+
+using namespace std;
+using namespace agl;
+
+static RenderMode MakeMode(const std::string& name, const std::string& define, unsigned int streams,
+   bool instanced)
+{
+   RenderMode mode;
+   mode.name = name;
+   mode.defines.push_back(define);
+   mode.streams = streams;
+   if (instanced)
+   {
+      mode.defines.push_back("INSTANCED");
+      mode.streams |= InstanceStream;
+   }
+   mode.modelColor = false;
+   mode.lightPosition = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // at the camera
+   mode.spotDirection = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+   mode.spotCutoff = 90.0f;
+   mode.material = MaterialUniforms();
+   mode.material.ka = glm::vec4(0.1f, 0.1f, 0.1f, 0.0f);
+   mode.material.kd = glm::vec4(0.4f, 0.6f, 1.0f, 0.0f);
+   mode.material.ks = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+   mode.material.shininess = 80.0f;
+   return mode;
+}
+
+RenderModes::RenderModes()
+{
+}
+
+RenderModes::~RenderModes()
+{
+   release();
+}
+
+int RenderModes::add(const RenderMode& mode)
+{
+   myModes.push_back(mode);
+   return (int) myModes.size() - 1;
+}
+
+void RenderModes::addDefaults(bool instanced)
+{
+   add(MakeMode("phong", "PHONG", PositionStream | NormalStream, instanced));
+
+   RenderMode toon = MakeMode("toon", "TOON", PositionStream | NormalStream, instanced);
+   toon.modelColor = true;
+   toon.lightPosition = glm::vec4(10.0f, 10.0f, 10.0f, 1.0f);
+   add(toon);
+
+   RenderMode spotlight = MakeMode("spotlight", "SPOTLIGHT", PositionStream | NormalStream, instanced);
+   spotlight.lightPosition = glm::vec4(0.0f, 0.0f, 100.0f, 1.0f);
+   spotlight.spotDirection = glm::vec4(0.0f, 0.0f, -1.0f, 90.0f);
+   spotlight.spotCutoff = 10.0f;
+   add(spotlight);
+
+   add(MakeMode("color", "VERTEX_COLOR", PositionStream | ColorStream, instanced));
+   add(MakeMode("unlit", "UNLIT", PositionStream | NormalStream, instanced));
+}
+
+void RenderModes::submit(const std::string& sourceFile, const std::string& cacheDir)
+{
+   myShaders.setCacheDirectory(cacheDir);
+   for (int i = myShaders.size(); i < size(); i++)
+   {
+      // instanced modes get their own names, so both kinds can share a cache
+      std::string name = myModes[i].name;
+      if (myModes[i].streams & InstanceStream) name += "-instanced";
+      myShaders.add(name, sourceFile, myModes[i].defines);
+   }
+   myShaders.submit();
+}
+
+bool RenderModes::finish()
+{
+   if (!myShaders.finish()) return false;
+
+   for (int i = 0; i < myShaders.size(); i++)
+   {
+      myShaders.program(i).bindBlock("Frame", FrameBinding);
+      myShaders.program(i).bindBlock("MaterialBlock", MaterialBinding);
+   }
+   return true;
+}
+
+void RenderModes::attach(GLuint positions, GLuint normals, GLuint colors, GLuint elements,
+   GLuint instances)
+{
+   // replace the vertex arrays of an earlier attach
+   if (!myArrays.empty())
+   {
+      glDeleteVertexArrays((GLsizei) myArrays.size(), &myArrays[0]);
+      myArrays.clear();
+   }
+
+   const GLuint buffers[3] = {positions, normals, colors};
+   for (int i = 0; i < size(); i++)
+   {
+      GLuint vaoId;
+      glGenVertexArrays(1, &vaoId);
+      glBindVertexArray(vaoId);
+      for (GLuint location = 0; location < 3; location++)
+      {
+         // streams the mode doesn't read are left disabled
+         if (!(myModes[i].streams & (1u << location))) continue;
+
+         glEnableVertexAttribArray(location);
+         glBindBuffer(GL_ARRAY_BUFFER, buffers[location]); // always bind before setting data
+         glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
+      }
+      if (myModes[i].streams & InstanceStream)
+      {
+         // a mat4 takes four locations, one column each, advancing once per instance
+         glBindBuffer(GL_ARRAY_BUFFER, instances);
+         for (GLuint column = 0; column < 4; column++)
+         {
+            glEnableVertexAttribArray(3 + column);
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+               (GLubyte*)NULL + column * sizeof(glm::vec4));
+            glVertexAttribDivisor(3 + column, 1);
+         }
+      }
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements);
+      myArrays.push_back(vaoId);
+   }
+}
+
+void RenderModes::release()
+{
+   myShaders.release();
+   if (!myArrays.empty())
+   {
+      glDeleteVertexArrays((GLsizei) myArrays.size(), &myArrays[0]);
+      myArrays.clear();
+   }
+}
+
+int RenderModes::find(const std::string& name) const
+{
+   for (int i = 0; i < size(); i++)
+   {
+      if (myModes[i].name == name) return i;
+   }
+   return -1;
+}
+
+bool RenderModes::supports(int i, const Mesh& mesh) const
+{
+   unsigned int streams = PositionStream;
+   if (mesh.hasNormals()) streams |= NormalStream;
+   if (mesh.hasColors()) streams |= ColorStream;
+   return supports(i, streams);
+}
+
+bool RenderModes::supports(int i, unsigned int streams) const
+{
+   unsigned int needed = myModes[i].streams & ~InstanceStream; // instances come from the scene
+   return (needed & streams) == needed;
+}
+
+void RenderModes::use(int i, FrameUniforms& frame, MaterialUniforms& material)
+{
+   const RenderMode& mode = myModes[i];
+   myShaders.program(i).use();
+   glBindVertexArray(myArrays[i]);
+
+   frame.lightPosition = mode.lightPosition;
+   frame.spotDirection = mode.spotDirection;
+   frame.spotCutoff = mode.spotCutoff;
+   material = mode.material;
+}
@@ -0,0 +1,89 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef rendermode_H_
+#define rendermode_H_
+
+#include <string>
+#include <vector>
+#include "AGL.h"
+#include "AGLM.h"
+#include "mesh.h"
+#include "shadermanager.h"
+#include "uniforms.h"
+
+namespace agl {
+
+   // How a render mode shades a model
+   struct RenderMode
+   {
+      std::string name;
+      std::vector<std::string> defines; // select the mode in the shader source
+      unsigned int streams;      // VertexStream flags of the attributes the mode reads
+      bool modelColor;           // diffuse color is picked per model instead of material.kd
+      glm::vec4 lightPosition;   // eye coordinates
+      glm::vec4 spotDirection;   // xyz: eye coordinates, w: angular exponent
+      float spotCutoff;          // degrees
+      MaterialUniforms material;
+   };
+
+   // The render modes of a viewer. Each mode has its own program and its own
+   // vertex array, which enables only the streams the mode reads.
+   //
+   // Every vertex array reads the same buffers, so switching modes binds a
+   // program and a vertex array; the model is never loaded or uploaded again.
+   class RenderModes
+   {
+   public:
+      RenderModes();
+      virtual ~RenderModes();
+
+      RenderModes(const RenderModes&) = delete;
+      RenderModes& operator=(const RenderModes&) = delete;
+
+      // Register a mode. Returns its index.
+      int add(const RenderMode& mode);
+
+      // Register phong, toon, spotlight, color and unlit, in that order.
+      // Instanced modes read a model matrix per instance (InstanceStream).
+      void addDefaults(bool instanced = false);
+
+      // Start building a program for every mode from sourceFile.
+      // Programs are cached in cacheDir (see ShaderManager).
+      void submit(const std::string& sourceFile, const std::string& cacheDir);
+
+      // Wait for the programs. Returns true if every mode built.
+      bool finish();
+
+      // Create the vertex array of every mode over the given buffers.
+      // Buffers may be refilled later; the vertex arrays stay valid.
+      // Attaching again replaces the vertex arrays, for new buffers.
+      // instances holds a mat4 per instance, for instanced modes.
+      void attach(GLuint positions, GLuint normals, GLuint colors, GLuint elements,
+         GLuint instances = 0);
+
+      // Delete the programs and vertex arrays
+      void release();
+
+      int size() const { return (int) myModes.size(); }
+      const RenderMode& mode(int i) const { return myModes[i]; }
+      const ShaderManager& shaders() const { return myShaders; }
+      ShaderProgram& program(int i) { return myShaders.program(i); }
+
+      // Return the index of the named mode, -1 if there is none
+      int find(const std::string& name) const;
+
+      // Return true if mesh has every vertex stream mode i reads
+      bool supports(int i, const Mesh& mesh) const;
+      bool supports(int i, unsigned int streams) const;
+
+      // Bind the program and vertex array of mode i, and copy its light
+      // and material into frame and material
+      void use(int i, FrameUniforms& frame, MaterialUniforms& material);
+
+   private:
+      std::vector<RenderMode> myModes;
+      std::vector<GLuint> myArrays;
+      ShaderManager myShaders;
+   };
+}
+
+#endif
@@ -0,0 +1,304 @@
+// Haverford College, Jiajie Ma, 2021
+#include "resample.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_RESAMPLE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Output rows made by each parallel task, at least
+static const int BandRows = 16;
+
+namespace {
+
+   const double Pi = 3.14159265358979323846;
+
+   // Fills row, four floats per pixel, with input row y; returns row or the input row itself
+   typedef std::function<const float*(int y, float* row)> RowSource;
+
+   // Takes output row y, four floats per pixel
+   typedef std::function<void(int y, const float* row)> RowSink;
+
+   // Half the width of each filter, in pixels of the smaller image
+   double FilterRadius(ResampleFilter filter)
+   {
+      return filter == LanczosFilter ? 3.0 : filter == MitchellFilter ? 2.0 : 0.5;
+   }
+
+   double Mitchell(double x)
+   {
+      const double B = 1.0 / 3.0;
+      const double C = 1.0 / 3.0;
+      x = fabs(x);
+      if (x < 1.0)
+      {
+         return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0;
+      }
+      if (x < 2.0)
+      {
+         return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x +
+            (8 * B + 24 * C)) / 6.0;
+      }
+      return 0.0;
+   }
+
+   double Sinc(double x)
+   {
+      if (x == 0.0) return 1.0;
+      x *= Pi;
+      return sin(x) / x;
+   }
+
+   double Lanczos(double x)
+   {
+      return fabs(x) < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+   }
+
+   // The input pixels, and their weights, that make each output pixel along one axis
+   struct Weights
+   {
+      std::vector<int> first;     // the first input pixel
+      std::vector<int> count;     // how many
+      std::vector<float> weights; // taps for each output pixel, the unused ones 0
+      int taps;
+   };
+
+   Weights MakeWeights(int inSize, int outSize, ResampleFilter filter)
+   {
+      // shrinking stretches the filter over every input pixel
+      double scale = (double) outSize / inSize;
+      double stretch = scale < 1.0 ? 1.0 / scale : 1.0;
+      double support = FilterRadius(filter) * stretch;
+
+      Weights w;
+      w.taps = (int) ceil(2.0 * support) + 2;
+      w.first.resize(outSize);
+      w.count.resize(outSize);
+      w.weights.assign((size_t) outSize * w.taps, 0.0f);
+      std::vector<double> taps(w.taps);
+      for (int i = 0; i < outSize; i++)
+      {
+         double center = (i + 0.5) / scale;
+         int lo = std::max((int) floor(center - support), 0);
+         int hi = std::min((int) ceil(center + support), inSize);
+         double sum = 0;
+         for (int j = lo; j < hi; j++)
+         {
+            double weight;
+            if (filter == BoxFilter)
+            {
+               // how much of the pixel the box covers
+               weight = std::max(0.0, std::min(j + 1.0, center + support) - std::max((double) j, center - support));
+            }
+            else
+            {
+               double x = (j + 0.5 - center) / stretch;
+               weight = filter == MitchellFilter ? Mitchell(x) : Lanczos(x);
+            }
+            taps[j - lo] = weight;
+            sum += weight;
+         }
+
+         // the taps past the edges are dropped, so the rest must sum to 1 again
+         float* out = &w.weights[(size_t) i * w.taps];
+         for (int j = lo; j < hi; j++)
+         {
+            out[j - lo] = (float) (sum != 0.0 ? taps[j - lo] / sum : 1.0 / (hi - lo));
+         }
+         w.first[i] = lo;
+         w.count[i] = hi - lo;
+      }
+      return w;
+   }
+
+   // Each output pixel is the weighted sum of its input pixels, four floats each
+   void FilterRow(const float* in, const Weights& w, float* out, int outSize)
+   {
+      for (int i = 0; i < outSize; i++)
+      {
+         const float* src = in + (size_t) w.first[i] * 4;
+         const float* weight = &w.weights[(size_t) i * w.taps];
+         int count = w.count[i];
+#ifdef AGL_RESAMPLE_SSE
+         __m128 sum = _mm_setzero_ps();
+         for (int k = 0; k < count; k++)
+         {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[k]), _mm_loadu_ps(src + 4 * k)));
+         }
+         _mm_storeu_ps(out + 4 * i, sum);
+#else
+         float sum[4] = {0, 0, 0, 0};
+         for (int k = 0; k < count; k++)
+         {
+            for (int c = 0; c < 4; c++) sum[c] += weight[k] * src[4 * k + c];
+         }
+         memcpy(out + 4 * i, sum, sizeof(sum));
+#endif
+      }
+   }
+
+   // The weighted sum of count rows of n floats
+   void BlendRows(const float* const* rows, const float* weights, int count, float* out, size_t n)
+   {
+      size_t i = 0;
+#ifdef AGL_RESAMPLE_SSE
+      for (; i + 4 <= n; i += 4)
+      {
+         __m128 sum = _mm_setzero_ps();
+         for (int k = 0; k < count; k++)
+         {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+         }
+         _mm_storeu_ps(out + i, sum);
+      }
+#endif
+      for (; i < n; i++)
+      {
+         float sum = 0;
+         for (int k = 0; k < count; k++) sum += weights[k] * rows[k][i];
+         out[i] = sum;
+      }
+   }
+
+   // Each band of output rows filters the input rows under it across, then
+   // blends those down; bands overlap by the filter's height
+   void Resample(const RowSource& source, int inWidth, int inHeight, const RowSink& sink,
+      int outWidth, int outHeight, ResampleFilter filter, int numThreads)
+   {
+      AGL_PROFILE_SCOPE("Resample");
+      Weights across = MakeWeights(inWidth, outWidth, filter);
+      Weights down = MakeWeights(inHeight, outHeight, filter);
+      size_t outFloats = (size_t) outWidth * 4;
+
+      // tall enough that the overlap is a small part of each band
+      int bandRows = std::max(BandRows, (int) ((4.0 * down.taps * outHeight) / inHeight));
+      ParallelFor(0, (outHeight + bandRows - 1) / bandRows, [&](int band)
+      {
+         int begin = band * bandRows;
+         int end = std::min(begin + bandRows, outHeight);
+         int first = down.first[begin];
+         int last = first;
+         for (int y = begin; y < end; y++)
+         {
+            last = std::max(last, down.first[y] + down.count[y]);
+         }
+
+         std::vector<float> row(std::max((size_t) inWidth * 4, outFloats));
+         std::vector<float> filtered(outFloats * (last - first));
+         for (int y = first; y < last; y++)
+         {
+            FilterRow(source(y, &row[0]), across, &filtered[(y - first) * outFloats], outWidth);
+         }
+
+         std::vector<const float*> rows(down.taps);
+         for (int y = begin; y < end; y++)
+         {
+            for (int k = 0; k < down.count[y]; k++)
+            {
+               rows[k] = &filtered[(down.first[y] + k - first) * outFloats];
+            }
+            BlendRows(&rows[0], &down.weights[(size_t) y * down.taps], down.count[y], &row[0], outFloats);
+            sink(y, &row[0]);
+         }
+      }, numThreads);
+   }
+
+   RowSource DecodeRows(const Image& image, const ColorConverter& converter)
+   {
+      return [&image, &converter](int y, float* row)
+      {
+         converter.decode(image.data() + (size_t) y * image.width() * 3, 3, row, 4, image.width(), 1);
+         return (const float*) row;
+      };
+   }
+
+   RowSink EncodeRows(Image& image, const ColorConverter& converter)
+   {
+      return [&image, &converter](int y, const float* row)
+      {
+         converter.encode(row, 4, image.data() + (size_t) y * image.width() * 3, 3, image.width(), 1);
+      };
+   }
+}
+
+void agl::ResampleImage(const Image& in, Image& out, int width, int height,
+   ResampleFilter filter, ColorSpace space, int numThreads)
+{
+   if (in.width() <= 0 || in.height() <= 0 || width <= 0 || height <= 0) return;
+   const ColorConverter& converter = ColorConverter::get(space);
+   out.allocate(width, height);
+   Resample(DecodeRows(in, converter), in.width(), in.height(), EncodeRows(out, converter),
+      width, height, filter, numThreads);
+}
+
+void agl::MakeThumbnail(const Image& image, Image& thumbnail, int maxSize,
+   ResampleFilter filter, ColorSpace space, int numThreads)
+{
+   int width = image.width();
+   int height = image.height();
+   if (width <= 0 || height <= 0 || maxSize <= 0) return;
+
+   // never larger than the image
+   double scale = std::min(1.0, (double) maxSize / std::max(width, height));
+   int w = std::max((int) floor(width * scale + 0.5), 1);
+   int h = std::max((int) floor(height * scale + 0.5), 1);
+   ResampleImage(image, thumbnail, w, h, filter, space, numThreads);
+}
+
+void agl::MakeMipChain(const Image& image, std::vector<Image>& levels,
+   ResampleFilter filter, ColorSpace space, int numThreads)
+{
+   levels.clear();
+   int width = image.width();
+   int height = image.height();
+   if (width <= 0 || height <= 0) return;
+
+   // all the levels first, so none is moved as the vector grows
+   int numLevels = 0;
+   for (int w = width, h = height; w > 1 || h > 1; w = std::max(w / 2, 1), h = std::max(h / 2, 1))
+   {
+      numLevels++;
+   }
+   levels.resize(numLevels);
+
+   const ColorConverter& converter = ColorConverter::get(space);
+   std::vector<float> previous, current;
+   for (int level = 0; level < numLevels; level++)
+   {
+      int w = std::max(width / 2, 1);
+      int h = std::max(height / 2, 1);
+      Image& out = levels[level];
+      out.allocate(w, h);
+      current.resize((size_t) w * h * 4);
+
+      RowSource source = DecodeRows(image, converter);
+      if (level > 0)
+      {
+         int previousWidth = width;
+         source = [&previous, previousWidth](int y, float*)
+         {
+            return (const float*) &previous[(size_t) y * previousWidth * 4];
+         };
+      }
+      RowSink encode = EncodeRows(out, converter);
+      Resample(source, width, height, [&](int y, const float* row)
+      {
+         // the next level starts from these floats, not the rounded bytes
+         memcpy(&current[(size_t) y * w * 4], row, (size_t) w * 4 * sizeof(float));
+         encode(y, row);
+      }, w, h, filter, numThreads);
+
+      previous.swap(current);
+      width = w;
+      height = h;
+   }
+}
@@ -0,0 +1,40 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef resample_H_
+#define resample_H_
+
+#include <vector>
+#include "colorconvert.h"
+#include "image.h"
+
+namespace agl {
+
+   enum ResampleFilter
+   {
+      BoxFilter,      // the average of the pixels under each new one; for mip chains
+      MitchellFilter, // Mitchell-Netravali, B = C = 1/3: sharp with little ringing
+      LanczosFilter   // Lanczos with three lobes: sharpest, may ring at hard edges
+   };
+
+   // Resample in to width x height into out.
+   //
+   // Colors are decoded from space, filtered as linear light and encoded
+   // again, so thin bright lines keep their brightness. The filter runs
+   // across each row and then down the columns, four floats per pixel at a
+   // time with SSE, on bands of rows on numThreads threads (<= 0 for all
+   // cores); each band keeps only its own rows of floats in between.
+   // Shrinking widens the filter so every input pixel counts.
+   void ResampleImage(const Image& in, Image& out, int width, int height,
+      ResampleFilter filter = MitchellFilter, ColorSpace space = SrgbColor, int numThreads = 0);
+
+   // Shrink image to fit in maxSize x maxSize, keeping its aspect ratio
+   void MakeThumbnail(const Image& image, Image& thumbnail, int maxSize,
+      ResampleFilter filter = LanczosFilter, ColorSpace space = SrgbColor, int numThreads = 0);
+
+   // Fill levels with image halved again and again, rounding down, to 1x1;
+   // levels[0] is half the size of image. Each level is made from the
+   // linear floats of the one before, so levels aren't rounded twice.
+   void MakeMipChain(const Image& image, std::vector<Image>& levels,
+      ResampleFilter filter = BoxFilter, ColorSpace space = SrgbColor, int numThreads = 0);
+}
+
+#endif
@@ -0,0 +1,325 @@
+// Haverford College, Jiajie Ma, 2021
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+using namespace agl;
+
+// Instances culled by each parallel task
+static const int CullBatch = 4096;
+
+// What culling decided for each instance
+enum { Outside = 0, Visible = 1, Occluded = 2 };
+
+Scene::Scene() :
+   myInstanceBuffer(0), myIndirectBuffer(0), myIndirect(false), mySorted(true),
+   myOcclusionEnabled(false), myMaxOccluders(16)
+{
+   myStats = SceneStats();
+}
+
+Scene::~Scene()
+{
+   release();
+}
+
+void Scene::create()
+{
+   release();
+#ifdef APPLE
+   myIndirect = false; // macOS stops at GL 4.1
+#else
+   myIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+#endif
+   glGenBuffers(1, &myInstanceBuffer);
+   if (myIndirect)
+   {
+      glGenBuffers(1, &myIndirectBuffer);
+   }
+}
+
+void Scene::release()
+{
+   if (myInstanceBuffer)
+   {
+      glDeleteBuffers(1, &myInstanceBuffer);
+      myInstanceBuffer = 0;
+   }
+   if (myIndirectBuffer)
+   {
+      glDeleteBuffers(1, &myIndirectBuffer);
+      myIndirectBuffer = 0;
+   }
+   clear();
+}
+
+void Scene::clear()
+{
+   myInstances.clear();
+   myMatrices.clear();
+   myCommands.clear();
+   mySorted = true;
+   myStats = SceneStats();
+}
+
+bool Scene::add(const MeshBuffer& meshes, int key, const glm::mat4& transform)
+{
+   const MeshSlot* slot = meshes.find(key);
+   if (!slot) return false;
+
+   // the sphere around the model's box, moved and scaled with the instance
+   glm::vec3 center = 0.5f * (slot->minBounds + slot->maxBounds);
+   float radius = 0.5f * glm::length(slot->maxBounds - slot->minBounds);
+   float scale = std::max(glm::length(glm::vec3(transform[0])),
+      std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+   SceneInstance instance;
+   instance.model = key;
+   instance.transform = transform;
+   instance.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+   instance.radius = radius * scale;
+   instance.minBounds = slot->minBounds;
+   instance.maxBounds = slot->maxBounds;
+
+   if (!myInstances.empty() && myInstances.back().model > key) mySorted = false;
+   myInstances.push_back(instance);
+   return true;
+}
+
+void Scene::setOccluder(int key, const Mesh& mesh)
+{
+   myOccluders[key] = MakeOccluder(mesh);
+}
+
+void Scene::enableOcclusion(bool enable, int maxOccluders)
+{
+   myOcclusionEnabled = enable;
+   myMaxOccluders = maxOccluders;
+}
+
+void Scene::update(const MeshBuffer& meshes, const glm::mat4& viewProjection)
+{
+   AGL_PROFILE_SCOPE("Scene::update");
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   if (!mySorted)
+   {
+      // instances of a model must be next to each other to share a command
+      std::stable_sort(myInstances.begin(), myInstances.end(),
+         [](const SceneInstance& a, const SceneInstance& b) { return a.model < b.model; });
+      mySorted = true;
+   }
+
+   // frustum planes from the rows of the matrix, pointing inwards
+   glm::vec4 planes[6];
+   glm::mat4 m = glm::transpose(viewProjection);
+   for (int i = 0; i < 3; i++)
+   {
+      planes[2 * i] = m[3] + m[i];
+      planes[2 * i + 1] = m[3] - m[i];
+   }
+   for (int i = 0; i < 6; i++)
+   {
+      planes[i] /= glm::length(glm::vec3(planes[i]));
+   }
+
+   int count = (int) myInstances.size();
+   myVisible.resize(count);
+   int numBatches = (count + CullBatch - 1) / CullBatch;
+   auto cull = [this, count, &planes](int batch)
+   {
+      int end = std::min(count, (batch + 1) * CullBatch);
+      for (int i = batch * CullBatch; i < end; i++)
+      {
+         const SceneInstance& instance = myInstances[i];
+         bool inside = true;
+         for (int p = 0; p < 6 && inside; p++)
+         {
+            inside = glm::dot(glm::vec3(planes[p]), instance.center) + planes[p].w >= -instance.radius;
+         }
+         myVisible[i] = inside ? Visible : Outside;
+      }
+   };
+   if (numBatches > 1)
+   {
+      ParallelFor(0, numBatches, cull);
+   }
+   else if (numBatches == 1)
+   {
+      cull(0); // not worth waking threads for
+   }
+
+   myStats.occluders = 0;
+   myStats.occlusionMs = 0;
+   if (myOcclusionEnabled && !myOccluders.empty())
+   {
+      cullOccluded(viewProjection);
+   }
+
+   // one command per model, over its visible instances
+   myMatrices.clear();
+   myCommands.clear();
+   myStats.occluded = 0;
+   myStats.triangles = myStats.occludedTriangles = 0;
+   const MeshSlot* slot = 0;
+   int slotModel = 0;
+   for (int i = 0; i < count; i++)
+   {
+      if (myVisible[i] == Outside) continue;
+
+      // instances are sorted, so a new model starts a new command
+      const SceneInstance& instance = myInstances[i];
+      if (!slot || instance.model != slotModel)
+      {
+         slot = meshes.find(instance.model);
+         slotModel = instance.model;
+         if (!slot) continue;
+      }
+      if (myVisible[i] == Occluded)
+      {
+         myStats.occluded++;
+         myStats.occludedTriangles += slot->numIndices / 3;
+         continue;
+      }
+      myStats.triangles += slot->numIndices / 3;
+
+      if (myCommands.empty() || myCommands.back().firstIndex != slot->firstIndex ||
+         myCommands.back().baseVertex != (GLint) slot->firstVertex)
+      {
+         DrawCommand command;
+         command.count = (GLuint) slot->numIndices;
+         command.instanceCount = 0;
+         command.firstIndex = (GLuint) slot->firstIndex;
+         command.baseVertex = (GLint) slot->firstVertex;
+         command.baseInstance = (GLuint) myMatrices.size();
+         myCommands.push_back(command);
+      }
+      myCommands.back().instanceCount++;
+      myMatrices.push_back(instance.transform);
+   }
+
+   // orphan last frame's data instead of waiting for the GPU to finish with it
+   if (!myMatrices.empty())
+   {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, myInstanceBuffer);
+      glBufferData(GL_COPY_WRITE_BUFFER, myMatrices.size() * sizeof(glm::mat4), &myMatrices[0], GL_STREAM_DRAW);
+   }
+   if (myIndirect && myCommands.size() > 1)
+   {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, myIndirectBuffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER, myCommands.size() * sizeof(DrawCommand), &myCommands[0], GL_STREAM_DRAW);
+   }
+
+   myStats.instances = count;
+   myStats.visible = (int) myMatrices.size();
+   myStats.commands = (int) myCommands.size();
+   myStats.cullMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void Scene::cullOccluded(const glm::mat4& viewProjection)
+{
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   // the nearest instances hide the most; clip w is the distance along the view
+   glm::vec4 toW(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+   std::vector<std::pair<float, int> > nearest;
+   for (int i = 0; i < (int) myInstances.size(); i++)
+   {
+      const SceneInstance& instance = myInstances[i];
+      if (myVisible[i] == Visible && myOccluders.count(instance.model))
+      {
+         nearest.push_back(std::make_pair(glm::dot(toW, glm::vec4(instance.center, 1.0f)) - instance.radius, i));
+      }
+   }
+   int numOccluders = std::min((int) nearest.size(), myMaxOccluders);
+   std::partial_sort(nearest.begin(), nearest.begin() + numOccluders, nearest.end());
+
+   myOcclusion.begin(viewProjection);
+   for (int i = 0; i < numOccluders; i++)
+   {
+      const SceneInstance& instance = myInstances[nearest[i].second];
+      myOcclusion.add(myOccluders[instance.model], instance.transform);
+   }
+   myOcclusion.rasterize();
+
+   int count = (int) myInstances.size();
+   int numBatches = (count + CullBatch - 1) / CullBatch;
+   auto test = [this, count](int batch)
+   {
+      int end = std::min(count, (batch + 1) * CullBatch);
+      for (int i = batch * CullBatch; i < end; i++)
+      {
+         const SceneInstance& instance = myInstances[i];
+         if (myVisible[i] == Visible &&
+            !myOcclusion.isVisible(instance.minBounds, instance.maxBounds, instance.transform))
+         {
+            myVisible[i] = Occluded;
+         }
+      }
+   };
+   if (numBatches > 1)
+   {
+      ParallelFor(0, numBatches, test);
+   }
+   else if (numBatches == 1)
+   {
+      test(0);
+   }
+
+   // the occluders are the nearest instances; a flat one may even sit exactly on its own box
+   for (int i = 0; i < numOccluders; i++)
+   {
+      myVisible[nearest[i].second] = Visible;
+   }
+
+   myStats.occluders = numOccluders;
+   myStats.occlusionMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void Scene::draw()
+{
+   myStats.drawCalls = 0;
+   if (myCommands.empty()) return;
+
+   if (myCommands.size() == 1)
+   {
+      const DrawCommand& command = myCommands[0];
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+         (void*) (command.firstIndex * sizeof(unsigned int)), command.instanceCount, command.baseVertex);
+      myStats.drawCalls = 1;
+   }
+   else if (myIndirect)
+   {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, myIndirectBuffer);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, (GLsizei) myCommands.size(), 0);
+      myStats.drawCalls = 1;
+   }
+   else
+   {
+      // without base instances, point the instance attributes at each command's matrices
+      glBindBuffer(GL_ARRAY_BUFFER, myInstanceBuffer);
+      for (size_t i = 0; i < myCommands.size(); i++)
+      {
+         const DrawCommand& command = myCommands[i];
+         for (GLuint column = 0; column < 4; column++)
+         {
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+               (GLubyte*)NULL + command.baseInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4));
+         }
+         glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+            (void*) (command.firstIndex * sizeof(unsigned int)), command.instanceCount, command.baseVertex);
+      }
+      for (GLuint column = 0; column < 4; column++)
+      {
+         glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+            (GLubyte*)NULL + column * sizeof(glm::vec4));
+      }
+      myStats.drawCalls = (int) myCommands.size();
+   }
+   ProfileCount(DrawCalls, myStats.drawCalls);
+   ProfileCount(TrianglesSubmitted, myStats.triangles);
+}
@@ -0,0 +1,131 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef scene_H_
+#define scene_H_
+
+#include <unordered_map>
+#include <vector>
+#include "AGL.h"
+#include "AGLM.h"
+#include "mesh.h"
+#include "meshbuffer.h"
+#include "occlusion.h"
+
+namespace agl {
+
+   // One placed copy of a model
+   struct SceneInstance
+   {
+      int model;           // key of the mesh in the MeshBuffer
+      glm::mat4 transform; // model to world
+      glm::vec3 center;    // bounding sphere, in world coordinates
+      float radius;
+      glm::vec3 minBounds; // bounding box, in model coordinates
+      glm::vec3 maxBounds;
+   };
+
+   // What the last update and draw did
+   struct SceneStats
+   {
+      int instances;   // in the scene
+      int visible;     // left after frustum and occlusion culling
+      int commands;    // one per model with visible instances
+      int drawCalls;   // GL draw calls issued by the last draw()
+      double cullMs;   // time spent culling and building commands
+      int occluders;   // instances rasterized as occluders
+      int occluded;    // inside the frustum but hidden behind the occluders
+      long long triangles;         // in the visible instances
+      long long occludedTriangles; // in the hidden ones
+      double occlusionMs;          // rasterizing the occluders and testing boxes
+   };
+
+   // Many instances of the meshes in a MeshBuffer, drawn together.
+   //
+   // Every frame, instances outside the view frustum are culled on the CPU.
+   // With occlusion culling, the nearest instances with occluders are then
+   // rasterized into an OcclusionBuffer, and instances whose boxes are hidden
+   // behind them are culled too.
+   // The model matrices of the rest are written to one instance buffer,
+   // grouped by model, with one draw command per model. A single model is
+   // drawn with one instanced draw. Several models are drawn with one
+   // glMultiDrawElementsIndirect where the driver supports it (GL 4.3),
+   // and with one instanced draw per model otherwise.
+   //
+   // The instance buffer feeds the mat4 at locations 3-6 (InstanceStream);
+   // pass it to RenderModes::attach for the instanced modes.
+   class Scene
+   {
+   public:
+      Scene();
+      virtual ~Scene();
+
+      Scene(const Scene&) = delete;
+      Scene& operator=(const Scene&) = delete;
+
+      // Create the instance and command buffers
+      void create();
+
+      // Delete the buffers and every instance
+      void release();
+
+      // Remove every instance
+      void clear();
+
+      // Add an instance of the mesh stored under key in meshes.
+      // Returns false if that mesh isn't resident.
+      bool add(const MeshBuffer& meshes, int key, const glm::mat4& transform);
+
+      // Give the mesh stored under key an occluder, simplified from mesh
+      void setOccluder(int key, const Mesh& mesh);
+
+      // Cull instances hidden behind the nearest maxOccluders instances that
+      // have occluders
+      void enableOcclusion(bool enable, int maxOccluders = 16);
+      bool occlusionEnabled() const { return myOcclusionEnabled; }
+
+      // Cull against the frustum of viewProjection and build this frame's
+      // instance matrices and draw commands
+      void update(const MeshBuffer& meshes, const glm::mat4& viewProjection);
+
+      // Draw the visible instances with the current program and a vertex
+      // array that reads the mesh buffer and instanceBuffer()
+      void draw();
+
+      int size() const { return (int) myInstances.size(); }
+      const SceneInstance& instance(int i) const { return myInstances[i]; }
+      GLuint instanceBuffer() const { return myInstanceBuffer; }
+      bool usesIndirect() const { return myIndirect; }
+      const SceneStats& stats() const { return myStats; }
+      const OcclusionBuffer& occlusion() const { return myOcclusion; }
+
+   private:
+      void cullOccluded(const glm::mat4& viewProjection);
+
+   private:
+      // Layout of glMultiDrawElementsIndirect commands
+      struct DrawCommand
+      {
+         GLuint count;
+         GLuint instanceCount;
+         GLuint firstIndex;
+         GLint baseVertex;
+         GLuint baseInstance;
+      };
+
+      std::vector<SceneInstance> myInstances; // sorted by model before culling
+      std::vector<unsigned char> myVisible;   // Outside, Visible or Occluded
+      std::vector<glm::mat4> myMatrices;      // visible instances, grouped by model
+      std::vector<DrawCommand> myCommands;
+      GLuint myInstanceBuffer;
+      GLuint myIndirectBuffer;
+      bool myIndirect; // true if the driver has glMultiDrawElementsIndirect
+      bool mySorted;
+      SceneStats myStats;
+
+      OcclusionBuffer myOcclusion;
+      std::unordered_map<int, OccluderMesh> myOccluders; // by mesh key
+      bool myOcclusionEnabled;
+      int myMaxOccluders;
+   };
+}
+
+#endif
@@ -0,0 +1,115 @@
+// Haverford College, Jiajie Ma, 2021
+#include "scheduler.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+RenderScheduler::RenderScheduler() :
+   myDirty(true), myAnimating(false), myTargetFps(60), myIdleTimeout(1.0), myLastFrame(0),
+   myFrames(0), myIdle(0), myStatsStart(0), myCpuStart(0)
+{
+}
+
+RenderScheduler::~RenderScheduler()
+{
+}
+
+void RenderScheduler::invalidate()
+{
+   if (!myDirty.exchange(true))
+   {
+      glfwPostEmptyEvent(); // wake the render thread if it is waiting
+   }
+}
+
+bool RenderScheduler::wait()
+{
+   double start = glfwGetTime();
+   if (myStatsStart == 0)
+   {
+      resetStats();
+   }
+
+   if (myDirty || myAnimating)
+   {
+      glfwPollEvents();
+   }
+   else
+   {
+      glfwWaitEventsTimeout(myIdleTimeout);
+      if (!myDirty && !myAnimating)
+      {
+         // woken by an event that changed nothing, or by the timeout
+         myIdle += glfwGetTime() - start;
+         return false;
+      }
+   }
+
+   // no sooner than one frame period after the last frame, handling input meanwhile
+   if (myTargetFps > 0)
+   {
+      double next = myLastFrame + 1.0 / myTargetFps;
+      for (double now = glfwGetTime(); now < next; now = glfwGetTime())
+      {
+         glfwWaitEventsTimeout(next - now);
+      }
+   }
+
+   double now = glfwGetTime();
+   myIdle += now - start;
+   myLastFrame = now;
+   myFrames++;
+
+   // changes made while this frame is drawn go into the next one
+   myDirty = false;
+   return true;
+}
+
+SchedulerStats RenderScheduler::stats() const
+{
+   SchedulerStats stats;
+   stats.frames = myFrames;
+   stats.seconds = glfwGetTime() - myStatsStart;
+   stats.idleSeconds = myIdle;
+   stats.cpuSeconds = ProcessCpuSeconds() - myCpuStart;
+   return stats;
+}
+
+void RenderScheduler::resetStats()
+{
+   myFrames = 0;
+   myIdle = 0;
+   myStatsStart = glfwGetTime();
+   myCpuStart = ProcessCpuSeconds();
+}
+
+void RenderScheduler::printStats(std::ostream& out) const
+{
+   SchedulerStats s = stats();
+   out << "Frames: " << s.frames << " in " << s.seconds << " s, " << s.fps() << " fps, idle "
+      << 100.0 * s.idleFraction() << "%, CPU " << 100.0 * s.cpuUtilization() << "%" << std::endl;
+}
+
+double RenderScheduler::ProcessCpuSeconds()
+{
+#ifdef _WIN32
+   FILETIME creation, exit, kernel, user;
+   if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0.0;
+   ULARGE_INTEGER k, u;
+   k.LowPart = kernel.dwLowDateTime;
+   k.HighPart = kernel.dwHighDateTime;
+   u.LowPart = user.dwLowDateTime;
+   u.HighPart = user.dwHighDateTime;
+   return (k.QuadPart + u.QuadPart) * 1e-7; // 100 ns units
+#else
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+   return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+      1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
@@ -0,0 +1,87 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef scheduler_H_
+#define scheduler_H_
+
+#include <atomic>
+#include <iostream>
+#include "AGL.h"
+
+namespace agl {
+
+   // How the render loop spent its time since the statistics were reset
+   struct SchedulerStats
+   {
+      int frames;          // drawn
+      double seconds;      // wall time
+      double idleSeconds;  // waiting for events or for the next paced frame
+      double cpuSeconds;   // process CPU time, over every thread
+
+      double fps() const { return seconds > 0 ? frames / seconds : 0.0; }
+      double idleFraction() const { return seconds > 0 ? idleSeconds / seconds : 0.0; }
+
+      // 1 is one core busy all the time; more with several threads
+      double cpuUtilization() const { return seconds > 0 ? cpuSeconds / seconds : 0.0; }
+   };
+
+   // Decides when the render loop draws. A frame is drawn only when something
+   // changed (invalidate) or while animating; otherwise the loop sleeps in
+   // glfwWaitEventsTimeout until an event arrives. Frames are paced to a
+   // target rate, so dragging the camera doesn't draw one frame per mouse
+   // event.
+   //
+   //    while (!glfwWindowShouldClose(window))
+   //    {
+   //       if (!scheduler.wait()) continue;
+   //       ... draw ...
+   //       glfwSwapBuffers(window);
+   //    }
+   class RenderScheduler
+   {
+   public:
+      RenderScheduler();
+      virtual ~RenderScheduler();
+
+      RenderScheduler(const RenderScheduler&) = delete;
+      RenderScheduler& operator=(const RenderScheduler&) = delete;
+
+      // Draw at most fps frames per second; 0 draws as fast as the swap allows
+      void setTargetFps(double fps) { myTargetFps = fps; }
+      double targetFps() const { return myTargetFps; }
+
+      // While idle, wake up at least this often, in seconds
+      void setIdleTimeout(double seconds) { myIdleTimeout = seconds; }
+
+      // Redraw every frame, as for animation or work in progress
+      void setAnimating(bool animating) { myAnimating = animating; }
+      bool isAnimating() const { return myAnimating; }
+
+      // Draw the next frame. May be called from any thread.
+      void invalidate();
+
+      // Process events, sleeping until a frame is due.
+      // Returns true if the caller should draw a frame now.
+      bool wait();
+
+      // Statistics since the last reset
+      SchedulerStats stats() const;
+      void resetStats();
+      void printStats(std::ostream& out) const;
+
+      // CPU time used by this process so far, in seconds
+      static double ProcessCpuSeconds();
+
+   private:
+      std::atomic<bool> myDirty;
+      bool myAnimating;
+      double myTargetFps;
+      double myIdleTimeout;
+      double myLastFrame;
+
+      int myFrames;
+      double myIdle;
+      double myStatsStart;
+      double myCpuStart;
+   };
+}
+
+#endif
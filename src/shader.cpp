@@ -0,0 +1,410 @@
+// Haverford College, Jiajie Ma, 2021
+#include "shader.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace agl;
+
+static bool theCaching = true;
+// The program bound in the calling thread's context. Each thread that draws or
+// uploads has a context of its own, and contexts don't share bindings.
+static thread_local GLuint theCurrentProgram = 0;
+
+void agl::PrintShaderErrors(GLuint id, const std::string& label)
+{
+   std::cerr << label << " failed\n";
+   GLint logLen;
+   glGetShaderiv(id, GL_INFO_LOG_LENGTH, &logLen);
+   if (logLen > 0)
+   {
+      char* log = (char*)malloc(logLen);
+      GLsizei written;
+      glGetShaderInfoLog(id, logLen, &written, log);
+      std::cerr << "Shader log: " << log << std::endl;
+      free(log);
+   }
+}
+
+void agl::PrintProgramErrors(GLuint id, const std::string& label)
+{
+   std::cerr << label << " failed\n";
+   GLint logLen;
+   glGetProgramiv(id, GL_INFO_LOG_LENGTH, &logLen);
+   if (logLen > 0)
+   {
+      char* log = (char*)malloc(logLen);
+      GLsizei written;
+      glGetProgramInfoLog(id, logLen, &written, log);
+      std::cerr << "Program log: " << log << std::endl;
+      free(log);
+   }
+}
+
+bool agl::LoadShaderFromFile(const std::string& fileName, std::string& code)
+{
+   std::ifstream file(fileName);
+   if (!file)
+   {
+      std::cout << "Cannot load file: " << fileName << std::endl;
+      return false;
+   }
+
+   std::stringstream contents;
+   contents << file.rdbuf();
+   code = contents.str();
+   return true;
+}
+
+static GLuint CompileShader(GLenum kind, const std::string& source, const std::string& label)
+{
+   const char* raw = source.c_str();
+   GLuint id = glCreateShader(kind);
+   glShaderSource(id, 1, &raw, NULL);
+   glCompileShader(id);
+
+   GLint result;
+   glGetShaderiv(id, GL_COMPILE_STATUS, &result);
+   if (result == GL_FALSE)
+   {
+      PrintShaderErrors(id, label);
+      glDeleteShader(id);
+      return 0;
+   }
+   return id;
+}
+
+// Bytes of one element of a uniform of the given type
+static size_t ValueSize(GLenum type)
+{
+   switch (type)
+   {
+   case GL_FLOAT_VEC2: return 2 * sizeof(float);
+   case GL_FLOAT_VEC3: return 3 * sizeof(float);
+   case GL_FLOAT_VEC4: return 4 * sizeof(float);
+   case GL_FLOAT_MAT3: return 9 * sizeof(float);
+   case GL_FLOAT_MAT4: return 16 * sizeof(float);
+   case GL_INT_VEC2: return 2 * sizeof(int);
+   case GL_INT_VEC3: return 3 * sizeof(int);
+   case GL_INT_VEC4: return 4 * sizeof(int);
+   default: return 4; // scalars, booleans and samplers
+   }
+}
+
+// Samplers and booleans are set with integers
+static bool Compatible(GLenum uniformType, GLenum setterType)
+{
+   if (uniformType == setterType) return true;
+   return setterType == GL_INT && uniformType != GL_FLOAT && ValueSize(uniformType) == sizeof(int);
+}
+
+//--------------------------------------------------------------------
+// ShaderProgram
+
+ShaderProgram::ShaderProgram() : myId(0)
+{
+}
+
+ShaderProgram::~ShaderProgram()
+{
+   release();
+}
+
+void ShaderProgram::setCaching(bool enabled)
+{
+   theCaching = enabled;
+}
+
+bool ShaderProgram::caching()
+{
+   return theCaching;
+}
+
+bool ShaderProgram::load(const std::string& vertexFile, const std::string& fragmentFile)
+{
+   std::string vertexSource, fragmentSource;
+   if (!LoadShaderFromFile(vertexFile, vertexSource) ||
+      !LoadShaderFromFile(fragmentFile, fragmentSource))
+   {
+      return false;
+   }
+   return build(vertexSource, fragmentSource, vertexFile);
+}
+
+bool ShaderProgram::build(const std::string& vertexSource, const std::string& fragmentSource,
+   const std::string& label)
+{
+   release();
+
+   GLuint vshaderId = CompileShader(GL_VERTEX_SHADER, vertexSource, "Vertex shader " + label);
+   if (!vshaderId) return false;
+
+   GLuint fshaderId = CompileShader(GL_FRAGMENT_SHADER, fragmentSource, "Fragment shader " + label);
+   if (!fshaderId)
+   {
+      glDeleteShader(vshaderId);
+      return false;
+   }
+   return link(vshaderId, fshaderId, label);
+}
+
+bool ShaderProgram::link(GLuint vshaderId, GLuint fshaderId, const std::string& label)
+{
+   GLuint id = glCreateProgram();
+   glAttachShader(id, vshaderId);
+   glAttachShader(id, fshaderId);
+   glLinkProgram(id);
+
+   // the program keeps what it needs once linked
+   glDetachShader(id, vshaderId);
+   glDetachShader(id, fshaderId);
+   glDeleteShader(vshaderId);
+   glDeleteShader(fshaderId);
+
+   return adopt(id, label);
+}
+
+bool ShaderProgram::adopt(GLuint id, const std::string& label)
+{
+   release();
+
+   GLint result;
+   glGetProgramiv(id, GL_LINK_STATUS, &result);
+   if (result == GL_FALSE)
+   {
+      PrintProgramErrors(id, "Shader link " + label);
+      glDeleteProgram(id);
+      return false;
+   }
+
+   myId = id;
+   reflect();
+   return true;
+}
+
+void ShaderProgram::reflect()
+{
+   GLint count = 0, maxLength = 0;
+   glGetProgramiv(myId, GL_ACTIVE_UNIFORMS, &count);
+   glGetProgramiv(myId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+   std::vector<char> name(maxLength + 1);
+   for (GLuint i = 0; i < (GLuint) count; i++)
+   {
+      UniformInfo u;
+      GLsizei length = 0;
+      glGetActiveUniform(myId, i, (GLsizei) name.size(), &length, &u.size, &u.type, &name[0]);
+      glGetActiveUniformsiv(myId, 1, &i, GL_UNIFORM_BLOCK_INDEX, &u.block);
+      glGetActiveUniformsiv(myId, 1, &i, GL_UNIFORM_OFFSET, &u.offset);
+
+      u.name.assign(&name[0], length);
+      u.location = u.block < 0 ? glGetUniformLocation(myId, u.name.c_str()) : -1;
+      if (u.name.size() > 3 && u.name.compare(u.name.size() - 3, 3, "[0]") == 0)
+      {
+         u.name.resize(u.name.size() - 3);
+      }
+      u.cache = myValues.size();
+      u.cached = false;
+      if (u.block < 0)
+      {
+         myValues.resize(myValues.size() + ValueSize(u.type));
+      }
+
+      myUniformIndex[u.name] = (int) myUniforms.size();
+      myUniforms.push_back(u);
+   }
+
+   count = 0;
+   maxLength = 0;
+   glGetProgramiv(myId, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+   glGetProgramiv(myId, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+   name.resize(maxLength + 1);
+   for (GLuint i = 0; i < (GLuint) count; i++)
+   {
+      UniformBlockInfo b;
+      GLsizei length = 0;
+      GLint binding = 0;
+      glGetActiveUniformBlockName(myId, i, (GLsizei) name.size(), &length, &name[0]);
+      glGetActiveUniformBlockiv(myId, i, GL_UNIFORM_BLOCK_DATA_SIZE, &b.size);
+      glGetActiveUniformBlockiv(myId, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+      b.name.assign(&name[0], length);
+      b.binding = binding;
+      myBlocks.push_back(b);
+   }
+}
+
+void ShaderProgram::release()
+{
+   if (myId)
+   {
+      if (theCurrentProgram == myId) theCurrentProgram = 0;
+      glDeleteProgram(myId);
+   }
+   myId = 0;
+   myUniforms.clear();
+   myBlocks.clear();
+   myUniformIndex.clear();
+   myValues.clear();
+   myWarned.clear();
+}
+
+void ShaderProgram::use() const
+{
+   if (theCaching && theCurrentProgram == myId) return;
+   glUseProgram(myId);
+   theCurrentProgram = myId;
+}
+
+int ShaderProgram::findUniform(const std::string& name) const
+{
+   std::unordered_map<std::string, int>::const_iterator it = myUniformIndex.find(name);
+   return it == myUniformIndex.end() ? -1 : it->second;
+}
+
+int ShaderProgram::findBlock(const std::string& name) const
+{
+   for (int i = 0; i < (int) myBlocks.size(); i++)
+   {
+      if (myBlocks[i].name == name) return i;
+   }
+   return -1;
+}
+
+GLint ShaderProgram::location(const std::string& name) const
+{
+   int index = findUniform(name);
+   return index < 0 ? -1 : myUniforms[index].location;
+}
+
+bool ShaderProgram::bindBlock(const std::string& name, GLuint binding)
+{
+   int index = findBlock(name);
+   if (index < 0) return false;
+
+   if (myBlocks[index].binding != binding)
+   {
+      glUniformBlockBinding(myId, index, binding);
+      myBlocks[index].binding = binding;
+   }
+   return true;
+}
+
+// Return the location to upload value to, or -1 if the upload can be skipped
+int ShaderProgram::prepare(const std::string& name, GLenum type, const void* value, size_t size)
+{
+   use();
+
+   int index = findUniform(name);
+   if (index < 0 || myUniforms[index].location < 0 || !Compatible(myUniforms[index].type, type))
+   {
+      if (std::find(myWarned.begin(), myWarned.end(), name) == myWarned.end())
+      {
+         std::cout << "WARNING: shader has no uniform " << name << " of this type" << std::endl;
+         myWarned.push_back(name);
+      }
+      return theCaching ? -1 : glGetUniformLocation(myId, name.c_str());
+   }
+
+   UniformInfo& u = myUniforms[index];
+   unsigned char* last = &myValues[u.cache];
+   bool same = u.cached && memcmp(last, value, size) == 0;
+   memcpy(last, value, size);
+   u.cached = true;
+
+   if (!theCaching) return glGetUniformLocation(myId, name.c_str());
+   return same ? -1 : u.location;
+}
+
+void ShaderProgram::setUniform(const std::string& name, int value)
+{
+   GLint loc = prepare(name, GL_INT, &value, sizeof(value));
+   if (loc >= 0) glUniform1i(loc, value);
+}
+
+void ShaderProgram::setUniform(const std::string& name, float value)
+{
+   GLint loc = prepare(name, GL_FLOAT, &value, sizeof(value));
+   if (loc >= 0) glUniform1f(loc, value);
+}
+
+void ShaderProgram::setUniform(const std::string& name, const glm::vec2& value)
+{
+   GLint loc = prepare(name, GL_FLOAT_VEC2, &value[0], sizeof(value));
+   if (loc >= 0) glUniform2fv(loc, 1, &value[0]);
+}
+
+void ShaderProgram::setUniform(const std::string& name, const glm::vec3& value)
+{
+   GLint loc = prepare(name, GL_FLOAT_VEC3, &value[0], sizeof(value));
+   if (loc >= 0) glUniform3fv(loc, 1, &value[0]);
+}
+
+void ShaderProgram::setUniform(const std::string& name, const glm::vec4& value)
+{
+   GLint loc = prepare(name, GL_FLOAT_VEC4, &value[0], sizeof(value));
+   if (loc >= 0) glUniform4fv(loc, 1, &value[0]);
+}
+
+void ShaderProgram::setUniform(const std::string& name, const glm::mat3& value)
+{
+   GLint loc = prepare(name, GL_FLOAT_MAT3, &value[0][0], sizeof(value));
+   if (loc >= 0) glUniformMatrix3fv(loc, 1, GL_FALSE, &value[0][0]);
+}
+
+void ShaderProgram::setUniform(const std::string& name, const glm::mat4& value)
+{
+   GLint loc = prepare(name, GL_FLOAT_MAT4, &value[0][0], sizeof(value));
+   if (loc >= 0) glUniformMatrix4fv(loc, 1, GL_FALSE, &value[0][0]);
+}
+
+//--------------------------------------------------------------------
+// UniformBuffer
+
+UniformBuffer::UniformBuffer() : myId(0), myBinding(0), myValid(false)
+{
+}
+
+UniformBuffer::~UniformBuffer()
+{
+   release();
+}
+
+bool UniformBuffer::create(size_t size, GLuint binding)
+{
+   release();
+
+   glGenBuffers(1, &myId);
+   glBindBuffer(GL_UNIFORM_BUFFER, myId);
+   glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+   glBindBufferBase(GL_UNIFORM_BUFFER, binding, myId);
+
+   myBinding = binding;
+   myShadow.assign(size, 0);
+   myValid = false;
+   return myId != 0;
+}
+
+void UniformBuffer::release()
+{
+   if (myId) glDeleteBuffers(1, &myId);
+   myId = 0;
+   myValid = false;
+   myShadow.clear();
+}
+
+bool UniformBuffer::update(const void* data)
+{
+   if (!myId) return false;
+   if (theCaching && myValid && memcmp(&myShadow[0], data, myShadow.size()) == 0)
+   {
+      return false;
+   }
+
+   memcpy(&myShadow[0], data, myShadow.size());
+   myValid = true;
+   glBindBuffer(GL_UNIFORM_BUFFER, myId);
+   glBufferSubData(GL_UNIFORM_BUFFER, 0, myShadow.size(), &myShadow[0]);
+   return true;
+}
@@ -0,0 +1,161 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef shader_H_
+#define shader_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AGL.h"
+#include "AGLM.h"
+
+namespace agl {
+
+   // An active uniform found when the program was linked
+   struct UniformInfo
+   {
+      std::string name;  // array uniforms are listed without their "[0]"
+      GLenum type;       // GL_FLOAT_VEC3, GL_FLOAT_MAT4, ...
+      GLint size;        // number of array elements, 1 otherwise
+      GLint location;    // -1 for members of a uniform block
+      GLint block;       // index of the uniform block, -1 for plain uniforms
+      GLint offset;      // byte offset inside the block, -1 for plain uniforms
+      size_t cache;      // offset of the last uploaded value in the value cache
+      bool cached;       // false until the first upload
+   };
+
+   // An active uniform block found when the program was linked
+   struct UniformBlockInfo
+   {
+      std::string name;
+      GLint size;        // bytes needed by the block
+      GLuint binding;    // binding point the block reads from
+   };
+
+   // A linked GLSL program.
+   //
+   // Every active uniform and uniform block is looked up once, when the
+   // program is linked, so setting a uniform never asks the driver for its
+   // location. The setters also remember the last value uploaded and skip
+   // the GL call when it hasn't changed.
+   class ShaderProgram
+   {
+   public:
+      ShaderProgram();
+      virtual ~ShaderProgram();
+
+      ShaderProgram(const ShaderProgram&) = delete;
+      ShaderProgram& operator=(const ShaderProgram&) = delete;
+
+      // Compile and link the given vertex and fragment shader files
+      // Returns true if successfull. false otherwise.
+      bool load(const std::string& vertexFile, const std::string& fragmentFile);
+
+      // Compile and link shaders from source; label is only used for error messages
+      bool build(const std::string& vertexSource, const std::string& fragmentSource,
+         const std::string& label);
+
+      // Take over a program linked elsewhere, such as one restored from a
+      // program binary. The program is deleted if it didn't link.
+      // Returns true if successfull. false otherwise.
+      bool adopt(GLuint id, const std::string& label);
+
+      // Delete the program
+      void release();
+
+      // Return true if a program is linked
+      bool isValid() const { return myId != 0; }
+
+      // Return the GL name of the program
+      GLuint id() const { return myId; }
+
+      // Make this the current program; does nothing if it already is
+      void use() const;
+
+      // Reflection
+      int numUniforms() const { return (int) myUniforms.size(); }
+      const UniformInfo& uniform(int i) const { return myUniforms[i]; }
+      int numBlocks() const { return (int) myBlocks.size(); }
+      const UniformBlockInfo& block(int i) const { return myBlocks[i]; }
+
+      // Return the index of the named uniform or block, -1 if it is not active
+      int findUniform(const std::string& name) const;
+      int findBlock(const std::string& name) const;
+
+      // Return the location of the named uniform, -1 if it is not active
+      GLint location(const std::string& name) const;
+
+      // Read the named block from the given binding point.
+      // Returns false if the program doesn't use the block.
+      bool bindBlock(const std::string& name, GLuint binding);
+
+      // Typed setters. The program is made current first.
+      // Uniforms the program doesn't use are ignored, with a warning the first time.
+      void setUniform(const std::string& name, int value);
+      void setUniform(const std::string& name, float value);
+      void setUniform(const std::string& name, const glm::vec2& value);
+      void setUniform(const std::string& name, const glm::vec3& value);
+      void setUniform(const std::string& name, const glm::vec4& value);
+      void setUniform(const std::string& name, const glm::mat3& value);
+      void setUniform(const std::string& name, const glm::mat4& value);
+
+      // When false, setters look up the location and upload on every call,
+      // like code without a ShaderProgram. Used to measure what caching saves.
+      static void setCaching(bool enabled);
+      static bool caching();
+
+   private:
+      bool link(GLuint vshaderId, GLuint fshaderId, const std::string& label);
+      void reflect();
+      int prepare(const std::string& name, GLenum type, const void* value, size_t size);
+
+   private:
+      GLuint myId;
+      std::vector<UniformInfo> myUniforms;
+      std::vector<UniformBlockInfo> myBlocks;
+      std::unordered_map<std::string, int> myUniformIndex;
+      std::vector<unsigned char> myValues; // last value uploaded to each uniform
+      std::vector<std::string> myWarned;   // unknown names already reported
+   };
+
+   // Read a shader source file into code
+   // Returns true if successfull. false otherwise.
+   bool LoadShaderFromFile(const std::string& fileName, std::string& code);
+
+   // Print the info log of a shader that didn't compile, or a program that didn't link
+   void PrintShaderErrors(GLuint id, const std::string& label);
+   void PrintProgramErrors(GLuint id, const std::string& label);
+
+   // A uniform buffer object attached to a fixed binding point.
+   // Programs read it through blocks bound with ShaderProgram::bindBlock.
+   class UniformBuffer
+   {
+   public:
+      UniformBuffer();
+      virtual ~UniformBuffer();
+
+      UniformBuffer(const UniformBuffer&) = delete;
+      UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+      // Create a buffer of size bytes and attach it to the binding point
+      bool create(size_t size, GLuint binding);
+
+      // Delete the buffer
+      void release();
+
+      // Upload size() bytes from data unless they match the last upload.
+      // Returns true if the buffer was written.
+      bool update(const void* data);
+
+      GLuint id() const { return myId; }
+      GLuint binding() const { return myBinding; }
+      size_t size() const { return myShadow.size(); }
+
+   private:
+      GLuint myId;
+      GLuint myBinding;
+      bool myValid; // false until the first upload
+      std::vector<unsigned char> myShadow; // copy of the buffer contents
+   };
+}
+
+#endif
@@ -0,0 +1,386 @@
+// Haverford College, Jiajie Ma, 2021
+#include "shadermanager.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static const char binary_magic[8] = "AGLPROG";
+static const uint32_t binary_version = 1;
+
+// Header of a cached program binary
+struct BinaryHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t format;  // as returned by glGetProgramBinary
+   uint64_t key;     // hash of the sources and driver, to catch collisions
+   uint64_t length;  // bytes of binary data that follow
+};
+
+namespace agl {
+   struct ShaderVariant
+   {
+      std::string name;
+      std::string file;
+      std::vector<std::string> defines;
+      ShaderProgram program;
+
+      std::string vertexSource;   // the final sources, with defines
+      std::string fragmentSource;
+      uint64_t key;               // cache key of the sources and driver
+      GLuint vshaderId;           // shaders and program while building
+      GLuint fshaderId;
+      GLuint pending;             // 0 if nothing is being built
+      bool failed;
+   };
+}
+
+static uint64_t Hash(uint64_t h, const std::string& text)
+{
+   // FNV-1a, chained over several strings
+   for (size_t i = 0; i < text.size(); i++)
+   {
+      h = (h ^ (unsigned char) text[i]) * 1099511628211ull;
+   }
+   return (h ^ 0xff) * 1099511628211ull;
+}
+
+// Insert the stage and feature defines after the #version line
+static std::string Assemble(const std::string& source, const std::string& stage,
+   const std::vector<std::string>& defines)
+{
+   std::string header, body = source;
+   int firstLine = 1;
+   if (source.compare(0, 8, "#version") == 0)
+   {
+      size_t eol = source.find('\n');
+      header = source.substr(0, eol == std::string::npos ? source.size() : eol) + "\n";
+      body = eol == std::string::npos ? "" : source.substr(eol + 1);
+      firstLine = 2;
+   }
+
+   header += "#define " + stage + "\n";
+   for (size_t i = 0; i < defines.size(); i++)
+   {
+      header += "#define " + defines[i] + "\n";
+   }
+   // keep line numbers in error messages matching the file
+   char line[32];
+   sprintf(line, "#line %d\n", firstLine);
+   return header + line + body;
+}
+
+static GLuint StartCompile(GLenum kind, const std::string& source)
+{
+   const char* raw = source.c_str();
+   GLuint id = glCreateShader(kind);
+   glShaderSource(id, 1, &raw, NULL);
+   glCompileShader(id);
+   return id;
+}
+
+static void MakeDirectory(const std::string& dir)
+{
+#ifdef _WIN32
+   _mkdir(dir.c_str());
+#else
+   mkdir(dir.c_str(), 0755);
+#endif
+}
+
+ShaderManager::ShaderManager() :
+   myBinaries(false), myParallel(false), myNumCached(0), myNumCompiled(0)
+{
+}
+
+ShaderManager::~ShaderManager()
+{
+   release();
+}
+
+void ShaderManager::setCacheDirectory(const std::string& dir)
+{
+   myCacheDir = dir;
+   if (!myCacheDir.empty() && myCacheDir[myCacheDir.size() - 1] != '/' &&
+      myCacheDir[myCacheDir.size() - 1] != '\\')
+   {
+      myCacheDir += "/";
+   }
+}
+
+int ShaderManager::add(const std::string& name, const std::string& sourceFile,
+   const std::vector<std::string>& defines)
+{
+   std::unique_ptr<ShaderVariant> variant(new ShaderVariant);
+   variant->name = name;
+   variant->file = sourceFile;
+   variant->defines = defines;
+   variant->key = 0;
+   variant->vshaderId = 0;
+   variant->fshaderId = 0;
+   variant->pending = 0;
+   variant->failed = false;
+   myVariants.push_back(std::move(variant));
+   return (int) myVariants.size() - 1;
+}
+
+const std::string& ShaderManager::name(int i) const
+{
+   return myVariants[i]->name;
+}
+
+ShaderProgram& ShaderManager::program(int i)
+{
+   return myVariants[i]->program;
+}
+
+int ShaderManager::find(const std::string& name) const
+{
+   for (int i = 0; i < (int) myVariants.size(); i++)
+   {
+      if (myVariants[i]->name == name) return i;
+   }
+   return -1;
+}
+
+void ShaderManager::submit()
+{
+   if (myDriver.empty())
+   {
+      myDriver = std::string((const char*) glGetString(GL_VENDOR)) + "|" +
+         (const char*) glGetString(GL_RENDERER) + "|" + (const char*) glGetString(GL_VERSION);
+
+#ifdef APPLE
+      myBinaries = true; // core in the 4.1 contexts macOS creates
+#else
+      myBinaries = GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary;
+      if (GLEW_KHR_parallel_shader_compile)
+      {
+         glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // as many as the driver likes
+         myParallel = true;
+      }
+      else if (GLEW_ARB_parallel_shader_compile)
+      {
+         glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+         myParallel = true;
+      }
+#endif
+      if (myBinaries)
+      {
+         // some drivers support the calls but no binary format
+         GLint formats = 0;
+         glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+         myBinaries = formats > 0;
+      }
+   }
+
+   for (size_t i = 0; i < myVariants.size(); i++)
+   {
+      ShaderVariant& v = *myVariants[i];
+      if (v.program.isValid() || v.pending || v.failed) continue;
+
+      std::string source;
+      if (!LoadShaderFromFile(v.file, source))
+      {
+         v.failed = true;
+         continue;
+      }
+      v.vertexSource = Assemble(source, "VERTEX_SHADER", v.defines);
+      v.fragmentSource = Assemble(source, "FRAGMENT_SHADER", v.defines);
+      v.key = Hash(Hash(Hash(1469598103934665603ull, myDriver), v.vertexSource), v.fragmentSource);
+
+      if (loadBinary(v))
+      {
+         myNumCached++;
+         continue;
+      }
+
+      // don't ask for any result yet, so the driver can work on every variant at once
+      v.vshaderId = StartCompile(GL_VERTEX_SHADER, v.vertexSource);
+      v.fshaderId = StartCompile(GL_FRAGMENT_SHADER, v.fragmentSource);
+      v.pending = glCreateProgram();
+      glAttachShader(v.pending, v.vshaderId);
+      glAttachShader(v.pending, v.fshaderId);
+      if (myBinaries)
+      {
+         glProgramParameteri(v.pending, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+      }
+      glLinkProgram(v.pending);
+   }
+}
+
+bool ShaderManager::isReady(int i) const
+{
+   const ShaderVariant& v = *myVariants[i];
+   if (!v.pending || !myParallel) return true;
+
+   GLint done = GL_FALSE;
+   glGetProgramiv(v.pending, GL_COMPLETION_STATUS_KHR, &done);
+   return done == GL_TRUE;
+}
+
+bool ShaderManager::finish()
+{
+   bool ok = true;
+   for (size_t i = 0; i < myVariants.size(); i++)
+   {
+      ShaderVariant& v = *myVariants[i];
+      if (v.pending)
+      {
+         // the first query waits for the driver to finish
+         GLint result = GL_FALSE;
+         glGetProgramiv(v.pending, GL_LINK_STATUS, &result);
+         if (result == GL_FALSE)
+         {
+            glGetShaderiv(v.vshaderId, GL_COMPILE_STATUS, &result);
+            if (result == GL_FALSE) PrintShaderErrors(v.vshaderId, "Vertex shader " + v.name);
+            glGetShaderiv(v.fshaderId, GL_COMPILE_STATUS, &result);
+            if (result == GL_FALSE) PrintShaderErrors(v.fshaderId, "Fragment shader " + v.name);
+         }
+
+         glDetachShader(v.pending, v.vshaderId);
+         glDetachShader(v.pending, v.fshaderId);
+         glDeleteShader(v.vshaderId);
+         glDeleteShader(v.fshaderId);
+
+         if (v.program.adopt(v.pending, v.name))
+         {
+            myNumCompiled++;
+            saveBinary(v);
+         }
+         else
+         {
+            v.failed = true;
+         }
+         v.pending = 0;
+         v.vshaderId = 0;
+         v.fshaderId = 0;
+      }
+      ok = ok && v.program.isValid();
+   }
+   return ok;
+}
+
+bool ShaderManager::build()
+{
+   submit();
+   return finish();
+}
+
+void ShaderManager::release()
+{
+   for (size_t i = 0; i < myVariants.size(); i++)
+   {
+      ShaderVariant& v = *myVariants[i];
+      if (v.pending)
+      {
+         glDeleteProgram(v.pending);
+         glDeleteShader(v.vshaderId);
+         glDeleteShader(v.fshaderId);
+         v.pending = 0;
+      }
+      v.program.release();
+      v.failed = false;
+   }
+}
+
+std::string ShaderManager::cacheFile(const ShaderVariant& variant) const
+{
+   char key[32];
+   sprintf(key, "-%016llx.bin", (unsigned long long) variant.key);
+   return myCacheDir + variant.name + key;
+}
+
+bool ShaderManager::loadBinary(ShaderVariant& variant)
+{
+   if (!myBinaries || myCacheDir.empty()) return false;
+
+   FILE* file = fopen(cacheFile(variant).c_str(), "rb");
+   if (!file) return false;
+
+   BinaryHeader header;
+   std::vector<char> data;
+   bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+      memcmp(header.magic, binary_magic, sizeof(binary_magic)) == 0 &&
+      header.version == binary_version && header.key == variant.key &&
+      header.length > 0 && header.length < (1u << 30);
+   if (ok)
+   {
+      data.resize((size_t) header.length);
+      ok = fread(&data[0], 1, data.size(), file) == data.size();
+   }
+   fclose(file);
+   if (!ok) return false;
+
+   GLuint id = glCreateProgram();
+   glProgramBinary(id, header.format, &data[0], (GLsizei) data.size());
+
+   // a driver update can reject old binaries; rebuild those quietly
+   GLint result = GL_FALSE;
+   glGetProgramiv(id, GL_LINK_STATUS, &result);
+   if (result == GL_FALSE)
+   {
+      glDeleteProgram(id);
+      return false;
+   }
+   return variant.program.adopt(id, variant.name);
+}
+
+void ShaderManager::saveBinary(ShaderVariant& variant)
+{
+   if (!myBinaries || myCacheDir.empty()) return;
+
+   GLint length = 0;
+   glGetProgramiv(variant.program.id(), GL_PROGRAM_BINARY_LENGTH, &length);
+   if (length <= 0) return;
+
+   BinaryHeader header;
+   memset(&header, 0, sizeof(header));
+   std::vector<char> data(length);
+   GLsizei written = 0;
+   GLenum format = 0;
+   glGetProgramBinary(variant.program.id(), length, &written, &format, &data[0]);
+   if (written <= 0) return;
+
+   memcpy(header.magic, binary_magic, sizeof(binary_magic));
+   header.version = binary_version;
+   header.format = format;
+   header.key = variant.key;
+   header.length = written;
+
+   // write a temporary file and rename it, so other viewers never read half a binary
+   MakeDirectory(myCacheDir);
+   std::string filename = cacheFile(variant);
+   char suffix[32];
+#ifdef _WIN32
+   sprintf(suffix, ".%d.tmp", _getpid());
+#else
+   sprintf(suffix, ".%d.tmp", (int) getpid());
+#endif
+   std::string temp = filename + suffix;
+
+   FILE* file = fopen(temp.c_str(), "wb");
+   if (!file) return;
+   bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(&data[0], 1, written, file) == (size_t) written;
+   ok = (fclose(file) == 0) && ok;
+   if (!ok || rename(temp.c_str(), filename.c_str()) != 0)
+   {
+      remove(temp.c_str());
+   }
+}
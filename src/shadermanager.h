@@ -0,0 +1,88 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef shadermanager_H_
+#define shadermanager_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "shader.h"
+
+namespace agl {
+
+   struct ShaderVariant;
+
+   // Builds the variants of one or more shader sources and keeps them all
+   // linked, so a program can switch between them at any time.
+   //
+   // A source file holds both stages. Each variant compiles it with its own
+   // #define flags after the #version line, plus VERTEX_SHADER or
+   // FRAGMENT_SHADER for the stage being compiled.
+   //
+   // Linked programs are saved with glGetProgramBinary to a cache directory,
+   // under a key made from the final sources and the driver string. Later
+   // runs load those binaries and compile nothing. Variants that aren't in
+   // the cache are all submitted before any result is checked, so drivers
+   // with KHR/ARB_parallel_shader_compile build them at the same time.
+   class ShaderManager
+   {
+   public:
+      ShaderManager();
+      virtual ~ShaderManager();
+
+      ShaderManager(const ShaderManager&) = delete;
+      ShaderManager& operator=(const ShaderManager&) = delete;
+
+      // Save and load program binaries in dir; "" turns the cache off
+      void setCacheDirectory(const std::string& dir);
+
+      // Register a variant of sourceFile built with the given #defines.
+      // Returns its index. Nothing is compiled until submit() or build().
+      int add(const std::string& name, const std::string& sourceFile,
+         const std::vector<std::string>& defines);
+
+      // Start building every registered variant that isn't built yet.
+      // Cached variants are ready right away; the others compile in the background
+      // where the driver allows it.
+      void submit();
+
+      // Return true if variant i has finished building, without waiting
+      bool isReady(int i) const;
+
+      // Wait for the submitted variants, report errors and save new binaries.
+      // Returns true if every variant built.
+      bool finish();
+
+      // submit() and finish()
+      bool build();
+
+      // Delete every program
+      void release();
+
+      int size() const { return (int) myVariants.size(); }
+      const std::string& name(int i) const;
+      ShaderProgram& program(int i);
+
+      // Return the index of the named variant, -1 if there is none
+      int find(const std::string& name) const;
+
+      // Variants restored from the cache and compiled from source so far
+      int numCached() const { return myNumCached; }
+      int numCompiled() const { return myNumCompiled; }
+
+   private:
+      bool loadBinary(ShaderVariant& variant);
+      void saveBinary(ShaderVariant& variant);
+      std::string cacheFile(const ShaderVariant& variant) const;
+
+   private:
+      std::vector<std::unique_ptr<ShaderVariant> > myVariants;
+      std::string myCacheDir;
+      std::string myDriver; // vendor, renderer and version of the GL driver
+      bool myBinaries; // true if the driver can save program binaries
+      bool myParallel; // true if the driver compiles in the background
+      int myNumCached;
+      int myNumCompiled;
+   };
+}
+
+#endif
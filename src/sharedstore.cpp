@@ -0,0 +1,495 @@
+// Haverford College, Jiajie Ma, 2021
+#include "sharedstore.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+// Atomics in shared memory are only safe across processes if they are lock free
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+   "shared mesh store needs lock free 32 and 64 bit atomics");
+
+static const uint32_t store_version = 2;
+static const size_t array_alignment = 64;
+
+enum SlotState { Publishing = 0, Ready = 1, Failed = 2 };
+enum SlotFlags { HasNormals = 1, HasColors = 2 };
+
+namespace agl {
+   struct SharedIndex
+   {
+      std::atomic<uint32_t> ready; // set once the creator has written the header
+      uint32_t version;
+      uint32_t capacity;
+      uint32_t reserved;
+   };
+}
+
+struct SharedSlot
+{
+   std::atomic<uint64_t> tag;   // hash of the key; 0 while the slot is free
+   std::atomic<uint32_t> state; // SlotState, valid once tag is set
+   std::atomic<uint32_t> owner; // pid of the publisher, set once key is written
+   uint32_t flags;              // HasNormals | HasColors
+   uint32_t numVertices;
+   uint32_t numTriangles;
+   float minBounds[3];
+   float maxBounds[3];
+   uint64_t size;               // size of the model segment
+   uint64_t normals;            // offsets into the segment; positions are at 0
+   uint64_t colors;
+   uint64_t indices;
+   char key[192];
+};
+
+static SharedSlot* Slots(SharedIndex* index)
+{
+   return (SharedSlot*) (index + 1);
+}
+
+static uint64_t HashKey(const std::string& key)
+{
+   // FNV-1a; 0 marks a free slot so it is never returned
+   uint64_t h = 1469598103934665603ull;
+   for (size_t i = 0; i < key.size(); i++)
+   {
+      h = (h ^ (unsigned char) key[i]) * 1099511628211ull;
+   }
+   return h ? h : 1;
+}
+
+static uint64_t Align(uint64_t offset)
+{
+   return (offset + array_alignment - 1) & ~(uint64_t) (array_alignment - 1);
+}
+
+SharedMeshStore::SharedMeshStore() : myIndex(0), myIndexSize(0)
+{
+}
+
+SharedMeshStore::~SharedMeshStore()
+{
+   close();
+}
+
+std::string SharedMeshStore::segmentName(int slot) const
+{
+   char suffix[32];
+   sprintf(suffix, ".%d", slot);
+   return myName + suffix;
+}
+
+#ifdef _WIN32
+
+// Named mappings backed by the paging file. Windows deletes a mapping once
+// no process has a view of it, so there is nothing to unlink.
+
+static uint32_t CurrentProcess()
+{
+   return (uint32_t) GetCurrentProcessId();
+}
+
+// Return false only if pid is known to have exited
+static bool ProcessAlive(uint32_t pid)
+{
+   HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD) pid);
+   if (!process) return GetLastError() == ERROR_ACCESS_DENIED;
+   bool alive = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+   CloseHandle(process);
+   return alive;
+}
+
+static void* CreateSegment(const std::string& name, uint64_t size)
+{
+   HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      (DWORD) (size >> 32), (DWORD) size, name.c_str());
+   if (!mapping) return 0;
+
+   // an existing mapping may have another size
+   void* data = 0;
+   if (GetLastError() != ERROR_ALREADY_EXISTS)
+   {
+      data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T) size);
+   }
+   CloseHandle(mapping); // the view keeps the mapping alive
+   return data;
+}
+
+static void* OpenSegment(const std::string& name, uint64_t size)
+{
+   HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+   if (!mapping) return 0;
+   void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T) size);
+   CloseHandle(mapping);
+   return data;
+}
+
+static void UnmapSegment(void* data, size_t)
+{
+   UnmapViewOfFile(data);
+}
+
+bool SharedMeshStore::open(const std::string& name, int capacity)
+{
+   close();
+   myName = "Local\\" + name;
+
+   // new mappings are zero filled, so every slot starts out free
+   uint64_t size = sizeof(SharedIndex) + (uint64_t) capacity * sizeof(SharedSlot);
+   HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      (DWORD) (size >> 32), (DWORD) size, myName.c_str());
+   bool creator = (mapping && GetLastError() != ERROR_ALREADY_EXISTS);
+   void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : 0;
+   if (mapping) CloseHandle(mapping);
+   if (!data)
+   {
+      cout << "ERROR: Cannot open shared mesh store: " << name << endl;
+      return false;
+   }
+
+   // the view covers the creator's size, which may differ from ours
+   MEMORY_BASIC_INFORMATION info;
+   VirtualQuery(data, &info, sizeof(info));
+   myIndex = (SharedIndex*) data;
+   myIndexSize = info.RegionSize;
+   if (creator)
+   {
+      myIndex->version = store_version;
+      myIndex->capacity = capacity;
+      myIndex->ready.store(1, std::memory_order_release);
+   }
+
+   // wait (briefly) for the creator to write the header
+   for (int attempt = 0; attempt < 2000 && !myIndex->ready.load(std::memory_order_acquire); attempt++)
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+
+   if (!myIndex->ready.load(std::memory_order_acquire) || myIndex->version != store_version ||
+      myIndexSize < sizeof(SharedIndex) + (size_t) myIndex->capacity * sizeof(SharedSlot))
+   {
+      cout << "ERROR: Cannot attach to shared mesh store: " << name << endl;
+      close();
+      return false;
+   }
+   return true;
+}
+
+void SharedMeshStore::remove(const std::string&)
+{
+}
+
+#else
+
+static uint32_t CurrentProcess()
+{
+   return (uint32_t) getpid();
+}
+
+// Return false only if pid is known to have exited
+static bool ProcessAlive(uint32_t pid)
+{
+   return kill((pid_t) pid, 0) == 0 || errno != ESRCH;
+}
+
+// only processes of the same user may map segments
+static void* CreateSegment(const std::string& name, uint64_t size)
+{
+   int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+   if (fd < 0) return 0;
+
+   bool ok = (ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0);
+   void* data = ok ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+   ::close(fd);
+   if (data == MAP_FAILED)
+   {
+      shm_unlink(name.c_str());
+      return 0;
+   }
+   return data;
+}
+
+static void* OpenSegment(const std::string& name, uint64_t size)
+{
+   int fd = shm_open(name.c_str(), O_RDONLY, 0);
+   if (fd < 0) return 0;
+   void* data = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   return data == MAP_FAILED ? 0 : data;
+}
+
+static void UnmapSegment(void* data, size_t size)
+{
+   munmap(data, size);
+}
+
+bool SharedMeshStore::open(const std::string& name, int capacity)
+{
+   close();
+   myName = "/" + name;
+
+   // only processes of the same user may attach
+   int fd = shm_open(myName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+   bool creator = (fd >= 0);
+   if (!creator)
+   {
+      fd = shm_open(myName.c_str(), O_RDWR, 0);
+   }
+   if (fd < 0)
+   {
+      cout << "ERROR: Cannot open shared mesh store: " << name << endl;
+      return false;
+   }
+
+   if (creator)
+   {
+      // new shared memory is zero filled, so every slot starts out free
+      myIndexSize = sizeof(SharedIndex) + (size_t) capacity * sizeof(SharedSlot);
+      if (ftruncate(fd, myIndexSize) == 0)
+      {
+         void* data = mmap(0, myIndexSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+         if (data != MAP_FAILED)
+         {
+            myIndex = (SharedIndex*) data;
+            myIndex->version = store_version;
+            myIndex->capacity = capacity;
+            myIndex->ready.store(1, std::memory_order_release);
+         }
+      }
+   }
+   else
+   {
+      // wait (briefly) for the creator to size the segment and write the header
+      for (int attempt = 0; attempt < 2000 && !myIndex; attempt++)
+      {
+         struct stat info;
+         if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(SharedIndex))
+         {
+            void* data = mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+            {
+               SharedIndex* index = (SharedIndex*) data;
+               if (index->ready.load(std::memory_order_acquire))
+               {
+                  myIndex = index;
+                  myIndexSize = info.st_size;
+                  break;
+               }
+               munmap(data, info.st_size);
+            }
+         }
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+   }
+   ::close(fd);
+
+   if (!myIndex || myIndex->version != store_version ||
+      myIndexSize < sizeof(SharedIndex) + (size_t) myIndex->capacity * sizeof(SharedSlot))
+   {
+      cout << "ERROR: Cannot attach to shared mesh store: " << name << endl;
+      close();
+      return false;
+   }
+   return true;
+}
+
+void SharedMeshStore::remove(const std::string& name)
+{
+   SharedMeshStore store;
+   std::string path = "/" + name;
+   int fd = shm_open(path.c_str(), O_RDONLY, 0);
+   if (fd >= 0)
+   {
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(SharedIndex))
+      {
+         void* data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+         if (data != MAP_FAILED)
+         {
+            SharedIndex* index = (SharedIndex*) data;
+            store.myName = path;
+            uint32_t capacity = std::min<uint64_t>(index->capacity,
+               (info.st_size - sizeof(SharedIndex)) / sizeof(SharedSlot));
+            for (uint32_t i = 0; i < capacity; i++)
+            {
+               if (Slots(index)[i].tag.load() != 0)
+               {
+                  shm_unlink(store.segmentName(i).c_str());
+               }
+            }
+            munmap(data, info.st_size);
+         }
+      }
+      ::close(fd);
+   }
+   shm_unlink(path.c_str());
+}
+
+#endif
+
+void SharedMeshStore::close()
+{
+   std::map<int, std::pair<void*, size_t> >::iterator it;
+   for (it = mySegments.begin(); it != mySegments.end(); ++it)
+   {
+      UnmapSegment(it->second.first, it->second.second);
+   }
+   mySegments.clear();
+
+   if (myIndex)
+   {
+      UnmapSegment(myIndex, myIndexSize);
+   }
+   myIndex = 0;
+   myIndexSize = 0;
+}
+
+bool SharedMeshStore::acquire(const std::string& key, Mesh& mesh, const std::function<bool(Mesh&)>& load)
+{
+   if (!myIndex || key.size() >= sizeof(SharedSlot().key))
+   {
+      return load(mesh);
+   }
+
+   uint64_t hash = HashKey(key);
+   uint32_t capacity = myIndex->capacity;
+   SharedSlot* slots = Slots(myIndex);
+   uint32_t pid = CurrentProcess();
+
+   // this process owns the slot: load privately, then share
+   auto loadAndPublish = [&](int slot)
+   {
+      bool loaded = load(mesh);
+      bool published = loaded && publish(slot, mesh);
+      slots[slot].state.store(published ? Ready : Failed, std::memory_order_release);
+      return loaded;
+   };
+
+   for (uint32_t probe = 0; probe < capacity; probe++)
+   {
+      int slot = (int) ((hash + probe) % capacity);
+      SharedSlot& s = slots[slot];
+
+      uint64_t tag = s.tag.load(std::memory_order_acquire);
+      if (tag == 0)
+      {
+         if (s.tag.compare_exchange_strong(tag, hash, std::memory_order_acq_rel))
+         {
+            strcpy(s.key, key.c_str());
+            s.owner.store(pid, std::memory_order_release);
+            return loadAndPublish(slot);
+         }
+         // another process claimed it first; tag now holds its hash
+      }
+      if (tag != hash) continue;
+
+      // wait for the publisher; if it died publishing, the first process to
+      // notice takes the slot over
+      uint32_t state = s.state.load(std::memory_order_acquire);
+      bool abandoned = false;
+      for (int attempt = 0; state == Publishing && !abandoned && attempt < 10000; attempt++)
+      {
+         uint32_t owner = s.owner.load(std::memory_order_acquire);
+         if (owner != 0 && !ProcessAlive(owner))
+         {
+            // a slot of another key with the same hash stays abandoned
+            abandoned = (strcmp(s.key, key.c_str()) != 0);
+            if (!abandoned && s.owner.compare_exchange_strong(owner, pid, std::memory_order_acq_rel))
+            {
+               return loadAndPublish(slot);
+            }
+            continue;
+         }
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         state = s.state.load(std::memory_order_acquire);
+      }
+      if (abandoned || state == Failed) continue; // a later slot may still be published
+      if (state != Ready) break;
+      if (strcmp(s.key, key.c_str()) != 0) continue; // hash collision
+
+      if (attach(slot, mesh)) return true;
+      break;
+   }
+
+   // the table is full or the shared copy is unusable
+   return load(mesh);
+}
+
+bool SharedMeshStore::publish(int slot, Mesh& mesh)
+{
+   SharedSlot& s = Slots(myIndex)[slot];
+   uint64_t vsize = 3ull * mesh.numVertices() * sizeof(float);
+   uint64_t fsize = 3ull * mesh.numTriangles() * sizeof(unsigned int);
+   bool withNormals = mesh.hasNormals();
+   bool withColors = mesh.hasColors();
+
+   s.numVertices = mesh.numVertices();
+   s.numTriangles = mesh.numTriangles();
+   for (int k = 0; k < 3; k++)
+   {
+      s.minBounds[k] = mesh.getMinBounds()[k];
+      s.maxBounds[k] = mesh.getMaxBounds()[k];
+   }
+   s.flags = (withNormals ? HasNormals : 0) | (withColors ? HasColors : 0);
+   uint64_t next = Align(vsize);
+   s.normals = withNormals ? next : 0;
+   next = withNormals ? Align(next + vsize) : next;
+   s.colors = withColors ? next : 0;
+   next = withColors ? Align(next + vsize) : next;
+   s.indices = next;
+   s.size = std::max<uint64_t>(s.indices + fsize, 1);
+
+   unsigned char* bytes = (unsigned char*) CreateSegment(segmentName(slot), s.size);
+   if (!bytes) return false;
+   memcpy(bytes, mesh.positions(), vsize);
+   if (withNormals) memcpy(bytes + s.normals, mesh.normals(), vsize);
+   if (withColors) memcpy(bytes + s.colors, mesh.colors(), vsize);
+   memcpy(bytes + s.indices, mesh.indices(), fsize);
+#ifdef _WIN32
+   // the segment only lives while a view of it does, so this one is kept
+   mySegments[slot] = std::make_pair((void*) bytes, (size_t) s.size);
+#else
+   munmap(bytes, s.size);
+#endif
+
+   // drop the private copy: this process uses the shared pages too
+   return attach(slot, mesh);
+}
+
+bool SharedMeshStore::attach(int slot, Mesh& mesh)
+{
+   const SharedSlot& s = Slots(myIndex)[slot];
+
+   std::map<int, std::pair<void*, size_t> >::iterator it = mySegments.find(slot);
+   if (it == mySegments.end())
+   {
+      void* data = OpenSegment(segmentName(slot), s.size);
+      if (!data) return false;
+      it = mySegments.insert(std::make_pair(slot, std::make_pair(data, (size_t) s.size))).first;
+   }
+
+   unsigned char* bytes = (unsigned char*) it->second.first;
+   mesh.setExternalData(s.numVertices, s.numTriangles,
+      (float*) bytes,
+      (s.flags & HasNormals) ? (float*) (bytes + s.normals) : 0,
+      (s.flags & HasColors) ? (float*) (bytes + s.colors) : 0,
+      (unsigned int*) (bytes + s.indices),
+      glm::vec3(s.minBounds[0], s.minBounds[1], s.minBounds[2]),
+      glm::vec3(s.maxBounds[0], s.maxBounds[1], s.maxBounds[2]));
+   return true;
+}
@@ -0,0 +1,68 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef sharedstore_H_
+#define sharedstore_H_
+
+#include <functional>
+#include <map>
+#include <string>
+#include "mesh.h"
+
+namespace agl {
+
+   struct SharedIndex;
+
+   // Decoded meshes shared between processes through named shared memory.
+   //
+   // The store is an index segment "/<name>" holding a fixed-size, open
+   // addressed hash table, plus one segment "/<name>.<slot>" per model.
+   // Slots are claimed with a compare-and-swap on the key hash and become
+   // visible once their data is complete, so no process ever takes a lock.
+   // The first process to ask for a model loads and publishes it; every
+   // other process maps the published arrays read-only, without copying.
+   // If a publisher dies first, the next process to ask takes its slot over.
+   // Segments can only be opened by processes of the user that created them.
+   //
+   // On Linux and macOS, segments outlive the processes that created them
+   // until remove() is called. Keep store names short: macOS limits them to
+   // about 30 characters. On Windows, segments are named file mappings in the
+   // session namespace and disappear once no process has the store open.
+   class SharedMeshStore
+   {
+   public:
+      SharedMeshStore();
+      virtual ~SharedMeshStore();
+
+      // Create or attach to the store with the given name
+      // capacity is only used by the process that creates the store
+      // Returns true if successfull. false otherwise.
+      bool open(const std::string& name, int capacity = 1024);
+
+      // Unmap everything; meshes returned by acquire become invalid
+      void close();
+
+      // Return true if a store is open
+      bool isOpen() const { return myIndex != 0; }
+
+      // Point mesh at the shared copy of key. If no process has published key
+      // yet, load(mesh) is called to read it privately and the result is
+      // published for everyone else.
+      // The mesh must not be written to and is valid until close().
+      bool acquire(const std::string& key, Mesh& mesh, const std::function<bool(Mesh&)>& load);
+
+      // Unlink the index and all model segments of the named store
+      static void remove(const std::string& name);
+
+   private:
+      bool attach(int slot, Mesh& mesh);
+      bool publish(int slot, Mesh& mesh);
+      std::string segmentName(int slot) const;
+
+   private:
+      std::string myName;
+      SharedIndex* myIndex;
+      size_t myIndexSize;
+      std::map<int, std::pair<void*, size_t> > mySegments; // mapped model segments by slot
+   };
+}
+
+#endif
@@ -7,14 +7,18 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include "scheduler.h"
+#include "shader.h"
 
 using namespace std;
 using namespace glm;
+using namespace agl;
 
 const float cameraSpeed = 0.25f;
 float lastX, lastY, dist, azimuth, elevation;
 bool control = false, zoom = false;
 glm::vec3 lookfrom;
+RenderScheduler theScheduler; // draws only when the view changes
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
@@ -31,6 +35,12 @@ static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	
    // Set Viewport to window dimensions
    glViewport(0, 0, width, height);
+   theScheduler.invalidate();
+}
+
+static void window_refresh_callback(GLFWwindow* window)
+{
+   theScheduler.invalidate();
 }
 
 static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -63,6 +73,8 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 {
    if (control)
    {
+      theScheduler.invalidate(); // the camera moves
+
       // zoom in/out with shift and cursor
       if (zoom){
          float distDelta = ypos - lastY;
@@ -99,37 +111,6 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
    lastY = ypos;
 }
 
-static void PrintShaderErrors(GLuint id, const std::string label)
-{
-   std::cerr << label << " failed\n";
-   GLint logLen;
-   glGetShaderiv(id, GL_INFO_LOG_LENGTH, &logLen);
-   if (logLen > 0)
-   {
-      char* log = (char*)malloc(logLen);
-      GLsizei written;
-      glGetShaderInfoLog(id, logLen, &written, log);
-      std::cerr << "Shader log: " << log << std::endl;
-      free(log);
-   }
-}
-
-static std::string LoadShaderFromFile(const std::string& fileName)
-{
-   std::ifstream file(fileName);
-   if (!file)
-   {
-      std::cout << "Cannot load file: " << fileName << std::endl;
-      return "";
-   }
-
-   std::stringstream code;
-   code << file.rdbuf();
-   file.close();
-
-   return code.str();
-}
-
 int main(int argc, char** argv)
 {
    GLFWwindow* window;
@@ -161,6 +142,7 @@ int main(int argc, char** argv)
    glfwSetMouseButtonCallback(window, mouse_button_callback);
    glfwSetScrollCallback(window, scroll_callback);
    glfwSetCursorPosCallback(window, cursor_position_callback);
+   glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
 #ifndef APPLE
    if (glewInit() != GLEW_OK)
@@ -233,46 +215,14 @@ int main(int argc, char** argv)
    glBindBuffer(GL_ARRAY_BUFFER, vboNormalId); // always bind before setting data
    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
 
-   GLint result;
-   std::string vertexShader = LoadShaderFromFile("../shaders/unlit.vs");
-   const char* vertexShaderRaw = vertexShader.c_str();
-   GLuint vshaderId = glCreateShader(GL_VERTEX_SHADER);
-   glShaderSource(vshaderId, 1, &vertexShaderRaw, NULL);
-   glCompileShader(vshaderId);
-   glGetShaderiv(vshaderId, GL_COMPILE_STATUS, &result);
-   if (result == GL_FALSE)
-   {
-      PrintShaderErrors(vshaderId, "Vertex shader");
-      return -1;
-   }
-
-   std::string fragmentShader = LoadShaderFromFile("../shaders/unlit.fs");
-   const char* fragmentShaderRaw = fragmentShader.c_str();
-   GLuint fshaderId = glCreateShader(GL_FRAGMENT_SHADER);
-   glShaderSource(fshaderId, 1, &fragmentShaderRaw, NULL);
-   glCompileShader(fshaderId);
-   glGetShaderiv(fshaderId, GL_COMPILE_STATUS, &result);
-   if (result == GL_FALSE)
-   {
-      PrintShaderErrors(fshaderId, "Fragment shader");
-      return -1;
-   }
-
-   GLuint shaderId = glCreateProgram();
-   glAttachShader(shaderId, vshaderId);
-   glAttachShader(shaderId, fshaderId);
-   glLinkProgram(shaderId);
-   glGetShaderiv(shaderId, GL_LINK_STATUS, &result);
-   if (result == GL_FALSE)
+   ShaderProgram shader;
+   if (!shader.load("../shaders/unlit.vs", "../shaders/unlit.fs"))
    {
-      PrintShaderErrors(shaderId, "Shader link");
+      glfwTerminate();
       return -1;
    }
 
-   glUseProgram(shaderId);
-
    // set up the viewer
-   GLuint matrixParam = glGetUniformLocation(shaderId, "mvp");
    glm::mat4 transform(1.0); // initialize to identity
    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 10.0f);
    dist = 3.0f;
@@ -285,6 +235,9 @@ int main(int argc, char** argv)
    // Loop until the user closes the window 
    while (!glfwWindowShouldClose(window))
    {
+      // sleep until something changes
+      if (!theScheduler.wait()) continue;
+
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the buffers
 
       // enable camera control
@@ -293,19 +246,18 @@ int main(int argc, char** argv)
       lookfrom.y = dist * sin(glm::radians(elevation));
       glm::mat4 camera = glm::lookAt(lookfrom, glm::vec3(0,0,0), glm::vec3(0,1.0f,0));
       glm::mat4 mvp = projection * camera * transform;
-      glUniformMatrix4fv(matrixParam, 1, GL_FALSE, &mvp[0][0]);
+      shader.setUniform("mvp", mvp);
 
       // Draw primitive
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
       glDrawElements(GL_TRIANGLES, numTriangles * 3, GL_UNSIGNED_INT, (void*)0);
 
-      // Swap front and back buffers
+      // Swap front and back buffers; events are handled by the scheduler
       glfwSwapBuffers(window);
-
-      // Poll for and process events
-      glfwPollEvents();
    }
+   theScheduler.printStats(cout);
 
+   shader.release();
    glfwTerminate();
    return 0;
 }
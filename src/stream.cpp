@@ -0,0 +1,457 @@
+// Haverford College, Jiajie Ma, 2021
+#include "stream.h"
+#include <cstring>
+#include <iostream>
+#ifdef AGL_HAVE_ZLIB
+#include <zlib.h>
+#else
+#include <cstdlib>
+#include "stb/stb_image.h"
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+//--------------------------------------------------------------------
+// FileSource
+
+FileSource::FileSource(FILE* file, bool owned) : myFile(file), myOwned(owned)
+{
+}
+
+FileSource::~FileSource()
+{
+   if (myOwned && myFile)
+   {
+      fclose(myFile);
+   }
+}
+
+long FileSource::read(char* buffer, size_t size)
+{
+   size_t n = fread(buffer, 1, size, myFile);
+   if (n == 0 && ferror(myFile))
+   {
+      return -1;
+   }
+   return (long) n;
+}
+
+//--------------------------------------------------------------------
+// PrefixSource: replays bytes that were consumed to sniff the format
+
+namespace {
+   class PrefixSource : public ByteSource
+   {
+   public:
+      PrefixSource(const char* prefix, size_t len, ByteSource* rest) :
+         myPrefix(prefix, prefix + len), myPos(0), myRest(rest) {}
+
+      virtual long read(char* buffer, size_t size)
+      {
+         if (myPos < myPrefix.size())
+         {
+            size_t n = std::min(size, myPrefix.size() - myPos);
+            memcpy(buffer, &myPrefix[myPos], n);
+            myPos += n;
+            return (long) n;
+         }
+         return myRest->read(buffer, size);
+      }
+
+   private:
+      std::vector<char> myPrefix;
+      size_t myPos;
+      std::unique_ptr<ByteSource> myRest;
+   };
+}
+
+//--------------------------------------------------------------------
+// GzipSource
+
+#ifdef AGL_HAVE_ZLIB
+
+struct GzipSource::Impl
+{
+   z_stream zs;
+   std::vector<unsigned char> in;
+   bool eof;
+   bool error;
+   bool inMember; // true between the start and the end of a gzip member
+};
+
+GzipSource::GzipSource(ByteSource* compressed) : mySource(compressed), myImpl(new Impl)
+{
+   memset(&myImpl->zs, 0, sizeof(myImpl->zs));
+   myImpl->in.resize(1 << 16);
+   myImpl->eof = false;
+   myImpl->inMember = false;
+   myImpl->error = (inflateInit2(&myImpl->zs, 15 + 32) != Z_OK); // 32: detect gzip or zlib header
+}
+
+GzipSource::~GzipSource()
+{
+   inflateEnd(&myImpl->zs);
+}
+
+long GzipSource::read(char* buffer, size_t size)
+{
+   z_stream& zs = myImpl->zs;
+   if (myImpl->error) return -1;
+   if (size == 0) return 0;
+
+   zs.next_out = (Bytef*) buffer;
+   zs.avail_out = (uInt) size;
+   while (zs.avail_out == size)
+   {
+      if (zs.avail_in == 0)
+      {
+         if (myImpl->eof) break;
+         long n = mySource->read((char*) &myImpl->in[0], myImpl->in.size());
+         if (n < 0)
+         {
+            myImpl->error = true;
+            return -1;
+         }
+         if (n == 0)
+         {
+            myImpl->eof = true;
+            if (myImpl->inMember)
+            {
+               cout << "ERROR: gzip: unexpected end of data" << endl;
+               myImpl->error = true;
+               return -1;
+            }
+            break;
+         }
+         zs.next_in = &myImpl->in[0];
+         zs.avail_in = (uInt) n;
+      }
+
+      if (!myImpl->inMember)
+      {
+         // tools that write gzip to tape or blocks may pad members with zeros,
+         // which no gzip or zlib header starts with
+         while (zs.avail_in > 0 && *zs.next_in == 0)
+         {
+            zs.next_in++;
+            zs.avail_in--;
+         }
+         if (zs.avail_in == 0) continue;
+      }
+
+      myImpl->inMember = true;
+      int ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+      {
+         // concatenated gzip members are decoded as one stream
+         inflateReset(&zs);
+         myImpl->inMember = false;
+      }
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      {
+         cout << "ERROR: gzip: " << (zs.msg ? zs.msg : "corrupt data") << endl;
+         myImpl->error = true;
+         return -1;
+      }
+   }
+   return (long) (size - zs.avail_out);
+}
+
+#else
+
+// Without zlib the whole compressed input is read and handed to the stb
+// inflater, so decompression does not overlap with the reads.
+struct GzipSource::Impl
+{
+   char* data;
+   int size;
+   int pos;
+   bool decoded;
+   bool error;
+};
+
+static int SkipGzipHeader(const unsigned char* p, int len)
+{
+   // RFC 1952: ID1 ID2 CM FLG MTIME(4) XFL OS [EXTRA] [NAME] [COMMENT] [HCRC]
+   if (len < 10 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) return -1;
+   int flags = p[3];
+   int i = 10;
+   if (flags & 4)
+   {
+      if (i + 2 > len) return -1;
+      i += 2 + (p[i] | (p[i + 1] << 8));
+   }
+   if (flags & 8) { while (i < len && p[i] != 0) i++; i++; }
+   if (flags & 16) { while (i < len && p[i] != 0) i++; i++; }
+   if (flags & 2) i += 2;
+   return i < len ? i : -1;
+}
+
+GzipSource::GzipSource(ByteSource* compressed) : mySource(compressed), myImpl(new Impl)
+{
+   myImpl->data = 0;
+   myImpl->size = 0;
+   myImpl->pos = 0;
+   myImpl->decoded = false;
+   myImpl->error = false;
+}
+
+GzipSource::~GzipSource()
+{
+   stbi_image_free(myImpl->data); // stb allocates from the image pool
+}
+
+long GzipSource::read(char* buffer, size_t size)
+{
+   if (myImpl->error) return -1;
+   if (size == 0) return 0;
+   if (!myImpl->decoded)
+   {
+      myImpl->decoded = true;
+
+      std::vector<char> compressed;
+      char chunk[1 << 16];
+      long n;
+      while ((n = mySource->read(chunk, sizeof(chunk))) > 0)
+      {
+         compressed.insert(compressed.end(), chunk, chunk + n);
+      }
+      if (n < 0 || compressed.size() < 2)
+      {
+         myImpl->error = true;
+         return -1;
+      }
+
+      const unsigned char* p = (const unsigned char*) &compressed[0];
+      int len = (int) compressed.size();
+      if (p[0] == 0x1f)
+      {
+         int start = SkipGzipHeader(p, len);
+         if (start >= 0)
+         {
+            // the 8 byte trailer (CRC32, ISIZE) follows the deflate data
+            myImpl->data = stbi_zlib_decode_noheader_malloc(&compressed[start], len - start, &myImpl->size);
+         }
+      }
+      else
+      {
+         myImpl->data = stbi_zlib_decode_malloc(&compressed[0], len, &myImpl->size);
+      }
+
+      if (!myImpl->data)
+      {
+         cout << "ERROR: gzip: corrupt data" << endl;
+         myImpl->error = true;
+         return -1;
+      }
+   }
+
+   size_t n = std::min(size, (size_t) (myImpl->size - myImpl->pos));
+   memcpy(buffer, myImpl->data + myImpl->pos, n);
+   myImpl->pos += (int) n;
+   return (long) n;
+}
+
+#endif
+
+//--------------------------------------------------------------------
+// PipelinedStreamBuf
+
+PipelinedStreamBuf::PipelinedStreamBuf(ByteSource* source, size_t blockSize, int numBlocks) :
+   mySource(source),
+   myBlocks(numBlocks, std::vector<char>(blockSize)),
+   mySizes(numBlocks, 0),
+   myCurrent(-1),
+   myDone(false),
+   myFailed(false),
+   myStop(false)
+{
+   for (int i = 0; i < numBlocks; i++)
+   {
+      myEmpty.push_back(i);
+   }
+   setg(0, 0, 0);
+   myProducer = std::thread(&PipelinedStreamBuf::produce, this);
+}
+
+PipelinedStreamBuf::~PipelinedStreamBuf()
+{
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myStop = true;
+   }
+   myCond.notify_all();
+   myProducer.join();
+}
+
+bool PipelinedStreamBuf::failed() const
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   return myFailed;
+}
+
+void PipelinedStreamBuf::produce()
+{
+   while (true)
+   {
+      int block;
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         while (myEmpty.empty() && !myStop)
+         {
+            myCond.wait(lock);
+         }
+         if (myStop) return;
+         block = myEmpty.front();
+         myEmpty.pop_front();
+      }
+
+      // fill the whole block unless the source runs dry
+      std::vector<char>& data = myBlocks[block];
+      size_t filled = 0;
+      long n = 0;
+      while (filled < data.size())
+      {
+         n = mySource->read(&data[filled], data.size() - filled);
+         if (n <= 0) break;
+         filled += n;
+      }
+
+      {
+         std::lock_guard<std::mutex> lock(myMutex);
+         if (filled > 0)
+         {
+            mySizes[block] = filled;
+            myFull.push_back(block);
+         }
+         else
+         {
+            myEmpty.push_back(block);
+         }
+         if (n <= 0)
+         {
+            myDone = true;
+            myFailed = (n < 0);
+         }
+      }
+      myCond.notify_all();
+      if (n <= 0) return;
+   }
+}
+
+PipelinedStreamBuf::int_type PipelinedStreamBuf::underflow()
+{
+   if (gptr() < egptr())
+   {
+      return traits_type::to_int_type(*gptr());
+   }
+
+   std::unique_lock<std::mutex> lock(myMutex);
+   if (myCurrent >= 0)
+   {
+      myEmpty.push_back(myCurrent);
+      myCurrent = -1;
+      myCond.notify_all();
+   }
+   while (myFull.empty() && !myDone)
+   {
+      myCond.wait(lock);
+   }
+   if (myFull.empty())
+   {
+      setg(0, 0, 0);
+      return traits_type::eof();
+   }
+
+   myCurrent = myFull.front();
+   myFull.pop_front();
+   char* start = &myBlocks[myCurrent][0];
+   setg(start, start, start + mySizes[myCurrent]);
+   return traits_type::to_int_type(*gptr());
+}
+
+//--------------------------------------------------------------------
+// InputStream
+
+InputStream::InputStream() : std::istream(0)
+{
+}
+
+InputStream::InputStream(const std::string& filename) : std::istream(0)
+{
+   open(filename);
+}
+
+InputStream::~InputStream()
+{
+   close();
+}
+
+bool InputStream::open(const std::string& filename, size_t blockSize)
+{
+   if (filename == "-")
+   {
+#ifdef _WIN32
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+      return open(stdin, false, blockSize);
+   }
+
+   FILE* file = fopen(filename.c_str(), "rb");
+   if (!file)
+   {
+      close();
+      setstate(std::ios::failbit);
+      return false;
+   }
+   return open(file, true, blockSize);
+}
+
+bool InputStream::open(FILE* file, bool owned, size_t blockSize)
+{
+   close();
+
+   // sniff the magic bytes; they are replayed to whichever reader follows
+   ByteSource* source = new FileSource(file, owned);
+   char magic[2];
+   long n = source->read(magic, 2);
+   if (n < 0)
+   {
+      delete source;
+      setstate(std::ios::failbit);
+      return false;
+   }
+
+   source = new PrefixSource(magic, n, source);
+   bool gzip = (n == 2 && (unsigned char) magic[0] == 0x1f && (unsigned char) magic[1] == 0x8b);
+   if (gzip)
+   {
+      source = new GzipSource(source);
+   }
+
+   myBuffer.reset(new PipelinedStreamBuf(source, blockSize));
+   rdbuf(myBuffer.get());
+   clear();
+   return true;
+}
+
+bool InputStream::is_open() const
+{
+   return myBuffer.get() != 0;
+}
+
+bool InputStream::failed() const
+{
+   return myBuffer && myBuffer->failed();
+}
+
+void InputStream::close()
+{
+   rdbuf(0);
+   myBuffer.reset();
+}
@@ -0,0 +1,129 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef stream_H_
+#define stream_H_
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace agl {
+
+   // A forward-only source of bytes. Sources are never seeked, so files,
+   // stdin, pipes and decompressors can all be read the same way.
+   class ByteSource
+   {
+   public:
+      virtual ~ByteSource() {}
+
+      // Read up to size bytes into buffer
+      // Returns the number of bytes read, 0 at the end of the data, -1 on error
+      virtual long read(char* buffer, size_t size) = 0;
+   };
+
+   // Reads a FILE* (a regular file, stdin or a pipe) with fread
+   class FileSource : public ByteSource
+   {
+   public:
+      // If owned is true, the file is closed when this source is destroyed
+      FileSource(FILE* file, bool owned);
+      virtual ~FileSource();
+
+      virtual long read(char* buffer, size_t size);
+
+   private:
+      FILE* myFile;
+      bool myOwned;
+   };
+
+   // Inflates a gzip (or zlib) compressed source. Uses system zlib when the
+   // build found it (AGL_HAVE_ZLIB) and the inflater inside stb_image otherwise.
+   // With zlib, concatenated members are read as one stream and zero padding
+   // between or after them is skipped.
+   class GzipSource : public ByteSource
+   {
+   public:
+      GzipSource(ByteSource* compressed);
+      virtual ~GzipSource();
+
+      virtual long read(char* buffer, size_t size);
+
+   private:
+      struct Impl;
+      std::unique_ptr<ByteSource> mySource;
+      std::unique_ptr<Impl> myImpl;
+   };
+
+   // A streambuf whose data is produced by a background thread.
+   // The producer reads (and decompresses) fixed-size blocks from a ByteSource
+   // into a bounded queue while the consumer parses the previous blocks.
+   class PipelinedStreamBuf : public std::streambuf
+   {
+   public:
+      // Takes ownership of source
+      PipelinedStreamBuf(ByteSource* source, size_t blockSize, int numBlocks = 4);
+      virtual ~PipelinedStreamBuf();
+
+      // Return true if the source reported an error
+      bool failed() const;
+
+   protected:
+      virtual int_type underflow();
+
+   private:
+      void produce();
+
+   private:
+      std::unique_ptr<ByteSource> mySource;
+      std::vector<std::vector<char> > myBlocks;
+      std::deque<int> myFull;  // blocks ready to be parsed, with their sizes in mySizes
+      std::deque<int> myEmpty; // blocks ready to be filled
+      std::vector<size_t> mySizes;
+      int myCurrent; // block owned by the consumer, -1 if none
+      bool myDone;
+      bool myFailed;
+      bool myStop;
+      mutable std::mutex myMutex;
+      std::condition_variable myCond;
+      std::thread myProducer;
+   };
+
+   // Input stream over a file, stdin ("-"), a pipe or a gzip compressed file.
+   // Compressed data is detected by its magic bytes, so pipes work as well.
+   class InputStream : public std::istream
+   {
+   public:
+      InputStream();
+      InputStream(const std::string& filename);
+      virtual ~InputStream();
+
+      // Open the given filename; "-" reads from stdin
+      // blockSize is the read-ahead granularity; use a small one to read only a header
+      // Returns true if successfull. false otherwise.
+      bool open(const std::string& filename, size_t blockSize = DefaultBlockSize);
+
+      // Read from an already open FILE*, such as the read end of a pipe
+      bool open(FILE* file, bool owned, size_t blockSize = DefaultBlockSize);
+
+      static const size_t DefaultBlockSize = 1 << 18;
+
+      // Return true if the stream is open
+      bool is_open() const;
+
+      // Return true if reading failed below the parser (I/O or decompression errors)
+      bool failed() const;
+
+      void close();
+
+   private:
+      std::unique_ptr<PipelinedStreamBuf> myBuffer;
+   };
+}
+
+#endif
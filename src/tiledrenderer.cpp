@@ -0,0 +1,213 @@
+// Haverford College, Jiajie Ma, 2021
+#include "tiledrenderer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "colorconvert.h"
+#include "profiler.h"
+
+using namespace std;
+using namespace agl;
+
+// Strips of wide images get fewer rows to stay under this size
+static const size_t MaxStripBytes = 32 * 1024 * 1024;
+
+namespace {
+
+   typedef std::chrono::steady_clock Clock;
+
+   double MsSince(Clock::time_point start)
+   {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+   }
+
+   // A tile read into a pixel buffer, to be copied into its strip
+   struct Tile
+   {
+      int buffer;
+      int x;
+      int width;
+      int height;
+      unsigned char* strip;
+   };
+}
+
+glm::mat4 agl::TileProjection(const glm::mat4& projection, int width, int height,
+   int x, int y, int tileWidth, int tileHeight)
+{
+   // stretch the tile's part of clip space to all of it
+   glm::vec3 scale((float) width / tileWidth, (float) height / tileHeight, 1.0f);
+   glm::vec3 center((2.0f * x + tileWidth) / width - 1.0f, (2.0f * y + tileHeight) / height - 1.0f, 0.0f);
+   return glm::scale(glm::mat4(1), scale) * glm::translate(glm::mat4(1), -center) * projection;
+}
+
+TiledRenderer::TiledRenderer() : myFramebuffer(0), myColor(0), myDepth(0), myTileWidth(0), myTileHeight(0)
+{
+   myBuffers[0] = myBuffers[1] = 0;
+   memset(&myStats, 0, sizeof(myStats));
+}
+
+TiledRenderer::~TiledRenderer()
+{
+}
+
+bool TiledRenderer::create(int tileWidth, int tileHeight)
+{
+   release();
+   GLint maxSize = 0;
+   glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+   tileWidth = std::min(tileWidth, (int) maxSize);
+   tileHeight = std::min(tileHeight, (int) maxSize);
+   if (tileWidth <= 0 || tileHeight <= 0) return false;
+
+   glGenRenderbuffers(1, &myColor);
+   glBindRenderbuffer(GL_RENDERBUFFER, myColor);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, tileWidth, tileHeight);
+   glGenRenderbuffers(1, &myDepth);
+   glBindRenderbuffer(GL_RENDERBUFFER, myDepth);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, tileWidth, tileHeight);
+   glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+   glGenFramebuffers(1, &myFramebuffer);
+   glBindFramebuffer(GL_FRAMEBUFFER, myFramebuffer);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, myColor);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, myDepth);
+   GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   if (status != GL_FRAMEBUFFER_COMPLETE)
+   {
+      cout << "Cannot render " << tileWidth << "x" << tileHeight << " tiles (framebuffer status "
+         << status << ")" << endl;
+      release();
+      return false;
+   }
+   myTileWidth = tileWidth;
+   myTileHeight = tileHeight;
+
+   // RGBA, which drivers copy without converting
+   glGenBuffers(2, myBuffers);
+   for (int i = 0; i < 2; i++)
+   {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, myBuffers[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) tileWidth * tileHeight * 4, NULL, GL_STREAM_READ);
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   return true;
+}
+
+void TiledRenderer::release()
+{
+   if (myBuffers[0]) glDeleteBuffers(2, myBuffers);
+   if (myFramebuffer) glDeleteFramebuffers(1, &myFramebuffer);
+   if (myColor) glDeleteRenderbuffers(1, &myColor);
+   if (myDepth) glDeleteRenderbuffers(1, &myDepth);
+   myBuffers[0] = myBuffers[1] = 0;
+   myFramebuffer = myColor = myDepth = 0;
+   myTileWidth = myTileHeight = 0;
+}
+
+bool TiledRenderer::render(const std::string& filename, int width, int height, const glm::mat4& projection,
+   const DrawFunction& draw, PngLevel level)
+{
+   memset(&myStats, 0, sizeof(myStats));
+   if (!myFramebuffer) return false;
+
+   PngWriter writer;
+   if (!writer.open(filename, width, height, 3, level)) return false;
+
+   AGL_PROFILE_SCOPE("TiledRenderer::render");
+   Clock::time_point start = Clock::now();
+   size_t rowBytes = (size_t) width * 3;
+   int stripRows = (int) std::min<size_t>(myTileHeight, std::max<size_t>(MaxStripBytes / rowBytes, 1));
+   std::vector<unsigned char> strips[2];
+   strips[0].resize(rowBytes * stripRows);
+   strips[1].resize(rowBytes * stripRows);
+   myStats.width = width;
+   myStats.height = height;
+   myStats.stripRows = stripRows;
+   myStats.stripBytes = strips[0].size();
+
+   // the GPU finishes a tile while the next one is drawn, then it is copied out
+   auto copyOut = [&](const Tile& tile)
+   {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, myBuffers[tile.buffer]);
+      const unsigned char* rgba = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+         (GLsizeiptr) tile.width * tile.height * 4, GL_MAP_READ_BIT);
+      if (rgba)
+      {
+         // GL rows start at the bottom
+         for (int r = 0; r < tile.height; r++)
+         {
+            ConvertPixels(rgba + (size_t) (tile.height - 1 - r) * tile.width * 4, 4,
+               tile.strip + r * rowBytes + (size_t) tile.x * 3, 3, tile.width);
+         }
+         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   };
+
+   GLint viewport[4];
+   glGetIntegerv(GL_VIEWPORT, viewport);
+   glBindFramebuffer(GL_FRAMEBUFFER, myFramebuffer);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+   std::thread encoder;
+   bool written = true;
+   double encodeMs = 0;
+   Tile pending;
+   bool hasPending = false;
+   for (int top = 0, s = 0; top < height; top += stripRows, s++)
+   {
+      Clock::time_point begin = Clock::now();
+      int rows = std::min(stripRows, height - top);
+      unsigned char* strip = &strips[s % 2][0];
+      int y = height - top - rows; // of the strip's bottom row, in GL
+      for (int x = 0; x < width; x += myTileWidth)
+      {
+         int tileWidth = std::min(myTileWidth, width - x);
+         glViewport(0, 0, tileWidth, rows);
+         draw(TileProjection(projection, width, height, x, y, tileWidth, rows));
+
+         Tile tile = {myStats.tiles % 2, x, tileWidth, rows, strip};
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, myBuffers[tile.buffer]);
+         glReadPixels(0, 0, tileWidth, rows, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+         myStats.tiles++;
+
+         if (hasPending) copyOut(pending);
+         pending = tile;
+         hasPending = true;
+      }
+      copyOut(pending);
+      hasPending = false;
+      myStats.renderMs += MsSince(begin);
+
+      // strips go to the writer in order, one at a time
+      if (encoder.joinable()) encoder.join();
+      encoder = std::thread([&writer, &written, &encodeMs, strip, rows, rowBytes]
+      {
+         Clock::time_point begin = Clock::now();
+         written = writer.write(strip, rows, (int) rowBytes) && written;
+         encodeMs += MsSince(begin);
+      });
+   }
+   if (encoder.joinable()) encoder.join();
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+   bool complete = writer.close() && written;
+   myStats.encodeMs = encodeMs;
+   myStats.seconds = MsSince(start) / 1000.0;
+   return complete;
+}
+
+void TiledRenderer::printStats(std::ostream& out) const
+{
+   const TiledRenderStats& s = myStats;
+   out << "Tiled render: " << s.width << "x" << s.height << " in " << s.tiles << " tiles of up to "
+      << myTileWidth << "x" << s.stripRows << ", " << s.seconds << " s; drawing " << s.renderMs
+      << " ms, encoding " << s.encodeMs << " ms alongside; two strips of "
+      << s.stripBytes / (1024.0 * 1024.0) << " MB" << endl;
+}
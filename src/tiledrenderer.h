@@ -0,0 +1,80 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef tiledrenderer_H_
+#define tiledrenderer_H_
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+#include "AGL.h"
+#include "AGLM.h"
+#include "pngwriter.h"
+
+namespace agl {
+
+   // The part of projection that covers the tileWidth x tileHeight pixels at
+   // (x, y) of a width x height image, y from the bottom as in GL. For
+   // glm::perspective this is the glm::frustum of the tile, so tiles drawn
+   // with it join without seams.
+   glm::mat4 TileProjection(const glm::mat4& projection, int width, int height,
+      int x, int y, int tileWidth, int tileHeight);
+
+   struct TiledRenderStats
+   {
+      int width;
+      int height;
+      int tiles;
+      int stripRows;     // rows drawn and encoded together
+      double seconds;
+      double renderMs;   // drawing the tiles and copying them out, on the GL thread
+      double encodeMs;   // encoding and writing the strips, while the next ones are drawn
+      size_t stripBytes; // memory of a strip; two are used
+   };
+
+   // Renders images larger than any framebuffer, such as 16k posters, a tile
+   // at a time.
+   //
+   // The image is drawn in strips of rows, and each strip tile by tile into
+   // one offscreen framebuffer, with the projection narrowed to the tile.
+   // A tile is read into one of two pixel buffers while the one before it
+   // is copied into the strip. Each finished strip goes to a PngWriter on
+   // another thread while the next is drawn, so only two strips are ever in
+   // memory; strips of wide images are made shorter to stay under 32 MB.
+   class TiledRenderer
+   {
+   public:
+      // Draw with the given projection; the framebuffer and viewport are already set
+      typedef std::function<void(const glm::mat4& projection)> DrawFunction;
+
+      TiledRenderer();
+      virtual ~TiledRenderer();
+
+      TiledRenderer(const TiledRenderer&) = delete;
+      TiledRenderer& operator=(const TiledRenderer&) = delete;
+
+      // Make the framebuffer the tiles are drawn in.
+      // Returns false if the framebuffer is incomplete.
+      bool create(int tileWidth = 2048, int tileHeight = 512);
+      void release();
+
+      // Save a width x height image of what draw draws with projection as a PNG.
+      // Returns true if successfull. false otherwise.
+      bool render(const std::string& filename, int width, int height, const glm::mat4& projection,
+         const DrawFunction& draw, PngLevel level = PngDefault);
+
+      // Of the last render
+      const TiledRenderStats& stats() const { return myStats; }
+      void printStats(std::ostream& out) const;
+
+   private:
+      GLuint myFramebuffer;
+      GLuint myColor;
+      GLuint myDepth;
+      GLuint myBuffers[2];
+      int myTileWidth;
+      int myTileHeight;
+      TiledRenderStats myStats;
+   };
+}
+
+#endif
@@ -0,0 +1,496 @@
+// Haverford College, Jiajie Ma, 2021
+#include "turntable.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include "colorconvert.h"
+#include "image.h"
+#include "imagepool.h"
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+using namespace agl;
+
+// How long the GL thread waits for a readback before giving up the frame, in nanoseconds
+static const GLuint64 ReadTimeout = 1000000000;
+
+namespace {
+
+   typedef std::chrono::steady_clock Clock;
+
+   double MsSince(Clock::time_point start)
+   {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+   }
+
+   // A queue between two stages: pushes wait while it is full, pops while it is empty
+   template <class T>
+   class BoundedQueue
+   {
+   public:
+      explicit BoundedQueue(size_t capacity) : myCapacity(std::max<size_t>(capacity, 1)), myClosed(false) {}
+
+      void push(T item)
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         myNotFull.wait(lock, [this] { return myItems.size() < myCapacity; });
+         myItems.push_back(std::move(item));
+         lock.unlock();
+         myNotEmpty.notify_one();
+      }
+
+      // Wait for an item. Returns false once the queue is closed and empty.
+      bool pop(T& item)
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         myNotEmpty.wait(lock, [this] { return myClosed || !myItems.empty(); });
+         if (myItems.empty()) return false;
+         item = std::move(myItems.front());
+         myItems.pop_front();
+         lock.unlock();
+         myNotFull.notify_one();
+         return true;
+      }
+
+      bool tryPop(T& item)
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         if (myItems.empty()) return false;
+         item = std::move(myItems.front());
+         myItems.pop_front();
+         lock.unlock();
+         myNotFull.notify_one();
+         return true;
+      }
+
+      // No more pushes; pops drain what is left
+      void close()
+      {
+         {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myClosed = true;
+         }
+         myNotEmpty.notify_all();
+      }
+
+   private:
+      std::mutex myMutex;
+      std::condition_variable myNotFull;
+      std::condition_variable myNotEmpty;
+      std::deque<T> myItems;
+      size_t myCapacity;
+      bool myClosed;
+   };
+
+   // A frame whose readback has finished
+   struct Readback
+   {
+      int frame;
+      int slot;            // copy from this slot's mapping, or -1
+      unsigned char* copy; // else from this pooled copy of the buffer
+   };
+
+   struct Unpacked
+   {
+      int frame;
+      Image pixels;
+   };
+
+   struct Encoded
+   {
+      int frame;
+      std::vector<unsigned char> png;
+   };
+}
+
+TurntableExporter::TurntableExporter() : myFramebuffer(0), myColor(0), myDepth(0),
+   myWidth(0), myHeight(0), myPersistent(false)
+{
+   memset(&myStats, 0, sizeof(myStats));
+}
+
+TurntableExporter::~TurntableExporter()
+{
+}
+
+bool TurntableExporter::create(int width, int height, int numBuffers)
+{
+   release();
+#ifdef APPLE
+   myPersistent = false; // macOS stops at GL 4.1
+#else
+   myPersistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+
+   GLint maxSize = 0;
+   glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+   if (width <= 0 || height <= 0 || width > maxSize || height > maxSize)
+   {
+      cout << "Cannot render " << width << "x" << height << " offscreen; the largest size is "
+         << maxSize << "x" << maxSize << endl;
+      return false;
+   }
+
+   glGenRenderbuffers(1, &myColor);
+   glBindRenderbuffer(GL_RENDERBUFFER, myColor);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+   glGenRenderbuffers(1, &myDepth);
+   glBindRenderbuffer(GL_RENDERBUFFER, myDepth);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+   glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+   glGenFramebuffers(1, &myFramebuffer);
+   glBindFramebuffer(GL_FRAMEBUFFER, myFramebuffer);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, myColor);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, myDepth);
+   GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   if (status != GL_FRAMEBUFFER_COMPLETE)
+   {
+      cout << "Cannot render " << width << "x" << height << " offscreen (framebuffer status "
+         << status << ")" << endl;
+      release();
+      return false;
+   }
+   myWidth = width;
+   myHeight = height;
+
+   // RGBA, which drivers copy without converting
+   GLsizeiptr bytes = (GLsizeiptr) width * height * 4;
+   mySlots.resize(std::max(numBuffers, 1));
+   for (size_t i = 0; i < mySlots.size(); i++)
+   {
+      Slot& slot = mySlots[i];
+      slot.mapping = 0;
+      slot.fence = 0;
+      slot.frame = -1;
+      glGenBuffers(1, &slot.buffer);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      if (myPersistent)
+      {
+         // coherent, so the readback thread sees the pixels once the fence signals
+         GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+         glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, NULL, flags);
+         slot.mapping = (unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags);
+      }
+      else
+      {
+         glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+      }
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   return true;
+}
+
+void TurntableExporter::release()
+{
+   for (size_t i = 0; i < mySlots.size(); i++)
+   {
+      Slot& slot = mySlots[i];
+      if (slot.fence)
+      {
+         glDeleteSync(slot.fence);
+      }
+      if (slot.mapping)
+      {
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      glDeleteBuffers(1, &slot.buffer);
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   mySlots.clear();
+
+   if (myFramebuffer) glDeleteFramebuffers(1, &myFramebuffer);
+   if (myColor) glDeleteRenderbuffers(1, &myColor);
+   if (myDepth) glDeleteRenderbuffers(1, &myDepth);
+   myFramebuffer = myColor = myDepth = 0;
+   myWidth = myHeight = 0;
+}
+
+bool TurntableExporter::run(const std::string& prefix, int numFrames, const DrawFunction& draw,
+   int numEncoders, PngLevel level, int queueDepth)
+{
+   memset(&myStats, 0, sizeof(myStats));
+   myStats.frames = std::max(numFrames, 0);
+   if (!myFramebuffer || numFrames <= 0) return numFrames <= 0;
+
+   AGL_PROFILE_SCOPE("TurntableExporter::run");
+   if (numEncoders <= 0)
+   {
+      numEncoders = std::max(NumWorkerThreads() - 1, 1);
+   }
+   myStats.threads[RenderStage] = 1;
+   myStats.threads[ReadbackStage] = 1;
+   myStats.threads[EncodeStage] = numEncoders;
+   myStats.threads[WriteStage] = 1;
+
+   int width = myWidth;
+   int height = myHeight;
+   BoundedQueue<int> freeSlots(mySlots.size());
+   BoundedQueue<Readback> readbacks(queueDepth);
+   BoundedQueue<Unpacked> unpacked(queueDepth);
+   BoundedQueue<Encoded> encoded(queueDepth);
+   for (size_t i = 0; i < mySlots.size(); i++)
+   {
+      freeSlots.push((int) i);
+   }
+   std::mutex statsMutex;
+   Clock::time_point start = Clock::now();
+
+   std::thread readbackThread([&]
+   {
+      SetProfileThreadName("readback");
+      double busy = 0;
+      Readback readback;
+      while (readbacks.pop(readback))
+      {
+         AGL_PROFILE_SCOPE("Turntable::readback");
+         Clock::time_point begin = Clock::now();
+
+         // GL rows start at the bottom
+         const unsigned char* rgba = readback.slot >= 0 ? mySlots[readback.slot].mapping : readback.copy;
+         Unpacked frame;
+         frame.frame = readback.frame;
+         frame.pixels.allocate(width, height);
+         for (int y = 0; y < height; y++)
+         {
+            ConvertPixels(rgba + (size_t) (height - 1 - y) * width * 4, 4,
+               frame.pixels.data() + (size_t) y * width * 3, 3, width);
+         }
+         if (readback.slot >= 0)
+         {
+            freeSlots.push(readback.slot);
+         }
+         ImagePool::release(readback.copy);
+         busy += MsSince(begin);
+         unpacked.push(std::move(frame));
+      }
+      std::lock_guard<std::mutex> lock(statsMutex);
+      myStats.busyMs[ReadbackStage] += busy;
+   });
+
+   std::vector<std::thread> encoders;
+   for (int e = 0; e < numEncoders; e++)
+   {
+      encoders.push_back(std::thread([&]
+      {
+         SetProfileThreadName("encode");
+         double busy = 0;
+         int failed = 0;
+         Unpacked frame;
+         while (unpacked.pop(frame))
+         {
+            AGL_PROFILE_SCOPE("Turntable::encode");
+            Clock::time_point begin = Clock::now();
+
+            // the encoders already run side by side, so each uses one thread
+            Encoded png;
+            png.frame = frame.frame;
+            bool ok = EncodePng(png.png, width, height, 3, frame.pixels.data(), width * 3, level, 1);
+            frame.pixels = Image(); // back to the pool before waiting for the writer
+            busy += MsSince(begin);
+            if (!ok)
+            {
+               failed++;
+               continue;
+            }
+            encoded.push(std::move(png));
+         }
+         std::lock_guard<std::mutex> lock(statsMutex);
+         myStats.busyMs[EncodeStage] += busy;
+         myStats.failed += failed;
+      }));
+   }
+
+   std::thread writer([&]
+   {
+      SetProfileThreadName("write");
+      double busy = 0;
+      int written = 0;
+      int failed = 0;
+      Encoded png;
+      while (encoded.pop(png))
+      {
+         AGL_PROFILE_SCOPE("Turntable::write");
+         Clock::time_point begin = Clock::now();
+         char number[16];
+         snprintf(number, sizeof(number), "%03d", png.frame);
+         std::string filename = prefix + number + ".png";
+         std::ofstream file(filename.c_str(), ios::binary);
+         file.write((const char*) png.png.data(), png.png.size());
+         file.close();
+         if (file)
+         {
+            written++;
+         }
+         else
+         {
+            failed++;
+            cout << "Cannot write " << filename << endl;
+            remove(filename.c_str());
+         }
+         busy += MsSince(begin);
+      }
+      std::lock_guard<std::mutex> lock(statsMutex);
+      myStats.busyMs[WriteStage] += busy;
+      myStats.written += written;
+      myStats.failed += failed;
+   });
+
+   // the render stage is this thread; it hands each readback on once its fence signals
+   double renderMs = 0, readbackMs = 0, waitMs = 0;
+   int lost = 0;
+   std::deque<int> reading;
+   auto collect = [&](bool wait)
+   {
+      while (!reading.empty())
+      {
+         int index = reading.front();
+         Slot& slot = mySlots[index];
+         Clock::time_point begin = Clock::now();
+         GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+            wait ? ReadTimeout : 0);
+         if (wait) waitMs += MsSince(begin);
+         if (status == GL_TIMEOUT_EXPIRED && !wait) return;
+         glDeleteSync(slot.fence);
+         slot.fence = 0;
+         reading.pop_front();
+         wait = false; // only for the oldest
+
+         if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+         {
+            lost++;
+            freeSlots.push(index);
+            continue;
+         }
+
+         Readback readback;
+         readback.frame = slot.frame;
+         readback.slot = index;
+         readback.copy = 0;
+         if (!slot.mapping)
+         {
+            // the copy is done, so mapping doesn't wait
+            begin = Clock::now();
+            size_t bytes = (size_t) width * height * 4;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) bytes, GL_MAP_READ_BIT);
+            readback.copy = data ? ImagePool::shared().acquire(bytes) : 0;
+            if (readback.copy)
+            {
+               memcpy(readback.copy, data, bytes);
+            }
+            if (data)
+            {
+               glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            readback.slot = -1;
+            freeSlots.push(index);
+            readbackMs += MsSince(begin);
+            if (!readback.copy)
+            {
+               lost++;
+               continue;
+            }
+         }
+
+         begin = Clock::now();
+         readbacks.push(readback);
+         waitMs += MsSince(begin);
+      }
+   };
+
+   GLint viewport[4];
+   glGetIntegerv(GL_VIEWPORT, viewport);
+   glBindFramebuffer(GL_FRAMEBUFFER, myFramebuffer);
+   glViewport(0, 0, myWidth, myHeight);
+   for (int i = 0; i < numFrames; i++)
+   {
+      collect(false);
+
+      // a buffer comes free when the GPU or the readback thread is done with it
+      int index = -1;
+      while (!freeSlots.tryPop(index))
+      {
+         if (reading.empty())
+         {
+            Clock::time_point begin = Clock::now();
+            freeSlots.pop(index);
+            waitMs += MsSince(begin);
+            break;
+         }
+         collect(true);
+      }
+
+      AGL_PROFILE_SCOPE("Turntable::render");
+      Clock::time_point begin = Clock::now();
+      draw(360.0f * i / numFrames);
+
+      // only queues a copy; the pixels are collected once the fence signals
+      Slot& slot = mySlots[index];
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, myWidth, myHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      slot.frame = i;
+      reading.push_back(index);
+      glFlush(); // start the GPU now rather than at the next wait
+      renderMs += MsSince(begin);
+   }
+   while (!reading.empty())
+   {
+      collect(true);
+   }
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+   // each stage finishes what it was given, then the next one is told to stop
+   readbacks.close();
+   readbackThread.join();
+   unpacked.close();
+   for (size_t e = 0; e < encoders.size(); e++)
+   {
+      encoders[e].join();
+   }
+   encoded.close();
+   writer.join();
+
+   myStats.seconds = MsSince(start) / 1000.0;
+   myStats.busyMs[RenderStage] = renderMs;
+   myStats.busyMs[ReadbackStage] += readbackMs;
+   myStats.waitMs = waitMs;
+   myStats.failed += lost;
+   return myStats.written == numFrames;
+}
+
+void TurntableExporter::printStats(std::ostream& out) const
+{
+   static const char* names[NumTurntableStages] = {"render", "readback", "encode", "write"};
+   const TurntableStats& s = myStats;
+   int busiest = 0;
+   for (int i = 1; i < NumTurntableStages; i++)
+   {
+      if (s.occupancy((TurntableStage) i) > s.occupancy((TurntableStage) busiest)) busiest = i;
+   }
+
+   out << "Turntable: " << s.written << " of " << s.frames << " frames saved in " << s.seconds
+      << " s, " << s.fps() << " frames/s, " << s.failed << " failed" << endl;
+   out << "Stages busy:";
+   for (int i = 0; i < NumTurntableStages; i++)
+   {
+      out << (i > 0 ? ", " : " ") << names[i] << " " << 100.0 * s.occupancy((TurntableStage) i) << "%";
+      if (s.threads[i] > 1) out << " of " << s.threads[i] << " threads";
+   }
+   out << "; the render thread waited " << (s.frames > 0 ? s.waitMs / s.frames : 0.0)
+      << " ms per frame; limited by " << names[busiest] << endl;
+}
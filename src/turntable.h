@@ -0,0 +1,104 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef turntable_H_
+#define turntable_H_
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "AGL.h"
+#include "pngwriter.h"
+
+namespace agl {
+
+   enum TurntableStage
+   {
+      RenderStage,   // drawing and queueing the readback, on the GL thread
+      ReadbackStage, // copying the pixels out of the pixel buffers and flipping them
+      EncodeStage,   // PNG encoding, on several threads
+      WriteStage,    // writing the files
+      NumTurntableStages
+   };
+
+   struct TurntableStats
+   {
+      int frames;                             // asked for
+      int written;                            // saved
+      int failed;                             // not saved
+      double seconds;                         // from the first draw to the last file
+      double busyMs[NumTurntableStages];      // time spent working, summed over the stage's threads
+      int threads[NumTurntableStages];
+      double waitMs;                          // render thread time waiting for the GPU, a buffer or the next stage
+
+      double fps() const { return seconds > 0 ? written / seconds : 0.0; }
+
+      // The share of the stage's thread time spent working
+      double occupancy(TurntableStage stage) const
+      {
+         return seconds > 0 ? busyMs[stage] / (1000.0 * seconds * threads[stage]) : 0.0;
+      }
+   };
+
+   // Renders a model seen from evenly spaced angles around it into an
+   // offscreen framebuffer, and saves every frame as a PNG.
+   //
+   // The frames go through four stages that run at once, joined by short
+   // queues: the GL thread draws each frame and reads it into one of a ring
+   // of pixel buffers; a readback thread copies it out once its fence has
+   // signaled; encoding threads compress it; a writer thread saves it. A
+   // full queue holds back the stage before it, so memory stays bounded
+   // however many frames are asked for. The stats tell which stage is busy
+   // all the time, and so limits the frame rate.
+   class TurntableExporter
+   {
+   public:
+      // Draw the frame seen from azimuth degrees; the framebuffer and
+      // viewport are already set
+      typedef std::function<void(float azimuth)> DrawFunction;
+
+      TurntableExporter();
+      virtual ~TurntableExporter();
+
+      TurntableExporter(const TurntableExporter&) = delete;
+      TurntableExporter& operator=(const TurntableExporter&) = delete;
+
+      // Make a width x height framebuffer and numBuffers pixel buffers.
+      // Returns false if the framebuffer is incomplete.
+      bool create(int width, int height, int numBuffers = 4);
+      void release();
+
+      // Save numFrames frames, 360 / numFrames degrees apart, as prefix000.png,
+      // prefix001.png, ... numEncoders <= 0 uses a thread per spare core; queueDepth
+      // frames may wait between two stages. Returns true if every frame was saved.
+      bool run(const std::string& prefix, int numFrames, const DrawFunction& draw,
+         int numEncoders = 0, PngLevel level = PngFastest, int queueDepth = 4);
+
+      int width() const { return myWidth; }
+      int height() const { return myHeight; }
+
+      // Of the last run
+      const TurntableStats& stats() const { return myStats; }
+      void printStats(std::ostream& out) const;
+
+   private:
+      struct Slot
+      {
+         GLuint buffer;
+         unsigned char* mapping; // persistent, or 0
+         GLsync fence;
+         int frame;
+      };
+
+   private:
+      GLuint myFramebuffer;
+      GLuint myColor;
+      GLuint myDepth;
+      int myWidth;
+      int myHeight;
+      bool myPersistent;
+      std::vector<Slot> mySlots;
+      TurntableStats myStats;
+   };
+}
+
+#endif
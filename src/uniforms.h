@@ -0,0 +1,51 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef uniforms_H_
+#define uniforms_H_
+
+#include "AGLM.h"
+
+// Uniform blocks and vertex attributes shared by the shaders in shaders/.
+// The structs mirror the std140 layout of the GLSL blocks, so keep them in sync.
+namespace agl {
+
+   // Vertex attribute streams, as flags; stream i is read from location i
+   enum VertexStream
+   {
+      PositionStream = 1 << 0, // location 0
+      NormalStream = 1 << 1,   // location 1
+      ColorStream = 1 << 2,    // location 2
+      InstanceStream = 1 << 3  // locations 3-6: a mat4 per instance
+   };
+
+   // Binding points of the blocks
+   const unsigned int FrameBinding = 0;
+   const unsigned int MaterialBinding = 1;
+
+   // uniform Frame: camera, transform and lights; written once per frame
+   struct FrameUniforms
+   {
+      glm::mat4 mvp;
+      glm::mat4 modelView;
+      glm::mat4 normalMatrix;  // only the upper 3x3 is used
+      glm::vec4 lightPosition; // eye coordinates
+      glm::vec4 lightColor;
+      glm::vec4 spotDirection; // xyz: eye coordinates, w: angular exponent
+      float spotCutoff;        // degrees
+      float pad[3];
+   };
+
+   // uniform MaterialBlock (instance Material): written when the material changes
+   struct MaterialUniforms
+   {
+      glm::vec4 ka;
+      glm::vec4 kd;
+      glm::vec4 ks;
+      float shininess;
+      float pad[3];
+   };
+
+   static_assert(sizeof(FrameUniforms) == 256, "FrameUniforms must match the std140 layout");
+   static_assert(sizeof(MaterialUniforms) == 64, "MaterialUniforms must match the std140 layout");
+}
+
+#endif
@@ -0,0 +1,292 @@
+// Haverford College, Jiajie Ma, 2021
+#include "uploader.h"
+#include <chrono>
+#include <cstring>
+#include "profiler.h"
+
+using namespace std;
+using namespace agl;
+
+// How long the upload thread waits for one slice, in nanoseconds
+static const GLuint64 SliceTimeout = 1000000000ull;
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+UploadedMesh::UploadedMesh() :
+   key(-1), preview(false), elements(0), loaded(false), loadMs(0), uploadMs(0), bytes(0), slices(0), fence(0)
+{
+   buffers[0] = buffers[1] = buffers[2] = 0;
+}
+
+MeshUploader::MeshUploader() :
+   myWorking(false), myStop(false), myStarted(false),
+   mySliceBytes(0), myNumSlices(0), myNextSlice(0), myStaging(0), myMapping(0)
+{
+}
+
+MeshUploader::~MeshUploader()
+{
+   stop();
+}
+
+bool MeshUploader::start(const std::function<bool()>& makeCurrent, const std::function<void()>& doneCurrent,
+   size_t sliceBytes, int numSlices)
+{
+   stop();
+   mySliceBytes = sliceBytes;
+   myNumSlices = numSlices;
+   myStop = false;
+   myStarted = false;
+   myWorking = true; // until the thread reports whether it has a context
+
+   myThread = std::thread(&MeshUploader::run, this, makeCurrent, doneCurrent);
+
+   std::unique_lock<std::mutex> lock(myMutex);
+   myWake.wait(lock, [this] { return !myWorking; });
+   if (!myStarted)
+   {
+      lock.unlock();
+      myThread.join();
+      return false;
+   }
+   return true;
+}
+
+void MeshUploader::stop()
+{
+   if (!myThread.joinable()) return;
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myStop = true;
+      myRequests.clear();
+   }
+   myWake.notify_all();
+   myThread.join();
+
+   // finished meshes nobody polled; the buffers are shared, so any context can delete them
+   for (size_t i = 0; i < myDone.size(); i++)
+   {
+      releaseBuffers(myDone[i]);
+   }
+   myDone.clear();
+}
+
+void MeshUploader::request(int key, const Loader& load)
+{
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myRequests.clear(); // only the newest request matters
+      Request request;
+      request.key = key;
+      request.load = load;
+      myRequests.push_back(request);
+   }
+   myWake.notify_all();
+}
+
+bool MeshUploader::busy() const
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   return myWorking || !myRequests.empty() || !myDone.empty();
+}
+
+bool MeshUploader::poll(UploadedMesh& result)
+{
+   std::lock_guard<std::mutex> lock(myMutex);
+   if (myDone.empty()) return false;
+
+   // never wait: the render thread keeps drawing the old mesh until the new one is on the GPU
+   UploadedMesh& newest = myDone.back();
+   GLenum status = glClientWaitSync(newest.fence, 0, 0);
+   if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+
+   while (myDone.size() > 1)
+   {
+      releaseBuffers(myDone.front());
+      myDone.pop_front();
+   }
+   glDeleteSync(newest.fence);
+   newest.fence = 0;
+   result = std::move(newest);
+   myDone.clear();
+   return true;
+}
+
+void MeshUploader::releaseBuffers(UploadedMesh& result)
+{
+   if (result.fence)
+   {
+      glDeleteSync(result.fence);
+      result.fence = 0;
+   }
+   if (result.elements)
+   {
+      glDeleteBuffers(3, result.buffers);
+      glDeleteBuffers(1, &result.elements);
+      result.buffers[0] = result.buffers[1] = result.buffers[2] = 0;
+      result.elements = 0;
+   }
+}
+
+void MeshUploader::run(std::function<bool()> makeCurrent, std::function<void()> doneCurrent)
+{
+   SetProfileThreadName("upload");
+   bool current = makeCurrent();
+   if (current)
+   {
+#ifdef APPLE
+      bool persistent = false; // macOS stops at GL 4.1
+#else
+      bool persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+      GLsizeiptr bytes = (GLsizeiptr) (mySliceBytes * myNumSlices);
+      glGenBuffers(1, &myStaging);
+      glBindBuffer(GL_COPY_READ_BUFFER, myStaging);
+      if (persistent)
+      {
+         // coherent, so a memcpy is visible to the next copy without a flush
+         GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+         glBufferStorage(GL_COPY_READ_BUFFER, bytes, NULL, flags);
+         myMapping = (unsigned char*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, flags);
+      }
+      mySliceFences.assign(myNumSlices, (GLsync) 0);
+      myNextSlice = 0;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myStarted = current;
+      myWorking = false;
+   }
+   myWake.notify_all();
+   if (!current) return;
+
+   for (;;)
+   {
+      Request request;
+      {
+         std::unique_lock<std::mutex> lock(myMutex);
+         myWake.wait(lock, [this] { return myStop || !myRequests.empty(); });
+         if (myStop) break;
+         request = myRequests.front();
+         myRequests.pop_front();
+         myWorking = true;
+      }
+
+      UploadedMesh result;
+      result.key = request.key;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      result.loaded = request.load(result.mesh, [this, &request, start](const Mesh& preview)
+      {
+         publishPreview(request.key, preview, start);
+      });
+      result.loadMs = MillisecondsSince(start);
+
+      start = std::chrono::steady_clock::now();
+      upload(result);
+      result.uploadMs = MillisecondsSince(start);
+
+      std::lock_guard<std::mutex> lock(myMutex);
+      myDone.push_back(std::move(result));
+      myWorking = false;
+   }
+
+   for (size_t i = 0; i < mySliceFences.size(); i++)
+   {
+      if (mySliceFences[i]) glDeleteSync(mySliceFences[i]);
+   }
+   mySliceFences.clear();
+   if (myMapping)
+   {
+      glBindBuffer(GL_COPY_READ_BUFFER, myStaging);
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      myMapping = 0;
+   }
+   glDeleteBuffers(1, &myStaging);
+   myStaging = 0;
+   glFinish();
+   doneCurrent();
+}
+
+void MeshUploader::publishPreview(int key, const Mesh& preview, std::chrono::steady_clock::time_point start)
+{
+   {
+      // a newer model is waiting; its load starts as soon as this one is done
+      std::lock_guard<std::mutex> lock(myMutex);
+      if (!myRequests.empty() || myStop) return;
+   }
+
+   UploadedMesh result;
+   result.key = key;
+   result.preview = true;
+   result.loaded = true;
+   result.mesh = preview;
+   result.loadMs = MillisecondsSince(start);
+
+   std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
+   upload(result);
+   result.uploadMs = MillisecondsSince(uploadStart);
+
+   std::lock_guard<std::mutex> lock(myMutex);
+   myDone.push_back(std::move(result));
+}
+
+void MeshUploader::upload(UploadedMesh& result)
+{
+   AGL_PROFILE_SCOPE("MeshUploader::upload");
+   const Mesh& mesh = result.mesh;
+   size_t vertexBytes = (size_t) mesh.numVertices() * 3 * sizeof(float);
+   size_t indexBytes = (size_t) mesh.numTriangles() * 3 * sizeof(unsigned int);
+   const float* data[3] = {mesh.positions(), mesh.normals(), mesh.colors()};
+
+   glGenBuffers(3, result.buffers);
+   glGenBuffers(1, &result.elements);
+   for (int i = 0; i < 3; i++)
+   {
+      copy(result.buffers[i], data[i], data[i] ? vertexBytes : 0, result);
+   }
+   copy(result.elements, mesh.indices(), indexBytes, result);
+
+   // the render thread waits on this before drawing; flush so it ever signals
+   result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   glFlush();
+}
+
+void MeshUploader::copy(GLuint buffer, const void* data, size_t bytes, UploadedMesh& result)
+{
+   glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+   glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+
+   const unsigned char* source = (const unsigned char*) data;
+   for (size_t offset = 0; offset < bytes; offset += mySliceBytes)
+   {
+      size_t size = std::min(mySliceBytes, bytes - offset);
+      if (myMapping)
+      {
+         // wait until the GPU is done with this slice's last copy
+         int slice = myNextSlice;
+         myNextSlice = (myNextSlice + 1) % myNumSlices;
+         if (mySliceFences[slice])
+         {
+            glClientWaitSync(mySliceFences[slice], GL_SYNC_FLUSH_COMMANDS_BIT, SliceTimeout);
+            glDeleteSync(mySliceFences[slice]);
+         }
+
+         memcpy(myMapping + slice * mySliceBytes, source + offset, size);
+         glBindBuffer(GL_COPY_READ_BUFFER, myStaging);
+         glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            (GLintptr) (slice * mySliceBytes), (GLintptr) offset, (GLsizeiptr) size);
+         mySliceFences[slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+      else
+      {
+         glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) offset, (GLsizeiptr) size, source + offset);
+      }
+      result.bytes += size;
+      result.slices++;
+      ProfileCount(BytesUploaded, (long long) size);
+   }
+}
@@ -0,0 +1,121 @@
+// Haverford College, Jiajie Ma, 2021
+#ifndef uploader_H_
+#define uploader_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AGL.h"
+#include "AGLM.h"
+#include "mesh.h"
+
+namespace agl {
+
+   // A mesh read and uploaded by a MeshUploader, ready to draw
+   struct UploadedMesh
+   {
+      UploadedMesh();
+
+      int key;
+      bool preview;          // a point cloud of the mesh, sent while the rest loads
+      Mesh mesh;             // the CPU copy, for bounds and counts
+      GLuint buffers[3];     // positions, normals, colors; colors is empty without them
+      GLuint elements;
+      bool loaded;           // false if the loader failed; the buffers are then empty
+      double loadMs;         // reading the model, or the part a preview comes from
+      double uploadMs;       // copying it into the buffers
+      long long bytes;       // uploaded
+      int slices;            // staging slices used
+      GLsync fence;          // signaled once the GPU has all the data
+   };
+
+   // Reads meshes and uploads them into new buffers on a thread with its own
+   // GL context, so the render thread never waits for glBufferData.
+   //
+   // Data goes through a small staging buffer, persistently mapped where the
+   // driver supports it (GL 4.4), in fixed-size slices: each slice is copied
+   // into the mapping and then into the destination buffer, and a fence
+   // tells when the slice can be reused. Without persistent mapping, slices
+   // are written with glBufferSubData. A finished mesh ends with a fence,
+   // and poll() only hands it to the render thread once that fence has
+   // signaled.
+   //
+   // A loader may pass previews of the mesh to the callback it is given;
+   // each preview is uploaded and handed out by poll() as soon as it is
+   // ready, so something is drawn long before the whole mesh is read.
+   class MeshUploader
+   {
+   public:
+      // Reads a mesh; preview may be called with coarse versions first
+      typedef std::function<bool(Mesh& mesh, const Mesh::PreviewCallback& preview)> Loader;
+
+      MeshUploader();
+      virtual ~MeshUploader();
+
+      MeshUploader(const MeshUploader&) = delete;
+      MeshUploader& operator=(const MeshUploader&) = delete;
+
+      // Start the upload thread. makeCurrent runs on that thread and must make
+      // current a context that shares objects with the render thread's;
+      // doneCurrent runs when the thread exits.
+      // Returns false if makeCurrent failed.
+      bool start(const std::function<bool()>& makeCurrent, const std::function<void()>& doneCurrent,
+         size_t sliceBytes = 1 << 20, int numSlices = 4);
+
+      // Finish the current upload, drop the rest and join the thread
+      void stop();
+
+      bool isRunning() const { return myThread.joinable(); }
+
+      // Read and upload the mesh under key, using load to read it.
+      // Replaces any request that hasn't started yet.
+      void request(int key, const Loader& load);
+
+      // Return true if a request is waiting, running, or not yet polled
+      bool busy() const;
+
+      // Called by the render thread. Returns true and fills result with the most
+      // recent finished mesh or preview, whose buffers are ready to draw. The
+      // caller owns the buffers; older finished meshes are deleted.
+      bool poll(UploadedMesh& result);
+
+      // Delete the buffers of an uploaded mesh
+      static void releaseBuffers(UploadedMesh& result);
+
+   private:
+      void run(std::function<bool()> makeCurrent, std::function<void()> doneCurrent);
+      void upload(UploadedMesh& result);
+      void publishPreview(int key, const Mesh& preview, std::chrono::steady_clock::time_point start);
+      void copy(GLuint buffer, const void* data, size_t bytes, UploadedMesh& result);
+
+   private:
+      struct Request
+      {
+         int key;
+         Loader load;
+      };
+
+      std::thread myThread;
+      mutable std::mutex myMutex;
+      std::condition_variable myWake;
+      std::deque<Request> myRequests;
+      std::deque<UploadedMesh> myDone;
+      bool myWorking;
+      bool myStop;
+      bool myStarted; // makeCurrent result, once known
+
+      // staging memory, used by the upload thread only
+      size_t mySliceBytes;
+      int myNumSlices;
+      int myNextSlice;
+      GLuint myStaging;
+      unsigned char* myMapping; // 0 without persistent mapping
+      std::vector<GLsync> mySliceFences;
+   };
+}
+
+#endif